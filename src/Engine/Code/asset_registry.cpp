@@ -0,0 +1,169 @@
+#include "asset_registry.h"
+
+#define ASSET_SLOT_EMPTY     UINT32_MAX
+#define ASSET_SLOT_TOMBSTONE (UINT32_MAX - 1)
+
+#define ASSET_REGISTRY_MIN_CAPACITY 64
+
+u64 HashAssetName(AssetType type, const char* name, u32 length)
+{
+    // Seeded with the asset type so equal names of different types don't collide
+    const u8 typeByte = (u8)type;
+    return HashBytes(name, length, HashBytes(&typeByte, 1));
+}
+
+static bool EntryMatches(const AssetRegistry& registry, const AssetEntry& entry, u64 hash, AssetType type, const char* name, u32 length)
+{
+    return entry.hash == hash &&
+           entry.type == (u32)type &&
+           entry.name_length == length &&
+           memcmp(&registry.names[entry.name_offset], name, length) == 0;
+}
+
+static u32 FindSlot(const AssetRegistry& registry, u64 hash, AssetType type, const char* name, u32 length)
+{
+    if (registry.table.empty())
+        return UINT32_MAX;
+
+    const u32 mask = (u32)registry.table.size() - 1;
+    for (u32 slot = (u32)hash & mask; ; slot = (slot + 1) & mask)
+    {
+        const u32 entryIdx = registry.table[slot];
+        if (entryIdx == ASSET_SLOT_EMPTY)
+            return UINT32_MAX;
+        if (entryIdx != ASSET_SLOT_TOMBSTONE && EntryMatches(registry, registry.entries[entryIdx], hash, type, name, length))
+            return slot;
+    }
+}
+
+static void Rehash(AssetRegistry& registry, u32 capacity)
+{
+    registry.table.assign(capacity, ASSET_SLOT_EMPTY);
+    registry.tombstones = 0;
+
+    const u32 mask = capacity - 1;
+    for (u32 entryIdx = 0; entryIdx < registry.entries.size(); ++entryIdx)
+    {
+        const AssetEntry& entry = registry.entries[entryIdx];
+        if (!entry.alive)
+            continue;
+
+        u32 slot = (u32)entry.hash & mask;
+        while (registry.table[slot] != ASSET_SLOT_EMPTY)
+            slot = (slot + 1) & mask;
+        registry.table[slot] = entryIdx;
+    }
+}
+
+AssetHandle RegisterAsset(AssetRegistry& registry, AssetType type, const char* name, u32 index)
+{
+    const u32 length = Strlen(name);
+    const u64 hash = HashAssetName(type, name, length);
+
+    // Re-registering a name just points it to the new index
+    u32 slot = FindSlot(registry, hash, type, name, length);
+    if (slot != UINT32_MAX)
+    {
+        AssetEntry& entry = registry.entries[registry.table[slot]];
+        entry.index = index;
+        return { registry.table[slot], entry.generation };
+    }
+
+    // Keep the load factor (tombstones included) under 3/4
+    const u32 capacity = (u32)registry.table.size();
+    if ((registry.count + registry.tombstones + 1) * 4 > capacity * 3)
+    {
+        u32 newCapacity = capacity ? capacity : ASSET_REGISTRY_MIN_CAPACITY;
+        while ((registry.count + 1) * 2 > newCapacity)
+            newCapacity *= 2;
+        Rehash(registry, newCapacity);
+    }
+
+    u32 entryIdx;
+    if (!registry.free_entries.empty())
+    {
+        entryIdx = registry.free_entries.back();
+        registry.free_entries.pop_back();
+    }
+    else
+    {
+        entryIdx = (u32)registry.entries.size();
+        registry.entries.push_back(AssetEntry{});
+    }
+
+    AssetEntry& entry = registry.entries[entryIdx];
+    entry.hash = hash;
+    entry.name_offset = (u32)registry.names.size();
+    entry.name_length = length;
+    entry.type = (u32)type;
+    entry.index = index;
+    entry.alive = true;
+
+    registry.names.insert(registry.names.end(), name, name + length + 1);
+
+    const u32 mask = (u32)registry.table.size() - 1;
+    slot = (u32)hash & mask;
+    while (registry.table[slot] != ASSET_SLOT_EMPTY && registry.table[slot] != ASSET_SLOT_TOMBSTONE)
+        slot = (slot + 1) & mask;
+    if (registry.table[slot] == ASSET_SLOT_TOMBSTONE)
+        registry.tombstones--;
+    registry.table[slot] = entryIdx;
+    registry.count++;
+
+    return { entryIdx, entry.generation };
+}
+
+void UnregisterAsset(AssetRegistry& registry, AssetHandle handle)
+{
+    if (!IsAssetHandleValid(registry, handle))
+        return;
+
+    AssetEntry& entry = registry.entries[handle.entry];
+    const char* name = &registry.names[entry.name_offset];
+    const u32 slot = FindSlot(registry, entry.hash, (AssetType)entry.type, name, entry.name_length);
+    ASSERT(slot != UINT32_MAX, "Live asset entry missing from the hash table");
+
+    registry.table[slot] = ASSET_SLOT_TOMBSTONE;
+    registry.tombstones++;
+    registry.count--;
+
+    // The interned name is leaked into the pool; names are small and removals rare
+    entry.alive = false;
+    entry.generation++;
+    registry.free_entries.push_back(handle.entry);
+}
+
+AssetHandle FindAsset(const AssetRegistry& registry, AssetType type, const char* name)
+{
+    const u32 length = Strlen(name);
+    const u64 hash = HashAssetName(type, name, length);
+    const u32 slot = FindSlot(registry, hash, type, name, length);
+
+    if (slot == UINT32_MAX)
+        return INVALID_ASSET_HANDLE;
+
+    const u32 entryIdx = registry.table[slot];
+    return { entryIdx, registry.entries[entryIdx].generation };
+}
+
+bool IsAssetHandleValid(const AssetRegistry& registry, AssetHandle handle)
+{
+    return handle.entry < registry.entries.size() &&
+           registry.entries[handle.entry].alive &&
+           registry.entries[handle.entry].generation == handle.generation;
+}
+
+u32 GetAssetIndex(const AssetRegistry& registry, AssetHandle handle)
+{
+    return IsAssetHandleValid(registry, handle) ? registry.entries[handle.entry].index : UINT32_MAX;
+}
+
+u32 FindAssetIndex(const AssetRegistry& registry, AssetType type, const char* name)
+{
+    return GetAssetIndex(registry, FindAsset(registry, type, name));
+}
+
+const char* GetAssetName(const AssetRegistry& registry, AssetHandle handle)
+{
+    return IsAssetHandleValid(registry, handle) ? &registry.names[registry.entries[handle.entry].name_offset] : "";
+}
@@ -0,0 +1,80 @@
+//
+// asset_registry.h: Name table for the engine resources. Asset names (file paths,
+// program names, material names...) are interned once and hashed into an open
+// addressing table that maps them to indices into the App resource arrays.
+//
+
+#pragma once
+
+#include "platform.h"
+
+enum AssetType
+{
+    AssetType_Texture,
+    AssetType_Program,
+    AssetType_Mesh,
+    AssetType_Model,
+    AssetType_Material,
+    AssetType_Count
+};
+
+/**
+ * Handle to a registry entry. Entries never move when the hash table grows, so a
+ * handle stays valid until the asset is unregistered, which bumps the generation.
+ */
+struct AssetHandle
+{
+    u32 entry;
+    u32 generation;
+};
+
+#define INVALID_ASSET_HANDLE AssetHandle{ UINT32_MAX, 0 }
+
+struct AssetEntry
+{
+    u64  hash;
+    u32  name_offset; // Into AssetRegistry::names
+    u32  name_length;
+    u32  type;
+    u32  index;       // Into the App array of the given type
+    u32  generation;
+    bool alive;
+};
+
+struct AssetRegistry
+{
+    std::vector<u32>        table;   // Entry indices, power of 2 sized
+    std::vector<AssetEntry> entries;
+    std::vector<u32>        free_entries;
+    std::vector<char>       names;   // Interned, null terminated names
+
+    u32 count;
+    u32 tombstones;
+};
+
+u64 HashAssetName(AssetType type, const char* name, u32 length);
+
+AssetHandle RegisterAsset(AssetRegistry& registry, AssetType type, const char* name, u32 index);
+
+void UnregisterAsset(AssetRegistry& registry, AssetHandle handle);
+
+AssetHandle FindAsset(const AssetRegistry& registry, AssetType type, const char* name);
+
+bool IsAssetHandleValid(const AssetRegistry& registry, AssetHandle handle);
+
+/**
+ * Returns the App array index the handle refers to, or UINT32_MAX if the handle
+ * is stale or invalid.
+ */
+u32 GetAssetIndex(const AssetRegistry& registry, AssetHandle handle);
+
+/**
+ * Convenience lookup by name. Returns UINT32_MAX if no asset is registered with that name.
+ */
+u32 FindAssetIndex(const AssetRegistry& registry, AssetType type, const char* name);
+
+/**
+ * The returned string lives in the registry name pool. It is temporary and should be
+ * copied if it needs to persist after registering new assets.
+ */
+const char* GetAssetName(const AssetRegistry& registry, AssetHandle handle);
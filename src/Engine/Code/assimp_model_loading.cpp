@@ -3,8 +3,18 @@
 #include <assimp/postprocess.h>
 
 #include "assimp_model_loading.h"
+#include "mesh_optimizer.h"
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+#define MODEL_LOD_MAX_ERROR 0.05f // How far the coarsest level may move the surface, over the bounding sphere radius
+
+// CPU copy of a submesh, only kept until it is uploaded
+struct SubmeshGeometry
+{
+    std::vector<float> vertices;
+    std::vector<u32>   indices[MESH_MAX_LODS]; // One list per level, [0] is the full detail
+};
+
+void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, std::vector<SubmeshGeometry>& geometry, const u32* meshMaterialIndices, std::vector<u32>& submeshMaterialIndices)
 {
     std::vector<float> vertices;
     std::vector<u32> indices;
@@ -61,7 +71,7 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
     }
 
     // store the proper (previously proceessed) material for this mesh
-    submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+    submeshMaterialIndices.push_back(meshMaterialIndices[mesh->mMaterialIndex]);
 
     // create the vertex format
     VertexBufferLayout vertexBufferLayout = {};
@@ -85,25 +95,27 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
     // add the submesh into the mesh
     Submesh submesh = {};
     submesh.vertex_buffer_layout = vertexBufferLayout;
-    submesh.vertices.swap(vertices);
-    submesh.indices.swap(indices);
+    submesh.vertex_count = (u32)(vertices.size() * sizeof(float) / vertexBufferLayout.stride);
+    submesh.lods[0].index_count = (u32)indices.size();
+    submesh.lod_count = 1;
     myMesh->submeshes.push_back( submesh );
+
+    geometry.emplace_back();
+    geometry.back().vertices.swap(vertices);
+    geometry.back().indices[0].swap(indices);
 }
 
 void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial, String directory)
 {
-    aiString name;
     aiColor3D diffuseColor;
     aiColor3D emissiveColor;
     aiColor3D specularColor;
     ai_real shininess;
-    material->Get(AI_MATKEY_NAME, name);
     material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseColor);
     material->Get(AI_MATKEY_COLOR_EMISSIVE, emissiveColor);
     material->Get(AI_MATKEY_COLOR_SPECULAR, specularColor);
     material->Get(AI_MATKEY_SHININESS, shininess);
 
-    myMaterial.name = name.C_Str();
     myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
     myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
     myMaterial.smoothness = shininess / 256.0f;
@@ -148,31 +160,34 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
     //myMaterial.createNormalFromBump();
 }
 
-void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, std::vector<SubmeshGeometry>& geometry, const u32* meshMaterialIndices, std::vector<u32>& submeshMaterialIndices)
 {
     // process all the node's meshes (if any)
     for(unsigned int i = 0; i < node->mNumMeshes; ++i)
     {
         aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+        ProcessAssimpMesh(scene, mesh, myMesh, geometry, meshMaterialIndices, submeshMaterialIndices);
     }
 
     // then do the same for each of its children
     for(unsigned int i = 0; i < node->mNumChildren; ++i)
     {
-        ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+        ProcessAssimpNode(scene, node->mChildren[i], myMesh, geometry, meshMaterialIndices, submeshMaterialIndices);
     }
 }
 
 u32 LoadModel(App* app, const char* filename)
 {
+    u32 loadedModelIdx = FindAssetIndex(app->assets, AssetType_Model, filename);
+    if (loadedModelIdx != UINT32_MAX)
+        return loadedModelIdx;
+
     const aiScene* scene = aiImportFile(filename,
                                         aiProcess_Triangulate           |
                                         aiProcess_GenSmoothNormals      |
                                         aiProcess_CalcTangentSpace      |
                                         aiProcess_JoinIdenticalVertices |
                                         aiProcess_PreTransformVertices  |
-                                        aiProcess_ImproveCacheLocality  |
                                         aiProcess_OptimizeMeshes        |
                                         aiProcess_SortByPType);
 
@@ -182,37 +197,119 @@ u32 LoadModel(App* app, const char* filename)
         return UINT32_MAX;
     }
 
-    app->meshes.push_back(Mesh{});
-    Mesh& mesh = app->meshes.back();
-    u32 meshIdx = (u32)app->meshes.size() - 1u;
+    // Pool items never move, so the references stay valid while more resources are added
+    u32 meshIdx = AddPoolItem(app->meshes, Mesh{}).index;
+    Mesh& mesh = app->meshes[meshIdx];
 
-    app->models.push_back(Model{});
-    Model& model = app->models.back();
+    u32 modelIdx = AddPoolItem(app->models, Model{}).index;
+    Model& model = app->models[modelIdx];
     model.mesh_index = meshIdx;
-    u32 modelIdx = (u32)app->models.size() - 1u;
+
+    RegisterAsset(app->assets, AssetType_Mesh, filename, meshIdx);
+    RegisterAsset(app->assets, AssetType_Model, filename, modelIdx);
 
     String directory = GetDirectoryPart(MakeString(filename));
 
     // Create a list of materials
-    u32 baseMeshMaterialIndex = (u32)app->materials.size();
+    // Freed material slots are reused, so the model materials are not necessarily contiguous
+    std::vector<u32> meshMaterialIndices(scene->mNumMaterials);
     for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
     {
-        app->materials.push_back(Material{});
-        Material& material = app->materials.back();
+        meshMaterialIndices[i] = AddPoolItem(app->materials, Material{}).index;
+        Material& material = app->materials[meshMaterialIndices[i]];
         ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+
+        // Materials are named after their model file, e.g. "Patrick/Patrick.obj#Material"
+        aiString name;
+        scene->mMaterials[i]->Get(AI_MATKEY_NAME, name);
+        std::string materialName = std::string(filename) + "#" + name.C_Str();
+        material.asset = RegisterAsset(app->assets, AssetType_Material, materialName.c_str(), meshMaterialIndices[i]);
     }
 
-    ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.material_index);
+    std::vector<SubmeshGeometry> geometry;
+    ProcessAssimpNode(scene, scene->mRootNode, &mesh, geometry, meshMaterialIndices.data(), model.material_index);
 
     aiReleaseImport(scene);
 
+    // Bounding sphere around the center of the box, good enough for culling
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+    glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const u32 stride = mesh.submeshes[i].vertex_buffer_layout.stride / sizeof(float);
+        for (u32 v = 0; v < geometry[i].vertices.size(); v += stride)
+        {
+            const glm::vec3 position = glm::make_vec3(&geometry[i].vertices[v]);
+            boundsMin = glm::min(boundsMin, position);
+            boundsMax = glm::max(boundsMax, position);
+        }
+    }
+
+    mesh.bounds_center = boundsMin.x <= boundsMax.x ? (boundsMin + boundsMax) * 0.5f : glm::vec3(0.0f);
+    mesh.bounds_extent = boundsMin.x <= boundsMax.x ? (boundsMax - boundsMin) * 0.5f : glm::vec3(0.0f);
+    mesh.bounds_radius = 0.0f;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const u32 stride = mesh.submeshes[i].vertex_buffer_layout.stride / sizeof(float);
+        for (u32 v = 0; v < geometry[i].vertices.size(); v += stride)
+            mesh.bounds_radius = glm::max(mesh.bounds_radius, glm::distance(mesh.bounds_center, glm::make_vec3(&geometry[i].vertices[v])));
+    }
+
+    // Coarser index lists over the same vertices, for the entities far from the camera
+    mesh.lod_count = 1;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        Submesh& submesh = mesh.submeshes[i];
+        const u32 lodCount = BuildMeshLods(geometry[i].vertices.data(), submesh.vertex_buffer_layout.stride / sizeof(float), submesh.vertex_count,
+                                           geometry[i].indices[0], mesh.bounds_radius * MODEL_LOD_MAX_ERROR, &geometry[i].indices[1]);
+        for (u32 lod = 0; lod < lodCount; ++lod)
+            submesh.lods[lod + 1].index_count = (u32)geometry[i].indices[lod + 1].size();
+        submesh.lod_count = 1 + lodCount;
+        mesh.lod_count = glm::max(mesh.lod_count, submesh.lod_count);
+    }
+
+    // Triangle order for the post-transform cache and overdraw, then vertex order for the fetch
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        Submesh& submesh = mesh.submeshes[i];
+        const u32 stride = submesh.vertex_buffer_layout.stride / sizeof(float);
+        const VertexCacheStats before = AnalyzeVertexCache(geometry[i].indices[0], submesh.vertex_count);
+
+        for (u32 lod = 0; lod < submesh.lod_count; ++lod)
+        {
+            OptimizeVertexCache(geometry[i].indices[lod], submesh.vertex_count);
+            OptimizeOverdraw(geometry[i].indices[lod], geometry[i].vertices.data(), stride, submesh.vertex_count);
+        }
+        submesh.vertex_count = OptimizeVertexFetch(geometry[i].vertices, stride, geometry[i].indices, submesh.lod_count);
+
+        const VertexCacheStats after = AnalyzeVertexCache(geometry[i].indices[0], submesh.vertex_count);
+        ILOG("%s submesh %u: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", filename, i, before.acmr, after.acmr, before.atvr, after.atvr);
+
+        // Clusters of the final triangle order, so culling them keeps the cache friendly runs
+        if (geometry[i].indices[0].size() / 3 >= MESHLET_MIN_SUBMESH_TRIANGLES)
+        {
+            submesh.first_meshlet = (u32)app->meshlets.size();
+            submesh.meshlet_count = BuildMeshlets(geometry[i].vertices.data(), stride, submesh.vertex_count, geometry[i].indices[0], app->meshlets);
+        }
+    }
+
+    if (app->meshlets.size() > 0)
+    {
+        if (app->meshletBuffer == 0)
+            glGenBuffers(1, &app->meshletBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->meshletBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, app->meshlets.size() * sizeof(Meshlet), app->meshlets.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
     u32 vertexBufferSize = 0;
     u32 indexBufferSize = 0;
 
     for (u32 i = 0; i < mesh.submeshes.size(); ++i)
     {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize  += mesh.submeshes[i].indices.size()  * sizeof(u32);
+        vertexBufferSize += geometry[i].vertices.size() * sizeof(float);
+        for (u32 lod = 0; lod < mesh.submeshes[i].lod_count; ++lod)
+            indexBufferSize += geometry[i].indices[lod].size() * sizeof(u32);
     }
 
     glGenBuffers(1, &mesh.vertex_buffer_handle);
@@ -228,17 +325,21 @@ u32 LoadModel(App* app, const char* filename)
 
     for (u32 i = 0; i < mesh.submeshes.size(); ++i)
     {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
+        const void* verticesData = geometry[i].vertices.data();
+        const u32   verticesSize = geometry[i].vertices.size() * sizeof(float);
         glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
         mesh.submeshes[i].vertex_offset = verticesOffset;
         verticesOffset += verticesSize;
 
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].index_offset = indicesOffset;
-        indicesOffset += indicesSize;
+        // The levels of a submesh follow its full detail indices
+        for (u32 lod = 0; lod < mesh.submeshes[i].lod_count; ++lod)
+        {
+            const std::vector<u32>& indices = geometry[i].indices[lod];
+            const u32 indicesSize = indices.size() * sizeof(u32);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indices.data());
+            mesh.submeshes[i].lods[lod].index_offset = indicesOffset;
+            indicesOffset += indicesSize;
+        }
     }
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -0,0 +1,182 @@
+#include "command_list.h"
+#include "engine.h"
+
+#define REPLAY_MAX_UNIFORM_BINDINGS 8
+#define REPLAY_MAX_TEXTURE_UNITS 16
+
+// What the replay has bound so far. Zero means unknown, so the first bind always goes through.
+struct ReplayState
+{
+    Program* program;
+    GLuint   programHandle;
+    GLuint   vao;
+    GLuint   textures[REPLAY_MAX_TEXTURE_UNITS];
+    GLuint   activeTextureUnit;
+    GLuint   indirectBuffer;
+    GLuint   parameterBuffer;
+
+    struct UniformRange { GLuint buffer; u32 offset; u32 size; } uniformRanges[REPLAY_MAX_UNIFORM_BINDINGS];
+};
+
+void ResetCommandList(CommandList& list)
+{
+    list.data.clear();
+    list.count = 0;
+}
+
+static GLuint GetCommandBufferHandle(App* app, CommandBufferId buffer)
+{
+    switch (buffer)
+    {
+        case CommandBuffer_Constants: return app->cbuffer.handle;
+        case CommandBuffer_DrawIndirect: return app->culling.commandBuffer;
+        case CommandBuffer_DrawCount: return app->culling.drawCountBuffer;
+        default: ASSERT(false, "Unknown command buffer");
+    }
+    return 0;
+}
+
+void ReplayCommandList(App* app, const CommandList& list)
+{
+    ReplayState state = {};
+    state.activeTextureUnit = UINT32_MAX;
+
+    const u8* cursor = list.data.data();
+    const u8* end = cursor + list.data.size();
+
+    while (cursor < end)
+    {
+        const CommandHeader& header = *(const CommandHeader*)cursor;
+
+        switch (header.type)
+        {
+            case Command_BindProgram:
+            {
+                const BindProgramCommand& command = *(const BindProgramCommand*)cursor;
+                state.program = &GetProgram(app, command.programIdx);
+                if (state.program->handle != state.programHandle)
+                {
+                    glUseProgram(state.program->handle);
+                    state.programHandle = state.program->handle;
+                }
+            }
+            break;
+
+            case Command_BindMeshVao:
+            {
+                const BindMeshVaoCommand& command = *(const BindMeshVaoCommand*)cursor;
+                ASSERT(state.program, "A program must be bound before its VAOs");
+
+                const GLuint vao = FindVao(app->meshes[command.meshIdx], command.submeshIdx, *state.program);
+                if (vao != state.vao)
+                {
+                    glBindVertexArray(vao);
+                    state.vao = vao;
+                }
+            }
+            break;
+
+            case Command_BindTexture:
+            {
+                const BindTextureCommand& command = *(const BindTextureCommand*)cursor;
+                ASSERT(command.unit < REPLAY_MAX_TEXTURE_UNITS, "Texture unit out of range");
+
+                const GLuint texture = app->textures[command.texIdx].handle;
+                if (texture != state.textures[command.unit])
+                {
+                    if (command.unit != state.activeTextureUnit)
+                    {
+                        glActiveTexture(GL_TEXTURE0 + command.unit);
+                        state.activeTextureUnit = command.unit;
+                    }
+                    glBindTexture(GL_TEXTURE_2D, texture);
+                    state.textures[command.unit] = texture;
+                }
+            }
+            break;
+
+            case Command_BindUniformRange:
+            {
+                const BindUniformRangeCommand& command = *(const BindUniformRangeCommand*)cursor;
+                ASSERT(command.binding < REPLAY_MAX_UNIFORM_BINDINGS, "Uniform binding out of range");
+
+                const GLuint buffer = GetCommandBufferHandle(app, command.buffer);
+                ReplayState::UniformRange& bound = state.uniformRanges[command.binding];
+                if (bound.buffer != buffer || bound.offset != command.offset || bound.size != command.size)
+                {
+                    glBindBufferRange(GL_UNIFORM_BUFFER, command.binding, buffer, command.offset, command.size);
+                    bound = { buffer, command.offset, command.size };
+                }
+            }
+            break;
+
+            // The reflection cache already drops the uniforms that did not change
+            case Command_SetUniformU32:
+            {
+                const SetUniformU32Command& command = *(const SetUniformU32Command*)cursor;
+                SetUniform(*state.program, command.name, command.value);
+            }
+            break;
+
+            case Command_SetUniformMat4:
+            {
+                const SetUniformMat4Command& command = *(const SetUniformMat4Command*)cursor;
+                SetUniform(*state.program, command.name, command.value);
+            }
+            break;
+
+            case Command_DrawIndexed:
+            {
+                const DrawIndexedCommand& command = *(const DrawIndexedCommand*)cursor;
+                glDrawElements(GL_TRIANGLES, command.indexCount, GL_UNSIGNED_INT, (void*)(u64)command.indexOffset);
+            }
+            break;
+
+            case Command_DrawIndexedInstanced:
+            {
+                const DrawIndexedInstancedCommand& command = *(const DrawIndexedInstancedCommand*)cursor;
+                glDrawElementsInstanced(GL_TRIANGLES, command.indexCount, GL_UNSIGNED_INT, (void*)(u64)command.indexOffset, command.instanceCount);
+            }
+            break;
+
+            case Command_MultiDrawIndexedIndirectCount:
+            {
+                const MultiDrawIndexedIndirectCountCommand& command = *(const MultiDrawIndexedIndirectCountCommand*)cursor;
+                const GLuint indirectBuffer = GetCommandBufferHandle(app, command.commandBuffer);
+                if (indirectBuffer != state.indirectBuffer)
+                {
+                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+                    state.indirectBuffer = indirectBuffer;
+                }
+                const GLuint parameterBuffer = GetCommandBufferHandle(app, command.countBuffer);
+                if (parameterBuffer != state.parameterBuffer)
+                {
+                    glBindBuffer(GL_PARAMETER_BUFFER_ARB, parameterBuffer);
+                    state.parameterBuffer = parameterBuffer;
+                }
+                glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(u64)(command.firstCommand * sizeof(IndirectDrawCommand)),
+                                                    (GLintptr)(command.countIndex * sizeof(u32)), command.maxDrawCount, 0);
+            }
+            break;
+
+            case Command_SetViewport:
+            {
+                const SetViewportCommand& command = *(const SetViewportCommand*)cursor;
+                glViewport(command.x, command.y, command.width, command.height);
+            }
+            break;
+
+            default: ASSERT(false, "Unknown command");
+        }
+
+        cursor += header.size;
+    }
+
+    // Later GL calls must not edit the last VAO by accident
+    if (state.vao)
+        glBindVertexArray(0);
+    if (state.indirectBuffer)
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    if (state.parameterBuffer)
+        glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+}
@@ -0,0 +1,226 @@
+//
+// command_list.h: Draw commands recorded into a linear buffer of POD structs instead of
+// being sent to GL right away. They refer to engine resources by index (programs, meshes,
+// textures, materials), so any thread can record them; the render thread replays them and
+// skips the binds that would not change anything.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct App;
+
+enum CommandType : u16
+{
+    Command_BindProgram,
+    Command_BindMeshVao,
+    Command_BindTexture,
+    Command_BindUniformRange,
+    Command_SetUniformU32,
+    Command_SetUniformMat4,
+    Command_DrawIndexed,
+    Command_DrawIndexedInstanced,
+    Command_SetViewport,
+    Command_MultiDrawIndexedIndirectCount,
+};
+
+// Buffers the commands can bind, resolved to GL handles when replayed
+enum CommandBufferId : u16
+{
+    CommandBuffer_Constants,
+    CommandBuffer_DrawIndirect,
+    CommandBuffer_DrawCount,
+};
+
+struct CommandHeader
+{
+    CommandType type;
+    u16         size; // Of the whole command, header included
+};
+
+struct BindProgramCommand
+{
+    CommandHeader header;
+    u32           programIdx;
+};
+
+// The VAO pairing the submesh with the bound program
+struct BindMeshVaoCommand
+{
+    CommandHeader header;
+    u32           meshIdx;
+    u32           submeshIdx;
+};
+
+struct BindTextureCommand
+{
+    CommandHeader header;
+    u32           unit;
+    u32           texIdx;
+};
+
+struct BindUniformRangeCommand
+{
+    CommandHeader   header;
+    CommandBufferId buffer;
+    u32             binding;
+    u32             offset;
+    u32             size;
+};
+
+// Uniforms of the bound program. name must outlive the list (string literals do).
+struct SetUniformU32Command
+{
+    CommandHeader header;
+    const char*   name;
+    u32           value;
+};
+
+struct SetUniformMat4Command
+{
+    CommandHeader header;
+    const char*   name;
+    glm::mat4     value;
+};
+
+struct DrawIndexedCommand
+{
+    CommandHeader header;
+    u32           indexCount;
+    u32           indexOffset; // In bytes, into the bound element buffer
+};
+
+struct DrawIndexedInstancedCommand
+{
+    CommandHeader header;
+    u32           indexCount;
+    u32           indexOffset;
+    u32           instanceCount;
+};
+
+// Draws the IndirectDrawCommands from firstCommand on, as many as the GPU wrote at countIndex, maxDrawCount at most
+struct MultiDrawIndexedIndirectCountCommand
+{
+    CommandHeader   header;
+    CommandBufferId commandBuffer;
+    CommandBufferId countBuffer;
+    u32             firstCommand;
+    u32             countIndex;
+    u32             maxDrawCount;
+};
+
+struct SetViewportCommand
+{
+    CommandHeader header;
+    i32           x;
+    i32           y;
+    i32           width;
+    i32           height;
+};
+
+struct CommandList
+{
+    std::vector<u8> data; // Cleared every frame, so the capacity is reused like an arena
+    u32             count;
+};
+
+void ResetCommandList(CommandList& list);
+
+// Appends a command, padded so the next one stays 8 byte aligned
+template <typename T>
+T& PushCommand(CommandList& list, CommandType type)
+{
+    const u32 size = (sizeof(T) + 7) & ~7u;
+    const u32 offset = (u32)list.data.size();
+    list.data.resize(offset + size);
+    list.count++;
+
+    T* command = (T*)(list.data.data() + offset);
+    command->header.type = type;
+    command->header.size = (u16)size;
+    return *command;
+}
+
+inline void CmdBindProgram(CommandList& list, u32 programIdx)
+{
+    PushCommand<BindProgramCommand>(list, Command_BindProgram).programIdx = programIdx;
+}
+
+inline void CmdBindVao(CommandList& list, u32 meshIdx, u32 submeshIdx)
+{
+    BindMeshVaoCommand& command = PushCommand<BindMeshVaoCommand>(list, Command_BindMeshVao);
+    command.meshIdx = meshIdx;
+    command.submeshIdx = submeshIdx;
+}
+
+inline void CmdBindTexture(CommandList& list, u32 unit, u32 texIdx)
+{
+    BindTextureCommand& command = PushCommand<BindTextureCommand>(list, Command_BindTexture);
+    command.unit = unit;
+    command.texIdx = texIdx;
+}
+
+inline void CmdBindUBORange(CommandList& list, u32 binding, CommandBufferId buffer, u32 offset, u32 size)
+{
+    BindUniformRangeCommand& command = PushCommand<BindUniformRangeCommand>(list, Command_BindUniformRange);
+    command.buffer = buffer;
+    command.binding = binding;
+    command.offset = offset;
+    command.size = size;
+}
+
+inline void CmdSetUniform(CommandList& list, const char* name, u32 value)
+{
+    SetUniformU32Command& command = PushCommand<SetUniformU32Command>(list, Command_SetUniformU32);
+    command.name = name;
+    command.value = value;
+}
+
+inline void CmdSetUniform(CommandList& list, const char* name, const glm::mat4& value)
+{
+    SetUniformMat4Command& command = PushCommand<SetUniformMat4Command>(list, Command_SetUniformMat4);
+    command.name = name;
+    command.value = value;
+}
+
+inline void CmdDrawIndexed(CommandList& list, u32 indexCount, u32 indexOffset)
+{
+    DrawIndexedCommand& command = PushCommand<DrawIndexedCommand>(list, Command_DrawIndexed);
+    command.indexCount = indexCount;
+    command.indexOffset = indexOffset;
+}
+
+inline void CmdDrawIndexedInstanced(CommandList& list, u32 indexCount, u32 indexOffset, u32 instanceCount)
+{
+    DrawIndexedInstancedCommand& command = PushCommand<DrawIndexedInstancedCommand>(list, Command_DrawIndexedInstanced);
+    command.indexCount = indexCount;
+    command.indexOffset = indexOffset;
+    command.instanceCount = instanceCount;
+}
+
+// Draws from the GPU culling buffers
+inline void CmdMultiDrawIndexedIndirectCount(CommandList& list, u32 firstCommand, u32 countIndex, u32 maxDrawCount)
+{
+    MultiDrawIndexedIndirectCountCommand& command = PushCommand<MultiDrawIndexedIndirectCountCommand>(list, Command_MultiDrawIndexedIndirectCount);
+    command.commandBuffer = CommandBuffer_DrawIndirect;
+    command.countBuffer = CommandBuffer_DrawCount;
+    command.firstCommand = firstCommand;
+    command.countIndex = countIndex;
+    command.maxDrawCount = maxDrawCount;
+}
+
+inline void CmdSetViewport(CommandList& list, i32 x, i32 y, i32 width, i32 height)
+{
+    SetViewportCommand& command = PushCommand<SetViewportCommand>(list, Command_SetViewport);
+    command.x = x;
+    command.y = y;
+    command.width = width;
+    command.height = height;
+}
+
+/**
+ * Sends the list to GL, on the render thread. Nothing is assumed about the GL state on
+ * entry. The program and texture bindings are left as the list set them, the VAO unbound.
+ */
+void ReplayCommandList(App* app, const CommandList& list);
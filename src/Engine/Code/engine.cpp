@@ -12,106 +12,443 @@
 #include "engine.h"
 #include "assimp_model_loading.h"
 #include "buffer_management.h"
+#include "memory_arena.h"
+#include "program_cache.h"
+#include "parallel.h"
+#include "render_thread.h"
+#include "simd_math.h"
+
+#include <algorithm>
 
 #define BINDING(b) b
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+static const char* ShaderFeatureDefines[ShaderFeature_Count] = {
+    "CLIPPING",
+    "INSTANCED",
+    "NORMAL_MAP",
+    "SKINNED",
+    "BINDLESS",
+    "VERTEX_LAYER",
+    "COMPUTE",
+    "GPU_DRIVEN",
+    "TESSELLATION"
+};
+
+/**
+ * Submits the compile and link of a program without querying their status, so the
+ * driver is free to do the work in the background until EndProgramCompile().
+ */
+static ProgramCompile BeginProgramCompile(String programSource, const char* shaderName, ShaderFeatures features)
 {
-    GLchar  infoLogBuffer[1024] = {};
-    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
-    GLsizei infoLogSize;
-    GLint   success;
+    ProgramCompile compile = {};
 
     char versionString[] = "#version 430\n";
+    char featuresString[512] = {};
+    if (features & ShaderFeature_Bindless)
+        strcat(featuresString, "#extension GL_ARB_bindless_texture : require\n");
+    if (features & ShaderFeature_VertexLayer)
+        strcat(featuresString, "#extension GL_ARB_shader_viewport_layer_array : require\n");
+    if (features & ShaderFeature_GpuDriven)
+        strcat(featuresString, "#extension GL_ARB_shader_draw_parameters : require\n");
+    for (u32 i = 0; i < ShaderFeature_Count; ++i)
+    {
+        if (features & (1u << i))
+        {
+            strcat(featuresString, "#define ");
+            strcat(featuresString, ShaderFeatureDefines[i]);
+            strcat(featuresString, "\n");
+        }
+    }
     char shaderNameDefine[128];
     sprintf_s(shaderNameDefine, "#define %s\n", shaderName);
+    if (features & ShaderFeature_Compute)
+    {
+        // A single stage, already told apart by the COMPUTE define of the features
+        const GLchar* computeShaderSource[] = {
+            versionString,
+            featuresString,
+            shaderNameDefine,
+            programSource.str
+        };
+        const GLint computeShaderLengths[] = {
+            (GLint) strlen(versionString),
+            (GLint) strlen(featuresString),
+            (GLint) strlen(shaderNameDefine),
+            (GLint) programSource.len
+        };
+
+        compile.binaryKey = GetProgramBinaryKey(computeShaderSource, computeShaderLengths, ARRAY_COUNT(computeShaderSource));
+
+        compile.handle = LoadProgramBinary(compile.binaryKey);
+        if (compile.handle)
+            return compile;
+
+        compile.vshader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compile.vshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+        glCompileShader(compile.vshader);
+
+        compile.handle = glCreateProgram();
+        glAttachShader(compile.handle, compile.vshader);
+        glProgramParameteri(compile.handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(compile.handle);
+
+        return compile;
+    }
+
     char vertexShaderDefine[] = "#define VERTEX\n";
     char fragmentShaderDefine[] = "#define FRAGMENT\n";
 
     const GLchar* vertexShaderSource[] = {
         versionString,
+        featuresString,
         shaderNameDefine,
         vertexShaderDefine,
         programSource.str
     };
     const GLint vertexShaderLengths[] = {
         (GLint) strlen(versionString),
+        (GLint) strlen(featuresString),
         (GLint) strlen(shaderNameDefine),
         (GLint) strlen(vertexShaderDefine),
         (GLint) programSource.len
     };
     const GLchar* fragmentShaderSource[] = {
         versionString,
+        featuresString,
         shaderNameDefine,
         fragmentShaderDefine,
         programSource.str
     };
     const GLint fragmentShaderLengths[] = {
         (GLint) strlen(versionString),
+        (GLint) strlen(featuresString),
         (GLint) strlen(shaderNameDefine),
         (GLint) strlen(fragmentShaderDefine),
         (GLint) programSource.len
     };
 
-    GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
-    glCompileShader(vshader);
-    glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    // The fragment stage only differs by its fixed stage define, so the vertex stage strings identify the program
+    compile.binaryKey = GetProgramBinaryKey(vertexShaderSource, vertexShaderLengths, ARRAY_COUNT(vertexShaderSource));
+
+    compile.handle = LoadProgramBinary(compile.binaryKey);
+    if (compile.handle)
+        return compile;
+
+    compile.vshader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(compile.vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
+    glCompileShader(compile.vshader);
+
+    compile.fshader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(compile.fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
+    glCompileShader(compile.fshader);
+
+    if (features & ShaderFeature_Tessellation)
+    {
+        // Same strings as the vertex stage but for the stage define
+        char tessControlShaderDefine[] = "#define TESS_CONTROL\n";
+        char tessEvaluationShaderDefine[] = "#define TESS_EVALUATION\n";
+
+        const GLchar* tessShaderSource[ARRAY_COUNT(vertexShaderSource)];
+        GLint tessShaderLengths[ARRAY_COUNT(vertexShaderLengths)];
+        memcpy(tessShaderSource, vertexShaderSource, sizeof(tessShaderSource));
+        memcpy(tessShaderLengths, vertexShaderLengths, sizeof(tessShaderLengths));
+
+        tessShaderSource[3] = tessControlShaderDefine;
+        tessShaderLengths[3] = (GLint) strlen(tessControlShaderDefine);
+        compile.tcshader = glCreateShader(GL_TESS_CONTROL_SHADER);
+        glShaderSource(compile.tcshader, ARRAY_COUNT(tessShaderSource), tessShaderSource, tessShaderLengths);
+        glCompileShader(compile.tcshader);
+
+        tessShaderSource[3] = tessEvaluationShaderDefine;
+        tessShaderLengths[3] = (GLint) strlen(tessEvaluationShaderDefine);
+        compile.teshader = glCreateShader(GL_TESS_EVALUATION_SHADER);
+        glShaderSource(compile.teshader, ARRAY_COUNT(tessShaderSource), tessShaderSource, tessShaderLengths);
+        glCompileShader(compile.teshader);
+    }
+
+    compile.handle = glCreateProgram();
+    glAttachShader(compile.handle, compile.vshader);
+    if (compile.tcshader)
+    {
+        glAttachShader(compile.handle, compile.tcshader);
+        glAttachShader(compile.handle, compile.teshader);
+    }
+    glAttachShader(compile.handle, compile.fshader);
+    glProgramParameteri(compile.handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(compile.handle);
+
+    return compile;
+}
+
+/**
+ * Whether EndProgramCompile() can be called without stalling. Without parallel
+ * compile support there is no way to ask, so this is always true: callers that must not
+ * stall wait a frame after the submit, and the driver may still be busy by then.
+ */
+static bool IsProgramCompileDone(const ProgramCompile& compile)
+{
+    if (compile.vshader == 0 || !GLEXT_KHR_parallel_shader_compile)
+        return true;
+
+    GLint done = GL_FALSE;
+    glGetProgramiv(compile.handle, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+// Detaches and deletes every shader stage of a compile, leaving the program itself
+static void DeleteProgramCompileShaders(ProgramCompile& compile)
+{
+    const GLuint shaders[] = { compile.vshader, compile.fshader, compile.tcshader, compile.teshader };
+    for (u32 i = 0; i < ARRAY_COUNT(shaders); ++i)
     {
-        glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        if (shaders[i] == 0)
+            continue;
+        glDetachShader(compile.handle, shaders[i]);
+        glDeleteShader(shaders[i]);
     }
+    compile.vshader = 0;
+    compile.fshader = 0;
+    compile.tcshader = 0;
+    compile.teshader = 0;
+}
+
+/**
+ * Checks the compile and link status, logging any error, and releases the shader
+ * objects. Returns false if the program failed to build.
+ */
+static bool EndProgramCompile(ProgramCompile& compile, const char* shaderName)
+{
+    if (compile.vshader == 0)
+        return true; // Loaded from the binary cache
+
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
 
-    GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
-    glCompileShader(fshader);
-    glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
+    bool compiled = true;
+
+    glGetShaderiv(compile.vshader, GL_COMPILE_STATUS, &success);
     if (!success)
     {
-        glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        glGetShaderInfoLog(compile.vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glCompileShader() failed with %s shader %s\nReported message:\n%s\n", compile.fshader ? "vertex" : "compute", shaderName, infoLogBuffer);
+        compiled = false;
+    }
+
+    if (compile.fshader)
+        glGetShaderiv(compile.fshader, GL_COMPILE_STATUS, &success);
+    if (compile.fshader && !success)
+    {
+        glGetShaderInfoLog(compile.fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
         ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        compiled = false;
+    }
+
+    const GLuint tessShaders[] = { compile.tcshader, compile.teshader };
+    const char* tessShaderNames[] = { "tessellation control", "tessellation evaluation" };
+    for (u32 i = 0; i < ARRAY_COUNT(tessShaders); ++i)
+    {
+        if (tessShaders[i] == 0)
+            continue;
+        glGetShaderiv(tessShaders[i], GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(tessShaders[i], infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glCompileShader() failed with %s shader %s\nReported message:\n%s\n", tessShaderNames[i], shaderName, infoLogBuffer);
+            compiled = false;
+        }
     }
 
-    GLuint programHandle = glCreateProgram();
-    glAttachShader(programHandle, vshader);
-    glAttachShader(programHandle, fshader);
-    glLinkProgram(programHandle);
-    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    glGetProgramiv(compile.handle, GL_LINK_STATUS, &success);
     if (!success)
     {
-        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        glGetProgramInfoLog(compile.handle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
         ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        compiled = false;
+    }
+
+    if (compiled)
+        SaveProgramBinary(compile.binaryKey, compile.handle);
+
+    DeleteProgramCompileShaders(compile);
+
+    return compiled;
+}
+
+GLuint CreateProgramFromSource(String programSource, const char* shaderName, ShaderFeatures features, u64* binaryKey)
+{
+    ProgramCompile compile = BeginProgramCompile(programSource, shaderName, features);
+    EndProgramCompile(compile, shaderName);
+
+    *binaryKey = compile.binaryKey;
+    return compile.handle;
+}
+
+u8 GetAttributeComponentCount(const GLenum& type);
+
+void ReflectProgramInterface(Program& program)
+{
+    ReflectProgram(program.reflection, program.handle);
+
+    program.vertex_input_layout.attributes.clear();
+    for (const ProgramAttribute& attribute : program.reflection.attributes)
+        program.vertex_input_layout.attributes.push_back({ (u8)attribute.location, GetAttributeComponentCount(attribute.type) });
+}
+
+void CompileProgram(Program& program)
+{
+    String programSource = ReadTextFile(program.filepath.c_str());
+    program.handle = CreateProgramFromSource(programSource, program.programName.c_str(), program.features, &program.binaryKey);
+
+    ReflectProgramInterface(program);
+}
+
+static void DeleteProgramVaos(App* app, GLuint programHandle)
+{
+    // The driver may reuse the name of a deleted program, which would match stale VAOs
+    ForEachPoolItem(app->meshes, [&](u32 /*meshIdx*/, Mesh& mesh)
+    {
+        for (Submesh& submesh : mesh.submeshes)
+        {
+            for (u32 i = 0; i < submesh.vao_count; )
+            {
+                if (submesh.vaos[i].program_handle == programHandle)
+                {
+                    glDeleteVertexArrays(1, &submesh.vaos[i].handle);
+                    submesh.vaos[i] = submesh.vaos[--submesh.vao_count];
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+    });
+}
+
+static void CancelProgramReload(App* app, u32 reloadIdx)
+{
+    ProgramCompile& compile = app->programReloads[reloadIdx];
+    DeleteProgramCompileShaders(compile);
+    glDeleteProgram(compile.handle);
+
+    app->programReloads.erase(app->programReloads.begin() + reloadIdx);
+}
+
+void BeginProgramReload(App* app, u32 programIdx)
+{
+    // A newer edit supersedes a compile still in flight
+    for (u32 i = 0; i < app->programReloads.size(); ++i)
+    {
+        if (app->programReloads[i].programIdx == programIdx)
+        {
+            CancelProgramReload(app, i);
+            break;
+        }
     }
 
-    glUseProgram(0);
+    const Program& program = app->programs[programIdx];
+    String programSource = ReadTextFile(program.filepath.c_str());
+
+    ProgramCompile compile = BeginProgramCompile(programSource, program.programName.c_str(), program.features);
+    compile.programIdx = programIdx;
+    compile.submitFrame = app->renderFrameIndex;
+    app->programReloads.push_back(compile);
+}
+
+void UpdateProgramReloads(App* app)
+{
+    for (u32 i = 0; i < app->programReloads.size(); )
+    {
+        // Never in the frame that submitted it, so the driver gets a frame to compile in the background
+        ProgramCompile& compile = app->programReloads[i];
+        if (compile.submitFrame == app->renderFrameIndex || !IsProgramCompileDone(compile))
+        {
+            ++i;
+            continue;
+        }
+
+        Program& program = app->programs[compile.programIdx];
+        if (EndProgramCompile(compile, program.programName.c_str()))
+        {
+            if (program.binaryKey != compile.binaryKey)
+                DeleteProgramBinary(program.binaryKey);
+
+            DeleteProgramVaos(app, program.handle);
+            glDeleteProgram(program.handle);
+
+            program.handle = compile.handle;
+            program.binaryKey = compile.binaryKey;
+            ReflectProgramInterface(program);
+
+            ILOG("Reloaded program %s (variant %x)", program.programName.c_str(), program.features);
+        }
+        else
+        {
+            // Keep rendering with the last program that built
+            glDeleteProgram(compile.handle);
+        }
 
-    glDetachShader(programHandle, vshader);
-    glDetachShader(programHandle, fshader);
-    glDeleteShader(vshader);
-    glDeleteShader(fshader);
+        app->programReloads.erase(app->programReloads.begin() + i);
+    }
+}
 
-    return programHandle;
+static void GetProgramVariantName(const char* programName, ShaderFeatures features, char* variantName, u32 variantNameSize)
+{
+    snprintf(variantName, variantNameSize, "%s|%x", programName, features);
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+u32 LoadProgram(App* app, const char* filepath, const char* programName, ShaderFeatures features)
 {
-    String programSource = ReadTextFile(filepath);
+    if (app->bindlessTextures)
+        features |= ShaderFeature_Bindless;
+
+    char variantName[256];
+    GetProgramVariantName(programName, features, variantName, sizeof(variantName));
+
+    u32 programIdx = FindAssetIndex(app->assets, AssetType_Program, variantName);
+    if (programIdx != UINT32_MAX)
+        return programIdx;
 
     Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
     program.filepath = filepath;
     program.programName = programName;
-    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.features = features;
+    program.sourceFile = WatchFile(app->fileWatcher, filepath);
     app->programs.push_back(program);
 
-    return app->programs.size() - 1;
+    programIdx = app->programs.size() - 1;
+    RegisterAsset(app->assets, AssetType_Program, variantName, programIdx);
+
+    return programIdx;
+}
+
+Program& GetProgram(App* app, u32 programIdx)
+{
+    Program& program = app->programs[programIdx];
+
+    if (program.handle == 0)
+        CompileProgram(program);
+
+    return program;
+}
+
+u32 FindProgram(App* app, const char* programName, ShaderFeatures features)
+{
+    if (app->bindlessTextures)
+        features |= ShaderFeature_Bindless;
+
+    char variantName[256];
+    GetProgramVariantName(programName, features, variantName, sizeof(variantName));
+
+    return FindAssetIndex(app->assets, AssetType_Program, variantName);
 }
 
 Image LoadImage(const char* filename)
 {
     Image img = {};
-    stbi_set_flip_vertically_on_load(true);
+    stbi_set_flip_vertically_on_load_thread(true); // Per thread, images are decoded on the workers
     img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
     if (img.pixels)
     {
@@ -157,29 +494,226 @@ GLuint CreateTexture2DFromImage(Image image)
     return texHandle;
 }
 
-u32 LoadTexture2D(App* app, const char* filepath)
+void LoadTextures2D(App* app, const char* const* filepaths, u32 count, u32* texIndices)
 {
-    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-        if (app->textures[texIdx].filepath == filepath)
-            return texIdx;
+    std::vector<Image> images(count);
 
-    Image image = LoadImage(filepath);
+    // Decoding is the slow part and touches no GL state, so it runs as jobs
+    ParallelFor(count, 1, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; ++i)
+            if (FindAssetIndex(app->assets, AssetType_Texture, filepaths[i]) == UINT32_MAX)
+                images[i] = LoadImage(filepaths[i]);
+    });
 
-    if (image.pixels)
+    for (u32 i = 0; i < count; ++i)
     {
+        // Already loaded, either before this call or earlier in the list
+        texIndices[i] = FindAssetIndex(app->assets, AssetType_Texture, filepaths[i]);
+        if (texIndices[i] != UINT32_MAX || !images[i].pixels)
+        {
+            FreeImage(images[i]);
+            continue;
+        }
+
         Texture tex = {};
-        tex.handle = CreateTexture2DFromImage(image);
-        tex.filepath = filepath;
+        tex.handle = CreateTexture2DFromImage(images[i]);
+        tex.filepath = filepaths[i];
 
-        u32 texIdx = app->textures.size();
-        app->textures.push_back(tex);
+        texIndices[i] = AddPoolItem(app->textures, tex).index;
+        RegisterAsset(app->assets, AssetType_Texture, filepaths[i], texIndices[i]);
 
-        FreeImage(image);
-        return texIdx;
+        FreeImage(images[i]);
     }
-    else
+}
+
+u32 LoadTexture2D(App* app, const char* filepath)
+{
+    u32 texIdx;
+    LoadTextures2D(app, &filepath, 1, &texIdx);
+    return texIdx;
+}
+
+GLuint64 GetBindlessTextureHandle(App* app, u32 texIdx)
+{
+    if (!IsPoolSlotAlive(app->textures, texIdx))
+        return 0;
+
+    Texture& tex = app->textures[texIdx];
+    if (tex.bindless_handle == 0)
+    {
+        tex.bindless_handle = glGetTextureHandleARB(tex.handle);
+        glMakeTextureHandleResidentARB(tex.bindless_handle);
+    }
+
+    return tex.bindless_handle;
+}
+
+void BuildTextureArrays(App* app)
+{
+    // Gather the textures referenced by materials
+    std::vector<u32> materialTextures;
+    std::vector<bool> isMaterialTexture(PoolSlotCount(app->textures), false);
+    ForEachPoolItem(app->materials, [&](u32 /*materialIdx*/, const Material& material)
+    {
+        const u32 texIndices[] = {
+            material.albedo_texture_index, material.emissive_texture_index, material.specular_texture_index,
+            material.normals_texture_index, material.bump_texture_index
+        };
+
+        for (u32 texIdx : texIndices)
+        {
+            if (IsPoolSlotAlive(app->textures, texIdx) && !isMaterialTexture[texIdx])
+            {
+                isMaterialTexture[texIdx] = true;
+                materialTextures.push_back(texIdx);
+            }
+        }
+    });
+
+    GLint maxLayers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+    // Assign every texture a layer in the array matching its size and format
+    for (u32 texIdx : materialTextures)
+    {
+        Texture& tex = app->textures[texIdx];
+
+        ivec2 size;
+        GLint internalFormat;
+        glBindTexture(GL_TEXTURE_2D, tex.handle);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &size.x);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &size.y);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        u32 arrayIdx = 0;
+        for (; arrayIdx < app->textureArrays.size(); ++arrayIdx)
+        {
+            const TextureArray& array = app->textureArrays[arrayIdx];
+            if (array.size == size && array.internal_format == (GLenum)internalFormat && array.layer_count < (u32)maxLayers)
+                break;
+        }
+
+        if (arrayIdx == app->textureArrays.size())
+        {
+            if (arrayIdx == MAX_MATERIAL_TEXTURE_ARRAYS)
+                continue; // Left out of the atlas, it is bound per draw
+
+            app->textureArrays.push_back({ 0, size, (GLenum)internalFormat, 0 });
+        }
+
+        tex.array_index = arrayIdx;
+        tex.array_layer = app->textureArrays[arrayIdx].layer_count++;
+    }
+
+    // Create the arrays and copy the textures into their layers
+    for (TextureArray& array : app->textureArrays)
+    {
+        glGenTextures(1, &array.handle);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array.handle);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, array.internal_format, array.size.x, array.size.y, array.layer_count);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    for (u32 texIdx : materialTextures)
     {
+        const Texture& tex = app->textures[texIdx];
+        if (tex.array_index == UINT32_MAX)
+            continue;
+
+        const TextureArray& array = app->textureArrays[tex.array_index];
+        glCopyImageSubData(tex.handle, GL_TEXTURE_2D, 0, 0, 0, 0,
+                           array.handle, GL_TEXTURE_2D_ARRAY, 0, 0, 0, tex.array_layer,
+                           array.size.x, array.size.y, 1);
+    }
+
+    ILOG("Packed %u material textures into %u texture arrays", (u32)materialTextures.size(), (u32)app->textureArrays.size());
+}
+
+GLuint64 GetMaterialTextureReference(App* app, u32 texIdx)
+{
+    if (app->bindlessTextures)
+        return GetBindlessTextureHandle(app, texIdx);
+
+    if (!IsPoolSlotAlive(app->textures, texIdx))
         return UINT32_MAX;
+
+    const Texture& tex = app->textures[texIdx];
+    return ((GLuint64)tex.array_layer << 32) | tex.array_index;
+}
+
+void UploadMaterialTable(App* app)
+{
+    if (!app->bindlessTextures && app->textureArrays.empty())
+        BuildTextureArrays(app);
+
+    // Indexed by material slot, the free slots are left zeroed
+    std::vector<MaterialRecord> records(PoolSlotCount(app->materials));
+    app->materialTexturesInTable = true;
+    ForEachPoolItem(app->materials, [&](u32 materialIdx, const Material& material)
+    {
+        MaterialRecord& record = records[materialIdx];
+
+        // Same test as RecordMaterial()
+        const u32 texIdx = material.albedo_texture_index;
+        if (!app->bindlessTextures && IsPoolSlotAlive(app->textures, texIdx) && app->textures[texIdx].array_index == UINT32_MAX)
+            app->materialTexturesInTable = false;
+
+        record.albedo = vec4(material.albedo, material.smoothness);
+        record.emissive = vec4(material.emissive, 1.0f);
+        record.albedo_texture = GetMaterialTextureReference(app, material.albedo_texture_index);
+        record.emissive_texture = GetMaterialTextureReference(app, material.emissive_texture_index);
+        record.specular_texture = GetMaterialTextureReference(app, material.specular_texture_index);
+        record.normals_texture = GetMaterialTextureReference(app, material.normals_texture_index);
+        record.bump_texture = GetMaterialTextureReference(app, material.bump_texture_index);
+    });
+
+    const u32 tableSize = records.size() * sizeof(MaterialRecord);
+    if (app->materialTable.handle == 0 || app->materialTable.size < tableSize)
+    {
+        if (app->materialTable.handle != 0)
+            glDeleteBuffers(1, &app->materialTable.handle);
+        app->materialTable = CreateBuffer(tableSize, GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->materialTable.handle);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, tableSize, records.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Binds the material texture arrays once for a whole pass
+void BindMaterialTextureArrays(App* app, Program& program)
+{
+    if (app->bindlessTextures)
+        return;
+
+    GLint units[MAX_MATERIAL_TEXTURE_ARRAYS];
+    for (u32 i = 0; i < MAX_MATERIAL_TEXTURE_ARRAYS; ++i)
+    {
+        units[i] = MATERIAL_TEXTURE_ARRAY_UNIT + i;
+        glActiveTexture(GL_TEXTURE0 + units[i]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, i < app->textureArrays.size() ? app->textureArrays[i].handle : 0);
+    }
+
+    SetUniformArray(program.reflection, "uTextureArrays", units, MAX_MATERIAL_TEXTURE_ARRAYS);
+}
+
+// Per draw material selection. Only textures left out of the arrays need a bind (unit 0).
+void RecordMaterial(App* app, u32 materialIdx, CommandList& list)
+{
+    CmdSetUniform(list, "uMaterialIndex", materialIdx);
+
+    if (!app->bindlessTextures)
+    {
+        const u32 texIdx = app->materials[materialIdx].albedo_texture_index;
+        if (IsPoolSlotAlive(app->textures, texIdx) && app->textures[texIdx].array_index == UINT32_MAX)
+            CmdBindTexture(list, 0, texIdx);
     }
 }
 
@@ -263,7 +797,11 @@ void Init(App* app)
     app->opengl_info.renderer = glGetString(GL_RENDERER);
     app->opengl_info.vendor = glGetString(GL_VENDOR);
     app->opengl_info.glsl_version = glGetString(GL_SHADING_LANGUAGE_VERSION);
-    // add opengl extensions
+
+    InitWorkerThreads();
+
+    // OpenGL extensions (loaded by the platform layer)
+    app->bindlessTextures = GLEXT_ARB_bindless_texture;
 
     glEnable(GL_DEPTH_TEST);
 
@@ -311,43 +849,53 @@ void Init(App* app)
     glBindVertexArray(0);
 
     app->texturedGeometryProgramIdx = LoadProgram(app, "shaders.glsl", "TEXTURED_GEOMETRY");
-    Program& texturedGeometryProgram = app->programs[app->texturedGeometryProgramIdx];
-    app->programUniformTexture = glGetUniformLocation(texturedGeometryProgram.handle, "uTexture");
-
-    app->diceTexIdx = LoadTexture2D(app, "dice.png");
-    app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
-    app->blackTexIdx = LoadTexture2D(app, "color_black.png");
-    app->normalTexIdx = LoadTexture2D(app, "color_normal.png");
-    app->magentaTexIdx = LoadTexture2D(app, "color_magenta.png");
-    
-    app->dudvMapIdx = LoadTexture2D(app, "Textures/dudv_map.png");
+
+    const char* textureFiles[] = { "dice.png", "color_white.png", "color_black.png", "color_normal.png", "color_magenta.png", "Textures/dudv_map.png" };
+    u32 textureIndices[ARRAY_COUNT(textureFiles)];
+    LoadTextures2D(app, textureFiles, ARRAY_COUNT(textureFiles), textureIndices);
+
+    app->diceTexIdx = textureIndices[0];
+    app->whiteTexIdx = textureIndices[1];
+    app->blackTexIdx = textureIndices[2];
+    app->normalTexIdx = textureIndices[3];
+    app->magentaTexIdx = textureIndices[4];
+    app->dudvMapIdx = textureIndices[5];
 
     // --------------------------------
 
     app->patrick_index = LoadModel(app, "Patrick/Patrick.obj");
     app->cube_index = LoadModel(app, "Cube/Cube.obj");
 
+    UploadMaterialTable(app);
+
     app->LoadQuad();
     app->LoadSphere();
 
-    app->entities.push_back({ TransformPositionRotationScale(vec3(0.0f, 10.0f, -20.0f), 60.0f, vec3(0.0f, 1.0f, 0.0f), vec3(2.0f)),
-                              app->patrick_index });
-    app->entities.push_back({ TransformPositionRotationScale(vec3(-5.0f, 10.0f, -20.0f), 60.0f, vec3(0.0f, 1.0f, 0.0f), vec3(2.0f)),
-                              app->patrick_index });
-    app->entities.push_back({ TransformPositionRotationScale(vec3(5.0f, 10.0f, -20.0f), 60.0f, vec3(0.0f, 1.0f, 0.0f), vec3(2.0f)),
-                              app->patrick_index });
+    CreateEntity(app->scene, app->patrick_index, vec3(0.0f, 10.0f, -20.0f), glm::angleAxis(glm::radians(60.0f), vec3(0.0f, 1.0f, 0.0f)), vec3(2.0f));
+    CreateEntity(app->scene, app->patrick_index, vec3(-5.0f, 10.0f, -20.0f), glm::angleAxis(glm::radians(60.0f), vec3(0.0f, 1.0f, 0.0f)), vec3(2.0f));
+    CreateEntity(app->scene, app->patrick_index, vec3(5.0f, 10.0f, -20.0f), glm::angleAxis(glm::radians(60.0f), vec3(0.0f, 1.0f, 0.0f)), vec3(2.0f));
+
+    // Occlusion culling check: one right behind the middle one and one right in front of it.
+    // From the start position the one in front is never culled, and the one behind is culled
+    // only where the other two hide it entirely. Neither may flicker as the camera moves.
+    CreateEntity(app->scene, app->patrick_index, vec3(0.0f, 10.0f, -30.0f), glm::angleAxis(glm::radians(60.0f), vec3(0.0f, 1.0f, 0.0f)), vec3(2.0f));
+    CreateEntity(app->scene, app->patrick_index, vec3(0.0f, 10.0f, -12.0f), glm::angleAxis(glm::radians(60.0f), vec3(0.0f, 1.0f, 0.0f)), vec3(2.0f));
+
+    // Nothing moves them, so their shadows are cached
+    for (u32 entity = 0; entity < app->scene.count; ++entity)
+        SetEntityStatic(app->scene, entity, true);
 
-    app->lights.push_back({ LightType_Point, vec3(1.0f, 0.0f, 0.0f), vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 5.0f, -20.0f), 20.0f, 1.0f });
-    app->lights.push_back({ LightType_Point, vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(5.0f, 7.0f, 0.0f), 14.0f, 0.7f });
-    app->lights.push_back({ LightType_Directional, vec3(1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 10.0f, -3.0f), 0.0f, 1.0f });
+    AddPoolItem(app->lights, { LightType_Point, vec3(1.0f, 0.0f, 0.0f), vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 5.0f, -20.0f), 20.0f, 1.0f });
+    AddPoolItem(app->lights, { LightType_Point, vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(5.0f, 7.0f, 0.0f), 14.0f, 0.7f });
+    AddPoolItem(app->lights, { LightType_Directional, vec3(1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 10.0f, -3.0f), 0.0f, 1.0f });
 
     /*int elements_j_patricks = 6, elements_i_patricks = 6;
     for (int j = -elements_j_patricks / 2; j <= elements_j_patricks / 2; ++j)
     {
         for (int i = -elements_i_patricks / 2; i <= elements_i_patricks / 2; ++i)
         {
-            app->entities.push_back({ TransformPositionRotationScale(vec3(i * 30, 0.0f, j * 30),
-                60.0f, vec3(0.0f, 1.0f, 0.0f), vec3(2.0f)), app->patrick_index });
+            CreateEntity(app->scene, app->patrick_index, vec3(i * 30, 0.0f, j * 30),
+                glm::angleAxis(glm::radians(60.0f), vec3(0.0f, 1.0f, 0.0f)), vec3(2.0f));
         }
     }*/
 
@@ -376,192 +924,35 @@ void Init(App* app)
     /* FORWARD RENDERING SHADER */
 
     app->texturedMeshProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH");
-    Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
-
-    GLint attribute_count;
-    glGetProgramiv(texturedMeshProgram.handle, GL_ACTIVE_ATTRIBUTES, &attribute_count);
-
-    for (int i = 0; i < attribute_count; ++i)
-    {
-        GLchar attribute_name[32];
-        GLsizei attribute_length;
-        GLint attribute_size;
-        GLenum attribute_type;
-
-        glGetActiveAttrib(texturedMeshProgram.handle, i, ARRAY_COUNT(attribute_name), &attribute_length, &attribute_size, &attribute_type, attribute_name);
-        GLint attribute_location = glGetAttribLocation(texturedMeshProgram.handle, attribute_name);
-        
-        ELOG("Attribute %s. Location: %d Type: %d", attribute_name, attribute_location, attribute_type);
-        
-        texturedMeshProgram.vertex_input_layout.attributes.push_back({ (u8)attribute_location, GetAttributeComponentCount(attribute_type) });
-    }
-
-    app->texturedMeshProgram_uTexture = glGetUniformLocation(texturedMeshProgram.handle, "uTexture");
-    app->texturedMeshProgram_uSkybox = glGetUniformLocation(texturedMeshProgram.handle, "uSkybox");
-
-    app->texturedMeshWithClippingProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH_WITH_CLIPPING");
-    Program& texturedMeshWithClippingProgram = app->programs[app->texturedMeshWithClippingProgramIdx];
-
-    GLint attribute_clipping_count;
-    glGetProgramiv(texturedMeshWithClippingProgram.handle, GL_ACTIVE_ATTRIBUTES, &attribute_clipping_count);
-
-    for (int i = 0; i < attribute_clipping_count; ++i)
-    {
-        GLchar attribute_name[32];
-        GLsizei attribute_length;
-        GLint attribute_size;
-        GLenum attribute_type;
-
-        glGetActiveAttrib(texturedMeshWithClippingProgram.handle, i, ARRAY_COUNT(attribute_name), &attribute_length, &attribute_size, &attribute_type, attribute_name);
-        GLint attribute_location = glGetAttribLocation(texturedMeshWithClippingProgram.handle, attribute_name);
-
-        ELOG("Attribute %s. Location: %d Type: %d", attribute_name, attribute_location, attribute_type);
-
-        texturedMeshWithClippingProgram.vertex_input_layout.attributes.push_back({ (u8)attribute_location, GetAttributeComponentCount(attribute_type) });
-    }
-
-    app->texturedMeshWithClippingProgram_uTexture = glGetUniformLocation(texturedMeshWithClippingProgram.handle, "uTexture");
-    app->texturedMeshWithClippingProgram_uSkybox = glGetUniformLocation(texturedMeshWithClippingProgram.handle, "uSkybox");
-    app->texturedMeshWithClippingProgram_uProjection = glGetUniformLocation(texturedMeshWithClippingProgram.handle, "uProjection");
-    app->texturedMeshWithClippingProgram_uView = glGetUniformLocation(texturedMeshWithClippingProgram.handle, "uView");
-    app->texturedMeshWithClippingProgram_uModel = glGetUniformLocation(texturedMeshWithClippingProgram.handle, "uModel");
-    app->texturedMeshWithClippingProgram_uClippingPlane = glGetUniformLocation(texturedMeshWithClippingProgram.handle, "uClippingPlane");
-
+    app->texturedMeshWithClippingProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH", ShaderFeature_Clipping);
     app->waterMeshProgramIdx = LoadProgram(app, "shaders.glsl", "WATER_MESH");
-    Program& waterMeshProgram = app->programs[app->waterMeshProgramIdx];
-
-    GLint attribute_water_count;
-    glGetProgramiv(waterMeshProgram.handle, GL_ACTIVE_ATTRIBUTES, &attribute_water_count);
-
-    for (int i = 0; i < attribute_water_count; ++i)
-    {
-        GLchar attribute_name[32];
-        GLsizei attribute_length;
-        GLint attribute_size;
-        GLenum attribute_type;
-
-        glGetActiveAttrib(waterMeshProgram.handle, i, ARRAY_COUNT(attribute_name), &attribute_length, &attribute_size, &attribute_type, attribute_name);
-        GLint attribute_location = glGetAttribLocation(waterMeshProgram.handle, attribute_name);
-
-        ELOG("Attribute %s. Location: %d Type: %d", attribute_name, attribute_location, attribute_type);
-
-        waterMeshProgram.vertex_input_layout.attributes.push_back({ (u8)attribute_location, GetAttributeComponentCount(attribute_type) });
-    }
 
-    app->waterMeshProgram_uProjection = glGetUniformLocation(waterMeshProgram.handle, "uProjection");
-    app->waterMeshProgram_uView = glGetUniformLocation(waterMeshProgram.handle, "uView");
-    app->waterMeshProgram_uModel = glGetUniformLocation(waterMeshProgram.handle, "uModel");
-    app->waterMeshProgram_uReflectionTexture = glGetUniformLocation(waterMeshProgram.handle, "uReflectionTexture");
-    app->waterMeshProgram_uRefractionTexture = glGetUniformLocation(waterMeshProgram.handle, "uRefractionTexture");
-    app->waterMeshProgram_uDudvMap = glGetUniformLocation(waterMeshProgram.handle, "uDudvMap");
-    app->waterMeshProgram_uMoveFactor = glGetUniformLocation(waterMeshProgram.handle, "uMoveFactor");
-    app->waterMeshProgram_uCameraPosition = glGetUniformLocation(waterMeshProgram.handle, "uCameraPosition");
-    
     /* --------- */
 
     /* DEFERRED RENDERING SHADERS */
 
     app->deferredGeometryPassProgramIdx = LoadProgram(app, "shaders.glsl", "DEFERRED_GEOMETRY_PASS");
-    Program& deferredGeometryPassProgram = app->programs[app->deferredGeometryPassProgramIdx];
-
-    GLint deferred_geometry_attribute_count;
-    glGetProgramiv(deferredGeometryPassProgram.handle, GL_ACTIVE_ATTRIBUTES, &deferred_geometry_attribute_count);
-
-    for (int i = 0; i < deferred_geometry_attribute_count; ++i)
-    {
-        GLchar attribute_name[32];
-        GLsizei attribute_length;
-        GLint attribute_size;
-        GLenum attribute_type;
-
-        glGetActiveAttrib(deferredGeometryPassProgram.handle, i, ARRAY_COUNT(attribute_name), &attribute_length, &attribute_size, &attribute_type, attribute_name);
-        GLint attribute_location = glGetAttribLocation(deferredGeometryPassProgram.handle, attribute_name);
-
-        ELOG("Attribute %s. Location: %d Type: %d", attribute_name, attribute_location, attribute_type);
-
-        deferredGeometryPassProgram.vertex_input_layout.attributes.push_back({ (u8)attribute_location, GetAttributeComponentCount(attribute_type) });
-    }
-
-    app->deferredGeometryProgram_uTexture = glGetUniformLocation(deferredGeometryPassProgram.handle, "uTexture");
-
     app->deferredLightingPassProgramIdx = LoadProgram(app, "shaders.glsl", "DEFERRED_LIGHTING_PASS");
-    Program& deferredLightingPassProgram = app->programs[app->deferredLightingPassProgramIdx];
-
-    GLint deferred_lighting_attribute_count;
-    glGetProgramiv(deferredLightingPassProgram.handle, GL_ACTIVE_ATTRIBUTES, &deferred_lighting_attribute_count);
-
-    for (int i = 0; i < deferred_lighting_attribute_count; ++i)
-    {
-        GLchar attribute_name[32];
-        GLsizei attribute_length;
-        GLint attribute_size;
-        GLenum attribute_type;
-
-        glGetActiveAttrib(deferredLightingPassProgram.handle, i, ARRAY_COUNT(attribute_name), &attribute_length, &attribute_size, &attribute_type, attribute_name);
-        GLint attribute_location = glGetAttribLocation(deferredLightingPassProgram.handle, attribute_name);
-
-        ELOG("Attribute %s. Location: %d Type: %d", attribute_name, attribute_location, attribute_type);
-
-        deferredLightingPassProgram.vertex_input_layout.attributes.push_back({ (u8)attribute_location, GetAttributeComponentCount(attribute_type) });
-    }
-
-    app->deferredLightingProgram_uGPosition = glGetUniformLocation(deferredLightingPassProgram.handle, "uGPosition");
-    app->deferredLightingProgram_uGNormals = glGetUniformLocation(deferredLightingPassProgram.handle, "uGNormals");
-    app->deferredLightingProgram_uGDiffuse = glGetUniformLocation(deferredLightingPassProgram.handle, "uGDiffuse");
-
     app->deferredLightProgramIdx = LoadProgram(app, "shaders.glsl", "LIGHT_VOLUME");
-    Program& deferredLightProgram = app->programs[app->deferredLightProgramIdx];
-
-    GLint deferred_light_attribute_count;
-    glGetProgramiv(deferredLightProgram.handle, GL_ACTIVE_ATTRIBUTES, &deferred_light_attribute_count);
-
-    for (int i = 0; i < deferred_light_attribute_count; ++i)
-    {
-        GLchar attribute_name[32];
-        GLsizei attribute_length;
-        GLint attribute_size;
-        GLenum attribute_type;
-
-        glGetActiveAttrib(deferredLightProgram.handle, i, ARRAY_COUNT(attribute_name), &attribute_length, &attribute_size, &attribute_type, attribute_name);
-        GLint attribute_location = glGetAttribLocation(deferredLightProgram.handle, attribute_name);
-
-        ELOG("Attribute %s. Location: %d Type: %d", attribute_name, attribute_location, attribute_type);
-
-        deferredLightProgram.vertex_input_layout.attributes.push_back({ (u8)attribute_location, GetAttributeComponentCount(attribute_type) });
-    }
-
-    app->deferredLightProgram_uProjection = glGetUniformLocation(deferredLightProgram.handle, "uProjection");
-    app->deferredLightProgram_uView = glGetUniformLocation(deferredLightProgram.handle, "uView");
-    app->deferredLightProgram_uModel = glGetUniformLocation(deferredLightProgram.handle, "uModel");
-    app->deferredLightProgram_uLightColor = glGetUniformLocation(deferredLightProgram.handle, "uLightColor");
-
     app->skyboxProgramIdx = LoadProgram(app, "shaders.glsl", "SKYBOX");
-    Program& skyboxProgram = app->programs[app->skyboxProgramIdx];
-
-    GLint skybox_attribute_count;
-    glGetProgramiv(skyboxProgram.handle, GL_ACTIVE_ATTRIBUTES, &skybox_attribute_count);
-
-    for (int i = 0; i < skybox_attribute_count; ++i)
-    {
-        GLchar attribute_name[32];
-        GLsizei attribute_length;
-        GLint attribute_size;
-        GLenum attribute_type;
 
-        glGetActiveAttrib(skyboxProgram.handle, i, ARRAY_COUNT(attribute_name), &attribute_length, &attribute_size, &attribute_type, attribute_name);
-        GLint attribute_location = glGetAttribLocation(skyboxProgram.handle, attribute_name);
-
-        ELOG("Attribute %s. Location: %d Type: %d", attribute_name, attribute_location, attribute_type);
+    /* --------- */
 
-        skyboxProgram.vertex_input_layout.attributes.push_back({ (u8)attribute_location, GetAttributeComponentCount(attribute_type) });
-    }
+    /* GPU CULLED VARIANTS (only compiled if used) */
 
-    app->skyboxProgram_uProjection = glGetUniformLocation(skyboxProgram.handle, "uProjection");
-    app->skyboxProgram_uView = glGetUniformLocation(skyboxProgram.handle, "uView");
-    app->skyboxProgram_uSkybox = glGetUniformLocation(skyboxProgram.handle, "uSkybox");
+    app->texturedMeshGpuDrivenProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH", ShaderFeature_GpuDriven);
+    app->texturedMeshWithClippingGpuDrivenProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH", ShaderFeature_Clipping | ShaderFeature_GpuDriven);
+    app->deferredGeometryPassGpuDrivenProgramIdx = LoadProgram(app, "shaders.glsl", "DEFERRED_GEOMETRY_PASS", ShaderFeature_GpuDriven);
 
     /* --------- */
 
+    InitShadowMaps(app);
+    InitPointShadows(app);
+    InitGpuCulling(app);
+    InitMeshLodSettings(app->lods);
+    InitTerrain(app, "Textures/heightmap.png");
+    InitWater(app);
+
     glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->max_uniform_buffer_size);
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniform_block_alignment);
 
@@ -979,6 +1370,7 @@ void Gui(App* app)
     ImGui::Begin("Info");
 
     ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
+    ImGui::Text("Render thread: %.2f ms", GetRenderThreadFrameMs());
 
     ImGui::Separator();
 
@@ -986,7 +1378,138 @@ void Gui(App* app)
     ImGui::Text("OpenGL renderer: %s", app->opengl_info.renderer);
     ImGui::Text("OpenGL vendor: %s", app->opengl_info.vendor);
     ImGui::Text("OpenGL GLSL version: %s", app->opengl_info.glsl_version);
+    if (app->bindlessTextures)
+        ImGui::Text("Material textures: bindless");
+    else
+        ImGui::Text("Material textures: %u texture arrays", (u32)app->textureArrays.size());
+
+    ImGui::Text("Resources: %u textures, %u materials, %u meshes, %u lights", app->textures.count,
+                app->materials.count, app->meshes.count, app->lights.count);
+    ImGui::Text("Resource pools: %.1f KB", (PoolMemorySize(app->textures) + PoolMemorySize(app->materials) +
+                PoolMemorySize(app->meshes) + PoolMemorySize(app->models) + PoolMemorySize(app->lights)) / 1024.0);
+
+    ImGui::Separator();
+
+    ImGui::Text("Entities: %u", app->scene.count);
+    static SceneBenchmark sceneBenchmark = {};
+    if (ImGui::Button("Benchmark transforms (100k entities)"))
+        sceneBenchmark = BenchmarkSceneTransforms(100000);
+    if (sceneBenchmark.entityCount)
+        ImGui::Text("All dirty: %.3f ms | 1%% dirty: %.3f ms | Idle: %.4f ms",
+                    sceneBenchmark.fullUpdateMs, sceneBenchmark.partialUpdateMs, sceneBenchmark.idleUpdateMs);
+    ImGui::Separator();
+
+    ImGui::Text("Worker threads: %u", GetWorkerThreadCount());
+    static JobScalingBenchmark jobBenchmark = {};
+    if (ImGui::Button("Benchmark job scaling"))
+        jobBenchmark = BenchmarkJobScaling();
+    for (u32 threads = 1; threads <= jobBenchmark.threadCountMax; ++threads)
+        ImGui::Text("%2u threads: %.2f ms (%.2fx)", threads, jobBenchmark.ms[threads], jobBenchmark.ms[1] / jobBenchmark.ms[threads]);
+    ImGui::Separator();
+
+    ImGui::Text("Frame arenas (high water / committed):");
+    FrameArenaStats arenaStats[MAX_FRAME_ARENA_STATS];
+    const u32 arenaCount = GetFrameArenaStats(arenaStats, MAX_FRAME_ARENA_STATS);
+    for (u32 i = 0; i < arenaCount; ++i)
+        ImGui::Text("  %-10s %8.1f KB / %8.1f KB", arenaStats[i].name,
+                    arenaStats[i].highWater / 1024.0, arenaStats[i].committed / 1024.0);
+    ImGui::Separator();
+
+    CascadedShadows& shadows = app->shadows;
+    ImGui::Text("Shadow cascades: %s", shadows.layeredRendering ? "layered, one instanced pass" : "one pass per cascade");
+    i32 cascadeCount = (i32)shadows.cascadeCount;
+    if (ImGui::SliderInt("Cascades", &cascadeCount, 2, SHADOW_MAX_CASCADES))
+        shadows.cascadeCount = (u32)cascadeCount;
+    ImGui::DragFloat("Shadow distance", &shadows.maxDistance, 1.0f, 10.0f, 1000.0f);
+    ImGui::SliderFloat("Split lambda", &shadows.splitLambda, 0.0f, 1.0f);
+    ImGui::Text("Static cascade redraws: %u", shadows.staticRedraws);
+
+    PointShadows& pointShadows = app->pointShadows;
+    i32 maxShadowedLights = (i32)pointShadows.maxLights;
+    if (ImGui::SliderInt("Shadowed point lights", &maxShadowedLights, 0, MAX_SHADOWED_POINT_LIGHTS))
+        pointShadows.maxLights = (u32)maxShadowedLights;
+    i32 faceBudget = (i32)pointShadows.faceBudget;
+    if (ImGui::SliderInt("Point shadow faces per frame", &faceBudget, 1, MAX_POINT_SHADOW_FACE_BUDGET))
+        pointShadows.faceBudget = (u32)faceBudget;
+    ImGui::Text("Point shadows: %u lights, %u faces drawn since startup", pointShadows.shadowedLightCount, pointShadows.facesRendered);
+    ImGui::Separator();
+
+    GpuCulling& culling = app->culling;
+    if (culling.supported)
+    {
+        ImGui::Checkbox("GPU culling", &culling.enabled);
+        if (culling.enabled)
+        {
+            ImGui::Checkbox("Occlusion culling (deferred)", &culling.occlusion);
+            ImGui::Text("Main pass culled instances: %u / %u", culling.culledInstances.load(), culling.testedInstances.load());
+            if (culling.meshletsSupported)
+            {
+                ImGui::Checkbox("Meshlet culling", &culling.meshlets);
+                ImGui::Text("Main pass culled meshlets: %u / %u (%zu meshlets)", culling.culledMeshlets.load(), culling.testedMeshlets.load(), app->meshlets.size());
+            }
+            if (!app->materialTexturesInTable)
+                ImGui::Text("Off: a material texture is not in the texture arrays");
+        }
+    }
+    else
+    {
+        ImGui::Text("GPU culling: not supported");
+    }
+    ImGui::Separator();
+
+    MeshLodSettings& lods = app->lods;
+    ImGui::Checkbox("Mesh LODs", &lods.enabled);
+    if (lods.enabled)
+    {
+        for (u32 i = 0; i < MESH_MAX_LODS - 1; ++i)
+        {
+            char label[32];
+            snprintf(label, sizeof(label), "LOD %u below screen size", i + 1);
+            ImGui::SliderFloat(label, &lods.screenSizes[i], 0.0f, 1.0f);
+        }
+        ImGui::SliderFloat("LOD hysteresis", &lods.hysteresis, 0.0f, 0.5f);
+    }
+    ImGui::Text("Triangles: %u (%u at full detail)", lods.triangles, lods.fullDetailTriangles);
+    ImGui::Separator();
+
+    Terrain& terrain = app->terrain;
+    if (terrain.loaded)
+    {
+        ImGui::Checkbox("Terrain", &terrain.enabled);
+        if (terrain.enabled)
+        {
+            if (terrain.tessellationSupported)
+                ImGui::Checkbox("Terrain tessellation", &terrain.tessellation);
+            ImGui::SliderFloat("Terrain LOD distance", &terrain.lodDistance, 2.0f * TERRAIN_GRID_SIZE * terrain.texelSize, 1000.0f);
+            ImGui::Text("Terrain nodes: %u, resident tiles: %u / %u, streamed: %u", terrain.drawnNodes, terrain.residentTiles, TERRAIN_TILE_CACHE, terrain.streamedTiles);
+        }
+    }
+    else
+    {
+        ImGui::Text("Terrain: no heightmap");
+    }
+    ImGui::Separator();
 
+    Water& water = app->water;
+    ImGui::Checkbox("Ocean waves", &water.enabled);
+    if (water.enabled)
+    {
+        ImGui::SliderFloat("Wind speed", &water.windSpeed, 1.0f, 30.0f);
+        ImGui::SliderAngle("Wind direction", &water.windAngle, -180.0f, 180.0f);
+        ImGui::SliderFloat("Choppiness", &water.choppiness, 0.0f, 2.5f);
+        ImGui::Text("Wave FFT: %ux%u, %.3f ms", WATER_FFT_SIZE, WATER_FFT_SIZE, water.fftMs);
+    }
+    const char* reflectionNames[WaterReflection_Count] = { "Planar", "Screen space" };
+    i32 reflection = (i32)water.reflection;
+    if (ImGui::Combo("Water reflection", &reflection, reflectionNames, WaterReflection_Count))
+        water.reflection = (WaterReflection)reflection;
+    if (water.reflection == WaterReflection_ScreenSpace)
+    {
+        ImGui::SliderFloat("Reflected ray length", &water.ssrMaxDistance, 10.0f, 1000.0f);
+        i32 ssrMaxSteps = (i32)water.ssrMaxSteps;
+        if (ImGui::SliderInt("Reflected ray steps", &ssrMaxSteps, 8, 256))
+            water.ssrMaxSteps = (u32)ssrMaxSteps;
+    }
     ImGui::Separator();
 
     ImGui::Checkbox("Enable Debug Group Mode", &app->debug_group_mode);
@@ -1043,7 +1566,13 @@ void Gui(App* app)
     }
     if (ImGui::TreeNode("Lights##2"))
     {
-        for (int i = 0; i < app->lights.size(); ++i) {
+        if (ImGui::Button("Add point light") && app->lights.count < MAX_LIGHTS)
+            AddPoolItem(app->lights, { LightType_Point, vec3(1.0f), vec3(0.0f, -1.0f, 0.0f), app->camera.position, 20.0f, 1.0f });
+
+        for (u32 i = 0; i < PoolSlotCount(app->lights); ++i) {
+            if (!IsPoolSlotAlive(app->lights, i))
+                continue;
+
             std::string type;
             if (app->lights[i].type == LightType::LightType_Directional) type = ("Directional Light " + std::to_string(i));
             else  type = ("Point Light " + std::to_string(i));
@@ -1085,6 +1614,11 @@ void Gui(App* app)
                     app->lights[i].radius = f2;
                 }
 
+                ImGui::Spacing();
+
+                if (ImGui::Button("Remove"))
+                    FreePoolItem(app->lights, GetPoolHandle(app->lights, i));
+
                 ImGui::TreePop();
             }
         }
@@ -1164,6 +1698,357 @@ void Gui(App* app)
     ImGui::End();
 }
 
+// Uploads the ranges of a CPU copy that differ from what the buffer already holds,
+// comparing blockSize bytes at a time and merging adjacent changed blocks into one call
+static void UploadChangedBlocks(GLenum target, u32 bufferOffset, const u8* data, u8* uploaded, u32 size, u32 blockSize)
+{
+    bool inRun = false;
+    u32 runBegin = 0;
+    u32 runEnd = 0;
+
+    for (u32 block = 0; block < size; block += blockSize)
+    {
+        const u32 blockEnd = glm::min(block + blockSize, size);
+        if (memcmp(data + block, uploaded + block, blockEnd - block) != 0)
+        {
+            if (!inRun)
+                runBegin = block;
+            runEnd = blockEnd;
+            inRun = true;
+        }
+        else if (inRun)
+        {
+            glBufferSubData(target, bufferOffset + runBegin, runEnd - runBegin, data + runBegin);
+            inRun = false;
+        }
+    }
+
+    if (inRun)
+        glBufferSubData(target, bufferOffset + runBegin, runEnd - runBegin, data + runBegin);
+
+    memcpy(uploaded, data, size);
+}
+
+// Game thread: lays out the uniform blob the render thread copies into the cbuffer
+static void PackFrameUniforms(App* app, FramePacket& packet)
+{
+    Scene& scene = app->scene;
+
+    // Globals live at the start of the buffer and every entity gets a fixed slice after them,
+    // so nothing moves between frames and unchanged data can stay where it is
+    app->localParamsBase = Align(GLOBAL_PARAMS_SIZE, app->uniform_block_alignment);
+    app->localParamsStride = Align(sizeof(glm::mat4), app->uniform_block_alignment);
+
+    // Global parameters. The render thread compares them per camera header and per light.
+    ASSERT(packet.lights.size() <= MAX_LIGHTS, "Too many lights for the GlobalParams block");
+    const u32 lightCount = glm::min((u32)packet.lights.size(), (u32)MAX_LIGHTS);
+
+    memset(packet.globalParams, 0, sizeof(packet.globalParams));
+    Buffer globalParamsBuffer = {};
+    globalParamsBuffer.data = packet.globalParams;
+    globalParamsBuffer.size = GLOBAL_PARAMS_SIZE;
+
+    PushMat4(globalParamsBuffer, app->projection * app->view);
+    PushVec3(globalParamsBuffer, app->camera.position);
+    PushUInt(globalParamsBuffer, lightCount);
+
+    for (u32 i = 0; i < lightCount; ++i)
+    {
+        const Light& light = packet.lights[i];
+
+        globalParamsBuffer.head = GLOBAL_PARAMS_LIGHTS_OFFSET + i * GLOBAL_PARAMS_LIGHT_SIZE;
+        PushUInt(globalParamsBuffer, light.type);
+        PushUInt(globalParamsBuffer, (u32)packet.pointShadows.lightSlots[i]);
+        PushVec3(globalParamsBuffer, light.color);
+        PushVec3(globalParamsBuffer, light.direction);
+        PushFloat(globalParamsBuffer, light.intensity);
+        PushVec3(globalParamsBuffer, light.position);
+        PushFloat(globalParamsBuffer, light.radius);
+    }
+
+    PackShadowParams(packet, globalParamsBuffer);
+
+    // Local parameters, only for the entities whose world matrix changed this frame
+    const u32 localParamsBase = app->localParamsBase;
+    const u32 localParamsStride = app->localParamsStride;
+
+    packet.localParams.clear();
+    packet.localParamsRanges.clear();
+
+    bool packAll = app->packedEntityCount != scene.count || scene.changedEntities.size() > scene.count / 4;
+    if (scene.count > app->localParamsCapacity)
+    {
+        // The render thread reallocates the cbuffer, so it needs every slice again
+        app->localParamsCapacity = scene.count + scene.count / 2;
+        packAll = true;
+    }
+    packet.cbufferSize = localParamsBase + app->localParamsCapacity * localParamsStride;
+
+    if (packAll)
+    {
+        // Enough changed that one upload of the whole range beats many small ones
+        packet.localParams.resize(scene.count * localParamsStride);
+        u8* localParamsData = packet.localParams.data();
+
+        ParallelFor(scene.count, 1024, [&](u32 begin, u32 end)
+        {
+            for (u32 entity = begin; entity < end; ++entity)
+            {
+                StoreMat4(scene.worldMatrix[entity], localParamsData + entity * localParamsStride);
+
+                scene.localParamsOffset[entity] = localParamsBase + entity * localParamsStride;
+                scene.localParamsSize[entity] = sizeof(glm::mat4);
+            }
+        });
+
+        if (scene.count > 0)
+            packet.localParamsRanges.push_back({ localParamsBase, 0, scene.count * localParamsStride });
+        app->packedEntityCount = scene.count;
+    }
+    else if (!scene.changedEntities.empty())
+    {
+        // Consecutive entities share one range, with the padding between slices included
+        std::vector<u32>& changed = scene.changedEntities;
+        std::sort(changed.begin(), changed.end());
+
+        for (u32 runBegin = 0; runBegin < changed.size();)
+        {
+            u32 runEnd = runBegin + 1;
+            while (runEnd < changed.size() && changed[runEnd] == changed[runEnd - 1] + 1)
+                runEnd++;
+
+            const u32 firstEntity = changed[runBegin];
+            const u32 runSize = (runEnd - runBegin - 1) * localParamsStride + sizeof(glm::mat4);
+            const u32 dataOffset = packet.localParams.size();
+            packet.localParams.resize(dataOffset + runSize);
+
+            for (u32 i = runBegin; i < runEnd; ++i)
+                StoreMat4(scene.worldMatrix[changed[i]], packet.localParams.data() + dataOffset + (i - runBegin) * localParamsStride);
+
+            packet.localParamsRanges.push_back({ localParamsBase + firstEntity * localParamsStride, dataOffset, runSize });
+            runBegin = runEnd;
+        }
+    }
+}
+
+glm::vec4 GetEntityWorldBounds(App* app, u32 entity)
+{
+    const Scene& scene = app->scene;
+    const Mesh& mesh = app->meshes[app->models[scene.modelIndex[entity]].mesh_index];
+    const glm::mat4& world = scene.worldMatrix[entity];
+
+    // The largest axis scale keeps the sphere around the mesh under non-uniform scaling
+    const f32 scale = glm::sqrt(glm::max(glm::max(glm::dot(world[0], world[0]), glm::dot(world[1], world[1])), glm::dot(world[2], world[2])));
+    return glm::vec4(glm::vec3(world * glm::vec4(mesh.bounds_center, 1.0f)), mesh.bounds_radius * scale);
+}
+
+// Game thread: records the entity draws of one pass
+static void RecordEntityDraws(App* app, const FramePacket& packet, u32 programIdx, bool setModelMatrix, CommandList& list)
+{
+    CmdBindProgram(list, programIdx);
+
+    for (const DrawItem& draw : packet.draws)
+    {
+        const Model& model = app->models[draw.modelIndex];
+        const Mesh& mesh = app->meshes[model.mesh_index];
+
+        CmdBindUBORange(list, BINDING(1), CommandBuffer_Constants, draw.localParamsOffset, draw.localParamsSize);
+        if (setModelMatrix)
+            CmdSetUniform(list, "uModel", draw.worldMatrix);
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            CmdBindVao(list, model.mesh_index, i);
+            RecordMaterial(app, model.material_index[i], list);
+
+            const SubmeshLod& lod = GetSubmeshLod(mesh.submeshes[i], draw.lod);
+            CmdDrawIndexed(list, lod.index_count, lod.index_offset);
+        }
+    }
+}
+
+void BuildFramePacket(App* app, FramePacket& packet)
+{
+    packet.displaySize = app->displaySize;
+    packet.deltaTime = app->deltaTime;
+    packet.mode = app->mode;
+    packet.debugGroupMode = app->debug_group_mode;
+
+    packet.camera = app->camera;
+    packet.view = app->view;
+    packet.projection = app->projection;
+
+    packet.waterCamera = app->camera;
+    packet.waterCamera.position.y = -packet.waterCamera.position.y;
+    packet.waterCamera.pitch = -packet.waterCamera.pitch;
+
+    // Live lights, packed
+    packet.lights.clear();
+    ForEachPoolItem(app->lights, [&](u32 /*lightIdx*/, const Light& light) { packet.lights.push_back(light); });
+
+    UpdateShadowCascades(app, packet);
+    UpdatePointShadows(app, packet);
+    PackFrameUniforms(app, packet);
+    UpdateTerrain(app, packet);
+    UpdateWater(app, packet);
+
+    // Every entity is a draw, culled per pass on the GPU when it can
+    Scene& scene = app->scene;
+    MeshLodSettings& lods = app->lods;
+    lods.triangles = 0;
+    lods.fullDetailTriangles = 0;
+
+    packet.draws.resize(scene.count);
+    for (u32 entity = 0; entity < scene.count; ++entity)
+    {
+        DrawItem& draw = packet.draws[entity];
+        draw.modelIndex = scene.modelIndex[entity];
+        draw.localParamsOffset = scene.localParamsOffset[entity];
+        draw.localParamsSize = scene.localParamsSize[entity];
+        draw.worldMatrix = scene.worldMatrix[entity];
+        draw.bounds = GetEntityWorldBounds(app, entity);
+        draw.isStatic = scene.isStatic[entity];
+
+        const Mesh& mesh = app->meshes[app->models[draw.modelIndex].mesh_index];
+        if (lods.enabled)
+            scene.lod[entity] = (u8)SelectLod(lods, ProjectedSphereSize(draw.bounds, packet.camera.position, packet.projection[1][1]), mesh.lod_count, scene.lod[entity]);
+        else
+            scene.lod[entity] = 0;
+        draw.lod = scene.lod[entity];
+
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            lods.triangles += GetSubmeshLod(submesh, draw.lod).index_count / 3;
+            lods.fullDetailTriangles += submesh.lods[0].index_count / 3;
+        }
+    }
+    packet.lods = lods;
+
+    BuildGpuCullingFrame(app, packet);
+
+    struct PassRecording
+    {
+        u32      programIdx;
+        bool     setModelMatrix; // The water clipping passes take the world matrix as a plain uniform
+        CullPass cullPass;       // Whose culled batches the pass draws on the GPU
+        bool     enabled;
+    };
+
+    const bool gpuDriven = packet.culling.enabled;
+    const bool gpuDrivenShadows = packet.culling.shadowCasters;
+    const PassRecording passes[RenderPass_Count] = {
+        { gpuDriven ? app->texturedMeshWithClippingGpuDrivenProgramIdx : app->texturedMeshWithClippingProgramIdx, true, CullPass_WaterReflection, packet.mode == Mode_Count && packet.water.reflection == WaterReflection_Planar },
+        { gpuDriven ? app->texturedMeshWithClippingGpuDrivenProgramIdx : app->texturedMeshWithClippingProgramIdx, true, CullPass_WaterRefraction, packet.mode == Mode_Count },
+        { gpuDriven ? app->texturedMeshGpuDrivenProgramIdx : app->texturedMeshProgramIdx, false, CullPass_Main, packet.mode == Mode_Count },
+        { gpuDriven ? app->deferredGeometryPassGpuDrivenProgramIdx : app->deferredGeometryPassProgramIdx, false, CullPass_Main, packet.mode == Mode_Deferred },
+        { gpuDrivenShadows ? app->shadows.gpuDrivenProgramIdx : app->shadows.programIdx, false, CullPass_ShadowStatic, packet.shadows.cascadeCount > 0 },
+        { gpuDrivenShadows ? app->shadows.gpuDrivenProgramIdx : app->shadows.programIdx, false, CullPass_ShadowMovable, packet.shadows.cascadeCount > 0 },
+        { app->pointShadows.programIdx, false, CullPass_Count, packet.pointShadows.faceCount > 0 },
+    };
+
+    for (u32 pass = 0; pass < RenderPass_Count; ++pass)
+        packet.passProgramIdx[pass] = passes[pass].programIdx;
+
+    // One pass per job, each into its own list
+    ParallelFor(RenderPass_Count, 1, [&](u32 begin, u32 end)
+    {
+        for (u32 pass = begin; pass < end; ++pass)
+        {
+            ResetCommandList(packet.passCommands[pass]);
+            if (!passes[pass].enabled)
+                continue;
+
+            CommandList& list = packet.passCommands[pass];
+            if (pass == RenderPass_ShadowStatic || pass == RenderPass_ShadowMovable)
+            {
+                RecordShadowCasters(app, packet, pass == RenderPass_ShadowStatic, list);
+            }
+            else if (pass == RenderPass_PointShadows)
+            {
+                RecordPointShadowCasters(app, packet, list);
+            }
+            else if (gpuDriven)
+            {
+                // One multi draw per group instead of the draws of every entity
+                CmdBindProgram(list, passes[pass].programIdx);
+                RecordCulledDraws(packet, passes[pass].cullPass, list);
+            }
+            else
+            {
+                RecordEntityDraws(app, packet, passes[pass].programIdx, passes[pass].setModelMatrix, list);
+            }
+        }
+    });
+}
+
+// Render thread: copies the packet uniform blob into the cbuffer
+static void UploadFrameUniforms(App* app, const FramePacket& packet)
+{
+    if (packet.cbufferSize > app->cbuffer.size)
+    {
+        // The game thread packed every entity on the frame it asked for more room
+        glDeleteBuffers(1, &app->cbuffer.handle);
+        app->cbuffer = CreateConstantBuffer(packet.cbufferSize);
+        app->globalParamsUploaded = false;
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, app->cbuffer.handle);
+
+    app->globalParamsOffset = 0;
+    app->globalParamsSize = GLOBAL_PARAMS_SIZE;
+
+    if (!app->globalParamsUploaded)
+    {
+        glBufferSubData(GL_UNIFORM_BUFFER, app->globalParamsOffset, GLOBAL_PARAMS_SIZE, packet.globalParams);
+        memcpy(app->uploadedGlobalParams, packet.globalParams, GLOBAL_PARAMS_SIZE);
+        app->globalParamsUploaded = true;
+    }
+    else
+    {
+        // The camera header is one block, then one block per light. The shadow cascades
+        // follow the lights and are compared in blocks of the same size.
+        static_assert(GLOBAL_PARAMS_LIGHTS_OFFSET % 16 == 0 && GLOBAL_PARAMS_LIGHT_SIZE % 16 == 0, "Blocks must stay vec4 aligned");
+        UploadChangedBlocks(GL_UNIFORM_BUFFER, app->globalParamsOffset, packet.globalParams, app->uploadedGlobalParams, GLOBAL_PARAMS_LIGHTS_OFFSET, GLOBAL_PARAMS_LIGHTS_OFFSET);
+        UploadChangedBlocks(GL_UNIFORM_BUFFER, app->globalParamsOffset + GLOBAL_PARAMS_LIGHTS_OFFSET,
+                            packet.globalParams + GLOBAL_PARAMS_LIGHTS_OFFSET, app->uploadedGlobalParams + GLOBAL_PARAMS_LIGHTS_OFFSET,
+                            GLOBAL_PARAMS_SIZE - GLOBAL_PARAMS_LIGHTS_OFFSET, GLOBAL_PARAMS_LIGHT_SIZE);
+    }
+
+    for (const UniformRange& range : packet.localParamsRanges)
+        glBufferSubData(GL_UNIFORM_BUFFER, range.bufferOffset, range.size, packet.localParams.data() + range.dataOffset);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void RenderFrame(App* app, const FramePacket& packet)
+{
+    UploadFrameUniforms(app, packet);
+
+    // Hot reload the programs built from any source file that changed
+    if (PollFileWatcher(app->fileWatcher))
+    {
+        for (u32 fileIdx = 0; fileIdx < app->fileWatcher.files.size(); ++fileIdx)
+        {
+            if (!ConsumeFileChange(app->fileWatcher, fileIdx))
+                continue;
+
+            for (u32 programIdx = 0; programIdx < app->programs.size(); ++programIdx)
+            {
+                // Variants not used yet will compile the latest source anyway
+                const Program& program = app->programs[programIdx];
+                if (program.sourceFile == fileIdx && program.handle != 0)
+                    BeginProgramReload(app, programIdx);
+            }
+        }
+    }
+
+    UpdateProgramReloads(app);
+
+    Render(app, packet);
+
+    app->renderFrameIndex++;
+}
+
 void Update(App* app)
 {
     // TODO: Handle app->input keyboard/mouse here
@@ -1211,76 +2096,23 @@ void Update(App* app)
     app->view = app->camera.GetViewMatrix();
     app->projection = app->camera.GetProjectionMatrix();
 
-    glBindBuffer(GL_UNIFORM_BUFFER, app->cbuffer.handle);
-    app->cbuffer.data = (u8*)glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-    app->cbuffer.head = 0;
-
-    // Global parameters
-    app->globalParamsOffset = app->cbuffer.head;
-
-    PushVec3(app->cbuffer, app->camera.position);
-    PushUInt(app->cbuffer, app->lights.size());
-
-    for (u32 i = 0; i < app->lights.size(); ++i)
-    {
-        AlignHead(app->cbuffer, sizeof(vec4));
-
-        Light& light = app->lights[i];
-
-        PushUInt(app->cbuffer, light.type);
-        PushVec3(app->cbuffer, light.color);
-        PushVec3(app->cbuffer, light.direction);
-        PushFloat(app->cbuffer, light.intensity);
-        PushVec3(app->cbuffer, light.position);
-        PushFloat(app->cbuffer, light.radius);
-    }
-
-    app->globalParamsSize = app->cbuffer.head - app->globalParamsOffset;
-
-    // Local parameters
-    for (u32 i = 0; i < app->entities.size(); ++i)
-    {
-        AlignHead(app->cbuffer, app->uniform_block_alignment);
-
-        Entity& entity = app->entities[i];
-
-        glm::mat4 world = entity.worldMatrix;
-        glm::mat4 worldViewProjectionMatrix = app->projection * app->view * world;
-
-        entity.localParamsOffset = app->cbuffer.head;
-
-        PushMat4(app->cbuffer, world);
-        PushMat4(app->cbuffer, worldViewProjectionMatrix);
-
-        entity.localParamsSize = app->cbuffer.head - entity.localParamsOffset;
-    }
-    
-    glUnmapBuffer(GL_UNIFORM_BUFFER);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-    // Check timestamp & reload
-    for (u64 i = 0; i < app->programs.size(); ++i)
-    {
-        Program& program = app->programs[i];
-        u64 currentTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
-
-        if (currentTimestamp > program.lastWriteTimestamp)
-        {
-            glDeleteProgram(program.handle);
-            String programSource = ReadTextFile(program.filepath.c_str());
-            const char* programName = program.programName.c_str();
-            program.handle = CreateProgramFromSource(programSource, programName);
-            program.lastWriteTimestamp = currentTimestamp;
-        }
-    }
+    UpdateSceneTransforms(app->scene);
 }
 
-void Render(App* app)
+void Render(App* app, const FramePacket& packet)
 {
-    if (app->debug_group_mode)
+    if (packet.debugGroupMode)
         glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Shaded Model");
 
-    switch (app->mode)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(0), app->materialTable.handle);
+
+    CullGpuDraws(app, packet);
+
+    RenderShadowMaps(app, packet);
+    RenderPointShadows(app, packet);
+    PrepareTerrain(app, packet);
+
+    switch (packet.mode)
     {
         case Mode_TexturedQuad:
         {
@@ -1298,18 +2130,18 @@ void Render(App* app)
             glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+            glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
 
             glEnable(GL_DEPTH_TEST);
 
             glEnable(GL_BLEND);
             glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-            Program& programTexturedGeometry = app->programs[app->texturedGeometryProgramIdx];
+            Program& programTexturedGeometry = GetProgram(app, app->texturedGeometryProgramIdx);
             glUseProgram(programTexturedGeometry.handle);
             glBindVertexArray(app->vao);
 
-            glUniform1i(app->programUniformTexture, 0);
+            SetUniform(programTexturedGeometry, "uTexture", 0);
             glActiveTexture(GL_TEXTURE0);
             GLuint textureHandle = app->textures[app->diceTexIdx].handle;
             glBindTexture(GL_TEXTURE_2D, textureHandle);
@@ -1323,108 +2155,91 @@ void Render(App* app)
 
         case Mode_Count:
         {
-            /* Water reflection ------------------------------- */
-            glBindFramebuffer(GL_FRAMEBUFFER, app->waterReflectionFrameBuffer);
-
             GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0 };
-            glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
+            Camera waterCamera = packet.waterCamera;
+            Program& skyboxProgram = GetProgram(app, app->skyboxProgramIdx);
+            glm::mat4 view_no_translation = glm::mat4(glm::mat3(packet.view)); // No translation
 
-            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-            glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-
-            glEnable(GL_DEPTH_TEST);
-
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            // Screen-space reflections trace the forward pass instead, see water.h
+            if (packet.water.reflection == WaterReflection_Planar)
+            {
+                /* Water reflection ------------------------------- */
+                glBindFramebuffer(GL_FRAMEBUFFER, app->waterReflectionFrameBuffer);
 
-            glEnable(GL_CLIP_DISTANCE0);
+                glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
 
-            Program& texturedMeshWithClippingProgram = app->programs[app->texturedMeshWithClippingProgramIdx];
-            glUseProgram(texturedMeshWithClippingProgram.handle);
+                glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            Camera reflectionCamera = app->camera;
-            reflectionCamera.position.y = -reflectionCamera.position.y;
-            reflectionCamera.pitch = -reflectionCamera.pitch;
+                glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
 
-            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+                glEnable(GL_DEPTH_TEST);
 
-            glUniform4i(app->texturedMeshWithClippingProgram_uClippingPlane, 0, 1, 0, 0);
-            
-            for (const Entity& entity : app->entities)
-            {
-                Model& model = app->models[entity.modelIndex];
-                Mesh& mesh = app->meshes[model.mesh_index];
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, entity.localParamsOffset, entity.localParamsSize);
+                glEnable(GL_CLIP_DISTANCE0);
 
-                glUniformMatrix4fv(app->texturedMeshWithClippingProgram_uProjection, 1, GL_FALSE, &reflectionCamera.GetProjectionMatrix()[0][0]);
-                glUniformMatrix4fv(app->texturedMeshWithClippingProgram_uView, 1, GL_FALSE, &reflectionCamera.GetViewMatrix()[0][0]);
-                glUniformMatrix4fv(app->texturedMeshWithClippingProgram_uModel, 1, GL_FALSE, &entity.worldMatrix[0][0]);
+                Program& texturedMeshWithClippingProgram = GetProgram(app, packet.passProgramIdx[RenderPass_WaterReflection]);
+                glUseProgram(texturedMeshWithClippingProgram.handle);
 
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-                {
-                    GLuint vao = FindVao(mesh, i, texturedMeshWithClippingProgram);
-                    glBindVertexArray(vao);
+                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
 
-                    u32 submesh_material_index = model.material_index[i];
-                    Material& submesh_material = app->materials[submesh_material_index];
+                SetUniform(texturedMeshWithClippingProgram, "uClippingPlane", vec4(0.0f, 1.0f, 0.0f, 0.0f));
 
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submesh_material.albedo_texture_index].handle);
-                    glUniform1i(app->texturedMeshWithClippingProgram_uTexture, 0);
+                SetUniform(texturedMeshWithClippingProgram, "uTexture", 0);
+                BindMaterialTextureArrays(app, texturedMeshWithClippingProgram);
 
-                    glActiveTexture(GL_TEXTURE1);
-                    glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap);
-                    glUniform1i(app->texturedMeshWithClippingProgram_uSkybox, 1);
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap);
+                SetUniform(texturedMeshWithClippingProgram, "uSkybox", 1);
+                SetUniform(texturedMeshWithClippingProgram, "uShadowMap", SHADOW_MAP_UNIT);
+                SetUniform(texturedMeshWithClippingProgram, "uPointShadowAtlas", POINT_SHADOW_ATLAS_UNIT);
 
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.index_offset);
+                SetUniform(texturedMeshWithClippingProgram, "uProjection", waterCamera.GetProjectionMatrix());
+                SetUniform(texturedMeshWithClippingProgram, "uView", waterCamera.GetViewMatrix());
 
-                    glBindVertexArray(0);
-                }
-            }
+                ReplayCommandList(app, packet.passCommands[RenderPass_WaterReflection]);
+                RenderTerrain(app, packet, TerrainPass_WaterReflection);
 
-            glUseProgram(0);
+                glUseProgram(0);
 
-            glDisable(GL_CLIP_DISTANCE0);
+                glDisable(GL_CLIP_DISTANCE0);
 
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-            /* Skybox */
-            glBindFramebuffer(GL_FRAMEBUFFER, app->waterReflectionFrameBuffer);
+                /* Skybox */
+                glBindFramebuffer(GL_FRAMEBUFFER, app->waterReflectionFrameBuffer);
 
-            Program& skyboxProgram = app->programs[app->skyboxProgramIdx];
-            glUseProgram(skyboxProgram.handle);
+                glUseProgram(skyboxProgram.handle);
 
-            glEnable(GL_DEPTH_TEST);
-            glDepthFunc(GL_LEQUAL);
-            glDepthMask(GL_FALSE);
+                glEnable(GL_DEPTH_TEST);
+                glDepthFunc(GL_LEQUAL);
+                glDepthMask(GL_FALSE);
 
-            glDisable(GL_BLEND);
+                glDisable(GL_BLEND);
 
-            glUniformMatrix4fv(app->skyboxProgram_uProjection, 1, GL_FALSE, &app->projection[0][0]);
-            glm::mat4 view_no_translation = glm::mat4(glm::mat3(app->view)); // No translation
-            glUniformMatrix4fv(app->skyboxProgram_uView, 1, GL_FALSE, &view_no_translation[0][0]);
+                SetUniform(skyboxProgram, "uProjection", packet.projection);
+                SetUniform(skyboxProgram, "uView", view_no_translation);
 
-            glUniform1i(app->skyboxProgram_uSkybox, 4);
+                SetUniform(skyboxProgram, "uSkybox", 4);
 
-            glBindVertexArray(app->skybox_vao);
+                glBindVertexArray(app->skybox_vao);
 
-            glActiveTexture(GL_TEXTURE4);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap);
+                glActiveTexture(GL_TEXTURE4);
+                glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap);
 
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+                glDrawArrays(GL_TRIANGLES, 0, 36);
 
-            glBindVertexArray(0);
+                glBindVertexArray(0);
 
-            glDepthMask(GL_TRUE);
-            glDepthFunc(GL_LESS);
+                glDepthMask(GL_TRUE);
+                glDepthFunc(GL_LESS);
 
-            glUseProgram(0);
+                glUseProgram(0);
 
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            }
 
             /* Water refraction ------------------------------- */
 
@@ -1435,7 +2250,7 @@ void Render(App* app)
             glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+            glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
 
             glEnable(GL_DEPTH_TEST);
 
@@ -1444,49 +2259,27 @@ void Render(App* app)
 
             glEnable(GL_CLIP_DISTANCE0);
 
+            Program& texturedMeshWithClippingProgram = GetProgram(app, packet.passProgramIdx[RenderPass_WaterRefraction]);
             glUseProgram(texturedMeshWithClippingProgram.handle);
 
-            Camera refractionCamera = app->camera;
-            refractionCamera.position.y = -refractionCamera.position.y;
-            refractionCamera.pitch = -refractionCamera.pitch;
-
             glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
 
-            glUniform4i(app->texturedMeshWithClippingProgram_uClippingPlane, 0, -1, 0, 0);
-
-            for (const Entity& entity : app->entities)
-            {
-                Model& model = app->models[entity.modelIndex];
-                Mesh& mesh = app->meshes[model.mesh_index];
+            SetUniform(texturedMeshWithClippingProgram, "uClippingPlane", vec4(0.0f, -1.0f, 0.0f, 0.0f));
 
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, entity.localParamsOffset, entity.localParamsSize);
+            SetUniform(texturedMeshWithClippingProgram, "uTexture", 0);
+            BindMaterialTextureArrays(app, texturedMeshWithClippingProgram);
 
-                glUniformMatrix4fv(app->texturedMeshWithClippingProgram_uProjection, 1, GL_FALSE, &refractionCamera.GetProjectionMatrix()[0][0]);
-                glUniformMatrix4fv(app->texturedMeshWithClippingProgram_uView, 1, GL_FALSE, &refractionCamera.GetViewMatrix()[0][0]);
-                glUniformMatrix4fv(app->texturedMeshWithClippingProgram_uModel, 1, GL_FALSE, &entity.worldMatrix[0][0]);
-
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-                {
-                    GLuint vao = FindVao(mesh, i, texturedMeshWithClippingProgram);
-                    glBindVertexArray(vao);
-
-                    u32 submesh_material_index = model.material_index[i];
-                    Material& submesh_material = app->materials[submesh_material_index];
-
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submesh_material.albedo_texture_index].handle);
-                    glUniform1i(app->texturedMeshWithClippingProgram_uTexture, 0);
-
-                    glActiveTexture(GL_TEXTURE1);
-                    glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap);
-                    glUniform1i(app->texturedMeshWithClippingProgram_uSkybox, 1);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap);
+            SetUniform(texturedMeshWithClippingProgram, "uSkybox", 1);
+            SetUniform(texturedMeshWithClippingProgram, "uShadowMap", SHADOW_MAP_UNIT);
+            SetUniform(texturedMeshWithClippingProgram, "uPointShadowAtlas", POINT_SHADOW_ATLAS_UNIT);
 
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.index_offset);
+            SetUniform(texturedMeshWithClippingProgram, "uProjection", waterCamera.GetProjectionMatrix());
+            SetUniform(texturedMeshWithClippingProgram, "uView", waterCamera.GetViewMatrix());
 
-                    glBindVertexArray(0);
-                }
-            }
+            ReplayCommandList(app, packet.passCommands[RenderPass_WaterRefraction]);
+            RenderTerrain(app, packet, TerrainPass_WaterRefraction);
 
             glUseProgram(0);
 
@@ -1502,47 +2295,29 @@ void Render(App* app)
             glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+            glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
 
             glEnable(GL_DEPTH_TEST);
 
             glEnable(GL_BLEND);
             glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-            Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
+            Program& texturedMeshProgram = GetProgram(app, packet.passProgramIdx[RenderPass_Forward]);
             glUseProgram(texturedMeshProgram.handle);
             
             glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
 
-            for (const Entity& entity : app->entities)
-            {
-                Model& model = app->models[entity.modelIndex];
-                Mesh& mesh = app->meshes[model.mesh_index];
+            SetUniform(texturedMeshProgram, "uTexture", 0);
+            BindMaterialTextureArrays(app, texturedMeshProgram);
 
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, entity.localParamsOffset, entity.localParamsSize);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap);
+            SetUniform(texturedMeshProgram, "uSkybox", 1);
+            SetUniform(texturedMeshProgram, "uShadowMap", SHADOW_MAP_UNIT);
+            SetUniform(texturedMeshProgram, "uPointShadowAtlas", POINT_SHADOW_ATLAS_UNIT);
 
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-                {
-                    GLuint vao = FindVao(mesh, i, texturedMeshProgram);
-                    glBindVertexArray(vao);
-
-                    u32 submesh_material_index = model.material_index[i];
-                    Material& submesh_material = app->materials[submesh_material_index];
-                    
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submesh_material.albedo_texture_index].handle);
-                    glUniform1i(app->texturedMeshProgram_uTexture, 0);
-
-                    glActiveTexture(GL_TEXTURE1);
-                    glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap);
-                    glUniform1i(app->texturedMeshProgram_uSkybox, 1);
-
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.index_offset);
-                    
-                    glBindVertexArray(0);
-                }
-            }
+            ReplayCommandList(app, packet.passCommands[RenderPass_Forward]);
+            RenderTerrain(app, packet, TerrainPass_Forward);
 
             glUseProgram(0);
 
@@ -1551,7 +2326,7 @@ void Render(App* app)
             /* Skybox */
             glBindFramebuffer(GL_FRAMEBUFFER, app->forwardFrameBuffer);
 
-            //Program& skyboxProgram = app->programs[app->skyboxProgramIdx];
+            //Program& skyboxProgram = GetProgram(app, app->skyboxProgramIdx);
             glUseProgram(skyboxProgram.handle);
 
             glEnable(GL_DEPTH_TEST);
@@ -1560,11 +2335,10 @@ void Render(App* app)
 
             glDisable(GL_BLEND);
 
-            glUniformMatrix4fv(app->skyboxProgram_uProjection, 1, GL_FALSE, &app->projection[0][0]);
-            /*glm::mat4 */view_no_translation = glm::mat4(glm::mat3(app->view)); // No translation
-            glUniformMatrix4fv(app->skyboxProgram_uView, 1, GL_FALSE, &view_no_translation[0][0]);
+            SetUniform(skyboxProgram, "uProjection", packet.projection);
+            SetUniform(skyboxProgram, "uView", view_no_translation);
 
-            glUniform1i(app->skyboxProgram_uSkybox, 4);
+            SetUniform(skyboxProgram, "uSkybox", 4);
 
             glBindVertexArray(app->skybox_vao);
 
@@ -1584,46 +2358,9 @@ void Render(App* app)
 
             // Water
 
-            Program& waterMeshProgram = app->programs[app->waterMeshProgramIdx];
-            glUseProgram(waterMeshProgram.handle);
-
             glBindFramebuffer(GL_FRAMEBUFFER, app->forwardFrameBuffer);
 
-            glUniformMatrix4fv(app->waterMeshProgram_uProjection, 1, GL_FALSE, &app->projection[0][0]);
-            glUniformMatrix4fv(app->waterMeshProgram_uView, 1, GL_FALSE, &app->view[0][0]);
-
-            glActiveTexture(GL_TEXTURE10);
-            glBindTexture(GL_TEXTURE_2D, app->waterReflectionColorAttachment);
-            glUniform1i(app->waterMeshProgram_uReflectionTexture, 10);
-
-            glActiveTexture(GL_TEXTURE11);
-            glBindTexture(GL_TEXTURE_2D, app->waterRefractionColorAttachment);
-            glUniform1i(app->waterMeshProgram_uRefractionTexture, 11);
-
-            glActiveTexture(GL_TEXTURE12);
-            GLuint dudvMapTexHandle = app->textures[app->dudvMapIdx].handle;
-            glBindTexture(GL_TEXTURE_2D, dudvMapTexHandle);
-            glUniform1i(app->waterMeshProgram_uDudvMap, 12);
-
-            static float wave_length = 0.03f;
-            static float moveFactor = 0.0f;
-            moveFactor += wave_length * app->deltaTime;
-            moveFactor = fmod(moveFactor, 1);
-
-            glUniform1f(app->waterMeshProgram_uMoveFactor, moveFactor);
-
-            glUniform3f(app->waterMeshProgram_uCameraPosition, app->camera.position.x, app->camera.position.y, app->camera.position.z);
-
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, vec3(0.0f));
-            model = glm::rotate(model, glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f));
-            model = glm::scale(model, glm::vec3(100.0f));
-
-            glUniformMatrix4fv(app->waterMeshProgram_uModel, 1, GL_FALSE, &model[0][0]);
-
-            app->RenderQuad(app->quad_vao, 4);
-
-            glUseProgram(0);
+            RenderWater(app, packet);
 
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
@@ -1642,7 +2379,7 @@ void Render(App* app)
             GLenum drawBuffersGBuffer[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
             glDrawBuffers(ARRAY_COUNT(drawBuffersGBuffer), drawBuffersGBuffer);
 
-            glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+            glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
 
             glEnable(GL_DEPTH_TEST);
 
@@ -1651,39 +2388,23 @@ void Render(App* app)
 
             glDepthMask(GL_TRUE);
 
-            Program& deferredGeometryPassProgram = app->programs[app->deferredGeometryPassProgramIdx];
+            Program& deferredGeometryPassProgram = GetProgram(app, packet.passProgramIdx[RenderPass_DeferredGeometry]);
             glUseProgram(deferredGeometryPassProgram.handle);
 
-            for (const Entity& entity : app->entities)
-            {
-                Model& model = app->models[entity.modelIndex];
-                Mesh& mesh = app->meshes[model.mesh_index];
-
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, entity.localParamsOffset, entity.localParamsSize);
-
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-                {
-                    GLuint vao = FindVao(mesh, i, deferredGeometryPassProgram);
-                    glBindVertexArray(vao);
-
-                    u32 submesh_material_index = model.material_index[i];
-                    Material& submesh_material = app->materials[submesh_material_index];
+            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
 
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submesh_material.albedo_texture_index].handle);
-                    glUniform1i(app->deferredGeometryProgram_uTexture, 0);
+            SetUniform(deferredGeometryPassProgram, "uTexture", 0);
+            BindMaterialTextureArrays(app, deferredGeometryPassProgram);
 
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.index_offset);
-
-                    glBindVertexArray(0);
-                }
-            }
+            ReplayCommandList(app, packet.passCommands[RenderPass_DeferredGeometry]);
+            RenderTerrain(app, packet, TerrainPass_DeferredGeometry);
 
             glUseProgram(0);
 
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+            BuildDepthPyramid(app, packet, app->depthAttachmentHandle);
+
             /* Second pass (lighting) */
 
             glBindFramebuffer(GL_FRAMEBUFFER, app->fBuffer);
@@ -1699,12 +2420,14 @@ void Render(App* app)
 
             //glDepthMask(GL_FALSE);
 
-            Program& deferredLightingPassProgram = app->programs[app->deferredLightingPassProgramIdx];
+            Program& deferredLightingPassProgram = GetProgram(app, app->deferredLightingPassProgramIdx);
             glUseProgram(deferredLightingPassProgram.handle);
 
-            glUniform1i(app->deferredLightingProgram_uGPosition, 1);
-            glUniform1i(app->deferredLightingProgram_uGNormals, 2);
-            glUniform1i(app->deferredLightingProgram_uGDiffuse, 3);
+            SetUniform(deferredLightingPassProgram, "uGPosition", 1);
+            SetUniform(deferredLightingPassProgram, "uGNormals", 2);
+            SetUniform(deferredLightingPassProgram, "uGDiffuse", 3);
+            SetUniform(deferredLightingPassProgram, "uShadowMap", SHADOW_MAP_UNIT);
+            SetUniform(deferredLightingPassProgram, "uPointShadowAtlas", POINT_SHADOW_ATLAS_UNIT);
 
             glActiveTexture(GL_TEXTURE1);
             glBindTexture(GL_TEXTURE_2D, app->positionAttachmentHandle);
@@ -1722,29 +2445,35 @@ void Render(App* app)
             glBindFramebuffer(GL_READ_FRAMEBUFFER, app->gBuffer);
             glBindFramebuffer(GL_DRAW_FRAMEBUFFER, app->fBuffer);
 
-            glBlitFramebuffer(0, 0, app->displaySize.x, app->displaySize.x, 0, 0, app->displaySize.x, app->displaySize.x, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBlitFramebuffer(0, 0, packet.displaySize.x, packet.displaySize.x, 0, 0, packet.displaySize.x, packet.displaySize.x, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
 
             glUseProgram(0);
 
             // Render lights
-            Program& deferredLightProgram = app->programs[app->deferredLightProgramIdx];
+            Program& deferredLightProgram = GetProgram(app, app->deferredLightProgramIdx);
             glUseProgram(deferredLightProgram.handle);
 
-            glUniformMatrix4fv(app->deferredLightProgram_uProjection, 1, GL_FALSE, &app->projection[0][0]);
-            glUniformMatrix4fv(app->deferredLightProgram_uView, 1, GL_FALSE, &app->view[0][0]);
+            SetUniform(deferredLightProgram, "uProjection", packet.projection);
+            SetUniform(deferredLightProgram, "uView", packet.view);
 
-            for (const Light& light : app->lights)
+            for (const Light& light : packet.lights)
             {
                 glm::mat4 model = glm::mat4(1.0f);
                 model = glm::translate(model, light.position);
                 model = glm::scale(model, glm::vec3(2.0f));
 
-                glUniformMatrix4fv(app->deferredLightProgram_uModel, 1, GL_FALSE, &model[0][0]);
-                glUniform3f(app->deferredLightProgram_uLightColor, light.color.r, light.color.g, light.color.b);
+                SetUniform(deferredLightProgram, "uModel", model);
+                SetUniform(deferredLightProgram, "uLightColor", light.color);
 
                 switch (light.type)
                 {
-                case LightType_Point: app->RenderSphere(app->sphere_vao, app->sphere_index_count); break;
+                case LightType_Point:
+                {
+                    // The markers keep no level from frame to frame, so they pick theirs as if coming from full detail
+                    const f32 screenSize = ProjectedSphereSize(glm::vec4(light.position, 2.0f), packet.camera.position, packet.projection[1][1]);
+                    app->RenderSphere(packet.lods.enabled ? SelectLod(packet.lods, screenSize, MESH_MAX_LODS, 0) : 0);
+                }
+                break;
                 case LightType_Directional: app->RenderQuad(app->quad_vao, 4); break;
 
                 default: break;
@@ -1761,7 +2490,7 @@ void Render(App* app)
         {} break;
     }
 
-    if (app->debug_group_mode)
+    if (packet.debugGroupMode)
         glPopDebugGroup();
 }
 
@@ -1770,7 +2499,7 @@ GLuint FindVao(Mesh& mesh, u32 submesh_index, const Program& program)
     Submesh& submesh = mesh.submeshes[submesh_index];
 
     // Try to find a vao for this submesh/program
-    for (u32 i = 0; i < (u32)submesh.vaos.size(); ++i)
+    for (u32 i = 0; i < submesh.vao_count; ++i)
     {
         if (submesh.vaos[i].program_handle == program.handle)
         {
@@ -1817,8 +2546,8 @@ GLuint FindVao(Mesh& mesh, u32 submesh_index, const Program& program)
         glBindVertexArray(0);
     }
 
-    Vao vao = { vao_handle, program.handle };
-    submesh.vaos.push_back(vao);
+    ASSERT(submesh.vao_count < MAX_SUBMESH_VAOS, "Too many programs drawing the same submesh");
+    submesh.vaos[submesh.vao_count++] = { vao_handle, program.handle };
 
     return vao_handle;
 }
@@ -1871,49 +2600,57 @@ void App::LoadSphere()
     std::vector<glm::vec3> normals;
     std::vector<unsigned int> indices;
 
-    const unsigned int X_SEGMENTS = 64;
-    const unsigned int Y_SEGMENTS = 64;
-    for (unsigned int y = 0; y <= Y_SEGMENTS; ++y)
+    // A parametric sphere gets its levels by halving the segments, every level after the previous one in the buffers
+    for (unsigned int lod = 0; lod < MESH_MAX_LODS; ++lod)
     {
-        for (unsigned int x = 0; x <= X_SEGMENTS; ++x)
-        {
-            float xSegment = (float)x / (float)X_SEGMENTS;
-            float ySegment = (float)y / (float)Y_SEGMENTS;
-            float xPos = std::cos(xSegment * 2.0f * PI) * std::sin(ySegment * PI);
-            float yPos = std::cos(ySegment * PI);
-            float zPos = std::sin(xSegment * 2.0f * PI) * std::sin(ySegment * PI);
-
-            positions.push_back(glm::vec3(xPos, yPos, zPos));
-            uv.push_back(glm::vec2(xSegment, ySegment));
-            normals.push_back(glm::vec3(xPos, yPos, zPos));
-        }
-    }
+        const unsigned int X_SEGMENTS = 64 >> lod;
+        const unsigned int Y_SEGMENTS = 64 >> lod;
 
-    bool oddRow = false;
-    for (unsigned int y = 0; y < Y_SEGMENTS; ++y)
-    {
-        if (!oddRow)
+        sphere_base_vertex[lod] = positions.size();
+        sphere_lods[lod].index_offset = indices.size() * sizeof(unsigned int);
+
+        for (unsigned int y = 0; y <= Y_SEGMENTS; ++y)
         {
             for (unsigned int x = 0; x <= X_SEGMENTS; ++x)
             {
-                indices.push_back(y * (X_SEGMENTS + 1) + x);
-                indices.push_back((y + 1) * (X_SEGMENTS + 1) + x);
+                float xSegment = (float)x / (float)X_SEGMENTS;
+                float ySegment = (float)y / (float)Y_SEGMENTS;
+                float xPos = std::cos(xSegment * 2.0f * PI) * std::sin(ySegment * PI);
+                float yPos = std::cos(ySegment * PI);
+                float zPos = std::sin(xSegment * 2.0f * PI) * std::sin(ySegment * PI);
+
+                positions.push_back(glm::vec3(xPos, yPos, zPos));
+                uv.push_back(glm::vec2(xSegment, ySegment));
+                normals.push_back(glm::vec3(xPos, yPos, zPos));
             }
         }
-        else
+
+        bool oddRow = false;
+        for (unsigned int y = 0; y < Y_SEGMENTS; ++y)
         {
-            for (int x = X_SEGMENTS; x >= 0; --x)
+            if (!oddRow)
             {
-                indices.push_back((y + 1) * (X_SEGMENTS + 1) + x);
-                indices.push_back(y * (X_SEGMENTS + 1) + x);
+                for (unsigned int x = 0; x <= X_SEGMENTS; ++x)
+                {
+                    indices.push_back(y * (X_SEGMENTS + 1) + x);
+                    indices.push_back((y + 1) * (X_SEGMENTS + 1) + x);
+                }
+            }
+            else
+            {
+                for (int x = X_SEGMENTS; x >= 0; --x)
+                {
+                    indices.push_back((y + 1) * (X_SEGMENTS + 1) + x);
+                    indices.push_back(y * (X_SEGMENTS + 1) + x);
+                }
             }
+
+            oddRow = !oddRow;
         }
 
-        oddRow = !oddRow;
+        sphere_lods[lod].index_count = indices.size() - sphere_lods[lod].index_offset / sizeof(unsigned int);
     }
 
-    sphere_index_count = indices.size();
-
     std::vector<float> data;
     for (std::size_t i = 0; i < positions.size(); ++i)
     {
@@ -1955,11 +2692,11 @@ void App::LoadSphere()
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(float)));
 }
 
-void App::RenderSphere(const GLuint& vao, const u32& index_count)
+void App::RenderSphere(u32 lod)
 {
     glBindVertexArray(sphere_vao);
 
-    glDrawElements(GL_TRIANGLE_STRIP, index_count, GL_UNSIGNED_INT, 0);
+    glDrawElementsBaseVertex(GL_TRIANGLE_STRIP, sphere_lods[lod].index_count, GL_UNSIGNED_INT, (void*)(u64)sphere_lods[lod].index_offset, sphere_base_vertex[lod]);
 
     glBindVertexArray(0);
 }
@@ -1970,23 +2707,32 @@ GLuint App::LoadCubemap(const std::vector<std::string>& faces)
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-    int width, height, nrChannels;
+    struct Face
+    {
+        unsigned char* data;
+        int width, height, nrChannels;
+    };
+    std::vector<Face> decoded(faces.size());
+
+    ParallelFor(faces.size(), 1, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; ++i)
+        {
+            Face& face = decoded[i];
+            stbi_set_flip_vertically_on_load_thread(false);
+            face.data = stbi_load(faces[i].c_str(), &face.width, &face.height, &face.nrChannels, 0);
+        }
+    });
+
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        stbi_set_flip_vertically_on_load(false);
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
+        if (decoded[i].data)
         {
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
+                0, GL_RGB, decoded[i].width, decoded[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, decoded[i].data
             );
-
-            stbi_image_free(data);
-        }
-        else
-        {
-            stbi_image_free(data);
         }
+        stbi_image_free(decoded[i].data);
     }
 
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
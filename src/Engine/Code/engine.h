@@ -6,7 +6,21 @@
 
 #include <glad/glad.h>
 
+#include "gl_extensions.h"
+
 #include "platform.h"
+#include "asset_registry.h"
+#include "pool.h"
+#include "file_watcher.h"
+#include "program_reflection.h"
+#include "scene.h"
+#include "command_list.h"
+#include "shadows.h"
+#include "gpu_culling.h"
+#include "mesh_lod.h"
+#include "meshlets.h"
+#include "terrain.h"
+#include "water.h"
 
 
 typedef glm::vec2  vec2;
@@ -71,12 +85,37 @@ struct Image
 struct Texture
 {
     GLuint      handle;
+    GLuint64    bindless_handle; // 0 until it is made resident
     std::string filepath;
+
+    // Location in the material texture arrays (UINT32_MAX if not packed)
+    u32 array_index = UINT32_MAX;
+    u32 array_layer = UINT32_MAX;
+};
+
+// Same-sized, same-format material textures packed as layers of one
+// GL_TEXTURE_2D_ARRAY, used when bindless textures are not available
+struct TextureArray
+{
+    GLuint handle;
+    ivec2  size;
+    GLenum internal_format;
+    u32    layer_count;
 };
 
+#define MAX_MATERIAL_TEXTURE_ARRAYS 8
+#define MATERIAL_TEXTURE_ARRAY_UNIT 16
+
+// GlobalParams block layout (std140), must match shaders.glsl
+#define MAX_LIGHTS 50
+#define GLOBAL_PARAMS_LIGHTS_OFFSET 80 // mat4 view projection, vec3 camera position, uint light count
+#define GLOBAL_PARAMS_LIGHT_SIZE 64
+#define GLOBAL_PARAMS_SHADOWS_OFFSET (GLOBAL_PARAMS_LIGHTS_OFFSET + MAX_LIGHTS * GLOBAL_PARAMS_LIGHT_SIZE)
+#define GLOBAL_PARAMS_SIZE (GLOBAL_PARAMS_SHADOWS_OFFSET + GLOBAL_PARAMS_SHADOWS_SIZE)
+
 struct Material
 {
-    std::string name;
+    AssetHandle asset; // Registry entry, which holds the material name
 
     vec3 albedo;
     vec3 emissive;
@@ -90,43 +129,124 @@ struct Material
     u32 bump_texture_index;
 };
 
+// GPU copy of a Material, laid out for the std430 material table.
+// Textures are referenced by their bindless handle (0 if the material has none) or,
+// without bindless textures, by their texture array in the low 32 bits and layer in
+// the high 32 bits (array UINT32_MAX if the texture was not packed).
+struct MaterialRecord
+{
+    vec4 albedo; // rgb: albedo, a: smoothness
+    vec4 emissive;
+
+    GLuint64 albedo_texture;
+    GLuint64 emissive_texture;
+    GLuint64 specular_texture;
+    GLuint64 normals_texture;
+    GLuint64 bump_texture;
+    GLuint64 padding;
+};
+
 struct Model
 {
     u32 mesh_index;
     std::vector<u32> material_index;
 };
 
+#define MAX_SUBMESH_VAOS 8 // One per program variant drawing the submesh
+
+// The vertices and indices only live in the GPU buffers of the mesh once uploaded
 struct Submesh
 {
     VertexBufferLayout vertex_buffer_layout;
 
-    std::vector<float> vertices;
-    std::vector<u32> indices;
-
+    u32 vertex_count;
     u32 vertex_offset;
-    u32 index_offset;
 
-    std::vector<Vao> vaos;
+    // lods[0] is the full detail, every level indexes the same vertices
+    SubmeshLod lods[MESH_MAX_LODS];
+    u32        lod_count;
+
+    // Clusters of the full detail level in App::meshlets, none for the small submeshes
+    u32 first_meshlet;
+    u32 meshlet_count;
+
+    Vao vaos[MAX_SUBMESH_VAOS];
+    u32 vao_count;
 };
 
+// Submeshes simplified less than others run out of levels first and keep drawing their last one
+inline const SubmeshLod& GetSubmeshLod(const Submesh& submesh, u32 lod)
+{
+    return submesh.lods[glm::min(lod, submesh.lod_count - 1)];
+}
+
 struct Mesh
 {
     std::vector<Submesh> submeshes;
+    u32                  lod_count; // Of its most detailed submesh
+
+    // Bounds of every submesh, in model space: a box and a sphere around bounds_center
+    glm::vec3 bounds_center;
+    glm::vec3 bounds_extent; // Half size of the box
+    f32       bounds_radius;
 
     GLuint vertex_buffer_handle;
     GLuint index_buffer_handle;
 };
 
+// Feature keywords a program variant can be compiled with. Each enabled
+// feature is exposed to shaders.glsl as a #define of the same name.
+enum ShaderFeature
+{
+    ShaderFeature_Clipping     = 1 << 0, // CLIPPING
+    ShaderFeature_Instanced    = 1 << 1, // INSTANCED
+    ShaderFeature_NormalMap    = 1 << 2, // NORMAL_MAP
+    ShaderFeature_Skinned      = 1 << 3, // SKINNED
+    ShaderFeature_Bindless     = 1 << 4, // BINDLESS
+    ShaderFeature_VertexLayer  = 1 << 5, // VERTEX_LAYER
+    ShaderFeature_Compute      = 1 << 6, // COMPUTE, a compute shader instead of the vertex and fragment stages
+    ShaderFeature_GpuDriven    = 1 << 7, // GPU_DRIVEN, instances drawn from the visible lists of the GPU culling
+    ShaderFeature_Tessellation = 1 << 8, // TESSELLATION, with the tessellation control and evaluation stages
+    ShaderFeature_Count        = 9
+};
+
+typedef u32 ShaderFeatures;
+
 struct Program
 {
-    GLuint             handle;
+    GLuint             handle; // 0 until the variant is first used
     std::string        filepath;
     std::string        programName;
-    u64                lastWriteTimestamp;
+    ShaderFeatures     features;
+    u32                sourceFile; // Into App::fileWatcher
+    u64                binaryKey; // Program binary cache key
 
+    ProgramReflection  reflection;
     VertexShaderLayout vertex_input_layout;
 };
 
+template <typename T>
+inline void SetUniform(Program& program, const char* name, const T& value)
+{
+    SetUniform(program.reflection, name, value);
+}
+
+/**
+ * A program compile that has been submitted to the driver but not checked yet. With
+ * GL_KHR_parallel_shader_compile the driver compiles and links it in the background.
+ */
+struct ProgramCompile
+{
+    u32    programIdx;
+    GLuint handle;
+    GLuint vshader; // Or the compute shader. 0 if the program was loaded from the binary cache
+    GLuint fshader; // 0 for compute programs
+    GLuint tcshader; // 0 without tessellation
+    GLuint teshader;
+    u64    binaryKey;
+    u32    submitFrame; // Reloads only: RenderFrame() call that submitted it
+};
+
 struct Camera
 {
     vec3 position;
@@ -237,14 +357,6 @@ struct Camera
     }
 };
 
-struct Entity
-{
-    glm::mat4 worldMatrix;
-    u32 modelIndex;
-    u32 localParamsOffset;
-    u32 localParamsSize;
-};
-
 enum LightType
 {
     LightType_Directional,
@@ -287,6 +399,74 @@ enum class FboAttachmentType
     FinalRender, // Used only in the lighting pass FBO
 };
 
+struct DrawItem
+{
+    u32       modelIndex;
+    u32       localParamsOffset;
+    u32       localParamsSize;
+    glm::mat4 worldMatrix;
+    glm::vec4 bounds; // World bounding sphere
+    bool      isStatic;
+    u32       lod;    // The same level for every pass, picked from the main camera
+};
+
+// Bytes of FramePacket::localParams to copy into the cbuffer
+struct UniformRange
+{
+    u32 bufferOffset;
+    u32 dataOffset;
+    u32 size;
+};
+
+enum RenderPass
+{
+    RenderPass_WaterReflection,
+    RenderPass_WaterRefraction,
+    RenderPass_Forward,
+    RenderPass_DeferredGeometry,
+    RenderPass_ShadowStatic,
+    RenderPass_ShadowMovable,
+    RenderPass_PointShadows,
+    RenderPass_Count
+};
+
+/**
+ * Everything the render thread needs to draw a frame. Update() fills one while the render
+ * thread draws the previous one, and nothing in it is touched again until it is consumed.
+ */
+struct FramePacket
+{
+    ivec2 displaySize;
+    f32   deltaTime;
+    Mode  mode;
+    bool  debugGroupMode;
+
+    Camera    camera;
+    Camera    waterCamera; // Mirrored, for the water reflection and refraction passes
+    glm::mat4 view;
+    glm::mat4 projection;
+
+    std::vector<Light>    lights;
+    std::vector<DrawItem> draws;
+
+    ShadowFrame      shadows;
+    PointShadowFrame pointShadows;
+    GpuCullingFrame  culling;
+    MeshLodSettings  lods; // For the light markers the render thread draws
+    TerrainFrame     terrain;
+    WaterFrame       water;
+
+    // Uniform blob: the whole GlobalParams block and the entity slices that changed
+    u8                        globalParams[GLOBAL_PARAMS_SIZE];
+    u32                       cbufferSize;
+    std::vector<u8>           localParams;
+    std::vector<UniformRange> localParamsRanges;
+
+    // Entity draws of each pass, recorded in parallel. Empty for the passes the mode skips.
+    CommandList passCommands[RenderPass_Count];
+    u32         passProgramIdx[RenderPass_Count]; // What each list was recorded for, the GPU_DRIVEN variant when culled on the GPU
+};
+
 struct App
 {
     // Loop
@@ -304,13 +484,44 @@ struct App
 
     ivec2 displaySize;
 
-    std::vector<Texture>    textures;
-    std::vector<Material>   materials;
-    std::vector<Mesh>       meshes;
-    std::vector<Model>      models;
+    // Resources are referenced by slot index, which never changes while they are alive
+    Pool<Texture>           textures;
+    Pool<Material>          materials;
+    Pool<Mesh>              meshes;
+    Pool<Model>             models;
     std::vector<Program>    programs;
-    std::vector<Entity>     entities;
-    std::vector<Light>      lights;
+    Pool<Light>             lights;
+
+    // Clusters of every large submesh loaded so far, never freed
+    std::vector<Meshlet> meshlets;
+    GLuint               meshletBuffer;
+
+    // Entities (structure of arrays, with transform hierarchy)
+    Scene scene;
+
+    // Directional and point light shadows
+    CascadedShadows shadows;
+    PointShadows    pointShadows;
+
+    // Frustum and occlusion culling of the scene passes
+    GpuCulling culling;
+
+    // Level of detail selection of the entities
+    MeshLodSettings lods;
+
+    // Heightmap terrain
+    Terrain terrain;
+
+    // Ocean surface of the forward mode
+    Water water;
+
+    // Name table for textures, programs, meshes, models and materials
+    AssetRegistry assets;
+
+    // Shader hot reload: programs are rebuilt in the background and swapped once linked
+    FileWatcher                 fileWatcher;
+    std::vector<ProgramCompile> programReloads;
+    u32                         renderFrameIndex; // RenderFrame() calls so far
 
     // program indices
     u32 texturedGeometryProgramIdx;
@@ -324,6 +535,11 @@ struct App
     u32 deferredLightProgramIdx;
 
     u32 skyboxProgramIdx;
+
+    // GPU_DRIVEN variants, for the passes culled on the GPU
+    u32 texturedMeshGpuDrivenProgramIdx;
+    u32 texturedMeshWithClippingGpuDrivenProgramIdx;
+    u32 deferredGeometryPassGpuDrivenProgramIdx;
     
     // texture indices
     u32 diceTexIdx;
@@ -334,6 +550,13 @@ struct App
 
     u32 dudvMapIdx;
 
+    // Material table, indexed by material index in the shaders
+    bool   bindlessTextures;
+    Buffer materialTable;
+    bool   materialTexturesInTable; // No material needs a texture bind of its own (bindless, or every albedo texture in the arrays)
+
+    std::vector<TextureArray> textureArrays; // Only used without bindless textures
+
     // Camera
     Camera camera;
 
@@ -348,48 +571,6 @@ struct App
     GLuint embeddedVertices;
     GLuint embeddedElements;
 
-    // Location of the texture uniform in the textured quad shader
-    GLuint programUniformTexture;
-
-    // More Uniforms
-    GLint texturedMeshProgram_uTexture; // Forward rendering mesh texture
-    GLint texturedMeshProgram_uSkybox; // Forward rendering skybox
-
-    GLint texturedMeshWithClippingProgram_uTexture;
-    GLint texturedMeshWithClippingProgram_uSkybox;
-    GLint texturedMeshWithClippingProgram_uProjection;
-    GLint texturedMeshWithClippingProgram_uView;
-    GLint texturedMeshWithClippingProgram_uModel;
-    GLint texturedMeshWithClippingProgram_uClippingPlane;
-
-    GLint waterMeshProgram_uProjection;
-    GLint waterMeshProgram_uView;
-    GLint waterMeshProgram_uModel;
-
-    GLint waterMeshProgram_uReflectionTexture;
-    GLint waterMeshProgram_uRefractionTexture;
-
-    GLint waterMeshProgram_uDudvMap;
-
-    GLint waterMeshProgram_uMoveFactor;
-
-    GLint waterMeshProgram_uCameraPosition;
-
-    GLint deferredGeometryProgram_uTexture; // Deferred geometry pass
-
-    GLint deferredLightingProgram_uGPosition; // Lighting geometry pass
-    GLint deferredLightingProgram_uGNormals; // Lighting geometry pass
-    GLint deferredLightingProgram_uGDiffuse; // Lighting geometry pass
-
-    GLint deferredLightProgram_uProjection; // Projection matrix for deferred shading light
-    GLint deferredLightProgram_uView; // View matrix for deferred shading light
-    GLint deferredLightProgram_uModel; // Model matrix for deferred shading light
-    GLint deferredLightProgram_uLightColor; // Light volume for deferred shading
-
-    GLint skyboxProgram_uProjection;
-    GLint skyboxProgram_uView;
-    GLint skyboxProgram_uSkybox;
-
     // VAO object to link our screen filling quad with our textured quad shader
     GLuint vao;
 
@@ -427,6 +608,16 @@ struct App
     u32 globalParamsOffset;
     u32 globalParamsSize;
 
+    // Render thread: last globals uploaded to the cbuffer, so only the changed ranges are sent again
+    u8   uploadedGlobalParams[GLOBAL_PARAMS_SIZE];
+    bool globalParamsUploaded;
+
+    // Game thread: layout of the entity slices in the cbuffer
+    u32 localParamsBase;
+    u32 localParamsStride;
+    u32 localParamsCapacity; // Entities the cbuffer has room for
+    u32 packedEntityCount;
+
     glm::mat4 view;
     glm::mat4 projection;
 
@@ -443,10 +634,11 @@ struct App
 
     // Sphere
     GLuint sphere_vao = 0u;
-    u32 sphere_index_count;
+    SubmeshLod sphere_lods[MESH_MAX_LODS]; // Fewer segments per level
+    u32 sphere_base_vertex[MESH_MAX_LODS];
 
     void LoadSphere();
-    void RenderSphere(const GLuint& vao, const u32& index_count);
+    void RenderSphere(u32 lod); // Of sphere_lods, drawn from sphere_vao
 
     // Cubemap
     GLuint cubemap;
@@ -460,8 +652,39 @@ void Gui(App* app);
 
 void Update(App* app);
 
-void Render(App* app);
+// Fills the packet with the state Update() left, for the render thread to draw
+void BuildFramePacket(App* app, FramePacket& packet);
+
+// Runs on the thread that owns the GL context: uploads the packet uniforms, then draws it
+void RenderFrame(App* app, const FramePacket& packet);
+
+void Render(App* app, const FramePacket& packet);
 
 GLuint FindVao(Mesh& mesh, u32 submesh_index, const Program& program);
 
+// Bounding sphere of the entity mesh (xyz center, w radius), in world space
+glm::vec4 GetEntityWorldBounds(App* app, u32 entity);
+
 u32 LoadTexture2D(App* app, const char* filepath);
+
+// Decodes the images in parallel, then creates the textures. Writes UINT32_MAX for the files that failed.
+void LoadTextures2D(App* app, const char* const* filepaths, u32 count, u32* texIndices);
+
+/**
+ * Registers the variant of a program compiled with the given features. The variant is
+ * compiled lazily, the first time it is retrieved with GetProgram().
+ */
+u32 LoadProgram(App* app, const char* filepath, const char* programName, ShaderFeatures features = 0);
+
+Program& GetProgram(App* app, u32 programIdx);
+
+u32 FindProgram(App* app, const char* programName, ShaderFeatures features = 0);
+
+/**
+ * Resubmits a program built from a modified source. The current program keeps being
+ * used until UpdateProgramReloads() finds the new one linked, on a later frame, and
+ * swaps it in.
+ */
+void BeginProgramReload(App* app, u32 programIdx);
+
+void UpdateProgramReloads(App* app);
@@ -0,0 +1,178 @@
+#include "file_watcher.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+static void SplitFilepath(const char* filepath, std::string& directory, std::string& filename)
+{
+    const std::string path = filepath;
+    const size_t separator = path.find_last_of("/\\");
+
+    directory = separator == std::string::npos ? "." : path.substr(0, separator);
+    filename  = separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+static u32 WatchDirectory(FileWatcher& watcher, const std::string& path)
+{
+    for (u32 i = 0; i < watcher.directories.size(); ++i)
+        if (watcher.directories[i].path == path)
+            return i;
+
+    WatchedDirectory directory = {};
+    directory.path = path;
+
+#ifdef _WIN32
+    HANDLE notification = FindFirstChangeNotificationA(path.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    if (notification == INVALID_HANDLE_VALUE)
+        ELOG("FindFirstChangeNotification() failed watching directory %s", path.c_str());
+    directory.handle = (intptr_t)notification;
+#else
+    if (watcher.inotifyFd < 0)
+    {
+        watcher.inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watcher.inotifyFd < 0)
+            ELOG("inotify_init1() failed (errno %d), falling back to polling timestamps", errno);
+    }
+
+    directory.handle = -1;
+    if (watcher.inotifyFd >= 0)
+    {
+        // Editors often save through a temporary file renamed over the original
+        directory.handle = inotify_add_watch(watcher.inotifyFd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (directory.handle < 0)
+            ELOG("inotify_add_watch() failed watching directory %s (errno %d)", path.c_str(), errno);
+    }
+#endif
+
+    watcher.directories.push_back(directory);
+    return (u32)watcher.directories.size() - 1;
+}
+
+u32 WatchFile(FileWatcher& watcher, const char* filepath)
+{
+    for (u32 i = 0; i < watcher.files.size(); ++i)
+        if (watcher.files[i].filepath == filepath)
+            return i;
+
+    WatchedFile file = {};
+    std::string directory;
+    SplitFilepath(filepath, directory, file.filename);
+
+    file.filepath = filepath;
+    file.directory = WatchDirectory(watcher, directory);
+    file.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+
+    watcher.files.push_back(file);
+    return (u32)watcher.files.size() - 1;
+}
+
+static bool CheckDirectoryTimestamps(FileWatcher& watcher, u32 directoryIdx)
+{
+    bool anyChanged = false;
+
+    for (WatchedFile& file : watcher.files)
+    {
+        if (file.directory != directoryIdx)
+            continue;
+
+        const u64 timestamp = GetFileLastWriteTimestamp(file.filepath.c_str());
+        if (timestamp > file.lastWriteTimestamp)
+        {
+            file.lastWriteTimestamp = timestamp;
+            file.changed = true;
+            anyChanged = true;
+        }
+    }
+
+    return anyChanged;
+}
+
+bool PollFileWatcher(FileWatcher& watcher)
+{
+    bool anyChanged = false;
+
+#ifdef _WIN32
+    for (u32 i = 0; i < watcher.directories.size(); ++i)
+    {
+        HANDLE notification = (HANDLE)watcher.directories[i].handle;
+        if (notification == INVALID_HANDLE_VALUE)
+        {
+            anyChanged |= CheckDirectoryTimestamps(watcher, i);
+            continue;
+        }
+
+        if (WaitForSingleObject(notification, 0) == WAIT_OBJECT_0)
+        {
+            FindNextChangeNotification(notification);
+            anyChanged |= CheckDirectoryTimestamps(watcher, i);
+        }
+    }
+#else
+    for (u32 i = 0; i < watcher.directories.size(); ++i)
+        if (watcher.directories[i].handle < 0)
+            anyChanged |= CheckDirectoryTimestamps(watcher, i);
+
+    if (watcher.inotifyFd < 0)
+        return anyChanged;
+
+    alignas(inotify_event) char buffer[4096];
+    for (;;)
+    {
+        const ssize_t length = read(watcher.inotifyFd, buffer, sizeof(buffer));
+        if (length <= 0)
+            break; // EAGAIN: no more events queued
+
+        for (ssize_t offset = 0; offset < length; )
+        {
+            const inotify_event* event = (const inotify_event*)(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->len == 0)
+                continue;
+
+            for (WatchedFile& file : watcher.files)
+            {
+                // st_mtime only has a 1 second resolution, so trust the event instead
+                if (watcher.directories[file.directory].handle == event->wd && file.filename == event->name)
+                {
+                    file.lastWriteTimestamp = GetFileLastWriteTimestamp(file.filepath.c_str());
+                    file.changed = true;
+                    anyChanged = true;
+                }
+            }
+        }
+    }
+#endif
+
+    return anyChanged;
+}
+
+bool ConsumeFileChange(FileWatcher& watcher, u32 fileIdx)
+{
+    WatchedFile& file = watcher.files[fileIdx];
+    const bool changed = file.changed;
+    file.changed = false;
+    return changed;
+}
+
+void DestroyFileWatcher(FileWatcher& watcher)
+{
+#ifdef _WIN32
+    for (const WatchedDirectory& directory : watcher.directories)
+        if ((HANDLE)directory.handle != INVALID_HANDLE_VALUE)
+            FindCloseChangeNotification((HANDLE)directory.handle);
+#else
+    if (watcher.inotifyFd >= 0)
+        close(watcher.inotifyFd);
+    watcher.inotifyFd = -1;
+#endif
+
+    watcher.directories.clear();
+    watcher.files.clear();
+}
@@ -0,0 +1,54 @@
+//
+// file_watcher.h: Change notifications for the files the engine hot reloads. Each watched
+// directory gets one OS notification handle (inotify on Linux, a change notification on
+// Windows), so polling costs nothing until something in a watched directory is written.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <string>
+#include <vector>
+
+struct WatchedDirectory
+{
+    std::string path;
+    intptr_t    handle; // inotify watch descriptor or Win32 change notification HANDLE
+};
+
+struct WatchedFile
+{
+    std::string filepath;
+    std::string filename; // Part after the directory, matched against inotify events
+    u32         directory;
+    u64         lastWriteTimestamp;
+    bool        changed;
+};
+
+struct FileWatcher
+{
+    std::vector<WatchedDirectory> directories;
+    std::vector<WatchedFile>      files;
+
+    int inotifyFd = -1;
+};
+
+/**
+ * Starts watching a file and returns its index in FileWatcher::files. Watching the
+ * same path again returns the existing index.
+ */
+u32 WatchFile(FileWatcher& watcher, const char* filepath);
+
+/**
+ * Drains the pending notifications and flags the files whose last write timestamp
+ * moved forward. Returns true if any file changed; consume them with ConsumeFileChange().
+ */
+bool PollFileWatcher(FileWatcher& watcher);
+
+/**
+ * Returns whether the file changed since the last call and clears the flag.
+ */
+bool ConsumeFileChange(FileWatcher& watcher, u32 fileIdx);
+
+void DestroyFileWatcher(FileWatcher& watcher);
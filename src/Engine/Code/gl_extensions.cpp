@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "gl_extensions.h"
+
+bool GLEXT_ARB_bindless_texture = false;
+PFNGLGETTEXTUREHANDLEARBPROC             glGetTextureHandleARB = NULL;
+PFNGLMAKETEXTUREHANDLERESIDENTARBPROC    glMakeTextureHandleResidentARB = NULL;
+PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC glMakeTextureHandleNonResidentARB = NULL;
+
+bool GLEXT_KHR_parallel_shader_compile = false;
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR = NULL;
+
+bool GLEXT_ARB_shader_viewport_layer_array = false;
+
+bool GLEXT_ARB_indirect_parameters = false;
+PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC glMultiDrawElementsIndirectCountARB = NULL;
+
+bool GLEXT_ARB_shader_draw_parameters = false;
+
+static bool HasExtension(const char* name)
+{
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+
+    for (GLint i = 0; i < extensionCount; ++i)
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+
+    return false;
+}
+
+void LoadOpenGLExtensions(GLADloadproc load)
+{
+    if (HasExtension("GL_ARB_bindless_texture"))
+    {
+        glGetTextureHandleARB             = (PFNGLGETTEXTUREHANDLEARBPROC)load("glGetTextureHandleARB");
+        glMakeTextureHandleResidentARB    = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)load("glMakeTextureHandleResidentARB");
+        glMakeTextureHandleNonResidentARB = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)load("glMakeTextureHandleNonResidentARB");
+
+        GLEXT_ARB_bindless_texture = glGetTextureHandleARB && glMakeTextureHandleResidentARB && glMakeTextureHandleNonResidentARB;
+    }
+
+    if (HasExtension("GL_KHR_parallel_shader_compile"))
+        glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+    else if (HasExtension("GL_ARB_parallel_shader_compile"))
+        glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsARB");
+
+    GLEXT_KHR_parallel_shader_compile = glMaxShaderCompilerThreadsKHR != NULL;
+    if (GLEXT_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); // Let the driver pick the thread count
+
+    GLEXT_ARB_shader_viewport_layer_array = HasExtension("GL_ARB_shader_viewport_layer_array");
+
+    if (HasExtension("GL_ARB_indirect_parameters"))
+        glMultiDrawElementsIndirectCountARB = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC)load("glMultiDrawElementsIndirectCountARB");
+    GLEXT_ARB_indirect_parameters = glMultiDrawElementsIndirectCountARB != NULL;
+
+    GLEXT_ARB_shader_draw_parameters = HasExtension("GL_ARB_shader_draw_parameters");
+}
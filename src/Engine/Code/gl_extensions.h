@@ -0,0 +1,53 @@
+//
+// gl_extensions.h: OpenGL extensions used by the engine on top of the 4.3 core
+// profile that glad exposes. They are loaded right after glad, and each one has a
+// flag telling whether the driver supports it, so callers can pick a fallback path.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+
+/* GL_ARB_bindless_texture */
+
+typedef GLuint64 (APIENTRYP PFNGLGETTEXTUREHANDLEARBPROC)(GLuint texture);
+typedef void     (APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)(GLuint64 handle);
+typedef void     (APIENTRYP PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)(GLuint64 handle);
+
+extern bool GLEXT_ARB_bindless_texture;
+extern PFNGLGETTEXTUREHANDLEARBPROC             glGetTextureHandleARB;
+extern PFNGLMAKETEXTUREHANDLERESIDENTARBPROC    glMakeTextureHandleResidentARB;
+extern PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC glMakeTextureHandleNonResidentARB;
+
+/* GL_KHR_parallel_shader_compile (or its ARB twin, which shares the enums) */
+
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR           0x91B1
+
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+extern bool GLEXT_KHR_parallel_shader_compile;
+extern PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR;
+
+/* GL_ARB_shader_viewport_layer_array (no entry points, lets the vertex shader write gl_Layer) */
+
+extern bool GLEXT_ARB_shader_viewport_layer_array;
+
+/* GL_ARB_indirect_parameters */
+
+#define GL_PARAMETER_BUFFER_ARB 0x80EE
+
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC)(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+
+extern bool GLEXT_ARB_indirect_parameters;
+extern PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC glMultiDrawElementsIndirectCountARB;
+
+/* GL_ARB_shader_draw_parameters (no entry points, gives the vertex shader gl_BaseInstanceARB) */
+
+extern bool GLEXT_ARB_shader_draw_parameters;
+
+/**
+ * Loads the extension entry points with the same loader used for glad. Must be
+ * called with a current context, after gladLoadGLLoader().
+ */
+void LoadOpenGLExtensions(GLADloadproc load);
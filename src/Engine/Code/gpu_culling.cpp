@@ -0,0 +1,484 @@
+#include "gpu_culling.h"
+#include "engine.h"
+#include "memory_arena.h"
+
+#define BINDING(b) b
+
+#define DEPTH_PYRAMID_GROUP_SIZE 8 // Must match shaders.glsl
+#define DEPTH_PYRAMID_SOURCE_UNIT 0
+
+// Value initialized, so the padding is zero too
+static CullPassParams MakeCullPass(const glm::mat4& viewProjection, const glm::vec4& eye, u32 flags)
+{
+    CullPassParams pass = {};
+    pass.viewProjection = viewProjection;
+    pass.eye = eye;
+    pass.flags = flags;
+    return pass;
+}
+
+static u32 FloorPowerOf2(u32 value)
+{
+    u32 power = 1;
+    while (power * 2 <= value)
+        power *= 2;
+    return power;
+}
+
+void InitGpuCulling(App* app)
+{
+    GpuCulling& culling = app->culling;
+
+    culling.supported = GLEXT_ARB_indirect_parameters && GLEXT_ARB_shader_draw_parameters;
+    culling.enabled = culling.supported;
+    culling.occlusion = true;
+
+    GLint maxStorageBlocks = 0;
+    glGetIntegerv(GL_MAX_COMPUTE_SHADER_STORAGE_BLOCKS, &maxStorageBlocks);
+    culling.meshletsSupported = culling.supported && maxStorageBlocks >= GPU_CULL_STORAGE_BLOCKS;
+    culling.meshlets = culling.meshletsSupported;
+
+    culling.cullProgramIdx = LoadProgram(app, "shaders.glsl", "GPU_CULL", ShaderFeature_Compute);
+    culling.compactProgramIdx = LoadProgram(app, "shaders.glsl", "GPU_CULL_COMPACT", ShaderFeature_Compute);
+    culling.depthPyramidProgramIdx = LoadProgram(app, "shaders.glsl", "DEPTH_PYRAMID", ShaderFeature_Compute);
+
+    glGenBuffers(1, &culling.instanceBuffer);
+    glGenBuffers(1, &culling.batchBuffer);
+    glGenBuffers(1, &culling.instanceCountBuffer);
+    glGenBuffers(1, &culling.visibleBuffer);
+    glGenBuffers(1, &culling.commandBuffer);
+    glGenBuffers(1, &culling.drawCountBuffer);
+
+    glGenBuffers(1, &culling.passBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.passBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, CullPass_Count * sizeof(CullPassParams), NULL, GL_DYNAMIC_DRAW);
+
+    const GpuCullStats zero = {};
+    glGenBuffers(GPU_CULL_STATS_BUFFERS, culling.statsBuffers);
+    for (u32 i = 0; i < GPU_CULL_STATS_BUFFERS; ++i)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.statsBuffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuCullStats), &zero, GL_DYNAMIC_READ);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if (!culling.supported)
+    {
+        ILOG("GPU culling needs GL_ARB_indirect_parameters and GL_ARB_shader_draw_parameters, every pass records its draws");
+    }
+    else if (!culling.meshletsSupported)
+    {
+        ILOG("Meshlet culling needs %d storage blocks in compute shaders (%d here), submeshes are culled whole", GPU_CULL_STORAGE_BLOCKS, maxStorageBlocks);
+    }
+}
+
+// Can the submesh be drawn with the VAO of the other one, through a base vertex?
+static bool CanShareVao(const Submesh& vaoSubmesh, const Submesh& submesh)
+{
+    const VertexBufferLayout& a = vaoSubmesh.vertex_buffer_layout;
+    const VertexBufferLayout& b = submesh.vertex_buffer_layout;
+    if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+        return false;
+
+    for (u32 i = 0; i < a.attributes.size(); ++i)
+    {
+        if (a.attributes[i].location != b.attributes[i].location ||
+            a.attributes[i].component_count != b.attributes[i].component_count ||
+            a.attributes[i].offset != b.attributes[i].offset)
+            return false;
+    }
+
+    return submesh.vertex_offset >= vaoSubmesh.vertex_offset && (submesh.vertex_offset - vaoSubmesh.vertex_offset) % a.stride == 0;
+}
+
+void BuildGpuCullingFrame(App* app, FramePacket& packet)
+{
+    GpuCulling& culling = app->culling;
+    GpuCullingFrame& frame = packet.culling;
+
+    // Materials with a texture out of the arrays need a bind per draw, which the multi draws cannot do
+    frame.enabled = culling.enabled && culling.supported && app->materialTexturesInTable;
+    frame.shadowCasters = frame.enabled && app->shadows.layeredRendering;
+    frame.instances.clear();
+    frame.batches.clear();
+    frame.groups.clear();
+    frame.clusterCount = 0;
+    memset(frame.passes, 0, sizeof(frame.passes));
+    if (!frame.enabled)
+        return;
+
+    MemoryArena& arena = GetThreadFrameArena();
+    ScopedArenaMarker arenaMarker(arena);
+
+    // The batches of a model follow its submeshes and their levels, for every model with entities
+    const u32 modelSlotCount = PoolSlotCount(app->models);
+    u32* modelFirstBatch = (u32*)ArenaPush(arena, modelSlotCount * sizeof(u32), alignof(u32));
+    memset(modelFirstBatch, 0xFF, modelSlotCount * sizeof(u32));
+
+    for (const DrawItem& draw : packet.draws)
+    {
+        if (modelFirstBatch[draw.modelIndex] != UINT32_MAX)
+            continue;
+        modelFirstBatch[draw.modelIndex] = (u32)frame.batches.size();
+
+        const Model& model = app->models[draw.modelIndex];
+        const Mesh& mesh = app->meshes[model.mesh_index];
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const Submesh& submesh = mesh.submeshes[i];
+
+            // A submesh joins the group of the previous ones when it can use their VAO
+            if (i == 0 || !CanShareVao(mesh.submeshes[frame.groups.back().vaoSubmesh], submesh))
+                frame.groups.push_back({ model.mesh_index, i, (u32)frame.batches.size(), 0, 0, 0 }); // Clusters are counted once every batch is in
+
+            GpuDrawGroup& group = frame.groups.back();
+            const Submesh& vaoSubmesh = mesh.submeshes[group.vaoSubmesh];
+
+            // The levels index the vertices of their submesh, so they share its group
+            for (u32 lod = 0; lod < submesh.lod_count; ++lod)
+            {
+                GpuBatch batch = {};
+                batch.indexCount = submesh.lods[lod].index_count;
+                batch.firstIndex = submesh.lods[lod].index_offset / (u32)sizeof(u32);
+                batch.baseVertex = (i32)((submesh.vertex_offset - vaoSubmesh.vertex_offset) / vaoSubmesh.vertex_buffer_layout.stride);
+                batch.group = (u32)frame.groups.size() - 1;
+                batch.groupFirstBatch = group.firstBatch;
+                if (lod == 0 && culling.meshlets)
+                {
+                    batch.firstMeshlet = submesh.first_meshlet;
+                    batch.meshletCount = submesh.meshlet_count;
+                }
+                frame.batches.push_back(batch);
+
+                group.batchCount++;
+            }
+        }
+    }
+
+    // Every batch gets a slice of the visible instances as large as its instance count
+    for (const DrawItem& draw : packet.draws)
+    {
+        const Mesh& mesh = app->meshes[app->models[draw.modelIndex].mesh_index];
+        u32 submeshFirstBatch = modelFirstBatch[draw.modelIndex];
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            frame.batches[submeshFirstBatch + glm::min(draw.lod, submesh.lod_count - 1)].firstInstance++;
+            submeshFirstBatch += submesh.lod_count;
+        }
+    }
+
+    u32 instanceCount = 0;
+    for (GpuBatch& batch : frame.batches)
+    {
+        const u32 batchInstances = batch.firstInstance;
+        batch.firstInstance = instanceCount;
+        instanceCount += batchInstances;
+
+        // Room for a command per meshlet of every instance, should none be culled
+        frame.groups[batch.group].clusterCount += batchInstances * batch.meshletCount;
+    }
+
+    for (GpuDrawGroup& group : frame.groups)
+    {
+        group.firstCluster = frame.clusterCount;
+        frame.clusterCount += group.clusterCount;
+    }
+    for (GpuBatch& batch : frame.batches)
+        batch.groupFirstCluster = frame.groups[batch.group].firstCluster;
+
+    frame.instances.reserve(instanceCount);
+    for (const DrawItem& draw : packet.draws)
+    {
+        const Model& model = app->models[draw.modelIndex];
+        const Mesh& mesh = app->meshes[model.mesh_index];
+        u32 submeshFirstBatch = modelFirstBatch[draw.modelIndex];
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const Submesh& submesh = mesh.submeshes[i];
+
+            GpuInstance instance = {};
+            instance.bounds = draw.bounds;
+            instance.batch = submeshFirstBatch + glm::min(draw.lod, submesh.lod_count - 1);
+            instance.matrixOffset = draw.localParamsOffset / (u32)sizeof(glm::vec4);
+            instance.material = model.material_index[i];
+            instance.flags = draw.isStatic ? GpuInstanceFlag_Static : 0;
+            instance.boxCenter = glm::vec4(mesh.bounds_center, 0.0f);
+            instance.boxExtent = glm::vec4(mesh.bounds_extent, 0.0f);
+            frame.instances.push_back(instance);
+
+            submeshFirstBatch += submesh.lod_count;
+        }
+    }
+
+    // The camera of every pass the mode draws
+    if (packet.mode == Mode_Count || packet.mode == Mode_Deferred)
+    {
+        // Only the deferred geometry pass writes the depth the pyramid is built from
+        CullPassParams& pass = frame.passes[CullPass_Main];
+        pass.viewProjection = packet.projection * packet.view;
+        pass.eye = glm::vec4(packet.camera.position, 1.0f);
+        pass.flags = CullPassFlag_Active | CullPassFlag_Cone | (packet.mode == Mode_Deferred && culling.occlusion ? CullPassFlag_Occlusion : 0);
+    }
+
+    if (packet.mode == Mode_Count)
+    {
+        Camera waterCamera = packet.waterCamera;
+        const glm::mat4 waterViewProjection = waterCamera.GetProjectionMatrix() * waterCamera.GetViewMatrix();
+        const glm::vec4 waterEye = glm::vec4(waterCamera.position, 1.0f);
+        if (packet.water.reflection == WaterReflection_Planar)
+            frame.passes[CullPass_WaterReflection] = MakeCullPass(waterViewProjection, waterEye, CullPassFlag_Active | CullPassFlag_Cone);
+        frame.passes[CullPass_WaterRefraction] = MakeCullPass(waterViewProjection, waterEye, CullPassFlag_Active | CullPassFlag_Cone);
+    }
+
+    if (frame.shadowCasters)
+    {
+        const ShadowFrame& shadows = packet.shadows;
+        for (u32 cascade = 0; cascade < shadows.cascadeCount; ++cascade)
+        {
+            // No cone test: faces are never culled, so the back of a caster lands in the shadow map too
+            if (shadows.staticRedrawMask & (1u << cascade))
+                frame.passes[CullPass_ShadowStatic + cascade] = MakeCullPass(shadows.viewProjection[cascade], glm::vec4(0.0f), CullPassFlag_Active | CullPassFlag_DepthClamp | CullPassFlag_StaticOnly);
+            if (shadows.movableCasterCount > 0)
+                frame.passes[CullPass_ShadowMovable + cascade] = MakeCullPass(shadows.viewProjection[cascade], glm::vec4(0.0f), CullPassFlag_Active | CullPassFlag_DepthClamp | CullPassFlag_MovableOnly);
+        }
+    }
+}
+
+void RecordCulledDraws(const FramePacket& packet, CullPass pass, CommandList& list)
+{
+    const GpuCullingFrame& frame = packet.culling;
+    const u32 batchCount = (u32)frame.batches.size();
+    const u32 groupCount = (u32)frame.groups.size();
+    const u32 commandsPerPass = batchCount + frame.clusterCount;
+
+    for (u32 groupIdx = 0; groupIdx < groupCount; ++groupIdx)
+    {
+        const GpuDrawGroup& group = frame.groups[groupIdx];
+        CmdBindVao(list, group.meshIdx, group.vaoSubmesh);
+        CmdMultiDrawIndexedIndirectCount(list, pass * commandsPerPass + group.firstBatch, pass * 2 * groupCount + groupIdx, group.batchCount);
+
+        // The meshlets left of the meshlet batches, one instance each
+        if (group.clusterCount > 0)
+            CmdMultiDrawIndexedIndirectCount(list, pass * commandsPerPass + batchCount + group.firstCluster, pass * 2 * groupCount + groupCount + groupIdx, group.clusterCount);
+    }
+}
+
+// Grows the buffer to hold size bytes, dropping its contents
+static void ReserveBuffer(GLuint buffer, u32 size)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+}
+
+void CullGpuDraws(App* app, const FramePacket& packet)
+{
+    GpuCulling& culling = app->culling;
+    const GpuCullingFrame& frame = packet.culling;
+
+    if (!(frame.passes[CullPass_Main].flags & CullPassFlag_Occlusion))
+        culling.depthPyramidValid = false;
+
+    const u32 instanceCount = (u32)frame.instances.size();
+    const u32 batchCount = (u32)frame.batches.size();
+    const u32 groupCount = (u32)frame.groups.size();
+    const u32 commandsPerPass = batchCount + frame.clusterCount;
+    if (!frame.enabled || instanceCount == 0)
+    {
+        culling.culledInstances = 0;
+        culling.testedInstances = 0;
+        culling.culledMeshlets = 0;
+        culling.testedMeshlets = 0;
+        return;
+    }
+
+    if (instanceCount > culling.instanceCapacity)
+    {
+        culling.instanceCapacity = glm::max(instanceCount, culling.instanceCapacity * 2);
+        ReserveBuffer(culling.instanceBuffer, culling.instanceCapacity * sizeof(GpuInstance));
+        ReserveBuffer(culling.visibleBuffer, CullPass_Count * culling.instanceCapacity * sizeof(glm::uvec2));
+    }
+    if (batchCount > culling.batchCapacity)
+    {
+        culling.batchCapacity = glm::max(batchCount, culling.batchCapacity * 2);
+        ReserveBuffer(culling.batchBuffer, culling.batchCapacity * sizeof(GpuBatch));
+        ReserveBuffer(culling.instanceCountBuffer, CullPass_Count * culling.batchCapacity * sizeof(u32));
+    }
+    if (commandsPerPass > culling.commandCapacity)
+    {
+        culling.commandCapacity = glm::max(commandsPerPass, culling.commandCapacity * 2);
+        ReserveBuffer(culling.commandBuffer, CullPass_Count * culling.commandCapacity * sizeof(IndirectDrawCommand));
+    }
+    if (groupCount > culling.groupCapacity)
+    {
+        culling.groupCapacity = glm::max(groupCount, culling.groupCapacity * 2);
+        ReserveBuffer(culling.drawCountBuffer, CullPass_Count * 2 * culling.groupCapacity * sizeof(u32));
+    }
+
+    // Uploaded once, every pass culls the same instances
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.instanceBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, instanceCount * sizeof(GpuInstance), frame.instances.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.batchBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, batchCount * sizeof(GpuBatch), frame.batches.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.passBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(frame.passes), frame.passes);
+
+    const u32 zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.instanceCountBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, CullPass_Count * batchCount * sizeof(u32), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.drawCountBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, CullPass_Count * 2 * groupCount * sizeof(u32), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    // The counters of the dispatch GPU_CULL_STATS_BUFFERS - 1 frames ago. They are only read
+    // once its fence signaled, otherwise the last ones stay, so the read never waits on the GPU.
+    const u32 statsIdx = culling.statsFrame++ % GPU_CULL_STATS_BUFFERS;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.statsBuffers[statsIdx]);
+    if (GLsync fence = culling.statsFences[statsIdx])
+    {
+        const GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+        {
+            GpuCullStats stats = {};
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(stats), &stats);
+            culling.culledInstances = stats.culledInstances;
+            culling.culledMeshlets = stats.culledMeshlets;
+            culling.testedMeshlets = stats.testedMeshlets;
+        }
+        glDeleteSync(fence);
+        culling.statsFences[statsIdx] = 0;
+    }
+    culling.testedInstances = frame.passes[CullPass_Main].flags ? instanceCount : 0;
+
+    const GpuCullStats zeroStats = {};
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeroStats), &zeroStats);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if (packet.debugGroupMode)
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 4, -1, "GPU Culling");
+
+    // Visible instances of every pass
+    Program& cullProgram = GetProgram(app, culling.cullProgramIdx);
+    glUseProgram(cullProgram.handle);
+
+    // The visible instances (3) and the cbuffer (4) stay bound for the GPU_DRIVEN programs
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), culling.instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), culling.batchBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), culling.visibleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), app->cbuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(5), culling.passBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), culling.instanceCountBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), culling.statsBuffers[statsIdx]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(8), app->meshletBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(9), culling.commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(10), culling.drawCountBuffer);
+
+    glActiveTexture(GL_TEXTURE0 + DEPTH_PYRAMID_SOURCE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, culling.depthPyramidValid ? culling.depthPyramid.texture : 0);
+
+    SetUniform(cullProgram, "uInstanceCount", instanceCount);
+    SetUniform(cullProgram, "uBatchCount", batchCount);
+    SetUniform(cullProgram, "uGroupCount", groupCount);
+    SetUniform(cullProgram, "uCommandsPerPass", commandsPerPass);
+    SetUniform(cullProgram, "uPyramidViewProjection", culling.depthPyramidViewProjection);
+    SetUniform(cullProgram, "uPyramidLevels", culling.depthPyramidValid ? culling.depthPyramid.levels : 0u);
+    SetUniform(cullProgram, "uDepthPyramid", DEPTH_PYRAMID_SOURCE_UNIT);
+
+    glDispatchCompute((instanceCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, CullPass_Count, 1);
+    culling.statsFences[statsIdx] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // The compaction reads the instance counts
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Commands of the batches with visible instances, packed per group
+    Program& compactProgram = GetProgram(app, culling.compactProgramIdx);
+    glUseProgram(compactProgram.handle);
+
+    SetUniform(compactProgram, "uInstanceCount", instanceCount);
+    SetUniform(compactProgram, "uBatchCount", batchCount);
+    SetUniform(compactProgram, "uGroupCount", groupCount);
+    SetUniform(compactProgram, "uCommandsPerPass", commandsPerPass);
+
+    glDispatchCompute((batchCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, CullPass_Count, 1);
+
+    // The passes read the commands, the draw counts and the visible instances
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(0);
+
+    if (packet.debugGroupMode)
+        glPopDebugGroup();
+}
+
+static void CreateDepthPyramid(DepthPyramid& pyramid, glm::ivec2 displaySize)
+{
+    if (pyramid.texture)
+        glDeleteTextures(1, &pyramid.texture);
+
+    // Power of 2 levels, so every texel of a level covers exactly 2x2 texels of the previous one
+    pyramid.size = glm::ivec2(FloorPowerOf2(glm::max(displaySize.x, 1)), FloorPowerOf2(glm::max(displaySize.y, 1)));
+
+    pyramid.levels = 1;
+    while (pyramid.levels < DEPTH_PYRAMID_MAX_LEVELS &&
+           (pyramid.size.x >> pyramid.levels) + (pyramid.size.y >> pyramid.levels) > 0)
+        pyramid.levels++;
+
+    glGenTextures(1, &pyramid.texture);
+    glBindTexture(GL_TEXTURE_2D, pyramid.texture);
+    glTexStorage2D(GL_TEXTURE_2D, pyramid.levels, GL_R32F, pyramid.size.x, pyramid.size.y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void ReduceDepthPyramid(App* app, const FramePacket& packet, u32 programIdx, GLuint depthTexture, DepthPyramid& pyramid)
+{
+    const glm::ivec2 pyramidSize = glm::ivec2(FloorPowerOf2(glm::max(packet.displaySize.x, 1)), FloorPowerOf2(glm::max(packet.displaySize.y, 1)));
+    if (!pyramid.texture || pyramid.size != pyramidSize)
+        CreateDepthPyramid(pyramid, packet.displaySize);
+
+    Program& program = GetProgram(app, programIdx);
+    glUseProgram(program.handle);
+    SetUniform(program, "uSourceDepth", DEPTH_PYRAMID_SOURCE_UNIT);
+
+    glActiveTexture(GL_TEXTURE0 + DEPTH_PYRAMID_SOURCE_UNIT);
+
+    // Level 0 from the depth buffer, then every level from the one above it
+    for (u32 level = 0; level < pyramid.levels; ++level)
+    {
+        const glm::ivec2 levelSize = glm::max(pyramid.size >> (i32)level, glm::ivec2(1));
+        const glm::ivec2 sourceSize = level == 0 ? packet.displaySize : glm::max(pyramid.size >> (i32)(level - 1), glm::ivec2(1));
+
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramid.texture);
+        SetUniform(program, "uSourceLevel", level == 0 ? 0u : level - 1);
+        SetUniform(program, "uSourceSize", glm::vec2(sourceSize));
+        glBindImageTexture(0, pyramid.texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        glDispatchCompute((levelSize.x + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE,
+                          (levelSize.y + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, 1);
+
+        // The next level reads this one
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
+
+void BuildDepthPyramid(App* app, const FramePacket& packet, GLuint depthTexture)
+{
+    GpuCulling& culling = app->culling;
+    if (!packet.culling.enabled || !(packet.culling.passes[CullPass_Main].flags & CullPassFlag_Occlusion))
+        return;
+
+    if (packet.debugGroupMode)
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 5, -1, "Depth Pyramid");
+
+    ReduceDepthPyramid(app, packet, culling.depthPyramidProgramIdx, depthTexture, culling.depthPyramid);
+
+    culling.depthPyramidViewProjection = packet.projection * packet.view;
+    culling.depthPyramidValid = true;
+
+    if (packet.debugGroupMode)
+        glPopDebugGroup();
+}
@@ -0,0 +1,221 @@
+//
+// gpu_culling.h: Frustum and occlusion culling of the scene passes on the GPU. Every
+// submesh of every entity is an instance, and the instances of one model submesh at one
+// level of detail are a batch, drawn by one indirect command. Each frame the game thread
+// uploads the instances once, and two compute dispatches serve every pass (main camera,
+// water reflection and refraction, each shadow cascade): the first appends the instances
+// a pass sees to the visible list of their batch with atomics, the second packs the
+// commands of the batches left with instances. A pass then draws each VAO group of batches with one
+// glMultiDrawElementsIndirectCount(), so recording it no longer walks the entities.
+//
+// The occlusion test of the main pass uses the depth pyramid of the previous frame: after
+// the deferred geometry pass the G-buffer depth is reduced into a mip chain holding the
+// farthest depth of every texel footprint. The bounding box of the mesh is transformed by
+// the world matrix and projected with the camera the pyramid was built with, so moving
+// objects are tested where they are now. Something that
+// was hidden last frame and shows up this frame is drawn one frame late.
+//
+// The full detail level of a large submesh is drawn by meshlets instead. The cull
+// dispatch tests every meshlet of a visible instance against the frustum, the depth
+// pyramid and its normal cone, and appends one command per surviving meshlet to the
+// cluster commands of its group, which the pass draws with a second multi draw.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include "platform.h"
+#include "command_list.h"
+#include "shadows.h"
+#include "meshlets.h"
+
+#include <atomic>
+
+struct App;
+struct FramePacket;
+
+#define DEPTH_PYRAMID_MAX_LEVELS 16
+#define GPU_CULL_GROUP_SIZE 64 // Must match shaders.glsl
+#define GPU_CULL_STORAGE_BLOCKS 10 // Bound by the cull dispatch, which culls the meshlets too
+#define GPU_CULL_STATS_BUFFERS 3 // In rotation, so each is read back 2 frames after the dispatch that wrote it
+
+// Passes with their own visible instances and indirect commands
+enum CullPass
+{
+    CullPass_Main, // Forward or deferred geometry, the only one with the occlusion test
+    CullPass_WaterReflection,
+    CullPass_WaterRefraction,
+    CullPass_ShadowStatic, // One per cascade
+    CullPass_ShadowMovable = CullPass_ShadowStatic + SHADOW_MAX_CASCADES,
+    CullPass_Count = CullPass_ShadowMovable + SHADOW_MAX_CASCADES
+};
+
+enum CullPassFlag
+{
+    CullPassFlag_Active      = 1 << 0,
+    CullPassFlag_Occlusion   = 1 << 1, // Against the depth pyramid
+    CullPassFlag_DepthClamp  = 1 << 2, // Casters before the near plane are drawn, so only the side planes cull
+    CullPassFlag_StaticOnly  = 1 << 3,
+    CullPassFlag_MovableOnly = 1 << 4,
+    CullPassFlag_Cone        = 1 << 5, // Meshlets facing away from the eye are dropped
+};
+
+// Must match shaders.glsl (std430)
+struct CullPassParams
+{
+    glm::mat4 viewProjection;
+    glm::vec4 eye; // For the cone test
+    u32       flags;
+    u32       padding[3];
+};
+
+enum GpuInstanceFlag
+{
+    GpuInstanceFlag_Static = 1 << 0,
+};
+
+// A submesh of an entity. Must match shaders.glsl (std430).
+struct GpuInstance
+{
+    glm::vec4 bounds;       // World bounding sphere of the entity
+    u32       batch;
+    u32       matrixOffset; // World matrix of the entity in the cbuffer, in vec4s
+    u32       material;
+    u32       flags;
+    glm::vec4 boxCenter;    // Model space bounding box of the mesh, for the occlusion test. w unused.
+    glm::vec4 boxExtent;    // Half size, w unused
+};
+
+// The instances of one model submesh level. Must match shaders.glsl (std430).
+struct GpuBatch
+{
+    u32 indexCount;
+    u32 firstIndex;
+    i32 baseVertex;      // From the vertices of the VAO of its group
+    u32 firstInstance;   // Of its slice of the visible instances of a pass
+    u32 group;
+    u32 groupFirstBatch;
+    u32 firstMeshlet;      // In App::meshlets
+    u32 meshletCount;      // The instances are drawn by meshlet when not 0
+    u32 groupFirstCluster; // Of the cluster commands of its group
+    u32 padding[3];
+};
+
+// Batches sharing a VAO, drawn by one multi draw: the submeshes of a model with the same vertex layout
+struct GpuDrawGroup
+{
+    u32 meshIdx;
+    u32 vaoSubmesh;
+    u32 firstBatch;
+    u32 batchCount;
+    u32 firstCluster; // Of the cluster commands of a pass
+    u32 clusterCount; // Every meshlet of every instance of its meshlet batches
+};
+
+// Must match shaders.glsl (std430)
+struct GpuCullStats
+{
+    u32 culledInstances;
+    u32 testedMeshlets;
+    u32 culledMeshlets;
+};
+
+// Layout of GL_DRAW_INDIRECT_BUFFER commands for glMultiDrawElementsIndirectCount()
+struct IndirectDrawCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    i32 baseVertex;
+    u32 baseInstance;
+};
+
+// The instances of one frame, built by the game thread
+struct GpuCullingFrame
+{
+    bool                      enabled;       // The passes draw the culled batches instead of recording every entity
+    bool                      shadowCasters; // The shadow cascades too, which needs layered rendering
+    std::vector<GpuInstance>  instances;
+    std::vector<GpuBatch>     batches;
+    std::vector<GpuDrawGroup> groups;
+    u32                       clusterCount; // Cluster commands of a pass, after its batch commands
+    CullPassParams            passes[CullPass_Count];
+};
+
+// Mip chain of a depth buffer, each texel reducing the texels it covers to one depth
+struct DepthPyramid
+{
+    GLuint     texture;
+    glm::ivec2 size; // Of level 0, the display size rounded down to powers of 2
+    u32        levels;
+};
+
+struct GpuCulling
+{
+    // Settings
+    bool enabled;
+    bool occlusion;
+    bool meshlets;
+
+    bool supported;         // GL_ARB_indirect_parameters and GL_ARB_shader_draw_parameters
+    bool meshletsSupported; // Enough storage blocks in a compute shader
+
+    u32 cullProgramIdx;
+    u32 compactProgramIdx;
+    u32 depthPyramidProgramIdx;
+
+    // Render thread
+    DepthPyramid depthPyramid;
+    glm::mat4    depthPyramidViewProjection; // Camera the pyramid was built with
+    bool         depthPyramidValid;
+
+    GLuint instanceBuffer;
+    GLuint batchBuffer;
+    GLuint passBuffer;
+    GLuint instanceCountBuffer; // Per pass and batch
+    GLuint visibleBuffer;       // Per pass and instance: world matrix offset and material
+    GLuint commandBuffer;       // Per pass: per batch packed per group, then the cluster commands of every group
+    GLuint drawCountBuffer;     // Per pass: per group for the batches, then per group for the clusters
+    u32    instanceCapacity;
+    u32    batchCapacity;
+    u32    commandCapacity;
+    u32    groupCapacity;
+
+    GLuint statsBuffers[GPU_CULL_STATS_BUFFERS]; // GpuCullStats of the main pass, read back GPU_CULL_STATS_BUFFERS - 1 frames later
+    GLsync statsFences[GPU_CULL_STATS_BUFFERS];  // Of the dispatch that last wrote each buffer, 0 once read
+    u32    statsFrame;
+
+    std::atomic<u32> culledInstances; // Last read back, for the GUI
+    std::atomic<u32> testedInstances;
+    std::atomic<u32> culledMeshlets;
+    std::atomic<u32> testedMeshlets;
+};
+
+// Loads the compute programs and creates the buffers
+void InitGpuCulling(App* app);
+
+/**
+ * Game thread: gathers the instances and batches of the packet draws and the camera of
+ * every pass. Call it once the draws and the shadow cascades are in the packet.
+ */
+void BuildGpuCullingFrame(App* app, FramePacket& packet);
+
+// Game thread: records one multi draw per group, for the program the list has bound
+void RecordCulledDraws(const FramePacket& packet, CullPass pass, CommandList& list);
+
+/**
+ * Render thread: uploads the instances, culls them for every active pass and binds the
+ * visible instances for the GPU_DRIVEN programs. Call it before the first pass.
+ */
+void CullGpuDraws(App* app, const FramePacket& packet);
+
+// Render thread: reduces the depth the main pass wrote into the pyramid the next frame tests against
+void BuildDepthPyramid(App* app, const FramePacket& packet, GLuint depthTexture);
+
+/**
+ * Render thread: reduces a depth texture of the display size into a pyramid with a
+ * DEPTH_PYRAMID program, which picks the depth each texel keeps. Creates the pyramid, or
+ * recreates it when the display size changed.
+ */
+void ReduceDepthPyramid(App* app, const FramePacket& packet, u32 programIdx, GLuint depthTexture, DepthPyramid& pyramid);
@@ -0,0 +1,175 @@
+#include "memory_arena.h"
+
+#ifdef _WIN32
+#define VC_EXTRALEAN
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <mutex>
+
+// Pages are committed in chunks this big, so growing does not cost a system call per push
+#define ARENA_COMMIT_GRANULARITY KB(64)
+
+static u64 AlignUp(u64 value, u64 alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool InitArena(MemoryArena& arena, u64 reserveSize)
+{
+    reserveSize = AlignUp(reserveSize, ARENA_COMMIT_GRANULARITY);
+
+#ifdef _WIN32
+    void* base = VirtualAlloc(NULL, reserveSize, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void* base = mmap(NULL, reserveSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        base = NULL;
+#endif
+
+    if (!base)
+    {
+        ELOG("Could not reserve %llu bytes for a memory arena", reserveSize);
+        return false;
+    }
+
+    arena.base = (u8*)base;
+    arena.reserved = reserveSize;
+    arena.head = 0;
+    arena.committed = 0;
+    arena.highWater = 0;
+    return true;
+}
+
+void ReleaseArena(MemoryArena& arena)
+{
+    if (!arena.base)
+        return;
+
+#ifdef _WIN32
+    VirtualFree(arena.base, 0, MEM_RELEASE);
+#else
+    munmap(arena.base, arena.reserved);
+#endif
+
+    arena.base = NULL;
+    arena.reserved = 0;
+    arena.head = 0;
+    arena.committed = 0;
+}
+
+static void CommitArenaPages(MemoryArena& arena, u64 requiredSize)
+{
+    const u64 committed = arena.committed.load(std::memory_order_relaxed);
+    const u64 newCommitted = glm::min(AlignUp(requiredSize, ARENA_COMMIT_GRANULARITY), arena.reserved);
+
+#ifdef _WIN32
+    const bool success = VirtualAlloc(arena.base + committed, newCommitted - committed, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    const bool success = mprotect(arena.base + committed, newCommitted - committed, PROT_READ | PROT_WRITE) == 0;
+#endif
+
+    ASSERT(success, "Could not commit memory arena pages");
+    arena.committed.store(newCommitted, std::memory_order_relaxed);
+}
+
+void* ArenaPush(MemoryArena& arena, u64 size, u64 alignment)
+{
+    ASSERT(alignment && !(alignment & (alignment - 1)), "The alignment must be a power of 2");
+
+    const u64 offset = AlignUp(arena.head, alignment);
+    const u64 newHead = offset + size;
+    ASSERT(newHead <= arena.reserved, "Trying to allocate more temp memory than reserved");
+
+    if (newHead > arena.committed.load(std::memory_order_relaxed))
+        CommitArenaPages(arena, newHead);
+
+    arena.head = newHead;
+    if (newHead > arena.highWater.load(std::memory_order_relaxed))
+        arena.highWater.store(newHead, std::memory_order_relaxed);
+
+    return arena.base + offset;
+}
+
+void* ArenaPushBytes(MemoryArena& arena, const void* bytes, u64 size, u64 alignment)
+{
+    void* destination = ArenaPush(arena, size, alignment);
+    memcpy(destination, bytes, size);
+    return destination;
+}
+
+struct ThreadFrameArena
+{
+    MemoryArena arena;
+    char        name[32];
+
+    ThreadFrameArena();
+    ~ThreadFrameArena();
+};
+
+static std::mutex                     FrameArenasMutex;
+static std::vector<ThreadFrameArena*> FrameArenas;
+static std::atomic<u64>               FrameArenaReserveSize(FRAME_ARENA_DEFAULT_RESERVE);
+static u32                            FrameArenaCount = 0;
+
+ThreadFrameArena::ThreadFrameArena()
+{
+    InitArena(arena, FrameArenaReserveSize);
+
+    std::lock_guard<std::mutex> lock(FrameArenasMutex);
+    snprintf(name, sizeof(name), "Thread %u", FrameArenaCount++);
+    FrameArenas.push_back(this);
+}
+
+ThreadFrameArena::~ThreadFrameArena()
+{
+    {
+        std::lock_guard<std::mutex> lock(FrameArenasMutex);
+        FrameArenas.erase(std::find(FrameArenas.begin(), FrameArenas.end(), this));
+    }
+    ReleaseArena(arena);
+}
+
+static ThreadFrameArena& GetThreadFrameArenaEntry()
+{
+    static thread_local ThreadFrameArena threadArena;
+    return threadArena;
+}
+
+void SetFrameArenaReserveSize(u64 reserveSize)
+{
+    FrameArenaReserveSize = reserveSize;
+}
+
+MemoryArena& GetThreadFrameArena()
+{
+    return GetThreadFrameArenaEntry().arena;
+}
+
+void SetThreadFrameArenaName(const char* name)
+{
+    ThreadFrameArena& entry = GetThreadFrameArenaEntry();
+
+    std::lock_guard<std::mutex> lock(FrameArenasMutex);
+    snprintf(entry.name, sizeof(entry.name), "%s", name);
+}
+
+u32 GetFrameArenaStats(FrameArenaStats* stats, u32 maxCount)
+{
+    std::lock_guard<std::mutex> lock(FrameArenasMutex);
+
+    const u32 count = glm::min((u32)FrameArenas.size(), maxCount);
+    for (u32 i = 0; i < count; ++i)
+    {
+        const ThreadFrameArena& entry = *FrameArenas[i];
+        memcpy(stats[i].name, entry.name, sizeof(stats[i].name));
+        stats[i].highWater = entry.arena.highWater.load(std::memory_order_relaxed);
+        stats[i].committed = entry.arena.committed.load(std::memory_order_relaxed);
+        stats[i].reserved = entry.arena.reserved;
+    }
+    return count;
+}
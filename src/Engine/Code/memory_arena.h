@@ -0,0 +1,105 @@
+//
+// memory_arena.h: Linear allocators over a reserved range of virtual memory. Pages are
+// committed as the arena grows, so the reservation can be generous and only what is used
+// costs memory. Markers rewind the arena to an earlier point, for scratch allocations
+// that die before the frame ends.
+//
+// Every thread gets its own frame arena (GetThreadFrameArena), so threads never share an
+// allocation head. PushSize/PushBytes/PushChar and the String helpers use it.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+
+struct MemoryArena
+{
+    u8* base;
+    u64 reserved;
+    u64 head;
+
+    // Written by the owning thread, read by the stats display on others
+    std::atomic<u64> committed;
+    std::atomic<u64> highWater;
+};
+
+struct ArenaMarker
+{
+    MemoryArena* arena;
+    u64          head;
+};
+
+/**
+ * Reserves reserveSize bytes of address space without committing any of it. Returns
+ * false if the reservation fails.
+ */
+bool InitArena(MemoryArena& arena, u64 reserveSize);
+
+void ReleaseArena(MemoryArena& arena);
+
+// Allocates uninitialized memory, committing more pages if the arena needs to grow
+void* ArenaPush(MemoryArena& arena, u64 size, u64 alignment = 8);
+
+void* ArenaPushBytes(MemoryArena& arena, const void* bytes, u64 size, u64 alignment = 1);
+
+inline ArenaMarker GetArenaMarker(MemoryArena& arena)
+{
+    return { &arena, arena.head };
+}
+
+// Frees everything allocated after the marker was taken. Committed pages are kept for reuse.
+inline void RestoreArenaMarker(const ArenaMarker& marker)
+{
+    ASSERT(marker.head <= marker.arena->head, "Restoring a marker that was already rewound past");
+    marker.arena->head = marker.head;
+}
+
+inline void ResetArena(MemoryArena& arena)
+{
+    arena.head = 0;
+}
+
+// Rewinds the arena when it goes out of scope
+struct ScopedArenaMarker
+{
+    ArenaMarker marker;
+
+    explicit ScopedArenaMarker(MemoryArena& arena) : marker(GetArenaMarker(arena)) {}
+    ~ScopedArenaMarker() { RestoreArenaMarker(marker); }
+
+    ScopedArenaMarker(const ScopedArenaMarker&) = delete;
+    ScopedArenaMarker& operator=(const ScopedArenaMarker&) = delete;
+};
+
+/**
+ * Address space reserved for each thread frame arena created from now on. Call it before
+ * spawning threads to change the default of FRAME_ARENA_DEFAULT_RESERVE bytes.
+ */
+#define FRAME_ARENA_DEFAULT_RESERVE ((u64)GB(1))
+void SetFrameArenaReserveSize(u64 reserveSize);
+
+/**
+ * The frame arena of the calling thread, reserved the first time it is used. Threads
+ * with a frame loop reset it once per frame with ResetFrameArena(); job code should
+ * rewind what it allocates with a ScopedArenaMarker instead.
+ */
+MemoryArena& GetThreadFrameArena();
+
+// Names the calling thread frame arena in the stats
+void SetThreadFrameArenaName(const char* name);
+
+// Enough for the main, render and every worker thread
+#define MAX_FRAME_ARENA_STATS 66
+
+struct FrameArenaStats
+{
+    char name[32];
+    u64  highWater;
+    u64  committed;
+    u64  reserved;
+};
+
+// Fills up to maxCount entries, one per live thread frame arena. Returns how many were written.
+u32 GetFrameArenaStats(FrameArenaStats* stats, u32 maxCount);
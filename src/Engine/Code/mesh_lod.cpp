@@ -0,0 +1,301 @@
+#include "mesh_lod.h"
+
+#include <algorithm>
+
+#define LOD_MIN_SHRINK 0.8f // A level keeping more than this fraction of the previous level's triangles is not worth it
+
+void InitMeshLodSettings(MeshLodSettings& settings)
+{
+    settings.enabled = true;
+    settings.screenSizes[0] = 0.3f;
+    settings.screenSizes[1] = 0.12f;
+    settings.screenSizes[2] = 0.05f;
+    settings.hysteresis = 0.1f;
+}
+
+// Sum of the squared distances to a set of planes, as the symmetric 4x4 matrix of Garland and Heckbert
+struct Quadric
+{
+    f64 a00, a01, a02, a03;
+    f64 a11, a12, a13;
+    f64 a22, a23;
+    f64 a33;
+};
+
+static void AddPlane(Quadric& q, const glm::dvec3& n, f64 d)
+{
+    q.a00 += n.x * n.x; q.a01 += n.x * n.y; q.a02 += n.x * n.z; q.a03 += n.x * d;
+    q.a11 += n.y * n.y; q.a12 += n.y * n.z; q.a13 += n.y * d;
+    q.a22 += n.z * n.z; q.a23 += n.z * d;
+    q.a33 += d * d;
+}
+
+static Quadric AddQuadrics(const Quadric& a, const Quadric& b)
+{
+    return { a.a00 + b.a00, a.a01 + b.a01, a.a02 + b.a02, a.a03 + b.a03,
+             a.a11 + b.a11, a.a12 + b.a12, a.a13 + b.a13,
+             a.a22 + b.a22, a.a23 + b.a23,
+             a.a33 + b.a33 };
+}
+
+static f64 EvaluateQuadric(const Quadric& q, const glm::vec3& p)
+{
+    const f64 x = p.x, y = p.y, z = p.z;
+    return q.a00 * x * x + 2.0 * q.a01 * x * y + 2.0 * q.a02 * x * z + 2.0 * q.a03 * x
+         + q.a11 * y * y + 2.0 * q.a12 * y * z + 2.0 * q.a13 * y
+         + q.a22 * z * z + 2.0 * q.a23 * z
+         + q.a33;
+}
+
+// Half edge collapses only: a vertex moves onto a neighbour, so every level indexes the original vertices
+struct Simplifier
+{
+    std::vector<glm::vec3>        positions;
+    std::vector<Quadric>          quadrics;
+    std::vector<u8>               locked;  // On an open edge or an attribute seam
+    std::vector<u8>               removed; // Collapsed onto a neighbour
+    std::vector<std::vector<u32>> vertexTriangles;
+    std::vector<u32>              triangles;
+    std::vector<u8>               triangleAlive;
+    u32                           triangleCount;
+};
+
+static void InitSimplifier(Simplifier& s, const f32* vertices, u32 vertexStride, u32 vertexCount, const std::vector<u32>& indices)
+{
+    s.positions.resize(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+        s.positions[v] = glm::make_vec3(vertices + v * vertexStride);
+
+    s.triangles = indices;
+    s.triangleCount = (u32)indices.size() / 3;
+    s.triangleAlive.assign(s.triangleCount, 1);
+    s.quadrics.assign(vertexCount, Quadric{});
+    s.locked.assign(vertexCount, 0);
+    s.removed.assign(vertexCount, 0);
+    s.vertexTriangles.assign(vertexCount, std::vector<u32>());
+
+    std::vector<u64> edges;
+    edges.reserve(indices.size());
+
+    for (u32 t = 0; t < s.triangleCount; ++t)
+    {
+        const u32* tri = &s.triangles[t * 3];
+        const glm::vec3 p0 = s.positions[tri[0]];
+        const glm::dvec3 normal = glm::cross(glm::dvec3(s.positions[tri[1]] - p0), glm::dvec3(s.positions[tri[2]] - p0));
+        const f64 length = glm::length(normal);
+
+        for (u32 corner = 0; corner < 3; ++corner)
+        {
+            s.vertexTriangles[tri[corner]].push_back(t);
+
+            if (length > 0.0)
+                AddPlane(s.quadrics[tri[corner]], normal / length, -glm::dot(normal / length, glm::dvec3(p0)));
+
+            const u32 a = tri[corner];
+            const u32 b = tri[(corner + 1) % 3];
+            edges.push_back(((u64)glm::min(a, b) << 32) | glm::max(a, b));
+        }
+    }
+
+    // Seams split the vertices of a position, so the edges along them have a single
+    // triangle per vertex pair, just like open edges. Both keep their vertices in place.
+    std::sort(edges.begin(), edges.end());
+    for (u32 i = 0; i < edges.size();)
+    {
+        u32 count = 1;
+        while (i + count < edges.size() && edges[i + count] == edges[i])
+            count++;
+
+        if (count != 2)
+        {
+            s.locked[(u32)(edges[i] >> 32)] = 1;
+            s.locked[(u32)(edges[i] & 0xFFFFFFFF)] = 1;
+        }
+        i += count;
+    }
+}
+
+// Would moving the vertex onto the target turn one of its remaining triangles over?
+static bool CollapseFlips(const Simplifier& s, u32 from, u32 to)
+{
+    for (u32 t : s.vertexTriangles[from])
+    {
+        if (!s.triangleAlive[t])
+            continue;
+
+        const u32* tri = &s.triangles[t * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+            continue;
+
+        glm::vec3 before[3], after[3];
+        for (u32 corner = 0; corner < 3; ++corner)
+        {
+            before[corner] = s.positions[tri[corner]];
+            after[corner] = tri[corner] == from ? s.positions[to] : before[corner];
+        }
+
+        const glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+        const glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+        if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+            return true;
+    }
+    return false;
+}
+
+static void Collapse(Simplifier& s, u32 from, u32 to)
+{
+    for (u32 t : s.vertexTriangles[from])
+    {
+        if (!s.triangleAlive[t])
+            continue;
+
+        u32* tri = &s.triangles[t * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+        {
+            s.triangleAlive[t] = 0;
+            s.triangleCount--;
+            continue;
+        }
+
+        for (u32 corner = 0; corner < 3; ++corner)
+        {
+            if (tri[corner] == from)
+                tri[corner] = to;
+        }
+        s.vertexTriangles[to].push_back(t);
+    }
+
+    s.quadrics[to] = AddQuadrics(s.quadrics[to], s.quadrics[from]);
+    s.removed[from] = 1;
+    s.vertexTriangles[from].clear();
+}
+
+/**
+ * Collapses the cheapest edges until triangleTarget is reached. The costs are computed up
+ * front, so a vertex whose neighbourhood changed waits for the next pass. Returns how many
+ * collapses were done.
+ */
+static u32 CollapsePass(Simplifier& s, u32 triangleTarget, f64 maxCost)
+{
+    struct Candidate
+    {
+        f64 cost;
+        u32 from;
+        u32 to;
+    };
+
+    std::vector<Candidate> candidates;
+    for (u32 v = 0; v < s.positions.size(); ++v)
+    {
+        if (s.locked[v] || s.removed[v])
+            continue;
+
+        Candidate best = { maxCost, UINT32_MAX, UINT32_MAX };
+        for (u32 t : s.vertexTriangles[v])
+        {
+            if (!s.triangleAlive[t])
+                continue;
+
+            for (u32 corner = 0; corner < 3; ++corner)
+            {
+                const u32 to = s.triangles[t * 3 + corner];
+                if (to == v)
+                    continue;
+
+                const f64 cost = EvaluateQuadric(AddQuadrics(s.quadrics[v], s.quadrics[to]), s.positions[to]);
+                if (cost <= best.cost)
+                    best = { cost, v, to };
+            }
+        }
+
+        if (best.from != UINT32_MAX)
+            candidates.push_back(best);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.cost < b.cost; });
+
+    std::vector<u8> touched(s.positions.size(), 0);
+    u32 collapses = 0;
+
+    for (const Candidate& candidate : candidates)
+    {
+        if (s.triangleCount <= triangleTarget)
+            break;
+        if (touched[candidate.from] || touched[candidate.to] || CollapseFlips(s, candidate.from, candidate.to))
+            continue;
+
+        for (u32 t : s.vertexTriangles[candidate.from])
+        {
+            if (s.triangleAlive[t])
+            {
+                for (u32 corner = 0; corner < 3; ++corner)
+                    touched[s.triangles[t * 3 + corner]] = 1;
+            }
+        }
+
+        Collapse(s, candidate.from, candidate.to);
+        collapses++;
+    }
+
+    return collapses;
+}
+
+u32 BuildMeshLods(const f32* vertices, u32 vertexStride, u32 vertexCount, const std::vector<u32>& indices, f32 maxError, std::vector<u32> lods[MESH_MAX_LODS - 1])
+{
+    Simplifier s;
+    InitSimplifier(s, vertices, vertexStride, vertexCount, indices);
+
+    const f64 maxCost = (f64)maxError * (f64)maxError;
+    u32 previousTriangles = s.triangleCount;
+    u32 lodCount = 0;
+
+    while (lodCount < MESH_MAX_LODS - 1)
+    {
+        const u32 triangleTarget = previousTriangles / 2;
+        while (s.triangleCount > triangleTarget)
+        {
+            if (CollapsePass(s, triangleTarget, maxCost) == 0)
+                break;
+        }
+
+        if (s.triangleCount == 0 || s.triangleCount > previousTriangles * LOD_MIN_SHRINK)
+            break;
+
+        std::vector<u32>& lod = lods[lodCount++];
+        lod.clear();
+        lod.reserve(s.triangleCount * 3);
+        for (u32 t = 0; t < s.triangleAlive.size(); ++t)
+        {
+            if (s.triangleAlive[t])
+                lod.insert(lod.end(), &s.triangles[t * 3], &s.triangles[t * 3] + 3);
+        }
+
+        previousTriangles = s.triangleCount;
+    }
+
+    return lodCount;
+}
+
+f32 ProjectedSphereSize(const glm::vec4& bounds, const glm::vec3& eye, f32 projectionScale)
+{
+    const f32 distance = glm::distance(glm::vec3(bounds), eye);
+    if (distance <= bounds.w)
+        return FLT_MAX;
+
+    return bounds.w * projectionScale / distance;
+}
+
+u32 SelectLod(const MeshLodSettings& settings, f32 screenSize, u32 lodCount, u32 currentLod)
+{
+    u32 lod = 0;
+    while (lod + 1 < lodCount)
+    {
+        // Each threshold is pushed away from the current level, so leaving it takes the margin
+        const bool currentIsCoarser = lod + 1 <= currentLod;
+        const f32 threshold = settings.screenSizes[lod] * (currentIsCoarser ? 1.0f + settings.hysteresis : 1.0f - settings.hysteresis);
+        if (screenSize >= threshold)
+            break;
+        lod++;
+    }
+    return lod;
+}
@@ -0,0 +1,52 @@
+//
+// mesh_lod.h: Levels of detail of the imported meshes. Each level is a coarser index list
+// over the vertices of its submesh, made at import time by collapsing the edges that move
+// the surface the least, measured with the quadric error of Garland and Heckbert. The
+// levels share the vertices and VAOs of their submesh, and their indices follow the ones
+// of the submesh in the index buffer of the mesh.
+//
+// The game thread picks one level per entity from how large its bounding sphere is on
+// screen. A threshold must be passed by a margin before the level changes back, so an
+// entity sitting right at a threshold does not flip between two levels every frame.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define MESH_MAX_LODS 4 // Including the full detail one
+
+// Index range of one level, in the index buffer of the mesh
+struct SubmeshLod
+{
+    u32 index_count;
+    u32 index_offset; // In bytes
+};
+
+struct MeshLodSettings
+{
+    bool enabled;
+    f32  screenSizes[MESH_MAX_LODS - 1]; // Bounding sphere diameter over the screen height below which the next level is drawn
+    f32  hysteresis;                     // Fraction of a threshold the size must pass it by to change the level
+
+    // Last frame, for the GUI
+    u32 triangles;
+    u32 fullDetailTriangles;
+};
+
+void InitMeshLodSettings(MeshLodSettings& settings);
+
+/**
+ * Simplifies a triangle list into coarser levels, each with about half the triangles of
+ * the previous one. Only the first 3 floats of a vertex (the position) are read. Vertices
+ * on open edges and on attribute seams never move, so the levels keep the outline and
+ * texture mapping of the mesh. Stops early once a collapse would move the surface more
+ * than maxError or a level barely shrinks. Returns how many levels were written.
+ */
+u32 BuildMeshLods(const f32* vertices, u32 vertexStride, u32 vertexCount, const std::vector<u32>& indices, f32 maxError, std::vector<u32> lods[MESH_MAX_LODS - 1]);
+
+// Bounding sphere diameter over the screen height, from the projection's [1][1] (the cotangent of half the vertical fov)
+f32 ProjectedSphereSize(const glm::vec4& bounds, const glm::vec3& eye, f32 projectionScale);
+
+// The level for the size, keeping the current one until a threshold is passed by the hysteresis margin
+u32 SelectLod(const MeshLodSettings& settings, f32 screenSize, u32 lodCount, u32 currentLod);
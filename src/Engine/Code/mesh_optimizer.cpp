@@ -0,0 +1,293 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+
+// Tuning of Forsyth's vertex scores, from his paper
+#define FORSYTH_CACHE_SIZE 32
+#define FORSYTH_CACHE_DECAY_POWER 1.5f
+#define FORSYTH_LAST_TRIANGLE_SCORE 0.75f
+#define FORSYTH_VALENCE_BOOST_SCALE 2.0f
+#define FORSYTH_VALENCE_BOOST_POWER 0.5f
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount)
+{
+    VertexCacheStats stats = {};
+    if (indices.empty())
+        return stats;
+
+    // A vertex is in the FIFO while fewer than its size misses happened since it was loaded
+    std::vector<u32> loadedAt(vertexCount, 0);
+    std::vector<u8> referenced(vertexCount, 0);
+    u32 misses = 0;
+    u32 referencedCount = 0;
+
+    for (u32 index : indices)
+    {
+        if (!referenced[index])
+        {
+            referenced[index] = 1;
+            referencedCount++;
+        }
+
+        if (loadedAt[index] == 0 || misses - loadedAt[index] + 1 > VERTEX_CACHE_ANALYSIS_SIZE)
+        {
+            misses++;
+            loadedAt[index] = misses;
+        }
+    }
+
+    stats.acmr = (f32)misses / (f32)(indices.size() / 3);
+    stats.atvr = (f32)misses / (f32)referencedCount;
+    return stats;
+}
+
+static f32 ForsythVertexScore(i32 cachePosition, u32 liveTriangles)
+{
+    if (liveTriangles == 0)
+        return -1.0f;
+
+    f32 score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The last triangle's vertices get a fixed score, so its neighbours don't win just for sharing an edge
+        if (cachePosition < 3)
+            score = FORSYTH_LAST_TRIANGLE_SCORE;
+        else
+            score = powf(1.0f - (f32)(cachePosition - 3) / (f32)(FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY_POWER);
+    }
+
+    // Vertices with few triangles left are finished first, so they don't linger as lone triangles
+    return score + FORSYTH_VALENCE_BOOST_SCALE * powf((f32)liveTriangles, -FORSYTH_VALENCE_BOOST_POWER);
+}
+
+void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount)
+{
+    const u32 triangleCount = (u32)indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // The triangles of every vertex, packed, the live ones first
+    std::vector<u32> liveTriangles(vertexCount, 0);
+    for (u32 index : indices)
+        liveTriangles[index]++;
+
+    std::vector<u32> firstTriangle(vertexCount + 1, 0);
+    for (u32 v = 0; v < vertexCount; ++v)
+        firstTriangle[v + 1] = firstTriangle[v] + liveTriangles[v];
+
+    std::vector<u32> vertexTriangles(indices.size());
+    std::vector<u32> cursor(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (u32 i = 0; i < indices.size(); ++i)
+        vertexTriangles[cursor[indices[i]]++] = i / 3;
+
+    std::vector<i32> cachePosition(vertexCount, -1);
+    std::vector<f32> vertexScore(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+        vertexScore[v] = ForsythVertexScore(-1, liveTriangles[v]);
+
+    std::vector<f32> triangleScore(triangleCount);
+    std::vector<u8> emitted(triangleCount, 0);
+    u32 bestTriangle = 0;
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+        if (triangleScore[t] > triangleScore[bestTriangle])
+            bestTriangle = t;
+    }
+
+    u32 cache[FORSYTH_CACHE_SIZE + 3];
+    u32 cacheCount = 0;
+    u32 scanCursor = 0;
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+
+    while (result.size() < indices.size())
+    {
+        // Nothing around the cache is left, so the order restarts from the next triangle not drawn
+        if (bestTriangle == UINT32_MAX)
+        {
+            while (emitted[scanCursor])
+                scanCursor++;
+            bestTriangle = scanCursor;
+        }
+
+        const u32* triangle = &indices[bestTriangle * 3];
+        result.insert(result.end(), triangle, triangle + 3);
+        emitted[bestTriangle] = 1;
+
+        // Its vertices move to the front of the LRU cache, the others shift back
+        u32 newCache[FORSYTH_CACHE_SIZE + 3];
+        u32 newCacheCount = 0;
+        for (u32 corner = 0; corner < 3; ++corner)
+            newCache[newCacheCount++] = triangle[corner];
+        for (u32 i = 0; i < cacheCount; ++i)
+        {
+            if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+                newCache[newCacheCount++] = cache[i];
+        }
+
+        for (u32 corner = 0; corner < 3; ++corner)
+        {
+            const u32 v = triangle[corner];
+            u32* live = &vertexTriangles[firstTriangle[v]];
+            for (u32 i = 0; i < liveTriangles[v]; ++i)
+            {
+                if (live[i] == bestTriangle)
+                {
+                    std::swap(live[i], live[liveTriangles[v] - 1]);
+                    liveTriangles[v]--;
+                    break;
+                }
+            }
+        }
+
+        // The vertices pushed out of the cache are rescored too
+        for (u32 i = 0; i < newCacheCount; ++i)
+        {
+            const u32 v = newCache[i];
+            cachePosition[v] = i < FORSYTH_CACHE_SIZE ? (i32)i : -1;
+            vertexScore[v] = ForsythVertexScore(cachePosition[v], liveTriangles[v]);
+        }
+
+        // Only the triangles around the cache changed score, the best of them is next
+        bestTriangle = UINT32_MAX;
+        f32 bestScore = -FLT_MAX;
+        for (u32 i = 0; i < newCacheCount; ++i)
+        {
+            const u32 v = newCache[i];
+            for (u32 j = 0; j < liveTriangles[v]; ++j)
+            {
+                const u32 t = vertexTriangles[firstTriangle[v] + j];
+                triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    bestTriangle = t;
+                }
+            }
+        }
+
+        cacheCount = glm::min(newCacheCount, (u32)FORSYTH_CACHE_SIZE);
+        memcpy(cache, newCache, cacheCount * sizeof(u32));
+    }
+
+    indices.swap(result);
+}
+
+void OptimizeOverdraw(std::vector<u32>& indices, const f32* vertices, u32 vertexStride, u32 vertexCount)
+{
+    const u32 triangleCount = (u32)indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    struct Cluster
+    {
+        u32 firstTriangle;
+        u32 triangleCount;
+        f32 outwardness; // How much the cluster faces away from the center of the mesh
+    };
+
+    // A cluster starts wherever the cache order restarted, at a triangle missing the cache on every vertex
+    std::vector<Cluster> clusters;
+    std::vector<u32> loadedAt(vertexCount, 0);
+    u32 misses = 0;
+
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        u32 triangleMisses = 0;
+        for (u32 corner = 0; corner < 3; ++corner)
+        {
+            const u32 index = indices[t * 3 + corner];
+            if (loadedAt[index] == 0 || misses - loadedAt[index] + 1 > VERTEX_CACHE_ANALYSIS_SIZE)
+            {
+                misses++;
+                loadedAt[index] = misses;
+                triangleMisses++;
+            }
+        }
+
+        if (t == 0 || triangleMisses == 3)
+            clusters.push_back({ t, 0, 0.0f });
+        clusters.back().triangleCount++;
+    }
+
+    // Area weighted centroids and normals
+    glm::vec3 meshCentroid = glm::vec3(0.0f);
+    f32 meshArea = 0.0f;
+    std::vector<glm::vec3> clusterCentroids(clusters.size(), glm::vec3(0.0f));
+    std::vector<glm::vec3> clusterNormals(clusters.size(), glm::vec3(0.0f));
+
+    for (u32 c = 0; c < clusters.size(); ++c)
+    {
+        f32 clusterArea = 0.0f;
+        for (u32 t = clusters[c].firstTriangle; t < clusters[c].firstTriangle + clusters[c].triangleCount; ++t)
+        {
+            const glm::vec3 p0 = glm::make_vec3(vertices + indices[t * 3] * vertexStride);
+            const glm::vec3 p1 = glm::make_vec3(vertices + indices[t * 3 + 1] * vertexStride);
+            const glm::vec3 p2 = glm::make_vec3(vertices + indices[t * 3 + 2] * vertexStride);
+            const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const f32 area = glm::length(normal);
+
+            clusterCentroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+            clusterNormals[c] += normal;
+            clusterArea += area;
+        }
+
+        meshCentroid += clusterCentroids[c];
+        meshArea += clusterArea;
+        if (clusterArea > 0.0f)
+            clusterCentroids[c] /= clusterArea;
+    }
+
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    for (u32 c = 0; c < clusters.size(); ++c)
+    {
+        const f32 normalLength = glm::length(clusterNormals[c]);
+        clusters[c].outwardness = normalLength > 0.0f ? glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c] / normalLength) : 0.0f;
+    }
+
+    // Outward facing clusters are the likely occluders of a roughly convex mesh, so they go first
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.outwardness > b.outwardness; });
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+    for (const Cluster& cluster : clusters)
+        result.insert(result.end(), &indices[cluster.firstTriangle * 3], &indices[cluster.firstTriangle * 3] + cluster.triangleCount * 3);
+
+    indices.swap(result);
+}
+
+u32 OptimizeVertexFetch(std::vector<f32>& vertices, u32 vertexStride, std::vector<u32>* lists, u32 listCount)
+{
+    const u32 vertexCount = (u32)vertices.size() / vertexStride;
+
+    std::vector<u32> remap(vertexCount, UINT32_MAX);
+    u32 newVertexCount = 0;
+    for (u32 l = 0; l < listCount; ++l)
+    {
+        for (u32 index : lists[l])
+        {
+            if (remap[index] == UINT32_MAX)
+                remap[index] = newVertexCount++;
+        }
+    }
+
+    std::vector<f32> result(newVertexCount * vertexStride);
+    for (u32 v = 0; v < vertexCount; ++v)
+    {
+        if (remap[v] != UINT32_MAX)
+            memcpy(&result[remap[v] * vertexStride], &vertices[v * vertexStride], vertexStride * sizeof(f32));
+    }
+
+    for (u32 l = 0; l < listCount; ++l)
+    {
+        for (u32& index : lists[l])
+            index = remap[index];
+    }
+
+    vertices.swap(result);
+    return newVertexCount;
+}
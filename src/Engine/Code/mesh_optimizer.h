@@ -0,0 +1,37 @@
+//
+// mesh_optimizer.h: Reorders the triangles and vertices of the imported meshes for the
+// GPU. The triangles are ordered so the post-transform cache reuses vertices as much as
+// possible (Tom Forsyth's linear-speed vertex cache optimization), then the clusters that
+// ordering produced are sorted so the ones facing outwards draw first and hide the rest,
+// which cuts overdraw without breaking the cache order inside a cluster. Last, the
+// vertices are moved into the order the indices first use them, so the vertex fetch reads
+// memory forward.
+//
+// ACMR is the average number of vertices transformed per triangle (0.5 at best on a
+// regular grid, 3 at worst), ATVR the transformed vertices over the vertex count (1 at best).
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define VERTEX_CACHE_ANALYSIS_SIZE 16 // FIFO entries of the simulated post-transform cache
+
+struct VertexCacheStats
+{
+    f32 acmr;
+    f32 atvr;
+};
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount);
+
+void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount);
+
+// Keeps the cache order inside each cluster of a cache optimized triangle list. Only the first 3 floats of a vertex are read.
+void OptimizeOverdraw(std::vector<u32>& indices, const f32* vertices, u32 vertexStride, u32 vertexCount);
+
+/**
+ * Moves the vertices into the order the index lists first use them, lists[0] first, and
+ * remaps every list. Vertices no list uses are dropped. Returns the new vertex count.
+ */
+u32 OptimizeVertexFetch(std::vector<f32>& vertices, u32 vertexStride, std::vector<u32>* lists, u32 listCount);
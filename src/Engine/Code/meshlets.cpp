@@ -0,0 +1,166 @@
+#include "meshlets.h"
+
+#include <algorithm>
+
+// Below this, the normals spread too wide for the cone to ever cull
+#define MESHLET_MIN_CONE_DOT 0.1f
+
+static void ComputeMeshletBounds(const f32* vertices, u32 vertexStride, const u32* indices, Meshlet& meshlet)
+{
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+    glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+    glm::vec3 normalSum = glm::vec3(0.0f);
+
+    for (u32 t = 0; t < meshlet.triangleCount; ++t)
+    {
+        glm::vec3 p[3];
+        for (u32 corner = 0; corner < 3; ++corner)
+        {
+            p[corner] = glm::make_vec3(vertices + indices[t * 3 + corner] * vertexStride);
+            boundsMin = glm::min(boundsMin, p[corner]);
+            boundsMax = glm::max(boundsMax, p[corner]);
+        }
+        normalSum += glm::cross(p[1] - p[0], p[2] - p[0]);
+    }
+
+    const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    f32 radius = 0.0f;
+    for (u32 i = 0; i < meshlet.triangleCount * 3; ++i)
+        radius = glm::max(radius, glm::distance(center, glm::make_vec3(vertices + indices[i] * vertexStride)));
+    meshlet.bounds = glm::vec4(center, radius);
+
+    // The cone around the average normal that holds every triangle normal
+    meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    const f32 normalLength = glm::length(normalSum);
+    if (normalLength <= 0.0f)
+        return;
+
+    const glm::vec3 axis = normalSum / normalLength;
+    f32 minDot = 1.0f;
+    for (u32 t = 0; t < meshlet.triangleCount; ++t)
+    {
+        const glm::vec3 p0 = glm::make_vec3(vertices + indices[t * 3] * vertexStride);
+        const glm::vec3 normal = glm::cross(glm::make_vec3(vertices + indices[t * 3 + 1] * vertexStride) - p0, glm::make_vec3(vertices + indices[t * 3 + 2] * vertexStride) - p0);
+        const f32 length = glm::length(normal);
+        if (length > 0.0f)
+            minDot = glm::min(minDot, glm::dot(normal / length, axis));
+    }
+
+    if (minDot > MESHLET_MIN_CONE_DOT)
+        meshlet.cone = glm::vec4(axis, glm::sqrt(1.0f - minDot * minDot));
+}
+
+/**
+ * Is the surface closed? Faces are never culled, so the back of an open surface can be
+ * seen, and only the meshlets of a closed one can be dropped for facing away. Vertices
+ * are matched by position, so attribute seams do not count as open edges.
+ */
+static bool IsClosedSurface(const f32* vertices, u32 vertexStride, u32 vertexCount, const std::vector<u32>& indices)
+{
+    std::vector<u32> order(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+        order[v] = v;
+
+    auto position = [&](u32 v) { return glm::make_vec3(vertices + v * vertexStride); };
+    auto less = [&](u32 a, u32 b)
+    {
+        const glm::vec3 pa = position(a), pb = position(b);
+        return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+
+    // The first vertex of every position stands for the others
+    std::vector<u32> canonical(vertexCount);
+    for (u32 i = 0; i < vertexCount; ++i)
+        canonical[order[i]] = (i > 0 && position(order[i]) == position(order[i - 1])) ? canonical[order[i - 1]] : order[i];
+
+    std::vector<u64> edges;
+    edges.reserve(indices.size());
+    for (u32 i = 0; i < indices.size(); i += 3)
+    {
+        // Triangles welded into a line or a point, like the ones at the poles of a sphere, have no edges
+        const u32 triangle[3] = { canonical[indices[i]], canonical[indices[i + 1]], canonical[indices[i + 2]] };
+        if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[2] == triangle[0])
+            continue;
+
+        for (u32 corner = 0; corner < 3; ++corner)
+        {
+            const u32 a = triangle[corner];
+            const u32 b = triangle[(corner + 1) % 3];
+            edges.push_back(((u64)glm::min(a, b) << 32) | glm::max(a, b));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (u32 i = 0; i < edges.size();)
+    {
+        u32 count = 1;
+        while (i + count < edges.size() && edges[i + count] == edges[i])
+            count++;
+        if (count != 2)
+            return false;
+        i += count;
+    }
+    return true;
+}
+
+u32 BuildMeshlets(const f32* vertices, u32 vertexStride, u32 vertexCount, const std::vector<u32>& indices, std::vector<Meshlet>& meshlets)
+{
+    const u32 firstMeshlet = (u32)meshlets.size();
+    const u32 triangleCount = (u32)indices.size() / 3;
+
+    // Which meshlet last used each vertex, to count the vertices of the current one
+    std::vector<u32> vertexMeshlet(vertexCount, UINT32_MAX);
+    u32 meshletVertexCount = 0;
+
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        const u32* triangle = &indices[t * 3];
+
+        u32 newVertices = 0;
+        if (meshlets.size() > firstMeshlet)
+        {
+            const u32 current = (u32)meshlets.size() - 1;
+            for (u32 corner = 0; corner < 3; ++corner)
+            {
+                // A degenerate triangle repeats a vertex, which only counts once
+                const u32 v = triangle[corner];
+                const bool repeated = (corner > 0 && v == triangle[0]) || (corner > 1 && v == triangle[1]);
+                if (vertexMeshlet[v] != current && !repeated)
+                    newVertices++;
+            }
+        }
+
+        // Greedy: the triangle starts a new meshlet when the current one would overflow
+        if (meshlets.size() == firstMeshlet ||
+            meshletVertexCount + newVertices > MESHLET_MAX_VERTICES ||
+            meshlets.back().triangleCount == MESHLET_MAX_TRIANGLES)
+        {
+            Meshlet meshlet = {};
+            meshlet.firstIndex = t * 3;
+            meshlets.push_back(meshlet);
+            meshletVertexCount = 0;
+        }
+
+        const u32 current = (u32)meshlets.size() - 1;
+        for (u32 corner = 0; corner < 3; ++corner)
+        {
+            if (vertexMeshlet[triangle[corner]] != current)
+            {
+                vertexMeshlet[triangle[corner]] = current;
+                meshletVertexCount++;
+            }
+        }
+        meshlets.back().triangleCount++;
+    }
+
+    const bool closed = IsClosedSurface(vertices, vertexStride, vertexCount, indices);
+    for (u32 i = firstMeshlet; i < meshlets.size(); ++i)
+    {
+        ComputeMeshletBounds(vertices, vertexStride, &indices[meshlets[i].firstIndex], meshlets[i]);
+        if (!closed)
+            meshlets[i].cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    return (u32)meshlets.size() - firstMeshlet;
+}
@@ -0,0 +1,35 @@
+//
+// meshlets.h: Splits the index list of a large submesh into clusters of a few dozen
+// triangles, so the GPU culling can drop the parts of a mesh that are off screen, hidden
+// or facing away instead of drawing the whole submesh. A meshlet is a contiguous range of
+// the optimized index list, so it draws with a plain indexed draw and the triangle order
+// the vertex cache optimization chose is kept.
+//
+// Each meshlet has a bounding sphere and a normal cone: when the camera sits inside the
+// cone's back side, every triangle of the meshlet faces away and none is drawn. Faces are
+// never culled, so only the meshlets of closed surfaces get a cone that can cull.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_MIN_SUBMESH_TRIANGLES 1024 // Smaller submeshes are culled whole
+
+// Must match shaders.glsl (std430)
+struct Meshlet
+{
+    glm::vec4 bounds;        // Bounding sphere in model space
+    glm::vec4 cone;          // Axis and cutoff, the sine of the widest angle between a triangle normal and the axis. 1 never culls.
+    u32       firstIndex;    // From the first index of its submesh
+    u32       triangleCount;
+    u32       padding[2];
+};
+
+/**
+ * Appends the meshlets of a triangle list, in index order. Only the first 3 floats of
+ * a vertex (the position) are read. Returns how many were appended.
+ */
+u32 BuildMeshlets(const f32* vertices, u32 vertexStride, u32 vertexCount, const std::vector<u32>& indices, std::vector<Meshlet>& meshlets);
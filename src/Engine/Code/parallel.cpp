@@ -0,0 +1,355 @@
+#include "parallel.h"
+#include "memory_arena.h"
+#include "simd_math.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Jobs in flight per thread. The job slots are recycled round robin, so a thread must
+// not have more than this many of its jobs queued or running at once, which RunJobs()
+// asserts.
+#define JOB_DEQUE_CAPACITY 4096
+#define MAX_JOB_THREADS 64
+
+struct Job
+{
+    JobFunction       function;
+    void*             userData;
+    JobCounter*       counter;
+    std::atomic<bool> inFlight; // From RunJobs() until it finished, the slot can't be reused meanwhile
+};
+
+struct JobThreadContext
+{
+    // Chase-Lev deque: the owner works at the bottom, thieves take from the top
+    std::atomic<i64>  top;
+    std::atomic<i64>  bottom;
+    std::atomic<Job*> entries[JOB_DEQUE_CAPACITY];
+
+    Job jobs[JOB_DEQUE_CAPACITY];
+    u32 nextJob;
+    u32 randomState;
+};
+
+static JobThreadContext*        ThreadContexts[MAX_JOB_THREADS];
+static std::vector<std::thread> Workers;
+static std::atomic<u32>         ThreadCount(1); // Workers plus the main thread
+static std::mutex               SleepMutex;
+static std::condition_variable  JobQueued;
+static std::atomic<u32>         QueuedJobs(0);
+static std::atomic<u32>         SleepingWorkers(0);
+static std::atomic<bool>        ShuttingDown(false);
+
+static thread_local u32 ThreadIndex = UINT32_MAX; // Main thread is 0, workers start at 1
+
+static void PushJob(JobThreadContext& context, Job* job)
+{
+    const i64 bottom = context.bottom.load(std::memory_order_relaxed);
+    const i64 top = context.top.load(std::memory_order_acquire);
+    ASSERT(bottom - top < JOB_DEQUE_CAPACITY, "Job deque overflow");
+
+    context.entries[bottom & (JOB_DEQUE_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+    context.bottom.store(bottom + 1, std::memory_order_release);
+}
+
+static Job* PopJob(JobThreadContext& context)
+{
+    const i64 bottom = context.bottom.load(std::memory_order_relaxed) - 1;
+    context.bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 top = context.top.load(std::memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        context.bottom.store(bottom + 1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    Job* job = context.entries[bottom & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (top == bottom)
+    {
+        // Last job left, race the thieves for it
+        if (!context.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            job = NULL;
+        context.bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+static Job* StealJob(JobThreadContext& context)
+{
+    i64 top = context.top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const i64 bottom = context.bottom.load(std::memory_order_acquire);
+
+    if (top >= bottom)
+        return NULL;
+
+    Job* job = context.entries[top & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (!context.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return NULL;
+    return job;
+}
+
+static Job* GetJob(JobThreadContext& context)
+{
+    Job* job = PopJob(context);
+
+    if (!job)
+    {
+        // Start from a random victim so thieves don't all hammer the same deque
+        const u32 threadCount = ThreadCount.load(std::memory_order_relaxed);
+        context.randomState ^= context.randomState << 13;
+        context.randomState ^= context.randomState >> 17;
+        context.randomState ^= context.randomState << 5;
+
+        for (u32 i = 0, victim = context.randomState % threadCount; i < threadCount && !job; ++i, victim = (victim + 1) % threadCount)
+            if (ThreadContexts[victim] != &context)
+                job = StealJob(*ThreadContexts[victim]);
+    }
+
+    if (job)
+        QueuedJobs.fetch_sub(1);
+    return job;
+}
+
+static void ExecuteJob(Job* job)
+{
+    job->function(job->userData);
+
+    // The slot may be reused as soon as it is released, so the counter is read first
+    JobCounter* counter = job->counter;
+    job->inFlight.store(false, std::memory_order_release);
+    counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+static void WorkerMain(u32 threadIndex)
+{
+    ThreadIndex = threadIndex;
+    JobThreadContext& context = *ThreadContexts[threadIndex];
+
+    char arenaName[32];
+    snprintf(arenaName, sizeof(arenaName), "Worker %u", threadIndex);
+    SetThreadFrameArenaName(arenaName);
+
+    while (!ShuttingDown)
+    {
+        if (Job* job = GetJob(context))
+        {
+            // Workers have no frame, so whatever a job leaves in the arena dies with it
+            ScopedArenaMarker arenaMarker(GetThreadFrameArena());
+            ExecuteJob(job);
+            continue;
+        }
+
+        // Nothing to steal. Registering as a sleeper before checking QueuedJobs pairs with
+        // RunJobs() bumping QueuedJobs before checking for sleepers, so no wake up is lost.
+        std::unique_lock<std::mutex> lock(SleepMutex);
+        SleepingWorkers.fetch_add(1);
+        JobQueued.wait(lock, [] { return ShuttingDown || QueuedJobs.load() > 0; });
+        SleepingWorkers.fetch_sub(1);
+    }
+}
+
+static JobThreadContext* CreateThreadContext(u32 threadIndex)
+{
+    JobThreadContext* context = new JobThreadContext();
+    context->top = 0;
+    context->bottom = 0;
+    context->nextJob = 0;
+    context->randomState = 0x9E3779B9u * (threadIndex + 1);
+    return context;
+}
+
+void InitWorkerThreads(u32 workerCount)
+{
+    if (workerCount == JOB_WORKERS_AUTO)
+    {
+        const u32 hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+    workerCount = glm::min(workerCount, (u32)MAX_JOB_THREADS - 1);
+
+    ThreadIndex = 0;
+    if (!ThreadContexts[0])
+        ThreadContexts[0] = CreateThreadContext(0);
+
+    ShuttingDown = false;
+    for (u32 i = 1; i <= workerCount; ++i)
+        ThreadContexts[i] = CreateThreadContext(i);
+    ThreadCount = workerCount + 1;
+    for (u32 i = 1; i <= workerCount; ++i)
+        Workers.emplace_back(WorkerMain, i);
+
+    ILOG("Started %u worker threads", workerCount);
+}
+
+void ShutdownWorkerThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(SleepMutex);
+        ShuttingDown = true;
+    }
+    JobQueued.notify_all();
+
+    for (std::thread& worker : Workers)
+        worker.join();
+    ThreadCount = 1;
+
+    for (u32 i = 1; i <= Workers.size(); ++i)
+    {
+        delete ThreadContexts[i];
+        ThreadContexts[i] = NULL;
+    }
+    Workers.clear();
+}
+
+u32 GetWorkerThreadCount()
+{
+    return (u32)Workers.size();
+}
+
+void RunJobs(const JobDecl* jobs, u32 count, JobCounter* counter)
+{
+    ASSERT(ThreadIndex != UINT32_MAX && ThreadContexts[ThreadIndex], "RunJobs() called from a thread without a job deque");
+    JobThreadContext& context = *ThreadContexts[ThreadIndex];
+
+    counter->pending.fetch_add(count);
+    QueuedJobs.fetch_add(count);
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        Job* job = &context.jobs[context.nextJob++ & (JOB_DEQUE_CAPACITY - 1)];
+        ASSERT(!job->inFlight.load(std::memory_order_acquire), "Job slot reused while its job is in flight, more than JOB_DEQUE_CAPACITY jobs queued");
+        job->inFlight.store(true, std::memory_order_relaxed);
+        job->function = jobs[i].function;
+        job->userData = jobs[i].userData;
+        job->counter = counter;
+        PushJob(context, job);
+    }
+
+    if (SleepingWorkers.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(SleepMutex);
+        if (count == 1)
+            JobQueued.notify_one();
+        else
+            JobQueued.notify_all();
+    }
+}
+
+void WaitForCounter(JobCounter* counter)
+{
+    // Threads without a deque, like the render thread, can't run jobs and only wait
+    if (ThreadIndex == UINT32_MAX || !ThreadContexts[ThreadIndex])
+    {
+        while (counter->pending.load(std::memory_order_acquire) != 0)
+            std::this_thread::yield();
+        return;
+    }
+
+    JobThreadContext& context = *ThreadContexts[ThreadIndex];
+
+    while (counter->pending.load(std::memory_order_acquire) != 0)
+    {
+        if (Job* job = GetJob(context))
+            ExecuteJob(job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+struct ParallelForBatch
+{
+    ParallelForFunction function;
+    void*               userData;
+    u32                 begin;
+    u32                 end;
+};
+
+void ParallelFor(u32 count, u32 minBatchSize, ParallelForFunction function, void* userData)
+{
+    if (count == 0)
+        return;
+
+    if (Workers.empty() || count <= minBatchSize)
+    {
+        function(0, count, userData);
+        return;
+    }
+
+    // A few batches per thread, so threads that finish early can steal the rest
+    const u32 maxBatchCount = 256;
+    const u32 targetBatchCount = glm::min((u32)(Workers.size() + 1) * 4, maxBatchCount);
+    const u32 batchSize = glm::max(minBatchSize, (count + targetBatchCount - 1) / targetBatchCount);
+    const u32 batchCount = (count + batchSize - 1) / batchSize;
+
+    ParallelForBatch batches[maxBatchCount];
+    JobDecl jobs[maxBatchCount];
+
+    for (u32 i = 0; i < batchCount; ++i)
+    {
+        batches[i] = { function, userData, i * batchSize, glm::min((i + 1) * batchSize, count) };
+        jobs[i].function = [](void* data) {
+            const ParallelForBatch& batch = *(const ParallelForBatch*)data;
+            batch.function(batch.begin, batch.end, batch.userData);
+        };
+        jobs[i].userData = &batches[i];
+    }
+
+    JobCounter counter = {};
+    RunJobs(jobs, batchCount, &counter);
+    WaitForCounter(&counter);
+}
+
+static f64 TimeScalingWorkload(std::vector<glm::mat4>& results)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    ParallelFor((u32)results.size(), 256, [&](u32 begin, u32 end)
+    {
+        const glm::mat4 step = glm::rotate(glm::mat4(1.0f), 0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+        for (u32 i = begin; i < end; ++i)
+        {
+            glm::mat4 m = glm::translate(glm::mat4(1.0f), glm::vec3((f32)i, 0.0f, 0.0f));
+            for (u32 j = 0; j < 64; ++j)
+                MultiplyMat4(step, m, m);
+            results[i] = m;
+        }
+    });
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<f64, std::milli>(end - start).count();
+}
+
+JobScalingBenchmark BenchmarkJobScaling()
+{
+    const u32 originalWorkerCount = GetWorkerThreadCount();
+    const u32 maxThreads = glm::min(glm::max(std::thread::hardware_concurrency(), 1u), (u32)JOB_SCALING_MAX_THREADS);
+
+    JobScalingBenchmark benchmark = {};
+    benchmark.threadCountMax = maxThreads;
+
+    std::vector<glm::mat4> results(1 << 17);
+
+    for (u32 threadCount = 1; threadCount <= maxThreads; ++threadCount)
+    {
+        ShutdownWorkerThreads();
+        InitWorkerThreads(threadCount - 1);
+
+        // Best of a few runs, after one to warm up the workers and caches
+        TimeScalingWorkload(results);
+        f64 bestMs = TimeScalingWorkload(results);
+        for (u32 run = 0; run < 3; ++run)
+            bestMs = glm::min(bestMs, TimeScalingWorkload(results));
+
+        benchmark.ms[threadCount] = bestMs;
+    }
+
+    ShutdownWorkerThreads();
+    InitWorkerThreads(originalWorkerCount);
+
+    return benchmark;
+}
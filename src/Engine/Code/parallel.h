@@ -0,0 +1,77 @@
+//
+// parallel.h: Work-stealing job system. Every worker thread, and the main thread, owns a
+// Chase-Lev deque: it pushes and pops its own jobs at the bottom while idle threads steal
+// from the top. Jobs signal a JobCounter when they finish, and waiting on a counter runs
+// other jobs meanwhile, so a thread never blocks while there is work it could do.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+
+typedef void (*JobFunction)(void* userData);
+
+struct JobDecl
+{
+    JobFunction function;
+    void*       userData;
+};
+
+// Number of jobs still to finish. Zero initialize it before the first RunJobs().
+struct JobCounter
+{
+    std::atomic<u32> pending;
+};
+
+#define JOB_WORKERS_AUTO UINT32_MAX
+
+/**
+ * Spawns the worker threads. With JOB_WORKERS_AUTO it uses one per hardware thread,
+ * leaving one for the main thread.
+ */
+void InitWorkerThreads(u32 workerCount = JOB_WORKERS_AUTO);
+
+void ShutdownWorkerThreads();
+
+u32 GetWorkerThreadCount();
+
+/**
+ * Queues the jobs on the calling thread's deque and adds them to counter. Can be called
+ * from the main thread or from inside a job.
+ */
+void RunJobs(const JobDecl* jobs, u32 count, JobCounter* counter);
+
+// Runs queued jobs on the calling thread until counter drops to zero. Threads without a deque only wait.
+void WaitForCounter(JobCounter* counter);
+
+typedef void (*ParallelForFunction)(u32 begin, u32 end, void* userData);
+
+/**
+ * Splits [0, count) into batches of at least minBatchSize items and runs function on
+ * them as jobs. Runs inline when the range is too small to be worth it.
+ */
+void ParallelFor(u32 count, u32 minBatchSize, ParallelForFunction function, void* userData);
+
+template <typename F>
+void ParallelFor(u32 count, u32 minBatchSize, const F& function)
+{
+    ParallelFor(count, minBatchSize, [](u32 begin, u32 end, void* userData) {
+        (*(const F*)userData)(begin, end);
+    }, (void*)&function);
+}
+
+#define JOB_SCALING_MAX_THREADS 32
+
+struct JobScalingBenchmark
+{
+    u32 threadCountMax;
+    f64 ms[JOB_SCALING_MAX_THREADS + 1]; // Indexed by thread count, main thread included
+};
+
+/**
+ * Times a fixed batch of matrix work with 1 to N threads, restarting the workers for each
+ * thread count. Must be called from the main thread with no jobs in flight.
+ */
+JobScalingBenchmark BenchmarkJobScaling();
@@ -13,9 +13,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
 #endif
 
 #include "engine.h"
+#include "memory_arena.h"
+#include "parallel.h"
+#include "render_thread.h"
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
@@ -27,10 +31,6 @@
 #define WINDOW_WIDTH  800
 #define WINDOW_HEIGHT 600
 
-#define GLOBAL_FRAME_ARENA_SIZE MB(16)
-u8* GlobalFrameArenaMemory = NULL;
-u32 GlobalFrameArenaHead = 0;
-
 void OnGlfwError(int errorCode, const char *errorMessage)
 {
 	fprintf(stderr, "glfw failed with error %d: %s\n", errorCode, errorMessage);
@@ -183,6 +183,8 @@ int main()
         return -1;
     }
 
+    LoadOpenGLExtensions((GLADloadproc) glfwGetProcAddress);
+
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
 
@@ -190,7 +192,7 @@ int main()
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;       // Enable Keyboard Controls
     //io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
     io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;           // Enable Docking
-    io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;         // Enable Multi-Viewport / Platform Windows
+    //io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;       // Enable Multi-Viewport / Platform Windows (they need the GL context, which lives on the render thread)
     //io.ConfigViewportsNoAutoMerge = true;
     //io.ConfigViewportsNoTaskBarIcon = true;
     io.WantSetMousePos = false;
@@ -223,17 +225,21 @@ int main()
 
     f64 lastFrameTime = glfwGetTime();
 
-    GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
+    SetThreadFrameArenaName("Main");
 
     Init(&app);
 
+    // Builds the GUI font texture while the context is still current here
+    ImGui_ImplOpenGL3_NewFrame();
+
+    StartRenderThread(&app, window);
+
     while (app.isRunning)
     {
         // Tell GLFW to call platform callbacks
         glfwPollEvents();
 
         // ImGui
-        ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
@@ -268,27 +274,16 @@ int main()
                 else if (app.input.mouseButtons[i] == BUTTON_RELEASE)
                     app.input.mouseButtons[i] = BUTTON_IDLE;
 
-        // Update
+        // Update, while the render thread is still drawing the previous frame
         Update(&app);
 
+        FramePacket& packet = AcquireFramePacket();
+        BuildFramePacket(&app, packet);
+
        app.input.mouseDelta = glm::vec2(0.0f, 0.0f);
 
         // Render
-        Render(&app);
-
-        // ImGui Render
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-
-        if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable)
-        {
-            GLFWwindow* backup_current_context = glfwGetCurrentContext();
-            ImGui::UpdatePlatformWindows();
-            ImGui::RenderPlatformWindowsDefault();
-            glfwMakeContextCurrent(backup_current_context);
-        }
-
-        // Present image on screen
-        glfwSwapBuffers(window);
+        SubmitFramePacket(ImGui::GetDrawData());
 
         // Frame time
         f64 currentFrameTime = glfwGetTime();
@@ -296,11 +291,14 @@ int main()
         app.timeSinceStartup += currentFrameTime;
         lastFrameTime = currentFrameTime;
 
-        // Reset frame allocator
-        GlobalFrameArenaHead = 0;
+        ResetFrameArena();
     }
 
-    free(GlobalFrameArenaMemory);
+    StopRenderThread();
+
+    DestroyFileWatcher(app.fileWatcher);
+
+    ShutdownWorkerThreads();
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -318,37 +316,24 @@ u32 Strlen(const char* string)
     return len;
 }
 
-void* PushSize(u32 byteCount)
+void ResetFrameArena()
 {
-    ASSERT(GlobalFrameArenaHead + byteCount <= GLOBAL_FRAME_ARENA_SIZE,
-           "Trying to allocate more temp memory than available");
+    ResetArena(GetThreadFrameArena());
+}
 
-    u8* curPtr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    GlobalFrameArenaHead += byteCount;
-    return curPtr;
+void* PushSize(u32 byteCount)
+{
+    return ArenaPush(GetThreadFrameArena(), byteCount);
 }
 
 void* PushBytes(const void* bytes, u32 byteCount)
 {
-    ASSERT(GlobalFrameArenaHead + byteCount <= GLOBAL_FRAME_ARENA_SIZE,
-            "Trying to allocate more temp memory than available");
-
-    u8* srcPtr = (u8*)bytes;
-    u8* curPtr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    u8* dstPtr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    GlobalFrameArenaHead += byteCount;
-    while (byteCount--) *dstPtr++ = *srcPtr++;
-    return curPtr;
+    return ArenaPushBytes(GetThreadFrameArena(), bytes, byteCount);
 }
 
 u8* PushChar(u8 c)
 {
-    ASSERT(GlobalFrameArenaHead + 1 <= GLOBAL_FRAME_ARENA_SIZE,
-            "Trying to allocate more temp memory than available");
-    u8* ptr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    GlobalFrameArenaHead++;
-    *ptr = c;
-    return ptr;
+    return (u8*)ArenaPushBytes(GetThreadFrameArena(), &c, 1);
 }
 
 String MakeString(const char *cstr)
@@ -436,6 +421,24 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+bool MakeDirectory(const char* path)
+{
+#ifdef _WIN32
+    return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+u64 HashBytes(const void* data, u32 size, u64 seed)
+{
+    const u8* bytes = (const u8*)data;
+    u64 hash = seed;
+    for (u32 i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
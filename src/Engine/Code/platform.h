@@ -72,6 +72,8 @@ struct String
     u32   len;
 };
 
+u32 Strlen(const char* string);
+
 String MakeString(const char *cstr);
 
 String MakePath(String dir, String filename);
@@ -84,12 +86,30 @@ String GetDirectoryPart(String path);
  */
 String ReadTextFile(const char *filepath);
 
+/**
+ * Releases every temporary allocation of the frame, such as the ReadTextFile() strings,
+ * made by the calling thread. Each thread has its own frame arena (see memory_arena.h).
+ */
+void ResetFrameArena();
+
 /**
  * It retrieves a timestamp indicating the last time the file was modified.
  * Can be useful in order to check for file modifications to implement hot reloads.
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Creates a directory if it does not exist yet. Returns false on failure.
+ */
+bool MakeDirectory(const char* path);
+
+/**
+ * FNV-1a hash of a block of memory. Pass a previous result as seed to hash
+ * several blocks as if they were contiguous.
+ */
+#define FNV1A_SEED 14695981039346656037ull
+u64 HashBytes(const void* data, u32 size, u64 seed = FNV1A_SEED);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -0,0 +1,202 @@
+//
+// pool.h: Slot pool for engine resources. Items live in fixed-size blocks that are never
+// reallocated, so adding items does not move the existing ones (pointers stay valid and
+// there is no copy hitch when the pool grows). Freed slots are reused, lowest first.
+//
+// Every slot has a generation that is bumped when its item is freed. A PoolHandle records
+// the generation it was created with, so a handle to a freed (or reused) slot is detected
+// instead of silently reading whatever lives there now.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <algorithm>
+#include <functional>
+#include <new>
+
+#define POOL_BLOCK_SIZE 64 // Items per block
+
+template <typename T>
+struct PoolHandle
+{
+    u32 index;
+    u32 generation;
+};
+
+template <typename T>
+inline PoolHandle<T> InvalidPoolHandle()
+{
+    return { UINT32_MAX, 0 };
+}
+
+template <typename T>
+struct Pool
+{
+    std::vector<T*>  blocks;      // NULL once released by CompactPool()
+    std::vector<u32> generations; // Per slot, kept when the block is released
+    std::vector<u8>  alive;
+    std::vector<u32> freeSlots;   // Sorted from highest to lowest, so the back is reused first
+    u32              count;       // Live items
+
+    Pool() : count(0) {}
+    ~Pool() { ClearPool(*this); }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    // Direct slot access, for the code that stores plain slot indices
+    T& operator[](u32 index)
+    {
+        ASSERT(index < alive.size() && alive[index], "Accessing a free pool slot");
+        return blocks[index / POOL_BLOCK_SIZE][index % POOL_BLOCK_SIZE];
+    }
+
+    const T& operator[](u32 index) const
+    {
+        ASSERT(index < alive.size() && alive[index], "Accessing a free pool slot");
+        return blocks[index / POOL_BLOCK_SIZE][index % POOL_BLOCK_SIZE];
+    }
+};
+
+// Slots ever used. Iterate [0, PoolSlotCount) and skip the ones !IsPoolSlotAlive.
+template <typename T>
+inline u32 PoolSlotCount(const Pool<T>& pool)
+{
+    return (u32)pool.alive.size();
+}
+
+template <typename T>
+inline bool IsPoolSlotAlive(const Pool<T>& pool, u32 index)
+{
+    return index < pool.alive.size() && pool.alive[index];
+}
+
+template <typename T>
+inline bool IsPoolHandleValid(const Pool<T>& pool, PoolHandle<T> handle)
+{
+    return IsPoolSlotAlive(pool, handle.index) && pool.generations[handle.index] == handle.generation;
+}
+
+// Returns NULL if the handle is stale or invalid
+template <typename T>
+inline T* GetPoolItem(Pool<T>& pool, PoolHandle<T> handle)
+{
+    return IsPoolHandleValid(pool, handle) ? &pool[handle.index] : NULL;
+}
+
+template <typename T>
+inline PoolHandle<T> GetPoolHandle(const Pool<T>& pool, u32 index)
+{
+    ASSERT(IsPoolSlotAlive(pool, index), "Taking a handle to a free pool slot");
+    return { index, pool.generations[index] };
+}
+
+template <typename T>
+PoolHandle<T> AddPoolItem(Pool<T>& pool, T item)
+{
+    u32 index;
+    if (!pool.freeSlots.empty())
+    {
+        index = pool.freeSlots.back();
+        pool.freeSlots.pop_back();
+    }
+    else
+    {
+        index = (u32)pool.alive.size();
+        pool.generations.push_back(0);
+        pool.alive.push_back(0);
+    }
+
+    const u32 block = index / POOL_BLOCK_SIZE;
+    if (block >= pool.blocks.size())
+        pool.blocks.resize(block + 1, NULL);
+    if (!pool.blocks[block])
+        pool.blocks[block] = (T*)::operator new(sizeof(T) * POOL_BLOCK_SIZE);
+
+    new (&pool.blocks[block][index % POOL_BLOCK_SIZE]) T(std::move(item));
+    pool.alive[index] = 1;
+    pool.count++;
+
+    return { index, pool.generations[index] };
+}
+
+// Destroys the item and bumps the slot generation. Stale handles are ignored.
+template <typename T>
+void FreePoolItem(Pool<T>& pool, PoolHandle<T> handle)
+{
+    if (!IsPoolHandleValid(pool, handle))
+        return;
+
+    pool[handle.index].~T();
+    pool.alive[handle.index] = 0;
+    pool.generations[handle.index]++;
+    pool.count--;
+
+    // Keeping the lowest slots in use lets CompactPool() release the blocks at the end
+    pool.freeSlots.insert(std::lower_bound(pool.freeSlots.begin(), pool.freeSlots.end(), handle.index, std::greater<u32>()), handle.index);
+}
+
+/**
+ * Releases the memory of the blocks with no live items. The slot generations are kept,
+ * so the handles to the items that lived there stay detectably stale.
+ */
+template <typename T>
+void CompactPool(Pool<T>& pool)
+{
+    for (u32 block = 0; block < pool.blocks.size(); ++block)
+    {
+        if (!pool.blocks[block])
+            continue;
+
+        const u32 begin = block * POOL_BLOCK_SIZE;
+        const u32 end = glm::min(begin + POOL_BLOCK_SIZE, (u32)pool.alive.size());
+        bool empty = true;
+        for (u32 index = begin; index < end && empty; ++index)
+            empty = !pool.alive[index];
+
+        if (empty)
+        {
+            ::operator delete(pool.blocks[block]);
+            pool.blocks[block] = NULL;
+        }
+    }
+
+    while (!pool.blocks.empty() && !pool.blocks.back())
+        pool.blocks.pop_back();
+}
+
+template <typename T>
+void ClearPool(Pool<T>& pool)
+{
+    for (u32 index = 0; index < pool.alive.size(); ++index)
+        if (pool.alive[index])
+            FreePoolItem(pool, GetPoolHandle(pool, index));
+
+    CompactPool(pool);
+}
+
+// Resident bytes, items and bookkeeping included
+template <typename T>
+u64 PoolMemorySize(const Pool<T>& pool)
+{
+    u64 size = 0;
+    for (const T* block : pool.blocks)
+        if (block)
+            size += sizeof(T) * POOL_BLOCK_SIZE;
+    size += pool.blocks.capacity() * sizeof(T*);
+    size += pool.generations.capacity() * sizeof(u32);
+    size += pool.alive.capacity();
+    size += pool.freeSlots.capacity() * sizeof(u32);
+    return size;
+}
+
+// Calls function(index, item) on every live item, in slot order
+template <typename T, typename F>
+void ForEachPoolItem(Pool<T>& pool, const F& function)
+{
+    for (u32 index = 0; index < pool.alive.size(); ++index)
+        if (pool.alive[index])
+            function(index, pool[index]);
+}
@@ -0,0 +1,129 @@
+#include "program_cache.h"
+
+#define PROGRAM_BINARY_MAGIC 0x42504741 // "AGPB"
+
+struct ProgramBinaryHeader
+{
+    u32    magic;
+    u64    key;
+    GLenum format;
+    u32    length;
+};
+
+static void GetProgramBinaryPath(u64 key, char* path, u32 pathSize)
+{
+    snprintf(path, pathSize, PROGRAM_CACHE_DIRECTORY "/%016llx.bin", (unsigned long long)key);
+}
+
+static bool ProgramBinariesSupported()
+{
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    return formatCount > 0;
+}
+
+u64 GetProgramBinaryKey(const char* const* sources, const GLint* lengths, u32 sourceCount)
+{
+    const char* driverStrings[] = {
+        (const char*)glGetString(GL_VENDOR),
+        (const char*)glGetString(GL_RENDERER),
+        (const char*)glGetString(GL_VERSION)
+    };
+
+    u64 key = FNV1A_SEED;
+    for (u32 i = 0; i < ARRAY_COUNT(driverStrings); ++i)
+        key = HashBytes(driverStrings[i], Strlen(driverStrings[i]), key);
+    for (u32 i = 0; i < sourceCount; ++i)
+        key = HashBytes(sources[i], lengths[i], key);
+
+    return key;
+}
+
+GLuint LoadProgramBinary(u64 key)
+{
+    if (!ProgramBinariesSupported())
+        return 0;
+
+    char path[256];
+    GetProgramBinaryPath(key, path, sizeof(path));
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return 0;
+
+    GLuint programHandle = 0;
+
+    ProgramBinaryHeader header = {};
+    if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRAM_BINARY_MAGIC && header.key == key)
+    {
+        std::vector<u8> binary(header.length);
+        if (fread(binary.data(), 1, header.length, file) == header.length)
+        {
+            programHandle = glCreateProgram();
+            glProgramBinary(programHandle, header.format, binary.data(), header.length);
+
+            GLint success;
+            glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+            if (!success)
+            {
+                // The driver rejected it (e.g. it was updated without changing its version string)
+                glDeleteProgram(programHandle);
+                programHandle = 0;
+            }
+        }
+    }
+
+    fclose(file);
+
+    if (!programHandle)
+        remove(path);
+
+    return programHandle;
+}
+
+void SaveProgramBinary(u64 key, GLuint programHandle)
+{
+    if (!ProgramBinariesSupported())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(programHandle, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    ProgramBinaryHeader header = {};
+    header.magic = PROGRAM_BINARY_MAGIC;
+    header.key = key;
+
+    std::vector<u8> binary(length);
+    glGetProgramBinary(programHandle, length, NULL, &header.format, binary.data());
+    header.length = (u32)length;
+
+    if (!MakeDirectory(PROGRAM_CACHE_DIRECTORY))
+    {
+        ELOG("Could not create the program cache directory %s", PROGRAM_CACHE_DIRECTORY);
+        return;
+    }
+
+    char path[256];
+    GetProgramBinaryPath(key, path, sizeof(path));
+
+    FILE* file = fopen(path, "wb");
+    if (file)
+    {
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(binary.data(), 1, header.length, file);
+        fclose(file);
+    }
+    else
+    {
+        ELOG("fopen() failed writing program binary %s", path);
+    }
+}
+
+void DeleteProgramBinary(u64 key)
+{
+    char path[256];
+    GetProgramBinaryPath(key, path, sizeof(path));
+    remove(path);
+}
@@ -0,0 +1,28 @@
+//
+// program_cache.h: On-disk cache of linked program binaries. Programs are keyed by a
+// hash of everything that goes into their compilation (source, preamble, program name)
+// plus the driver identification strings, so a driver update invalidates the cache.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include "platform.h"
+
+#define PROGRAM_CACHE_DIRECTORY "ShaderCache"
+
+/**
+ * Builds the cache key of a program out of the strings it is compiled from.
+ */
+u64 GetProgramBinaryKey(const char* const* sources, const GLint* lengths, u32 sourceCount);
+
+/**
+ * Returns a linked program created from the cached binary, or 0 if there is no
+ * usable binary for the key (missing, corrupted or rejected by the driver).
+ */
+GLuint LoadProgramBinary(u64 key);
+
+void SaveProgramBinary(u64 key, GLuint programHandle);
+
+void DeleteProgramBinary(u64 key);
@@ -0,0 +1,240 @@
+#include "program_reflection.h"
+
+#define REFLECTION_SLOT_EMPTY 0xFFFF
+
+u64 HashProgramResourceName(const char* name)
+{
+    return HashBytes(name, Strlen(name));
+}
+
+template <typename T>
+static void BuildTable(std::vector<u16>& table, const std::vector<T>& resources)
+{
+    u32 capacity = 8;
+    while (capacity < resources.size() * 2)
+        capacity *= 2;
+
+    table.assign(capacity, REFLECTION_SLOT_EMPTY);
+
+    const u32 mask = capacity - 1;
+    for (u32 i = 0; i < resources.size(); ++i)
+    {
+        u32 slot = (u32)resources[i].nameHash & mask;
+        while (table[slot] != REFLECTION_SLOT_EMPTY)
+            slot = (slot + 1) & mask;
+        table[slot] = (u16)i;
+    }
+}
+
+template <typename T>
+static T* FindInTable(const std::vector<u16>& table, const std::vector<T>& resources, u64 nameHash)
+{
+    if (table.empty())
+        return NULL;
+
+    const u32 mask = (u32)table.size() - 1;
+    for (u32 slot = (u32)nameHash & mask; table[slot] != REFLECTION_SLOT_EMPTY; slot = (slot + 1) & mask)
+        if (resources[table[slot]].nameHash == nameHash)
+            return const_cast<T*>(&resources[table[slot]]);
+
+    return NULL;
+}
+
+static u32 GetUniformTypeSize(GLenum type)
+{
+    switch (type)
+    {
+        case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2: return 8;
+        case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3: return 12;
+        case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: return 16;
+        case GL_FLOAT_MAT2: return 16;
+        case GL_FLOAT_MAT3: return 36;
+        case GL_FLOAT_MAT4: return 64;
+        default: return 4; // Scalars, samplers and images
+    }
+}
+
+static void GetResourceName(GLuint programHandle, GLenum interface, GLuint index, char* name, GLsizei nameSize)
+{
+    glGetProgramResourceName(programHandle, interface, index, nameSize, NULL, name);
+
+    // Arrays are reported by their first element
+    const u32 length = Strlen(name);
+    if (length > 3 && strcmp(name + length - 3, "[0]") == 0)
+        name[length - 3] = '\0';
+}
+
+static void ReflectBlocks(GLuint programHandle, GLenum interface, std::vector<ProgramBlock>& blocks)
+{
+    GLint blockCount = 0;
+    glGetProgramInterfaceiv(programHandle, interface, GL_ACTIVE_RESOURCES, &blockCount);
+
+    for (GLint i = 0; i < blockCount; ++i)
+    {
+        const GLenum properties[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+        GLint values[ARRAY_COUNT(properties)];
+        glGetProgramResourceiv(programHandle, interface, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+
+        char name[128];
+        GetResourceName(programHandle, interface, i, name, sizeof(name));
+
+        blocks.push_back({ HashProgramResourceName(name), values[0], values[1] });
+    }
+}
+
+void ReflectProgram(ProgramReflection& reflection, GLuint programHandle)
+{
+    reflection = ProgramReflection{};
+    reflection.handle = programHandle;
+
+    GLint linked = GL_FALSE;
+    if (programHandle)
+        glGetProgramiv(programHandle, GL_LINK_STATUS, &linked);
+    if (!linked)
+        return;
+
+    char name[128];
+
+    GLint inputCount = 0;
+    glGetProgramInterfaceiv(programHandle, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &inputCount);
+    for (GLint i = 0; i < inputCount; ++i)
+    {
+        const GLenum properties[] = { GL_TYPE, GL_LOCATION };
+        GLint values[ARRAY_COUNT(properties)];
+        glGetProgramResourceiv(programHandle, GL_PROGRAM_INPUT, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+
+        if (values[1] < 0)
+            continue; // Built-in inputs such as gl_VertexID
+
+        GetResourceName(programHandle, GL_PROGRAM_INPUT, i, name, sizeof(name));
+        reflection.attributes.push_back({ HashProgramResourceName(name), values[1], (GLenum)values[0] });
+    }
+
+    GLint uniformCount = 0;
+    glGetProgramInterfaceiv(programHandle, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+    for (GLint i = 0; i < uniformCount; ++i)
+    {
+        const GLenum properties[] = { GL_TYPE, GL_ARRAY_SIZE, GL_LOCATION, GL_BLOCK_INDEX };
+        GLint values[ARRAY_COUNT(properties)];
+        glGetProgramResourceiv(programHandle, GL_UNIFORM, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+
+        if (values[3] != -1 || values[2] < 0)
+            continue; // Member of a uniform block, not settable with glUniform*
+
+        GetResourceName(programHandle, GL_UNIFORM, i, name, sizeof(name));
+
+        ProgramUniform uniform = {};
+        uniform.nameHash = HashProgramResourceName(name);
+        uniform.type = (GLenum)values[0];
+        uniform.arraySize = (u32)values[1];
+        uniform.location = values[2];
+        uniform.valueOffset = (u32)reflection.uniformValues.size();
+        uniform.valueSize = GetUniformTypeSize(uniform.type) * uniform.arraySize;
+        reflection.uniforms.push_back(uniform);
+
+        reflection.uniformValues.resize(reflection.uniformValues.size() + uniform.valueSize);
+    }
+
+    ReflectBlocks(programHandle, GL_UNIFORM_BLOCK, reflection.uniformBlocks);
+    ReflectBlocks(programHandle, GL_SHADER_STORAGE_BLOCK, reflection.storageBlocks);
+
+    BuildTable(reflection.attributeTable, reflection.attributes);
+    BuildTable(reflection.uniformTable, reflection.uniforms);
+    BuildTable(reflection.uniformBlockTable, reflection.uniformBlocks);
+    BuildTable(reflection.storageBlockTable, reflection.storageBlocks);
+}
+
+const ProgramAttribute* FindProgramAttribute(const ProgramReflection& reflection, const char* name)
+{
+    return FindInTable(reflection.attributeTable, reflection.attributes, HashProgramResourceName(name));
+}
+
+ProgramUniform* FindProgramUniform(ProgramReflection& reflection, const char* name)
+{
+    return FindInTable(reflection.uniformTable, reflection.uniforms, HashProgramResourceName(name));
+}
+
+const ProgramBlock* FindProgramUniformBlock(const ProgramReflection& reflection, const char* name)
+{
+    return FindInTable(reflection.uniformBlockTable, reflection.uniformBlocks, HashProgramResourceName(name));
+}
+
+const ProgramBlock* FindProgramStorageBlock(const ProgramReflection& reflection, const char* name)
+{
+    return FindInTable(reflection.storageBlockTable, reflection.storageBlocks, HashProgramResourceName(name));
+}
+
+/**
+ * Finds the uniform and stores the new value in its cache. Returns NULL if there is
+ * nothing to send to GL, either because the uniform is not active or the value is the same.
+ */
+static ProgramUniform* UpdateUniformValue(ProgramReflection& reflection, const char* name, const void* value, u32 size)
+{
+    ProgramUniform* uniform = FindProgramUniform(reflection, name);
+    if (!uniform)
+        return NULL;
+
+    ASSERT(size <= uniform->valueSize, "Value does not fit the uniform type");
+
+    u8* cachedValue = &reflection.uniformValues[uniform->valueOffset];
+    if (uniform->hasValue && memcmp(cachedValue, value, size) == 0)
+        return NULL;
+
+    memcpy(cachedValue, value, size);
+    uniform->hasValue = true;
+    return uniform;
+}
+
+void SetUniform(ProgramReflection& reflection, const char* name, i32 value)
+{
+    if (ProgramUniform* uniform = UpdateUniformValue(reflection, name, &value, sizeof(value)))
+        glProgramUniform1i(reflection.handle, uniform->location, value);
+}
+
+void SetUniform(ProgramReflection& reflection, const char* name, u32 value)
+{
+    if (ProgramUniform* uniform = UpdateUniformValue(reflection, name, &value, sizeof(value)))
+        glProgramUniform1ui(reflection.handle, uniform->location, value);
+}
+
+void SetUniform(ProgramReflection& reflection, const char* name, f32 value)
+{
+    if (ProgramUniform* uniform = UpdateUniformValue(reflection, name, &value, sizeof(value)))
+        glProgramUniform1f(reflection.handle, uniform->location, value);
+}
+
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::vec2& value)
+{
+    if (ProgramUniform* uniform = UpdateUniformValue(reflection, name, &value, sizeof(value)))
+        glProgramUniform2fv(reflection.handle, uniform->location, 1, &value[0]);
+}
+
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::vec3& value)
+{
+    if (ProgramUniform* uniform = UpdateUniformValue(reflection, name, &value, sizeof(value)))
+        glProgramUniform3fv(reflection.handle, uniform->location, 1, &value[0]);
+}
+
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::vec4& value)
+{
+    if (ProgramUniform* uniform = UpdateUniformValue(reflection, name, &value, sizeof(value)))
+        glProgramUniform4fv(reflection.handle, uniform->location, 1, &value[0]);
+}
+
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::mat3& value)
+{
+    if (ProgramUniform* uniform = UpdateUniformValue(reflection, name, &value, sizeof(value)))
+        glProgramUniformMatrix3fv(reflection.handle, uniform->location, 1, GL_FALSE, &value[0][0]);
+}
+
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::mat4& value)
+{
+    if (ProgramUniform* uniform = UpdateUniformValue(reflection, name, &value, sizeof(value)))
+        glProgramUniformMatrix4fv(reflection.handle, uniform->location, 1, GL_FALSE, &value[0][0]);
+}
+
+void SetUniformArray(ProgramReflection& reflection, const char* name, const i32* values, u32 count)
+{
+    if (ProgramUniform* uniform = UpdateUniformValue(reflection, name, values, count * sizeof(i32)))
+        glProgramUniform1iv(reflection.handle, uniform->location, count, values);
+}
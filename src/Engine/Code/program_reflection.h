@@ -0,0 +1,91 @@
+//
+// program_reflection.h: Interface of a linked program (vertex inputs, default block
+// uniforms, uniform blocks and storage blocks) queried once at link time and indexed by
+// name hash. Uniforms are set through typed setters that remember the last value of
+// every uniform and skip the GL call when it did not change.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include "platform.h"
+
+struct ProgramAttribute
+{
+    u64    nameHash;
+    GLint  location;
+    GLenum type;
+};
+
+struct ProgramUniform
+{
+    u64    nameHash;
+    GLint  location;
+    GLenum type;
+    u32    arraySize;
+    u32    valueOffset; // Into ProgramReflection::uniformValues
+    u32    valueSize;   // Of the whole array
+    bool   hasValue;    // False until set once, since GLSL initializers are not known
+};
+
+struct ProgramBlock
+{
+    u64   nameHash;
+    GLint binding;
+    GLint dataSize;
+};
+
+struct ProgramReflection
+{
+    GLuint handle;
+
+    std::vector<ProgramAttribute> attributes;
+    std::vector<ProgramUniform>   uniforms;
+    std::vector<ProgramBlock>     uniformBlocks;
+    std::vector<ProgramBlock>     storageBlocks;
+
+    // Open addressing tables (power of 2 sized) of indices into the arrays above
+    std::vector<u16> attributeTable;
+    std::vector<u16> uniformTable;
+    std::vector<u16> uniformBlockTable;
+    std::vector<u16> storageBlockTable;
+
+    std::vector<u8> uniformValues; // Last value set to each uniform
+};
+
+u64 HashProgramResourceName(const char* name);
+
+/**
+ * Rebuilds the reflection of a linked program. It has to be run again whenever the
+ * program is relinked, which also forgets all the cached uniform values.
+ */
+void ReflectProgram(ProgramReflection& reflection, GLuint programHandle);
+
+const ProgramAttribute* FindProgramAttribute(const ProgramReflection& reflection, const char* name);
+
+/**
+ * Array uniforms are found by their plain name, without the "[0]" suffix. Returns NULL
+ * for uniforms not declared in the program or optimized out by the compiler.
+ */
+ProgramUniform* FindProgramUniform(ProgramReflection& reflection, const char* name);
+
+const ProgramBlock* FindProgramUniformBlock(const ProgramReflection& reflection, const char* name);
+
+const ProgramBlock* FindProgramStorageBlock(const ProgramReflection& reflection, const char* name);
+
+/**
+ * Typed uniform setters. They go through glProgramUniform*, so the program does not
+ * need to be bound, and they do nothing if the uniform already holds the value.
+ * Setting a uniform that is not active is silently ignored, like location -1 in GL.
+ */
+void SetUniform(ProgramReflection& reflection, const char* name, i32 value);
+void SetUniform(ProgramReflection& reflection, const char* name, u32 value);
+void SetUniform(ProgramReflection& reflection, const char* name, f32 value);
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::vec2& value);
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::vec3& value);
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::vec4& value);
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::mat3& value);
+void SetUniform(ProgramReflection& reflection, const char* name, const glm::mat4& value);
+
+void SetUniformArray(ProgramReflection& reflection, const char* name, const i32* values, u32 count);
@@ -0,0 +1,139 @@
+#include "render_thread.h"
+#include "engine.h"
+#include "memory_arena.h"
+
+#include <GLFW/glfw3.h>
+#include <imgui.h>
+#include <imgui_impl_opengl3.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define FRAME_PACKET_COUNT 2
+
+struct RenderThreadSlot
+{
+    FramePacket packet;
+
+    // The GUI draw lists are rebuilt by the next ImGui::NewFrame(), so each slot keeps a copy
+    ImVector<ImDrawList*> imguiDrawLists;
+    ImDrawData            imguiDrawData;
+};
+
+static App*                    RenderApp = NULL;
+static GLFWwindow*             RenderWindow = NULL;
+static std::thread             RenderThread;
+static std::mutex              PacketMutex;
+static std::condition_variable PacketSubmitted;
+static std::condition_variable PacketConsumed;
+static RenderThreadSlot        Slots[FRAME_PACKET_COUNT];
+static u64                     SubmittedPackets = 0;
+static u64                     ConsumedPackets = 0;
+static bool                    StopRequested = false;
+static std::atomic<f64>        RenderFrameMs(0.0);
+
+static void FreeImGuiDrawLists(RenderThreadSlot& slot)
+{
+    for (ImDrawList* drawList : slot.imguiDrawLists)
+        IM_DELETE(drawList);
+    slot.imguiDrawLists.clear();
+}
+
+static void RenderThreadMain()
+{
+    glfwMakeContextCurrent(RenderWindow);
+    SetThreadFrameArenaName("Render");
+
+    for (;;)
+    {
+        RenderThreadSlot* slot;
+        {
+            std::unique_lock<std::mutex> lock(PacketMutex);
+            PacketSubmitted.wait(lock, [] { return StopRequested || ConsumedPackets != SubmittedPackets; });
+            if (ConsumedPackets == SubmittedPackets)
+                break; // Stop requested and every packet drawn
+            slot = &Slots[ConsumedPackets % FRAME_PACKET_COUNT];
+        }
+
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        RenderFrame(RenderApp, slot->packet);
+
+        ImGui_ImplOpenGL3_NewFrame();
+        ImGui_ImplOpenGL3_RenderDrawData(&slot->imguiDrawData);
+
+        ResetFrameArena();
+
+        const auto end = std::chrono::high_resolution_clock::now();
+        RenderFrameMs = std::chrono::duration<f64, std::milli>(end - start).count();
+
+        glfwSwapBuffers(RenderWindow);
+
+        {
+            std::lock_guard<std::mutex> lock(PacketMutex);
+            ConsumedPackets++;
+        }
+        PacketConsumed.notify_one();
+    }
+
+    glfwMakeContextCurrent(NULL);
+}
+
+void StartRenderThread(App* app, GLFWwindow* window)
+{
+    RenderApp = app;
+    RenderWindow = window;
+    StopRequested = false;
+
+    glfwMakeContextCurrent(NULL);
+    RenderThread = std::thread(RenderThreadMain);
+}
+
+void StopRenderThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(PacketMutex);
+        StopRequested = true;
+    }
+    PacketSubmitted.notify_one();
+    RenderThread.join();
+
+    for (RenderThreadSlot& slot : Slots)
+        FreeImGuiDrawLists(slot);
+
+    glfwMakeContextCurrent(RenderWindow);
+}
+
+FramePacket& AcquireFramePacket()
+{
+    std::unique_lock<std::mutex> lock(PacketMutex);
+    PacketConsumed.wait(lock, [] { return SubmittedPackets - ConsumedPackets < FRAME_PACKET_COUNT; });
+    return Slots[SubmittedPackets % FRAME_PACKET_COUNT].packet;
+}
+
+void SubmitFramePacket(const ImDrawData* imguiDrawData)
+{
+    RenderThreadSlot& slot = Slots[SubmittedPackets % FRAME_PACKET_COUNT];
+
+    FreeImGuiDrawLists(slot);
+    for (int i = 0; i < imguiDrawData->CmdListsCount; ++i)
+        slot.imguiDrawLists.push_back(imguiDrawData->CmdLists[i]->CloneOutput());
+
+    slot.imguiDrawData = *imguiDrawData;
+    slot.imguiDrawData.CmdLists = slot.imguiDrawLists.Data;
+    slot.imguiDrawData.OwnerViewport = NULL;
+
+    {
+        std::lock_guard<std::mutex> lock(PacketMutex);
+        SubmittedPackets++;
+    }
+    PacketSubmitted.notify_one();
+}
+
+f64 GetRenderThreadFrameMs()
+{
+    return RenderFrameMs;
+}
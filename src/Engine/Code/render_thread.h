@@ -0,0 +1,33 @@
+//
+// render_thread.h: The thread that owns the GL context. The game thread fills a
+// FramePacket, hands it over and starts simulating the next frame while this thread
+// submits the previous one. Two packets are in flight at most, so the game thread
+// runs at most one frame ahead.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct App;
+struct FramePacket;
+struct GLFWwindow;
+struct ImDrawData;
+
+/**
+ * Moves the GL context of window to a new render thread. Call it once Init() is done,
+ * from the thread where the context is current.
+ */
+void StartRenderThread(App* app, GLFWwindow* window);
+
+// Waits for the render thread to finish and makes the context current on the caller again
+void StopRenderThread();
+
+// Blocks until the render thread is done with the oldest packet, then returns it to fill
+FramePacket& AcquireFramePacket();
+
+// Hands the packet from AcquireFramePacket() to the render thread, with a copy of the GUI draw data
+void SubmitFramePacket(const ImDrawData* imguiDrawData);
+
+// CPU time the render thread spent on its last frame, waits and buffer swaps excluded
+f64 GetRenderThreadFrameMs();
@@ -0,0 +1,204 @@
+#include "scene.h"
+#include "simd_math.h"
+
+#include <chrono>
+
+// Builds translate * rotate * scale straight from the quaternion, without the three matrix products
+static void ComposeTransform(const glm::vec3& p, const glm::quat& q, const glm::vec3& s, glm::mat4& out)
+{
+    const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+    out[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * s.x;
+    out[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * s.y;
+    out[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * s.z;
+    out[3] = glm::vec4(p, 1.0f);
+}
+
+static void MarkLocalDirty(Scene& scene, u32 entity)
+{
+    if (!(scene.dirty[entity] & SceneDirty_Local))
+    {
+        scene.dirty[entity] |= SceneDirty_Local;
+        scene.dirtyEntities.push_back(entity);
+    }
+}
+
+u32 CreateEntity(Scene& scene, u32 modelIndex, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale, u32 parent)
+{
+    ASSERT(parent == SCENE_NO_PARENT || parent < scene.count, "Invalid parent entity");
+
+    const u32 entity = scene.count++;
+
+    scene.position.push_back(position);
+    scene.rotation.push_back(rotation);
+    scene.scale.push_back(scale);
+    scene.parent.push_back(parent);
+    scene.localMatrix.push_back(glm::mat4(1.0f));
+    scene.worldMatrix.push_back(glm::mat4(1.0f));
+    scene.dirty.push_back(0);
+    scene.modelIndex.push_back(modelIndex);
+    scene.isStatic.push_back(0);
+    scene.lod.push_back(0);
+    scene.localParamsOffset.push_back(0);
+    scene.localParamsSize.push_back(0);
+
+    // Parents are created first, so appending keeps the order valid
+    scene.order.push_back(entity);
+
+    MarkLocalDirty(scene, entity);
+    return entity;
+}
+
+void SetEntityParent(Scene& scene, u32 entity, u32 parent)
+{
+    for (u32 ancestor = parent; ancestor != SCENE_NO_PARENT; ancestor = scene.parent[ancestor])
+        ASSERT(ancestor != entity, "Parenting would create a cycle");
+
+    scene.parent[entity] = parent;
+    scene.hierarchyChanged = true;
+    MarkLocalDirty(scene, entity);
+}
+
+void SetEntityPosition(Scene& scene, u32 entity, const glm::vec3& position)
+{
+    scene.position[entity] = position;
+    MarkLocalDirty(scene, entity);
+}
+
+void SetEntityRotation(Scene& scene, u32 entity, const glm::quat& rotation)
+{
+    scene.rotation[entity] = rotation;
+    MarkLocalDirty(scene, entity);
+}
+
+void SetEntityScale(Scene& scene, u32 entity, const glm::vec3& scale)
+{
+    scene.scale[entity] = scale;
+    MarkLocalDirty(scene, entity);
+}
+
+void SetEntityStatic(Scene& scene, u32 entity, bool isStatic)
+{
+    if (scene.isStatic[entity] != (u8)isStatic)
+    {
+        scene.isStatic[entity] = isStatic;
+        scene.staticVersion++;
+    }
+}
+
+// Sorts the entities by depth in the hierarchy (counting sort, stable)
+static void SortHierarchy(Scene& scene)
+{
+    std::vector<u32> depth(scene.count, UINT32_MAX);
+    u32 maxDepth = 0;
+
+    for (u32 entity = 0; entity < scene.count; ++entity)
+    {
+        // Walk up to the first ancestor with a known depth, then fill the path back down
+        u32 ancestor = entity;
+        u32 steps = 0;
+        while (ancestor != SCENE_NO_PARENT && depth[ancestor] == UINT32_MAX)
+        {
+            ancestor = scene.parent[ancestor];
+            steps++;
+        }
+
+        u32 d = (ancestor == SCENE_NO_PARENT ? 0 : depth[ancestor] + 1) + steps - 1;
+        for (u32 e = entity; e != ancestor; e = scene.parent[e])
+            depth[e] = d--;
+
+        maxDepth = glm::max(maxDepth, depth[entity]);
+    }
+
+    std::vector<u32> offsets(maxDepth + 2, 0);
+    for (u32 entity = 0; entity < scene.count; ++entity)
+        offsets[depth[entity] + 1]++;
+    for (u32 d = 1; d < offsets.size(); ++d)
+        offsets[d] += offsets[d - 1];
+
+    scene.order.resize(scene.count);
+    for (u32 entity = 0; entity < scene.count; ++entity)
+        scene.order[offsets[depth[entity]]++] = entity;
+
+    scene.hierarchyChanged = false;
+}
+
+void UpdateSceneTransforms(Scene& scene)
+{
+    for (u32 entity : scene.changedEntities)
+        scene.dirty[entity] &= ~SceneDirty_World;
+    scene.changedEntities.clear();
+
+    if (scene.dirtyEntities.empty())
+        return;
+
+    if (scene.hierarchyChanged)
+        SortHierarchy(scene);
+
+    // Batch the local matrices of the dirty entities
+    for (u32 entity : scene.dirtyEntities)
+        ComposeTransform(scene.position[entity], scene.rotation[entity], scene.scale[entity], scene.localMatrix[entity]);
+
+    // Parents come first, so their SceneDirty_World bit is final when the children read it
+    for (u32 entity : scene.order)
+    {
+        const u32 parent = scene.parent[entity];
+        const bool parentChanged = parent != SCENE_NO_PARENT && (scene.dirty[parent] & SceneDirty_World);
+        if (!(scene.dirty[entity] & SceneDirty_Local) && !parentChanged)
+            continue;
+
+        if (parent == SCENE_NO_PARENT)
+            scene.worldMatrix[entity] = scene.localMatrix[entity];
+        else
+            MultiplyMat4(scene.worldMatrix[parent], scene.localMatrix[entity], scene.worldMatrix[entity]);
+
+        scene.dirty[entity] = SceneDirty_World;
+        scene.changedEntities.push_back(entity);
+    }
+
+    scene.dirtyEntities.clear();
+}
+
+static f64 TimeSceneUpdate(Scene& scene, u32 iterations, u32 dirtyStride)
+{
+    f64 totalMs = 0.0;
+
+    for (u32 i = 0; i < iterations; ++i)
+    {
+        if (dirtyStride)
+            for (u32 entity = i % dirtyStride; entity < scene.count; entity += dirtyStride)
+                SetEntityPosition(scene, entity, scene.position[entity] + glm::vec3(0.0f, 0.01f, 0.0f));
+
+        const auto start = std::chrono::high_resolution_clock::now();
+        UpdateSceneTransforms(scene);
+        const auto end = std::chrono::high_resolution_clock::now();
+
+        totalMs += std::chrono::duration<f64, std::milli>(end - start).count();
+    }
+
+    return totalMs / iterations;
+}
+
+SceneBenchmark BenchmarkSceneTransforms(u32 entityCount)
+{
+    const u32 chainLength = 4;
+
+    Scene scene = {};
+    for (u32 i = 0; i < entityCount; ++i)
+    {
+        const u32 parent = i % chainLength == 0 ? SCENE_NO_PARENT : i - 1;
+        const glm::vec3 position = parent == SCENE_NO_PARENT ? glm::vec3((f32)(i % 1000), 0.0f, (f32)(i / 1000)) : glm::vec3(0.0f, 1.0f, 0.0f);
+        CreateEntity(scene, 0, position, glm::angleAxis(glm::radians(15.0f), glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(1.0f), parent);
+    }
+    UpdateSceneTransforms(scene);
+
+    SceneBenchmark benchmark = {};
+    benchmark.entityCount = entityCount;
+    benchmark.fullUpdateMs = TimeSceneUpdate(scene, 5, 1);
+    benchmark.partialUpdateMs = TimeSceneUpdate(scene, 20, 100);
+    benchmark.idleUpdateMs = TimeSceneUpdate(scene, 20, 0);
+
+    return benchmark;
+}
@@ -0,0 +1,802 @@
+#include "shadows.h"
+#include "engine.h"
+#include "buffer_management.h"
+
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+
+#define BINDING(b) b
+
+// Cascade origins snap to a grid of this many texels, and the cascades get that much margin
+// so the slice still fits wherever its center falls inside the cell
+#define SHADOW_CACHE_SNAP_TEXELS 64
+
+// How far towards the light, beyond the cascade sphere, casters are still caught. Depth
+// clamping flattens the ones even further onto the near plane.
+#define SHADOW_CASTER_DISTANCE 50.0f
+
+#define SHADOW_SLOPE_BIAS    2.0f
+#define SHADOW_CONSTANT_BIAS 4.0f
+
+static u32 CountBits(u32 mask)
+{
+    u32 count = 0;
+    for (; mask; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+static GLuint CreateShadowMapArray()
+{
+    GLuint handle;
+    glGenTextures(1, &handle);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, handle);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_MAX_CASCADES);
+
+    // Hardware depth comparison, with bilinear filtering of the results (2x2 PCF per tap)
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    // Outside the cascade is lit
+    const f32 border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return handle;
+}
+
+void InitShadowMaps(App* app)
+{
+    CascadedShadows& shadows = app->shadows;
+
+    shadows.cascadeCount = 3;
+    shadows.maxDistance = 150.0f;
+    shadows.splitLambda = 0.75f;
+    shadows.layeredRendering = GLEXT_ARB_shader_viewport_layer_array;
+
+    shadows.programIdx = LoadProgram(app, "shaders.glsl", "SHADOW_CASTER", shadows.layeredRendering ? ShaderFeature_VertexLayer : 0);
+    if (shadows.layeredRendering)
+        shadows.gpuDrivenProgramIdx = LoadProgram(app, "shaders.glsl", "SHADOW_CASTER", ShaderFeature_VertexLayer | ShaderFeature_GpuDriven);
+
+    shadows.staticMap = CreateShadowMapArray();
+    shadows.shadowMap = CreateShadowMapArray();
+
+    // Depth only, the layers are attached when drawing
+    glGenFramebuffers(1, &shadows.frameBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadows.frameBuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    ILOG("Shadow cascades rendered %s", shadows.layeredRendering ? "in one layered pass" : "one pass per cascade");
+}
+
+static bool operator==(const ShadowCascadeKey& a, const ShadowCascadeKey& b)
+{
+    return a.cell == b.cell && a.halfExtent == b.halfExtent;
+}
+
+void UpdateShadowCascades(App* app, FramePacket& packet)
+{
+    CascadedShadows& shadows = app->shadows;
+    ShadowFrame& frame = packet.shadows;
+    frame = {};
+
+    for (u32 i = 0; i < packet.lights.size() && i < MAX_LIGHTS; ++i)
+    {
+        if (packet.lights[i].type == LightType_Directional && glm::length(packet.lights[i].direction) > 0.0f)
+        {
+            frame.cascadeCount = glm::clamp(shadows.cascadeCount, 1u, (u32)SHADOW_MAX_CASCADES);
+            frame.shadowLightIndex = i;
+            break;
+        }
+    }
+
+    if (frame.cascadeCount == 0)
+    {
+        // Nothing to keep, the cache is rebuilt when a directional light shows up
+        for (u32 cascade = 0; cascade < SHADOW_MAX_CASCADES; ++cascade)
+            shadows.cacheValid[cascade] = false;
+        return;
+    }
+
+    const Camera& camera = packet.camera;
+    const glm::vec3 lightDirection = glm::normalize(packet.lights[frame.shadowLightIndex].direction);
+    frame.cameraForward = camera.front;
+
+    // Rotation only, so the light space grid stays put in the world
+    const glm::vec3 up = glm::abs(lightDirection.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    const glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+    const glm::mat4 cameraToWorld = glm::inverse(packet.view);
+
+    // Practical split scheme: a blend of uniform and logarithmic splits
+    const f32 nearPlane = camera.near_plane;
+    const f32 farPlane = glm::max(glm::min(camera.far_plane, shadows.maxDistance), nearPlane + 1.0f);
+    const f32 tanHalfFovY = tanf(glm::radians(camera.fov) * 0.5f);
+    const f32 tanHalfFovX = tanHalfFovY * camera.aspect_ratio;
+
+    // Something static changed, or the light turned: every cascade of the cache is stale
+    bool staticChanged = shadows.cachedStaticVersion != app->scene.staticVersion || shadows.cachedLightDirection != lightDirection;
+    for (u32 entity : app->scene.changedEntities)
+        staticChanged = staticChanged || app->scene.isStatic[entity];
+    shadows.cachedStaticVersion = app->scene.staticVersion;
+    shadows.cachedLightDirection = lightDirection;
+
+    f32 sliceNear = nearPlane;
+    for (u32 cascade = 0; cascade < frame.cascadeCount; ++cascade)
+    {
+        const f32 t = (f32)(cascade + 1) / frame.cascadeCount;
+        const f32 uniformSplit = nearPlane + (farPlane - nearPlane) * t;
+        const f32 logSplit = nearPlane * powf(farPlane / nearPlane, t);
+        const f32 sliceFar = glm::mix(uniformSplit, logSplit, shadows.splitLambda);
+
+        // Bounding sphere of the slice, centered on the view axis. It only depends on the
+        // projection, so turning the camera does not resize the cascade.
+        const f32 centerDepth = (sliceNear + sliceFar) * 0.5f;
+        const f32 nearCorner = glm::length(glm::vec3(tanHalfFovX * sliceNear, tanHalfFovY * sliceNear, sliceNear - centerDepth));
+        const f32 farCorner = glm::length(glm::vec3(tanHalfFovX * sliceFar, tanHalfFovY * sliceFar, sliceFar - centerDepth));
+        const f32 radius = ceilf(glm::max(nearCorner, farCorner) * 16.0f) / 16.0f;
+
+        // The margin makes the map SHADOW_MAP_SIZE texels wide with the sphere plus the margin
+        const f32 texelSize = 2.0f * radius / (SHADOW_MAP_SIZE - 2 * SHADOW_CACHE_SNAP_TEXELS);
+        const f32 snapStep = SHADOW_CACHE_SNAP_TEXELS * texelSize;
+
+        ShadowCascadeKey key;
+        key.halfExtent = radius + snapStep;
+
+        const glm::vec3 center = glm::vec3(lightView * cameraToWorld * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+        key.cell = glm::ivec3(glm::floor(center / snapStep + 0.5f));
+        const glm::vec3 snapped = glm::vec3(key.cell) * snapStep;
+
+        // Light space looks down -z, the casters between the light and the sphere have a higher z
+        const glm::mat4 projection = glm::ortho(snapped.x - key.halfExtent, snapped.x + key.halfExtent,
+                                                snapped.y - key.halfExtent, snapped.y + key.halfExtent,
+                                                -(snapped.z + key.halfExtent + SHADOW_CASTER_DISTANCE), -(snapped.z - key.halfExtent));
+
+        frame.viewProjection[cascade] = projection * lightView;
+        frame.splitDepth[cascade] = sliceFar;
+        frame.texelWorldSize[cascade] = texelSize;
+
+        if (staticChanged || !shadows.cacheValid[cascade] || !(shadows.cachedKeys[cascade] == key))
+        {
+            frame.staticRedrawMask |= 1u << cascade;
+            shadows.cachedKeys[cascade] = key;
+            shadows.cacheValid[cascade] = true;
+            shadows.staticRedraws++;
+        }
+
+        sliceNear = sliceFar;
+    }
+
+    for (u32 cascade = frame.cascadeCount; cascade < SHADOW_MAX_CASCADES; ++cascade)
+        shadows.cacheValid[cascade] = false;
+
+    for (u8 isStatic : app->scene.isStatic)
+        frame.movableCasterCount += !isStatic;
+}
+
+void PackShadowParams(const FramePacket& packet, Buffer& globalParamsBuffer)
+{
+    const ShadowFrame& shadows = packet.shadows;
+    globalParamsBuffer.head = GLOBAL_PARAMS_SHADOWS_OFFSET;
+
+    for (u32 cascade = 0; cascade < SHADOW_MAX_CASCADES; ++cascade)
+        PushMat4(globalParamsBuffer, shadows.viewProjection[cascade]);
+
+    const glm::vec4 splitDepth = glm::make_vec4(shadows.splitDepth);
+    const glm::vec4 texelWorldSize = glm::make_vec4(shadows.texelWorldSize);
+    PushVec4(globalParamsBuffer, splitDepth);
+    PushVec4(globalParamsBuffer, texelWorldSize);
+    PushVec3(globalParamsBuffer, shadows.cameraForward);
+    PushUInt(globalParamsBuffer, shadows.cascadeCount);
+    PushUInt(globalParamsBuffer, shadows.shadowLightIndex);
+
+    for (u32 face = 0; face < MAX_SHADOWED_POINT_LIGHTS * 6; ++face)
+        PushVec4(globalParamsBuffer, packet.pointShadows.faceRects[face]);
+}
+
+void RecordShadowCasters(App* app, const FramePacket& packet, bool staticCasters, CommandList& list)
+{
+    const ShadowFrame& frame = packet.shadows;
+    if (frame.cascadeCount == 0)
+        return;
+
+    const u32 cascadeMask = staticCasters ? frame.staticRedrawMask : (1u << frame.cascadeCount) - 1;
+    if (cascadeMask == 0 || (!staticCasters && frame.movableCasterCount == 0))
+        return;
+
+    // Each cascade has its own culled batches, so the mask picks one cascade per multi draw
+    if (packet.culling.shadowCasters)
+    {
+        CmdBindProgram(list, app->shadows.gpuDrivenProgramIdx);
+        const u32 firstPass = staticCasters ? CullPass_ShadowStatic : CullPass_ShadowMovable;
+        for (u32 cascade = 0; cascade < frame.cascadeCount; ++cascade)
+        {
+            if (cascadeMask & (1u << cascade))
+            {
+                CmdSetUniform(list, "uCascadeMask", 1u << cascade);
+                RecordCulledDraws(packet, (CullPass)(firstPass + cascade), list);
+            }
+        }
+        return;
+    }
+
+    // One instance per cascade, or one draw per cascade replaying the list
+    const u32 instanceCount = app->shadows.layeredRendering ? CountBits(cascadeMask) : 1;
+
+    CmdBindProgram(list, app->shadows.programIdx);
+
+    for (const DrawItem& draw : packet.draws)
+    {
+        if (draw.isStatic != staticCasters)
+            continue;
+
+        const Model& model = app->models[draw.modelIndex];
+        const Mesh& mesh = app->meshes[model.mesh_index];
+
+        CmdBindUBORange(list, BINDING(1), CommandBuffer_Constants, draw.localParamsOffset, draw.localParamsSize);
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            CmdBindVao(list, model.mesh_index, i);
+            const SubmeshLod& lod = GetSubmeshLod(mesh.submeshes[i], draw.lod);
+            CmdDrawIndexedInstanced(list, lod.index_count, lod.index_offset, instanceCount);
+        }
+    }
+}
+
+// Draws the list into the cascades of the mask. The vertex shader maps each instance to a cascade of the mask.
+static void DrawShadowCascades(App* app, Program& program, GLuint texture, u32 cascadeMask, bool clear, const CommandList& list)
+{
+    if (clear)
+    {
+        for (u32 cascade = 0; cascade < SHADOW_MAX_CASCADES; ++cascade)
+        {
+            if (cascadeMask & (1u << cascade))
+            {
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, cascade);
+                glClear(GL_DEPTH_BUFFER_BIT);
+            }
+        }
+    }
+
+    if (app->shadows.layeredRendering)
+    {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+        SetUniform(program, "uCascadeMask", cascadeMask);
+        ReplayCommandList(app, list);
+        return;
+    }
+
+    for (u32 cascade = 0; cascade < SHADOW_MAX_CASCADES; ++cascade)
+    {
+        if (cascadeMask & (1u << cascade))
+        {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, cascade);
+            SetUniform(program, "uCascadeMask", 1u << cascade);
+            ReplayCommandList(app, list);
+        }
+    }
+}
+
+void RenderShadowMaps(App* app, const FramePacket& packet)
+{
+    const ShadowFrame& frame = packet.shadows;
+    CascadedShadows& shadows = app->shadows;
+
+    const bool drawMovable = frame.cascadeCount > 0 && frame.movableCasterCount > 0;
+    if (frame.staticRedrawMask || drawMovable)
+    {
+        if (packet.debugGroupMode)
+            glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 2, -1, "Shadow Maps");
+
+        glBindFramebuffer(GL_FRAMEBUFFER, shadows.frameBuffer);
+        glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+
+        // Casters in front of the near plane still cast, flattened onto it
+        glEnable(GL_DEPTH_CLAMP);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(SHADOW_SLOPE_BIAS, SHADOW_CONSTANT_BIAS);
+
+        Program& program = GetProgram(app, packet.culling.shadowCasters ? shadows.gpuDrivenProgramIdx : shadows.programIdx);
+        glUseProgram(program.handle);
+        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+        if (frame.staticRedrawMask)
+            DrawShadowCascades(app, program, shadows.staticMap, frame.staticRedrawMask, true, packet.passCommands[RenderPass_ShadowStatic]);
+
+        if (drawMovable)
+        {
+            // The movable casters go over the cached static depth
+            glCopyImageSubData(shadows.staticMap, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                               shadows.shadowMap, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                               SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, frame.cascadeCount);
+            DrawShadowCascades(app, program, shadows.shadowMap, (1u << frame.cascadeCount) - 1, false, packet.passCommands[RenderPass_ShadowMovable]);
+        }
+
+        glUseProgram(0);
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_DEPTH_CLAMP);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (packet.debugGroupMode)
+            glPopDebugGroup();
+    }
+
+    glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, drawMovable ? shadows.shadowMap : shadows.staticMap);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Cube faces: +X, -X, +Y, -Y, +Z, -Z. The up vectors must match the ones in shaders.glsl.
+static const glm::vec3 PointShadowFaceForward[6] = {
+    { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f }
+};
+static const glm::vec3 PointShadowFaceUp[6] = {
+    { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }
+};
+
+void InitPointShadows(App* app)
+{
+    PointShadows& shadows = app->pointShadows;
+
+    shadows.maxLights = 8;
+    shadows.faceBudget = 12;
+
+    shadows.programIdx = LoadProgram(app, "shaders.glsl", "POINT_SHADOW_CASTER");
+
+    for (u32 level = 0; level < POINT_SHADOW_ATLAS_LEVELS; ++level)
+        shadows.freeTiles[level].clear();
+    shadows.freeTiles[0].push_back(0);
+
+    glGenTextures(1, &shadows.atlas);
+    glBindTexture(GL_TEXTURE_2D, shadows.atlas);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, POINT_SHADOW_ATLAS_SIZE, POINT_SHADOW_ATLAS_SIZE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &shadows.frameBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadows.frameBuffer);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadows.atlas, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        ELOG("The point shadow atlas framebuffer is not complete");
+
+    // Nothing is drawn in the atlas before its tiles are cleared, but start from a lit atlas anyway
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Atlas tiles are a quadtree: a free tile of one level is split in four tiles of the next one
+
+static u32 GetAtlasLevel(u32 tileSize)
+{
+    u32 level = 0;
+    while (((u32)POINT_SHADOW_ATLAS_SIZE >> level) > tileSize)
+        level++;
+    return level;
+}
+
+static bool AllocateAtlasTile(PointShadows& shadows, u32 tileSize, glm::ivec2& tile)
+{
+    const u32 level = GetAtlasLevel(tileSize);
+
+    i32 freeLevel = (i32)level;
+    while (freeLevel >= 0 && shadows.freeTiles[freeLevel].empty())
+        freeLevel--;
+    if (freeLevel < 0)
+        return false;
+
+    u32 packed = shadows.freeTiles[freeLevel].back();
+    shadows.freeTiles[freeLevel].pop_back();
+
+    // Keep the first quarter, free the other three
+    for (u32 splitLevel = (u32)freeLevel + 1; splitLevel <= level; ++splitLevel)
+    {
+        const u32 childSize = POINT_SHADOW_ATLAS_SIZE >> splitLevel;
+        shadows.freeTiles[splitLevel].push_back(packed + childSize);
+        shadows.freeTiles[splitLevel].push_back(packed + (childSize << 16));
+        shadows.freeTiles[splitLevel].push_back(packed + childSize + (childSize << 16));
+    }
+
+    tile = glm::ivec2(packed & 0xFFFF, packed >> 16);
+    return true;
+}
+
+static void FreeAtlasTile(PointShadows& shadows, u32 tileSize, glm::ivec2 tile)
+{
+    u32 level = GetAtlasLevel(tileSize);
+    u32 packed = (u32)tile.x | ((u32)tile.y << 16);
+
+    // Merge with the three siblings while they are all free
+    while (level > 0)
+    {
+        const u32 parentSize = POINT_SHADOW_ATLAS_SIZE >> (level - 1);
+        const u32 childSize = parentSize / 2;
+        const u32 parent = ((u32)tile.x & ~(parentSize - 1)) | (((u32)tile.y & ~(parentSize - 1)) << 16);
+        const u32 children[4] = { parent, parent + childSize, parent + (childSize << 16), parent + childSize + (childSize << 16) };
+
+        std::vector<u32>& freeTiles = shadows.freeTiles[level];
+        u32 freeSiblings = 0;
+        for (u32 child : children)
+            if (child != packed && std::find(freeTiles.begin(), freeTiles.end(), child) != freeTiles.end())
+                freeSiblings++;
+        if (freeSiblings < 3)
+            break;
+
+        for (u32 child : children)
+            if (child != packed)
+                freeTiles.erase(std::find(freeTiles.begin(), freeTiles.end(), child));
+
+        packed = parent;
+        tile = glm::ivec2(parent & 0xFFFF, parent >> 16);
+        level--;
+    }
+
+    shadows.freeTiles[level].push_back(packed);
+}
+
+static void FreePointShadowLight(PointShadows& shadows, PointShadowLight& light)
+{
+    if (light.tileSize)
+        for (u32 face = 0; face < 6; ++face)
+            FreeAtlasTile(shadows, light.tileSize, light.tiles[face]);
+    light = {};
+}
+
+// All six tiles or none
+static bool AllocatePointShadowTiles(PointShadows& shadows, u32 tileSize, glm::ivec2* tiles)
+{
+    for (u32 face = 0; face < 6; ++face)
+    {
+        if (!AllocateAtlasTile(shadows, tileSize, tiles[face]))
+        {
+            for (u32 allocated = 0; allocated < face; ++allocated)
+                FreeAtlasTile(shadows, tileSize, tiles[allocated]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Would the sphere (xyz center, w radius) cast in the face of the light?
+static bool SphereInPointShadowFace(const glm::vec4& sphere, const glm::vec3& lightPosition, f32 lightRadius, u32 face)
+{
+    const glm::vec3 toSphere = glm::vec3(sphere) - lightPosition;
+    if (glm::dot(toSphere, toSphere) > (lightRadius + sphere.w) * (lightRadius + sphere.w))
+        return false;
+
+    // The four side planes of the 90 degree frustum
+    const glm::vec3 forward = PointShadowFaceForward[face];
+    const glm::vec3 side = glm::normalize(glm::cross(forward, PointShadowFaceUp[face]));
+    const glm::vec3 up = glm::cross(side, forward);
+    const f32 margin = sphere.w * 1.41421356f;
+    return glm::dot(toSphere, forward - side) >= -margin && glm::dot(toSphere, forward + side) >= -margin &&
+           glm::dot(toSphere, forward - up) >= -margin && glm::dot(toSphere, forward + up) >= -margin;
+}
+
+void UpdatePointShadows(App* app, FramePacket& packet)
+{
+    PointShadows& shadows = app->pointShadows;
+    PointShadowFrame& frame = packet.pointShadows;
+    const Camera& camera = packet.camera;
+    const Scene& scene = app->scene;
+
+    shadows.frameIndex++;
+
+    // Lights ranked by the screen height their sphere covers
+    struct Candidate
+    {
+        u32 packedIndex;
+        u32 lightIndex;
+        f32 coverage;
+    };
+
+    std::vector<Candidate> candidates;
+    u32 packedIndex = 0;
+    const f32 pixelsPerUnit = packet.displaySize.y * 0.5f / tanf(glm::radians(camera.fov) * 0.5f);
+    ForEachPoolItem(app->lights, [&](u32 lightIndex, const Light& light)
+    {
+        if (light.type == LightType_Point && light.radius > POINT_SHADOW_NEAR * 4.0f)
+        {
+            const f32 distance = glm::distance(light.position, camera.position);
+            const f32 coverage = distance > light.radius ? 2.0f * light.radius * pixelsPerUnit / distance : (f32)packet.displaySize.y;
+            candidates.push_back({ packedIndex, lightIndex, coverage });
+        }
+        packedIndex++;
+    });
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.coverage > b.coverage; });
+    candidates.resize(glm::min((u32)candidates.size(), glm::min(shadows.maxLights, (u32)MAX_SHADOWED_POINT_LIGHTS)));
+
+    // Free the slots of the lights that are gone or lost their shadows
+    for (PointShadowLight& slot : shadows.lights)
+    {
+        if (!slot.used)
+            continue;
+
+        bool selected = false;
+        for (const Candidate& candidate : candidates)
+            selected = selected || (candidate.lightIndex == slot.lightIndex && app->lights.generations[slot.lightIndex] == slot.lightGeneration);
+        if (!selected)
+            FreePointShadowLight(shadows, slot);
+    }
+
+    frame.lightSlots.assign(packet.lights.size(), -1);
+    shadows.shadowedLightCount = 0;
+
+    // Largest first, so they get the tiles they want while there is room
+    for (const Candidate& candidate : candidates)
+    {
+        const Light& light = app->lights[candidate.lightIndex];
+        const u32 generation = app->lights.generations[candidate.lightIndex];
+
+        i32 slotIdx = -1;
+        for (u32 i = 0; i < MAX_SHADOWED_POINT_LIGHTS && slotIdx < 0; ++i)
+            if (shadows.lights[i].used && shadows.lights[i].lightIndex == candidate.lightIndex && shadows.lights[i].lightGeneration == generation)
+                slotIdx = (i32)i;
+        for (u32 i = 0; i < MAX_SHADOWED_POINT_LIGHTS && slotIdx < 0; ++i)
+            if (!shadows.lights[i].used)
+                slotIdx = (i32)i;
+
+        PointShadowLight& slot = shadows.lights[slotIdx];
+        u32 tileSize = POINT_SHADOW_MIN_TILE;
+        while (tileSize < POINT_SHADOW_MAX_TILE && tileSize * 2 <= candidate.coverage)
+            tileSize *= 2;
+
+        // Grow right away, shrink only once the tiles are 4 times too big, so the size does not flicker
+        if (!slot.used || tileSize > slot.tileSize || tileSize * 4 <= slot.tileSize)
+        {
+            // The largest size that fits, down to the one the light already has
+            glm::ivec2 tiles[6];
+            bool allocated = false;
+            for (; tileSize >= POINT_SHADOW_MIN_TILE && tileSize != slot.tileSize; tileSize /= 2)
+            {
+                allocated = AllocatePointShadowTiles(shadows, tileSize, tiles);
+                if (allocated)
+                    break;
+            }
+
+            if (allocated)
+            {
+                FreePointShadowLight(shadows, slot);
+
+                slot.used = true;
+                slot.lightIndex = candidate.lightIndex;
+                slot.lightGeneration = generation;
+                slot.tileSize = tileSize;
+                for (u32 face = 0; face < 6; ++face)
+                {
+                    slot.tiles[face] = tiles[face];
+                    slot.faceDirty[face] = 1;
+                }
+            }
+        }
+
+        // The atlas is full
+        if (!slot.used)
+            continue;
+
+        if (slot.position != light.position || slot.radius != light.radius)
+        {
+            slot.position = light.position;
+            slot.radius = light.radius;
+            for (u32 face = 0; face < 6; ++face)
+                slot.faceDirty[face] = 1;
+        }
+
+        slot.coverage = candidate.coverage;
+        frame.lightSlots[candidate.packedIndex] = slotIdx;
+        shadows.shadowedLightCount++;
+    }
+
+    // Casters that moved dirty the faces they were in and the ones they are in now
+    std::vector<glm::vec4>& bounds = shadows.casterBounds;
+    auto DirtyFacesTouching = [&](const glm::vec4& sphere)
+    {
+        for (PointShadowLight& slot : shadows.lights)
+            if (slot.used)
+                for (u32 face = 0; face < 6; ++face)
+                    if (!slot.faceDirty[face] && SphereInPointShadowFace(sphere, slot.position, slot.radius, face))
+                        slot.faceDirty[face] = 1;
+    };
+
+    const u32 knownEntities = (u32)bounds.size();
+    bounds.resize(scene.count);
+    for (u32 entity = knownEntities; entity < scene.count; ++entity)
+    {
+        bounds[entity] = GetEntityWorldBounds(app, entity);
+        DirtyFacesTouching(bounds[entity]);
+    }
+    for (u32 entity : scene.changedEntities)
+    {
+        if (entity >= knownEntities)
+            continue;
+
+        DirtyFacesTouching(bounds[entity]);
+        bounds[entity] = GetEntityWorldBounds(app, entity);
+        DirtyFacesTouching(bounds[entity]);
+    }
+
+    // Dirty faces with no casters are just lit, they do not take from the budget
+    struct FaceRequest
+    {
+        u32 slot;
+        u32 face;
+    };
+
+    std::vector<FaceRequest> requests;
+    for (u32 slotIdx = 0; slotIdx < MAX_SHADOWED_POINT_LIGHTS; ++slotIdx)
+    {
+        PointShadowLight& slot = shadows.lights[slotIdx];
+        if (!slot.used)
+            continue;
+
+        for (u32 face = 0; face < 6; ++face)
+        {
+            if (!slot.faceDirty[face])
+                continue;
+
+            bool hasCasters = false;
+            for (u32 entity = 0; entity < scene.count && !hasCasters; ++entity)
+                hasCasters = SphereInPointShadowFace(bounds[entity], slot.position, slot.radius, face);
+
+            if (hasCasters)
+            {
+                requests.push_back({ slotIdx, face });
+            }
+            else
+            {
+                slot.faceDirty[face] = 0;
+                slot.faceRendered[face] = 0;
+            }
+        }
+    }
+
+    // Faces showing no shadow at all first, then the lights covering more of the screen, then the stalest
+    std::sort(requests.begin(), requests.end(), [&](const FaceRequest& a, const FaceRequest& b)
+    {
+        const PointShadowLight& lightA = shadows.lights[a.slot];
+        const PointShadowLight& lightB = shadows.lights[b.slot];
+        if (lightA.faceRendered[a.face] != lightB.faceRendered[b.face])
+            return lightA.faceRendered[a.face] < lightB.faceRendered[b.face];
+        if (lightA.coverage != lightB.coverage)
+            return lightA.coverage > lightB.coverage;
+        return lightA.faceFrame[a.face] < lightB.faceFrame[b.face];
+    });
+
+    const u32 budget = glm::min(shadows.faceBudget, (u32)MAX_POINT_SHADOW_FACE_BUDGET);
+    frame.faceCount = glm::min((u32)requests.size(), budget);
+    frame.pendingFaceCount = (u32)requests.size() - frame.faceCount;
+    frame.casters.clear();
+
+    for (u32 i = 0; i < frame.faceCount; ++i)
+    {
+        PointShadowLight& slot = shadows.lights[requests[i].slot];
+        const u32 face = requests[i].face;
+
+        PointShadowFaceDraw& draw = frame.faces[i];
+        draw.viewport = glm::ivec4(slot.tiles[face], slot.tileSize, slot.tileSize);
+        draw.viewProjection = glm::perspective(glm::radians(90.0f), 1.0f, POINT_SHADOW_NEAR, slot.radius) *
+                              glm::lookAt(slot.position, slot.position + PointShadowFaceForward[face], PointShadowFaceUp[face]);
+
+        draw.casterBegin = (u32)frame.casters.size();
+        for (u32 entity = 0; entity < scene.count; ++entity)
+            if (SphereInPointShadowFace(bounds[entity], slot.position, slot.radius, face))
+                frame.casters.push_back(entity);
+        draw.casterCount = (u32)frame.casters.size() - draw.casterBegin;
+
+        slot.faceDirty[face] = 0;
+        slot.faceRendered[face] = 1;
+        slot.faceFrame[face] = shadows.frameIndex;
+        shadows.facesRendered++;
+    }
+
+    for (u32 slotIdx = 0; slotIdx < MAX_SHADOWED_POINT_LIGHTS; ++slotIdx)
+    {
+        const PointShadowLight& slot = shadows.lights[slotIdx];
+        for (u32 face = 0; face < 6; ++face)
+        {
+            glm::vec4& rect = frame.faceRects[slotIdx * 6 + face];
+            if (slot.used && slot.faceRendered[face])
+                rect = glm::vec4(glm::vec2(slot.tiles[face]) / (f32)POINT_SHADOW_ATLAS_SIZE, (f32)slot.tileSize / POINT_SHADOW_ATLAS_SIZE, (f32)slot.tileSize);
+            else
+                rect = glm::vec4(0.0f);
+        }
+    }
+}
+
+void RecordPointShadowCasters(App* app, const FramePacket& packet, CommandList& list)
+{
+    const PointShadowFrame& frame = packet.pointShadows;
+    if (frame.faceCount == 0)
+        return;
+
+    const Scene& scene = app->scene;
+    CmdBindProgram(list, app->pointShadows.programIdx);
+
+    for (u32 i = 0; i < frame.faceCount; ++i)
+    {
+        const PointShadowFaceDraw& face = frame.faces[i];
+        CmdSetViewport(list, face.viewport.x, face.viewport.y, face.viewport.z, face.viewport.w);
+        CmdSetUniform(list, "uFaceViewProjection", face.viewProjection);
+
+        for (u32 caster = face.casterBegin; caster < face.casterBegin + face.casterCount; ++caster)
+        {
+            const u32 entity = frame.casters[caster];
+            const Model& model = app->models[scene.modelIndex[entity]];
+            const Mesh& mesh = app->meshes[model.mesh_index];
+
+            CmdBindUBORange(list, BINDING(1), CommandBuffer_Constants, scene.localParamsOffset[entity], scene.localParamsSize[entity]);
+
+            for (u32 submesh = 0; submesh < mesh.submeshes.size(); ++submesh)
+            {
+                CmdBindVao(list, model.mesh_index, submesh);
+                const SubmeshLod& lod = GetSubmeshLod(mesh.submeshes[submesh], packet.draws[entity].lod);
+                CmdDrawIndexed(list, lod.index_count, lod.index_offset);
+            }
+        }
+    }
+}
+
+void RenderPointShadows(App* app, const FramePacket& packet)
+{
+    const PointShadowFrame& frame = packet.pointShadows;
+    PointShadows& shadows = app->pointShadows;
+
+    if (frame.faceCount)
+    {
+        if (packet.debugGroupMode)
+            glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 3, -1, "Point Shadows");
+
+        glBindFramebuffer(GL_FRAMEBUFFER, shadows.frameBuffer);
+
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+
+        // Only the tiles drawn this frame are cleared
+        glEnable(GL_SCISSOR_TEST);
+        for (u32 i = 0; i < frame.faceCount; ++i)
+        {
+            const glm::ivec4& viewport = frame.faces[i].viewport;
+            glScissor(viewport.x, viewport.y, viewport.z, viewport.w);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        glDisable(GL_SCISSOR_TEST);
+
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(SHADOW_SLOPE_BIAS, SHADOW_CONSTANT_BIAS);
+
+        ReplayCommandList(app, packet.passCommands[RenderPass_PointShadows]);
+
+        glUseProgram(0);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (packet.debugGroupMode)
+            glPopDebugGroup();
+    }
+
+    glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_ATLAS_UNIT);
+    glBindTexture(GL_TEXTURE_2D, shadows.atlas);
+    glActiveTexture(GL_TEXTURE0);
+}
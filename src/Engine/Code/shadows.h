@@ -0,0 +1,181 @@
+//
+// shadows.h: Cascaded shadow maps for the first directional light. The camera frustum is
+// split into 2 to 4 slices and each one gets a cascade: a bounding sphere of the slice, so
+// its size does not change when the camera turns, whose origin is snapped to a coarse grid
+// of shadow map texels, so it does not change either while the camera moves a little.
+// The cascades are the layers of one depth array, drawn in a single instanced pass when
+// the vertex shader can pick the layer (GL_ARB_shader_viewport_layer_array).
+//
+// Static casters are rendered into a cache array, and a cascade of it is only redrawn when
+// the cascade moves, the light turns or a static entity changes. Movable casters are drawn
+// every frame over a copy of the cache.
+//
+// Point lights render the six faces of a cube into tiles of a shared depth atlas. The lights
+// that cover the most of the screen get the shadows and the largest tiles, and faces are
+// only redrawn when the light or a caster inside the face moves, at most a budget of faces
+// per frame. The cost stays the same however many point lights there are.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include "platform.h"
+#include "command_list.h"
+
+struct App;
+struct FramePacket;
+struct Buffer;
+
+#define SHADOW_MAX_CASCADES 4
+#define SHADOW_MAP_SIZE 2048
+#define SHADOW_MAP_UNIT 13
+
+#define POINT_SHADOW_ATLAS_SIZE      4096
+#define POINT_SHADOW_ATLAS_LEVELS    7 // Tiles from the whole atlas down to POINT_SHADOW_MIN_TILE
+#define POINT_SHADOW_MIN_TILE        64
+#define POINT_SHADOW_MAX_TILE        512
+#define POINT_SHADOW_ATLAS_UNIT      14
+#define POINT_SHADOW_NEAR            0.05f // Must match shaders.glsl
+#define MAX_SHADOWED_POINT_LIGHTS    16
+#define MAX_POINT_SHADOW_FACE_BUDGET 48
+
+// Shadow block of GlobalParams (std140), right after the lights: the cascades, then one
+// vec4 per point light face. Must match shaders.glsl.
+#define GLOBAL_PARAMS_SHADOWS_SIZE (SHADOW_MAX_CASCADES * 64 + 4 * 16 + MAX_SHADOWED_POINT_LIGHTS * 6 * 16)
+
+// Where a cascade sits, in shadow map grid cells. The static cache of a cascade stays valid while it does not change.
+struct ShadowCascadeKey
+{
+    glm::ivec3 cell;
+    f32        halfExtent;
+};
+
+// The cascades of one frame, computed by the game thread
+struct ShadowFrame
+{
+    u32       cascadeCount;       // 0 when no directional light casts shadows
+    u32       shadowLightIndex;   // Into FramePacket::lights
+    u32       staticRedrawMask;   // Cascades whose static cache is redrawn this frame
+    u32       movableCasterCount;
+    glm::mat4 viewProjection[SHADOW_MAX_CASCADES];
+    f32       splitDepth[SHADOW_MAX_CASCADES]; // View depth where each cascade ends
+    f32       texelWorldSize[SHADOW_MAX_CASCADES];
+    glm::vec3 cameraForward;
+};
+
+struct CascadedShadows
+{
+    // Settings
+    u32  cascadeCount;
+    f32  maxDistance;
+    f32  splitLambda;      // 0: uniform splits, 1: logarithmic splits
+    bool layeredRendering; // Every cascade in one instanced draw
+
+    u32 programIdx;
+    u32 gpuDrivenProgramIdx; // Draws the culled batches of one cascade, only with layered rendering
+
+    // Game thread: what the static cache holds
+    bool             cacheValid[SHADOW_MAX_CASCADES];
+    ShadowCascadeKey cachedKeys[SHADOW_MAX_CASCADES];
+    glm::vec3        cachedLightDirection;
+    u32              cachedStaticVersion;
+    u32              staticRedraws; // Cascades redrawn since startup
+
+    // Render thread
+    GLuint staticMap; // Static casters only
+    GLuint shadowMap; // Static and movable casters, when there are movable ones
+    GLuint frameBuffer;
+};
+
+// A point light face drawn this frame
+struct PointShadowFaceDraw
+{
+    glm::ivec4 viewport; // In atlas texels
+    glm::mat4  viewProjection;
+    u32        casterBegin; // Into PointShadowFrame::casters
+    u32        casterCount;
+};
+
+// The point light shadows of one frame, computed by the game thread
+struct PointShadowFrame
+{
+    std::vector<i32>    lightSlots; // Per packet light, -1 if it casts no shadows
+    glm::vec4           faceRects[MAX_SHADOWED_POINT_LIGHTS * 6]; // xy: atlas origin, z: size (uv), w: size in texels, 0 if the face is lit
+    u32                 faceCount;
+    PointShadowFaceDraw faces[MAX_POINT_SHADOW_FACE_BUDGET];
+    std::vector<u32>    casters; // Entities drawn into the faces
+    u32                 pendingFaceCount; // Left for the next frames by the budget
+};
+
+struct PointShadowLight
+{
+    bool       used;
+    u32        lightIndex; // Pool slot and generation of the light
+    u32        lightGeneration;
+    glm::vec3  position; // What the faces were rendered with
+    f32        radius;
+    f32        coverage; // Screen pixels
+    u32        tileSize;
+    glm::ivec2 tiles[6];
+    u8         faceDirty[6];
+    u8         faceRendered[6]; // The tile holds casters, 0 while it would be empty or was not drawn yet
+    u32        faceFrame[6];    // When the face was last drawn
+};
+
+struct PointShadows
+{
+    // Settings
+    u32 maxLights;
+    u32 faceBudget; // Faces drawn per frame at most
+
+    u32 programIdx;
+
+    // Game thread
+    PointShadowLight       lights[MAX_SHADOWED_POINT_LIGHTS];
+    std::vector<u32>       freeTiles[POINT_SHADOW_ATLAS_LEVELS]; // Per tile size, packed x | y << 16
+    std::vector<glm::vec4> casterBounds; // World bounding sphere of every entity, as last seen
+    u32                    frameIndex;
+    u32                    shadowedLightCount;
+    u32                    facesRendered; // Since startup
+
+    // Render thread
+    GLuint atlas;
+    GLuint frameBuffer;
+};
+
+// Creates the shadow map arrays and loads the caster program
+void InitShadowMaps(App* app);
+
+/**
+ * Game thread: fits the cascades to the packet camera and decides which cascades of the
+ * static cache must be redrawn. Call it once the packet lights are gathered.
+ */
+void UpdateShadowCascades(App* app, FramePacket& packet);
+
+// Writes the shadow block of GlobalParams
+void PackShadowParams(const FramePacket& packet, Buffer& globalParamsBuffer);
+
+// Game thread: records the static or the movable casters of the frame
+void RecordShadowCasters(App* app, const FramePacket& packet, bool staticCasters, CommandList& list);
+
+/**
+ * Render thread: redraws what the frame needs and binds the shadow map to
+ * SHADOW_MAP_UNIT for the lighting passes.
+ */
+void RenderShadowMaps(App* app, const FramePacket& packet);
+
+// Creates the point light shadow atlas and loads its caster program
+void InitPointShadows(App* app);
+
+/**
+ * Game thread: picks the point lights that cast shadows, sizes their atlas tiles and
+ * decides which faces are redrawn this frame. Call it once the packet lights are gathered.
+ */
+void UpdatePointShadows(App* app, FramePacket& packet);
+
+// Game thread: records the casters of every face drawn this frame
+void RecordPointShadowCasters(App* app, const FramePacket& packet, CommandList& list);
+
+// Render thread: draws the faces of the frame and binds the atlas to POINT_SHADOW_ATLAS_UNIT
+void RenderPointShadows(App* app, const FramePacket& packet);
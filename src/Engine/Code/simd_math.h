@@ -0,0 +1,55 @@
+//
+// simd_math.h: SSE versions of the few matrix operations that run per entity every
+// frame. They fall back to plain glm on targets without SSE.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define ENGINE_USE_SSE
+#endif
+
+// out = a * b, column major. out may alias b but not a.
+inline void MultiplyMat4(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+{
+#ifdef ENGINE_USE_SSE
+    const float* A = &a[0][0];
+    const float* B = &b[0][0];
+    float*       O = &out[0][0];
+
+    const __m128 a0 = _mm_loadu_ps(A + 0);
+    const __m128 a1 = _mm_loadu_ps(A + 4);
+    const __m128 a2 = _mm_loadu_ps(A + 8);
+    const __m128 a3 = _mm_loadu_ps(A + 12);
+
+    for (u32 c = 0; c < 4; ++c)
+    {
+        __m128 column = _mm_mul_ps(a0, _mm_set1_ps(B[c * 4 + 0]));
+        column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(B[c * 4 + 1])));
+        column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(B[c * 4 + 2])));
+        column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(B[c * 4 + 3])));
+        _mm_storeu_ps(O + c * 4, column);
+    }
+#else
+    out = a * b;
+#endif
+}
+
+// Copies a matrix to memory that is only written (e.g. a mapped buffer) without reading it back
+inline void StoreMat4(const glm::mat4& m, void* destination)
+{
+#ifdef ENGINE_USE_SSE
+    const float* M = &m[0][0];
+    float*       D = (float*)destination;
+
+    _mm_storeu_ps(D + 0, _mm_loadu_ps(M + 0));
+    _mm_storeu_ps(D + 4, _mm_loadu_ps(M + 4));
+    _mm_storeu_ps(D + 8, _mm_loadu_ps(M + 8));
+    _mm_storeu_ps(D + 12, _mm_loadu_ps(M + 12));
+#else
+    memcpy(destination, &m[0][0], sizeof(m));
+#endif
+}
@@ -0,0 +1,778 @@
+#include "terrain.h"
+
+#include <stb_image.h>
+
+#include "engine.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+#define BINDING(b) b
+
+// The planes of the water passes in Render(), the terrain passes clip the same way
+static const glm::vec4 TerrainClippingPlanes[TerrainPass_Count] = {
+    glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+    glm::vec4(0.0f, -1.0f, 0.0f, 0.0f),
+    glm::vec4(0.0f),
+    glm::vec4(0.0f),
+};
+
+static const char* TerrainProgramNames[TerrainPass_Count] = {
+    "TERRAIN",
+    "TERRAIN",
+    "TERRAIN",
+    "TERRAIN_GEOMETRY_PASS"
+};
+
+static const ShaderFeatures TerrainProgramFeatures[TerrainPass_Count] = {
+    ShaderFeature_Clipping,
+    ShaderFeature_Clipping,
+    0,
+    0
+};
+
+/**
+ * Reads a width x height block of heights starting at (x, y) into out. Texels outside
+ * the heightmap repeat its edge. file is the open raw file, or null for decoded images.
+ */
+static void ReadHeightmapRegion(const Terrain& terrain, FILE* file, i32 x, i32 y, u32 width, u32 height, u16* out)
+{
+    const i32 lastTexel = (i32)terrain.size - 1;
+    const i32 firstColumn = glm::clamp(x, 0, lastTexel);
+    const i32 lastColumn = glm::clamp(x + (i32)width - 1, 0, lastTexel);
+    const u32 columnCount = (u32)(lastColumn - firstColumn + 1);
+    const u32 leftPadding = (u32)(firstColumn - x);
+
+    for (u32 row = 0; row < height; ++row)
+    {
+        const i32 sourceRow = glm::clamp(y + (i32)row, 0, lastTexel);
+        u16* rowOut = out + row * width;
+
+        if (file)
+        {
+            _fseeki64(file, ((i64)sourceRow * terrain.size + firstColumn) * (i64)sizeof(u16), SEEK_SET);
+            if (fread(rowOut + leftPadding, sizeof(u16), columnCount, file) != columnCount)
+                memset(rowOut + leftPadding, 0, columnCount * sizeof(u16));
+        }
+        else
+        {
+            memcpy(rowOut + leftPadding, &terrain.pixels[(u64)sourceRow * terrain.size + firstColumn], columnCount * sizeof(u16));
+        }
+
+        for (u32 i = 0; i < leftPadding; ++i)
+            rowOut[i] = rowOut[leftPadding];
+        for (u32 i = leftPadding + columnCount; i < width; ++i)
+            rowOut[i] = rowOut[leftPadding + columnCount - 1];
+    }
+}
+
+static bool LoadHeightmap(Terrain& terrain, const char* path)
+{
+    terrain.heightmapPath = path;
+
+    const char* extension = strrchr(path, '.');
+    terrain.rawFile = extension && strcmp(extension, ".r16") == 0;
+
+    if (terrain.rawFile)
+    {
+        FILE* file = fopen(path, "rb");
+        if (!file)
+        {
+            ELOG("fopen() failed reading heightmap %s", path);
+            return false;
+        }
+        _fseeki64(file, 0, SEEK_END);
+        const i64 bytes = _ftelli64(file);
+        fclose(file);
+
+        terrain.size = (u32)sqrt((f64)(bytes / (i64)sizeof(u16)));
+        if ((i64)terrain.size * terrain.size * (i64)sizeof(u16) != bytes)
+        {
+            ELOG("Heightmap %s is not a square of 16-bit heights", path);
+            return false;
+        }
+    }
+    else
+    {
+        // Rows go along +z from the first one, so the image is not flipped
+        stbi_set_flip_vertically_on_load_thread(false);
+
+        i32 width, height, channels;
+        u16* pixels = stbi_load_16(path, &width, &height, &channels, 1);
+        if (!pixels)
+        {
+            ELOG("Could not open heightmap %s", path);
+            return false;
+        }
+        if (width != height)
+        {
+            ELOG("Heightmap %s is not square", path);
+            stbi_image_free(pixels);
+            return false;
+        }
+
+        terrain.size = (u32)width;
+        terrain.pixels.assign(pixels, pixels + (u64)width * height);
+        stbi_image_free(pixels);
+    }
+
+    return terrain.size >= 2;
+}
+
+/**
+ * One pass over the rows: the height range of the finest cells, and the overview, which
+ * keeps every overviewStep-th texel so it matches the heightmap where their texels meet.
+ */
+static void ScanHeightmap(Terrain& terrain, std::vector<u16>& overview)
+{
+    const u32 quads = terrain.size - 1;
+
+    terrain.overviewStep = 1;
+    while (quads / terrain.overviewStep + 1 > TERRAIN_OVERVIEW_SIZE)
+        terrain.overviewStep *= 2;
+    terrain.overviewSize = (quads + terrain.overviewStep - 1) / terrain.overviewStep + 1;
+    overview.resize(terrain.overviewSize * terrain.overviewSize);
+
+    const u32 cells = glm::max((quads + TERRAIN_GRID_SIZE - 1) / TERRAIN_GRID_SIZE, 1u);
+    terrain.minMaxSize[0] = cells;
+    std::vector<u16>& minMax = terrain.minMax[0];
+    minMax.resize(cells * cells * 2);
+    for (u32 i = 0; i < cells * cells; ++i)
+    {
+        minMax[i * 2] = UINT16_MAX;
+        minMax[i * 2 + 1] = 0;
+    }
+
+    FILE* file = terrain.rawFile ? fopen(terrain.heightmapPath.c_str(), "rb") : nullptr;
+    std::vector<u16> row(terrain.size);
+    std::vector<u16> rowMinMax(cells * 2);
+
+    for (u32 y = 0; y < terrain.size; ++y)
+    {
+        ReadHeightmapRegion(terrain, file, 0, (i32)y, terrain.size, 1, row.data());
+
+        // A texel on the edge between two cells belongs to both
+        for (u32 cx = 0; cx < cells; ++cx)
+        {
+            const u32 first = cx * TERRAIN_GRID_SIZE;
+            const u32 last = glm::min(first + TERRAIN_GRID_SIZE, quads);
+            u16 low = UINT16_MAX, high = 0;
+            for (u32 x = first; x <= last; ++x)
+            {
+                low = glm::min(low, row[x]);
+                high = glm::max(high, row[x]);
+            }
+            rowMinMax[cx * 2] = low;
+            rowMinMax[cx * 2 + 1] = high;
+        }
+
+        for (u32 cy = y / TERRAIN_GRID_SIZE - (y % TERRAIN_GRID_SIZE == 0 && y > 0 ? 1 : 0); cy <= y / TERRAIN_GRID_SIZE && cy < cells; ++cy)
+        {
+            for (u32 cx = 0; cx < cells; ++cx)
+            {
+                u16* cell = &minMax[(cy * cells + cx) * 2];
+                cell[0] = glm::min(cell[0], rowMinMax[cx * 2]);
+                cell[1] = glm::max(cell[1], rowMinMax[cx * 2 + 1]);
+            }
+        }
+
+        if (y % terrain.overviewStep == 0 || y == quads)
+        {
+            const u32 oy = (y + terrain.overviewStep - 1) / terrain.overviewStep;
+            for (u32 ox = 0; ox < terrain.overviewSize; ++ox)
+                overview[oy * terrain.overviewSize + ox] = row[glm::min(ox * terrain.overviewStep, quads)];
+        }
+    }
+
+    if (file)
+        fclose(file);
+
+    // Each coarser level merges 2x2 cells, up to one cell over the whole heightmap
+    terrain.minMaxLevels = 1;
+    while (terrain.minMaxSize[terrain.minMaxLevels - 1] > 1 && terrain.minMaxLevels < TERRAIN_MAX_LEVELS)
+    {
+        const u32 level = terrain.minMaxLevels++;
+        const u32 fineSize = terrain.minMaxSize[level - 1];
+        const u32 coarseSize = (fineSize + 1) / 2;
+        const std::vector<u16>& fine = terrain.minMax[level - 1];
+        std::vector<u16>& coarse = terrain.minMax[level];
+
+        terrain.minMaxSize[level] = coarseSize;
+        coarse.resize(coarseSize * coarseSize * 2);
+        for (u32 cy = 0; cy < coarseSize; ++cy)
+        {
+            for (u32 cx = 0; cx < coarseSize; ++cx)
+            {
+                u16 low = UINT16_MAX, high = 0;
+                for (u32 i = 0; i < 4; ++i)
+                {
+                    const u32 fx = glm::min(cx * 2 + (i & 1), fineSize - 1);
+                    const u32 fy = glm::min(cy * 2 + (i >> 1), fineSize - 1);
+                    low = glm::min(low, fine[(fy * fineSize + fx) * 2]);
+                    high = glm::max(high, fine[(fy * fineSize + fx) * 2 + 1]);
+                }
+                coarse[(cy * coarseSize + cx) * 2] = low;
+                coarse[(cy * coarseSize + cx) * 2 + 1] = high;
+            }
+        }
+    }
+}
+
+static GLuint CreateHeightTexture(GLenum target, u32 size, u32 layers, GLenum internalFormat, GLenum filter)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(target, texture);
+    if (target == GL_TEXTURE_2D_ARRAY)
+        glTexStorage3D(target, 1, internalFormat, size, size, layers);
+    else
+        glTexStorage2D(target, 1, internalFormat, size, size);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(target, 0);
+    return texture;
+}
+
+// The grid of a node, its indices in quadrant order so a quadrant draws on its own
+static void CreateTerrainGrid(Terrain& terrain)
+{
+    const u32 side = TERRAIN_GRID_SIZE + 1;
+    std::vector<glm::vec2> vertices(side * side);
+    for (u32 y = 0; y < side; ++y)
+        for (u32 x = 0; x < side; ++x)
+            vertices[y * side + x] = glm::vec2((f32)x, (f32)y) / (f32)TERRAIN_GRID_SIZE;
+
+    std::vector<u16> triangles;
+    std::vector<u16> patches;
+    const u32 half = TERRAIN_GRID_SIZE / 2;
+    for (u32 quadrant = 0; quadrant < 4; ++quadrant)
+    {
+        const u32 firstX = (quadrant & 1) * half;
+        const u32 firstY = (quadrant >> 1) * half;
+        for (u32 y = firstY; y < firstY + half; ++y)
+        {
+            for (u32 x = firstX; x < firstX + half; ++x)
+            {
+                const u16 i0 = (u16)(y * side + x);
+                const u16 i1 = (u16)(i0 + 1);
+                const u16 i2 = (u16)(i0 + side + 1);
+                const u16 i3 = (u16)(i0 + side);
+
+                const u16 quadTriangles[] = { i0, i1, i2, i0, i2, i3 };
+                triangles.insert(triangles.end(), quadTriangles, quadTriangles + 6);
+
+                // Corners in the (u, v) order of the tessellation domain
+                const u16 quadPatch[] = { i0, i1, i2, i3 };
+                patches.insert(patches.end(), quadPatch, quadPatch + 4);
+            }
+        }
+    }
+
+    glGenBuffers(1, &terrain.gridVertices);
+    glBindBuffer(GL_ARRAY_BUFFER, terrain.gridVertices);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), vertices.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &terrain.instanceBuffer);
+    terrain.instanceCapacity = 0;
+
+    glGenBuffers(1, &terrain.gridIndices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain.gridIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangles.size() * sizeof(u16), triangles.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &terrain.gridPatchIndices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain.gridPatchIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, patches.size() * sizeof(u16), patches.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    GLuint* vaos[] = { &terrain.vao, &terrain.patchVao };
+    const GLuint indexBuffers[] = { terrain.gridIndices, terrain.gridPatchIndices };
+    for (u32 i = 0; i < ARRAY_COUNT(vaos); ++i)
+    {
+        glGenVertexArrays(1, vaos[i]);
+        glBindVertexArray(*vaos[i]);
+
+        glBindBuffer(GL_ARRAY_BUFFER, terrain.gridVertices);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+        glEnableVertexAttribArray(0);
+
+        glBindBuffer(GL_ARRAY_BUFFER, terrain.instanceBuffer);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainNode), (void*)0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(1);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffers[i]);
+        glBindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InitTerrain(App* app, const char* heightmapPath)
+{
+    Terrain& terrain = app->terrain;
+
+    terrain.enabled = true;
+    terrain.tessellationSupported = GLAD_GL_VERSION_4_0 != 0;
+    terrain.tessellation = false;
+    terrain.texelSize = 2.0f;
+    terrain.heightScale = 150.0f;
+    terrain.heightOffset = -30.0f;
+    terrain.lodDistance = 160.0f;
+    terrain.morphStart = 0.66f;
+    terrain.tessellationPixels = 8.0f;
+
+    for (u32 pass = 0; pass < TerrainPass_Count; ++pass)
+    {
+        terrain.programIdx[pass][0] = LoadProgram(app, "shaders.glsl", TerrainProgramNames[pass], TerrainProgramFeatures[pass]);
+        terrain.programIdx[pass][1] = LoadProgram(app, "shaders.glsl", TerrainProgramNames[pass], TerrainProgramFeatures[pass] | ShaderFeature_Tessellation);
+    }
+
+    terrain.loaded = LoadHeightmap(terrain, heightmapPath);
+    if (!terrain.loaded)
+        return;
+
+    std::vector<u16> overview;
+    ScanHeightmap(terrain, overview);
+
+    terrain.tilesPerSide = glm::max((terrain.size - 1 + TERRAIN_TILE_SIZE - 1) / TERRAIN_TILE_SIZE, 1u);
+    terrain.tileLayers.assign(terrain.tilesPerSide * terrain.tilesPerSide, -1);
+    terrain.tileWantedFrame.assign(terrain.tilesPerSide * terrain.tilesPerSide, 0);
+    for (u32 layer = 0; layer < TERRAIN_TILE_CACHE; ++layer)
+    {
+        terrain.layerTiles[layer] = UINT32_MAX;
+        terrain.layerLastWanted[layer] = 0;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+
+    terrain.overview = CreateHeightTexture(GL_TEXTURE_2D, terrain.overviewSize, 1, GL_R16, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, terrain.overview);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, terrain.overviewSize, terrain.overviewSize, GL_RED, GL_UNSIGNED_SHORT, overview.data());
+
+    terrain.tiles = CreateHeightTexture(GL_TEXTURE_2D_ARRAY, TERRAIN_TILE_TEXELS, TERRAIN_TILE_CACHE, GL_R16, GL_LINEAR);
+
+    // Layer + 1 of each tile, 0 while it is not resident
+    std::vector<u16> noLayers(terrain.tilesPerSide * terrain.tilesPerSide, 0);
+    terrain.tileLayerTexture = CreateHeightTexture(GL_TEXTURE_2D, terrain.tilesPerSide, 1, GL_R16UI, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, terrain.tileLayerTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, terrain.tilesPerSide, terrain.tilesPerSide, GL_RED_INTEGER, GL_UNSIGNED_SHORT, noLayers.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    CreateTerrainGrid(terrain);
+
+    ILOG("Terrain: %ux%u heightmap (%s), %u height range levels, overview 1/%u, %u tiles", terrain.size, terrain.size,
+         terrain.rawFile ? "streamed from disk" : "decoded", terrain.minMaxLevels, terrain.overviewStep, terrain.tilesPerSide * terrain.tilesPerSide);
+}
+
+struct TerrainSelectContext
+{
+    Terrain*          terrain;
+    TerrainSelection* selection;
+    u32               leafShift; // The finest nodes are (TERRAIN_GRID_SIZE << leafShift) texels wide
+    glm::vec4         planes[6];
+    f32               ranges[TERRAIN_MAX_LEVELS];
+    std::vector<TerrainNode> groups[TerrainDrawGroup_Count];
+    std::vector<u32>* wantedTiles; // Null for a view that streams nothing
+};
+
+static bool BoxOutsideFrustum(const glm::vec4* planes, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    for (u32 i = 0; i < 6; ++i)
+    {
+        // The corner furthest along the plane normal
+        const glm::vec3 corner = glm::vec3(planes[i].x > 0.0f ? boxMax.x : boxMin.x, planes[i].y > 0.0f ? boxMax.y : boxMin.y, planes[i].z > 0.0f ? boxMax.z : boxMin.z);
+        if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f)
+            return true;
+    }
+    return false;
+}
+
+static bool BoxInSphere(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& center, f32 radius)
+{
+    const glm::vec3 closest = glm::clamp(center, boxMin, boxMax);
+    return glm::dot(closest - center, closest - center) <= radius * radius;
+}
+
+// Requests the tiles under the texels of a node, when its vertices are closer together than the overview texels
+static void WantTiles(TerrainSelectContext& ctx, u32 level, u32 firstX, u32 firstY, u32 texels)
+{
+    Terrain& terrain = *ctx.terrain;
+    if (!ctx.wantedTiles || (1u << level) >= terrain.overviewStep)
+        return;
+
+    const u32 lastTile = terrain.tilesPerSide - 1;
+    const u32 lastTexel = terrain.size - 2;
+    for (u32 ty = firstY / TERRAIN_TILE_SIZE; ty <= glm::min(glm::min(firstY + texels, lastTexel) / TERRAIN_TILE_SIZE, lastTile); ++ty)
+    {
+        for (u32 tx = firstX / TERRAIN_TILE_SIZE; tx <= glm::min(glm::min(firstX + texels, lastTexel) / TERRAIN_TILE_SIZE, lastTile); ++tx)
+        {
+            const u32 tile = ty * terrain.tilesPerSide + tx;
+            if (terrain.tileWantedFrame[tile] != terrain.frameIndex)
+            {
+                terrain.tileWantedFrame[tile] = terrain.frameIndex;
+                ctx.wantedTiles->push_back(tile);
+            }
+        }
+    }
+}
+
+static void AddTerrainNode(TerrainSelectContext& ctx, TerrainDrawGroup group, u32 level, u32 nx, u32 ny)
+{
+    const Terrain& terrain = *ctx.terrain;
+    const u32 texels = TERRAIN_GRID_SIZE << (level + ctx.leafShift);
+    const f32 halfExtent = (f32)(terrain.size - 1) * 0.5f;
+
+    TerrainNode node;
+    node.origin = (glm::vec2((f32)(nx * texels), (f32)(ny * texels)) - halfExtent) * terrain.texelSize;
+    node.size = (f32)texels * terrain.texelSize;
+    node.level = (f32)level;
+    ctx.groups[group].push_back(node);
+
+    if (group == TerrainDrawGroup_Full)
+    {
+        WantTiles(ctx, level, nx * texels, ny * texels, texels);
+    }
+    else
+    {
+        const u32 quadrant = group - TerrainDrawGroup_Quadrant0;
+        WantTiles(ctx, level, nx * texels + (quadrant & 1) * texels / 2, ny * texels + (quadrant >> 1) * texels / 2, texels / 2);
+    }
+}
+
+/**
+ * Selects the node or, where it is close enough, its children. Returns false if the node
+ * is too far for its level, so its parent draws that quadrant instead.
+ */
+static bool SelectTerrainNode(TerrainSelectContext& ctx, u32 level, u32 nx, u32 ny)
+{
+    const Terrain& terrain = *ctx.terrain;
+    const u32 texels = TERRAIN_GRID_SIZE << (level + ctx.leafShift);
+    const u32 firstX = nx * texels;
+    const u32 firstY = ny * texels;
+    if (firstX >= terrain.size - 1 || firstY >= terrain.size - 1)
+        return true; // Past the heightmap, nothing to draw
+
+    // Nodes coarser than the whole heightmap use the range of all of it
+    const u32 minMaxLevel = level + ctx.leafShift;
+    const u16* range = &terrain.minMax[terrain.minMaxLevels - 1][0];
+    if (minMaxLevel < terrain.minMaxLevels)
+        range = &terrain.minMax[minMaxLevel][(ny * terrain.minMaxSize[minMaxLevel] + nx) * 2];
+
+    const f32 halfExtent = (f32)(terrain.size - 1) * 0.5f;
+    const glm::vec3 boxMin = glm::vec3(((f32)firstX - halfExtent) * terrain.texelSize,
+                                       terrain.heightOffset + range[0] / 65535.0f * terrain.heightScale,
+                                       ((f32)firstY - halfExtent) * terrain.texelSize);
+    const glm::vec3 boxMax = glm::vec3(((f32)glm::min(firstX + texels, terrain.size - 1) - halfExtent) * terrain.texelSize,
+                                       terrain.heightOffset + range[1] / 65535.0f * terrain.heightScale,
+                                       ((f32)glm::min(firstY + texels, terrain.size - 1) - halfExtent) * terrain.texelSize);
+
+    if (BoxOutsideFrustum(ctx.planes, boxMin, boxMax))
+        return true;
+    if (!BoxInSphere(boxMin, boxMax, ctx.selection->eye, ctx.ranges[level]))
+        return false;
+
+    if (level == 0 || !BoxInSphere(boxMin, boxMax, ctx.selection->eye, ctx.ranges[level - 1]))
+    {
+        AddTerrainNode(ctx, TerrainDrawGroup_Full, level, nx, ny);
+        return true;
+    }
+
+    // The children out of their range are drawn by this node, one quadrant each
+    for (u32 quadrant = 0; quadrant < 4; ++quadrant)
+    {
+        if (!SelectTerrainNode(ctx, level - 1, nx * 2 + (quadrant & 1), ny * 2 + (quadrant >> 1)))
+            AddTerrainNode(ctx, (TerrainDrawGroup)(TerrainDrawGroup_Quadrant0 + quadrant), level, nx, ny);
+    }
+    return true;
+}
+
+static void SelectTerrainNodes(Terrain& terrain, TerrainSelection& selection, u32 leafShift, f32 lodDistance, std::vector<u32>* wantedTiles)
+{
+    TerrainSelectContext ctx;
+    ctx.terrain = &terrain;
+    ctx.selection = &selection;
+    ctx.leafShift = leafShift;
+    ctx.wantedTiles = wantedTiles;
+
+    // Rows of the view projection, added and subtracted, are the clip planes
+    const glm::mat4& m = selection.viewProjection;
+    for (u32 i = 0; i < 3; ++i)
+    {
+        const glm::vec4 row = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+        const glm::vec4 w = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+        ctx.planes[i * 2] = w + row;
+        ctx.planes[i * 2 + 1] = w - row;
+    }
+
+    for (u32 level = 0; level < TERRAIN_MAX_LEVELS; ++level)
+        ctx.ranges[level] = lodDistance * (f32)(1u << level);
+
+    const u32 levelCount = terrain.minMaxLevels > leafShift ? glm::min(terrain.minMaxLevels - leafShift, (u32)TERRAIN_MAX_LEVELS) : 1;
+    if (!SelectTerrainNode(ctx, levelCount - 1, 0, 0))
+        AddTerrainNode(ctx, TerrainDrawGroup_Full, levelCount - 1, 0, 0);
+
+    selection.nodes.clear();
+    for (u32 group = 0; group < TerrainDrawGroup_Count; ++group)
+    {
+        selection.groupFirst[group] = (u32)selection.nodes.size();
+        selection.groupCount[group] = (u32)ctx.groups[group].size();
+        selection.nodes.insert(selection.nodes.end(), ctx.groups[group].begin(), ctx.groups[group].end());
+    }
+}
+
+/**
+ * Gives the wanted tiles that are not resident a layer, at most TERRAIN_TILE_UPLOADS per
+ * frame, taking the layers of the tiles wanted the longest time ago, and reads their texels.
+ */
+static void StreamTerrainTiles(Terrain& terrain, TerrainFrame& frame, std::vector<u32>& wantedTiles, const glm::vec3& eye)
+{
+    // Nearest first, so the tiles under the camera come in first
+    const f32 tileWorldSize = TERRAIN_TILE_SIZE * terrain.texelSize;
+    const f32 halfExtent = (f32)(terrain.size - 1) * 0.5f * terrain.texelSize;
+    auto tileDistance = [&](u32 tile)
+    {
+        const glm::vec2 center = (glm::vec2((f32)(tile % terrain.tilesPerSide), (f32)(tile / terrain.tilesPerSide)) + 0.5f) * tileWorldSize - halfExtent;
+        return glm::distance(center, glm::vec2(eye.x, eye.z));
+    };
+    std::sort(wantedTiles.begin(), wantedTiles.end(), [&](u32 a, u32 b) { return tileDistance(a) < tileDistance(b); });
+
+    for (u32 tile : wantedTiles)
+    {
+        if (terrain.tileLayers[tile] >= 0)
+            terrain.layerLastWanted[terrain.tileLayers[tile]] = terrain.frameIndex;
+    }
+
+    for (u32 tile : wantedTiles)
+    {
+        if (frame.uploadCount == TERRAIN_TILE_UPLOADS)
+            break;
+        if (terrain.tileLayers[tile] >= 0)
+            continue;
+
+        u32 layer = UINT32_MAX;
+        for (u32 l = 0; l < TERRAIN_TILE_CACHE; ++l)
+        {
+            if (terrain.layerTiles[l] == UINT32_MAX)
+            {
+                layer = l;
+                break;
+            }
+            if (layer == UINT32_MAX || terrain.layerLastWanted[l] < terrain.layerLastWanted[layer])
+                layer = l;
+        }
+
+        // Every layer holds a tile wanted this frame
+        if (terrain.layerTiles[layer] != UINT32_MAX && terrain.layerLastWanted[layer] == terrain.frameIndex)
+            break;
+
+        if (terrain.layerTiles[layer] != UINT32_MAX)
+        {
+            const u32 evicted = terrain.layerTiles[layer];
+            terrain.tileLayers[evicted] = -1;
+            frame.evictedTiles.push_back((evicted % terrain.tilesPerSide) | (evicted / terrain.tilesPerSide) << 16);
+            terrain.residentTiles--;
+        }
+
+        terrain.layerTiles[layer] = tile;
+        terrain.layerLastWanted[layer] = terrain.frameIndex;
+        terrain.tileLayers[tile] = (i32)layer;
+        terrain.residentTiles++;
+
+        frame.uploadTiles[frame.uploadCount] = (tile % terrain.tilesPerSide) | (tile / terrain.tilesPerSide) << 16;
+        frame.uploadLayers[frame.uploadCount] = layer;
+        frame.uploadCount++;
+    }
+
+    // Each tile comes with one texel more on every side
+    const u32 tileTexelCount = TERRAIN_TILE_TEXELS * TERRAIN_TILE_TEXELS;
+    frame.uploadTexels.resize(frame.uploadCount * tileTexelCount);
+    ParallelFor(frame.uploadCount, 1, [&](u32 begin, u32 end)
+    {
+        FILE* file = terrain.rawFile ? fopen(terrain.heightmapPath.c_str(), "rb") : nullptr;
+        for (u32 i = begin; i < end; ++i)
+        {
+            const i32 x = (i32)(frame.uploadTiles[i] & 0xFFFF) * TERRAIN_TILE_SIZE - 1;
+            const i32 y = (i32)(frame.uploadTiles[i] >> 16) * TERRAIN_TILE_SIZE - 1;
+            ReadHeightmapRegion(terrain, file, x, y, TERRAIN_TILE_TEXELS, TERRAIN_TILE_TEXELS, &frame.uploadTexels[i * tileTexelCount]);
+        }
+        if (file)
+            fclose(file);
+    });
+
+    terrain.streamedTiles += frame.uploadCount;
+}
+
+void UpdateTerrain(App* app, FramePacket& packet)
+{
+    Terrain& terrain = app->terrain;
+    TerrainFrame& frame = packet.terrain;
+
+    frame.enabled = terrain.loaded && terrain.enabled;
+    frame.uploadCount = 0;
+    frame.uploadTexels.clear();
+    frame.evictedTiles.clear();
+    for (TerrainSelection& selection : frame.views)
+        selection.nodes.clear();
+
+    terrain.drawnNodes = 0;
+    if (!frame.enabled)
+        return;
+
+    frame.tessellation = terrain.tessellation && terrain.tessellationSupported;
+
+    // The finest level is coarser when tessellation brings the detail back
+    const u32 leafShift = frame.tessellation ? 2 : 0;
+    static_assert((1 << 2) == TERRAIN_MAX_TESS_LEVEL, "The finest grid is coarser by the tessellation level");
+
+    // Ranges shorter than twice the nodes they select would let levels two apart meet
+    const f32 minLodDistance = 2.0f * TERRAIN_GRID_SIZE * terrain.texelSize;
+    frame.lodDistance = glm::max(terrain.lodDistance, minLodDistance) * (f32)(1u << leafShift);
+    frame.morphStart = terrain.morphStart;
+    frame.tessellationScale = packet.projection[1][1] * (f32)packet.displaySize.y * 0.5f / terrain.tessellationPixels;
+
+    TerrainSelection& main = frame.views[TerrainView_Main];
+    main.viewProjection = packet.projection * packet.view;
+    main.eye = packet.camera.position;
+
+    Camera waterCamera = packet.waterCamera;
+    TerrainSelection& water = frame.views[TerrainView_Water];
+    water.viewProjection = waterCamera.GetProjectionMatrix() * waterCamera.GetViewMatrix();
+    water.eye = waterCamera.position;
+
+    // Only the main camera streams tiles, the water passes draw what it brought in
+    terrain.frameIndex++;
+    std::vector<u32> wantedTiles;
+    SelectTerrainNodes(terrain, main, leafShift, frame.lodDistance, &wantedTiles);
+    SelectTerrainNodes(terrain, water, leafShift, frame.lodDistance, nullptr);
+    terrain.drawnNodes = (u32)main.nodes.size();
+
+    StreamTerrainTiles(terrain, frame, wantedTiles, main.eye);
+}
+
+void PrepareTerrain(App* app, const FramePacket& packet)
+{
+    Terrain& terrain = app->terrain;
+    const TerrainFrame& frame = packet.terrain;
+    if (!terrain.loaded)
+        return;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+
+    // Evicted first, as their layers may be refilled below
+    const u16 notResident = 0;
+    glBindTexture(GL_TEXTURE_2D, terrain.tileLayerTexture);
+    for (u32 tile : frame.evictedTiles)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, tile & 0xFFFF, tile >> 16, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &notResident);
+
+    for (u32 i = 0; i < frame.uploadCount; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, terrain.tiles);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, frame.uploadLayers[i], TERRAIN_TILE_TEXELS, TERRAIN_TILE_TEXELS, 1, GL_RED, GL_UNSIGNED_SHORT,
+                        &frame.uploadTexels[i * TERRAIN_TILE_TEXELS * TERRAIN_TILE_TEXELS]);
+
+        const u16 layer = (u16)(frame.uploadLayers[i] + 1);
+        glBindTexture(GL_TEXTURE_2D, terrain.tileLayerTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, frame.uploadTiles[i] & 0xFFFF, frame.uploadTiles[i] >> 16, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &layer);
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (!frame.enabled)
+        return;
+
+    // The nodes of every view, one after the other
+    u32 nodeCount = 0;
+    for (const TerrainSelection& selection : frame.views)
+        nodeCount += (u32)selection.nodes.size();
+
+    glBindBuffer(GL_ARRAY_BUFFER, terrain.instanceBuffer);
+    if (nodeCount > terrain.instanceCapacity)
+    {
+        terrain.instanceCapacity = glm::max(nodeCount, terrain.instanceCapacity * 2);
+        glBufferData(GL_ARRAY_BUFFER, terrain.instanceCapacity * sizeof(TerrainNode), nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    u32 firstNode = 0;
+    for (const TerrainSelection& selection : frame.views)
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, firstNode * sizeof(TerrainNode), selection.nodes.size() * sizeof(TerrainNode), selection.nodes.data());
+        firstNode += (u32)selection.nodes.size();
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glActiveTexture(GL_TEXTURE0 + TERRAIN_OVERVIEW_UNIT);
+    glBindTexture(GL_TEXTURE_2D, terrain.overview);
+    glActiveTexture(GL_TEXTURE0 + TERRAIN_TILES_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, terrain.tiles);
+    glActiveTexture(GL_TEXTURE0 + TERRAIN_TILE_LAYERS_UNIT);
+    glBindTexture(GL_TEXTURE_2D, terrain.tileLayerTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void RenderTerrain(App* app, const FramePacket& packet, TerrainPass pass)
+{
+    const TerrainFrame& frame = packet.terrain;
+    if (!frame.enabled)
+        return;
+
+    Terrain& terrain = app->terrain;
+    const TerrainView viewIdx = (pass == TerrainPass_WaterReflection || pass == TerrainPass_WaterRefraction) ? TerrainView_Water : TerrainView_Main;
+    const TerrainSelection& selection = frame.views[viewIdx];
+    if (selection.nodes.empty())
+        return;
+
+    u32 firstInstance = 0;
+    for (u32 view = 0; view < viewIdx; ++view)
+        firstInstance += (u32)frame.views[view].nodes.size();
+
+    Program& program = GetProgram(app, terrain.programIdx[pass][frame.tessellation ? 1 : 0]);
+    glUseProgram(program.handle);
+
+    SetUniform(program, "uViewProjection", selection.viewProjection);
+    SetUniform(program, "uTerrainEye", selection.eye);
+    SetUniform(program, "uTerrainParams", glm::vec4(terrain.texelSize, terrain.heightScale, terrain.heightOffset, (f32)terrain.size));
+    SetUniform(program, "uTerrainLod", glm::vec4(frame.lodDistance, frame.morphStart, (f32)terrain.overviewStep, frame.tessellationScale));
+    SetUniform(program, "uClippingPlane", TerrainClippingPlanes[pass]);
+    SetUniform(program, "uTerrainOverview", TERRAIN_OVERVIEW_UNIT);
+    SetUniform(program, "uTerrainTiles", TERRAIN_TILES_UNIT);
+    SetUniform(program, "uTerrainTileLayers", TERRAIN_TILE_LAYERS_UNIT);
+    SetUniform(program, "uShadowMap", SHADOW_MAP_UNIT);
+    SetUniform(program, "uPointShadowAtlas", POINT_SHADOW_ATLAS_UNIT);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+    // Quads go to the tessellator as patches of their 4 corners
+    GLenum mode = GL_TRIANGLES;
+    u32 quadIndices = 6;
+    if (frame.tessellation)
+    {
+        glBindVertexArray(terrain.patchVao);
+        glPatchParameteri(GL_PATCH_VERTICES, 4);
+        mode = GL_PATCHES;
+        quadIndices = 4;
+    }
+    else
+    {
+        glBindVertexArray(terrain.vao);
+    }
+
+    const u32 quadrantIndices = (TERRAIN_GRID_SIZE / 2) * (TERRAIN_GRID_SIZE / 2) * quadIndices;
+    for (u32 group = 0; group < TerrainDrawGroup_Count; ++group)
+    {
+        if (selection.groupCount[group] == 0)
+            continue;
+
+        const u32 firstIndex = group == TerrainDrawGroup_Full ? 0 : (group - TerrainDrawGroup_Quadrant0) * quadrantIndices;
+        const u32 indexCount = group == TerrainDrawGroup_Full ? 4 * quadrantIndices : quadrantIndices;
+        glDrawElementsInstancedBaseInstance(mode, indexCount, GL_UNSIGNED_SHORT, (void*)(u64)(firstIndex * sizeof(u16)),
+                                            selection.groupCount[group], firstInstance + selection.groupFirst[group]);
+    }
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
@@ -0,0 +1,177 @@
+//
+// terrain.h: Heightmap terrain drawn with continuous distance-dependent levels of detail
+// (CDLOD, Strugar 2009). A quadtree covers the heightmap and every node draws the same
+// grid mesh, scaled to its size. The game thread picks the nodes whose level fits their
+// distance to the camera and culls them against the frustum with the height range of each
+// node, then the render thread draws them as instances. Vertices towards the far end of a
+// level's range slide onto the grid of the next level, so neighbouring levels meet without
+// cracks and nothing pops when a node is split.
+//
+// Heights are read on the GPU from the world position alone, so every node agrees on
+// them: from a full resolution tile when the tile under the position is resident, from a
+// decimated overview of the whole heightmap otherwise. Tiles are streamed into a texture
+// array around the camera, a few per frame, and an indirection texture tells which layer
+// holds each one. Raw 16-bit files (.r16) are read from disk tile by tile, images (16-bit
+// PNG) are decoded whole by stb_image and only streamed to the GPU. The fragment shader
+// computes the normals from the same heights.
+//
+// With tessellation, the grid of the finest level is 4 times coarser and each of its
+// quads is split on the GPU into segments of about the same size on screen.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include "platform.h"
+
+struct App;
+struct FramePacket;
+
+#define TERRAIN_GRID_SIZE        32  // Quads per side of a node
+#define TERRAIN_MAX_LEVELS       16
+#define TERRAIN_MAX_TESS_LEVEL   4   // Segments per grid quad edge at most, the finest grid is this much coarser with tessellation
+#define TERRAIN_OVERVIEW_SIZE    512 // Texels per side of the overview at most
+#define TERRAIN_TILE_SIZE        256 // Heightmap texels per side of a streamed tile
+#define TERRAIN_TILE_TEXELS      (TERRAIN_TILE_SIZE + 3) // With the texels around it, for the filtering and the normals at its edges
+#define TERRAIN_TILE_CACHE       64  // Resident tiles, the layers of the tile array
+#define TERRAIN_TILE_UPLOADS     4   // Tiles streamed per frame at most
+#define TERRAIN_OVERVIEW_UNIT    5
+#define TERRAIN_TILES_UNIT       6
+#define TERRAIN_TILE_LAYERS_UNIT 7
+
+// Quadrants of a node, in the order of their indices in the grid mesh
+enum TerrainDrawGroup
+{
+    TerrainDrawGroup_Full,
+    TerrainDrawGroup_Quadrant0, // -x -z
+    TerrainDrawGroup_Quadrant1, // +x -z
+    TerrainDrawGroup_Quadrant2, // -x +z
+    TerrainDrawGroup_Quadrant3, // +x +z
+    TerrainDrawGroup_Count
+};
+
+enum TerrainView
+{
+    TerrainView_Main,
+    TerrainView_Water, // The mirrored camera of the water passes
+    TerrainView_Count
+};
+
+enum TerrainPass
+{
+    TerrainPass_WaterReflection,
+    TerrainPass_WaterRefraction,
+    TerrainPass_Forward,
+    TerrainPass_DeferredGeometry,
+    TerrainPass_Count
+};
+
+// Instance of the grid mesh, must match the vertex attributes of shaders.glsl
+struct TerrainNode
+{
+    glm::vec2 origin; // World xz of its -x -z corner
+    f32       size;   // World size of a side
+    f32       level;  // 0 is the finest
+};
+
+// The nodes one camera draws, grouped by the part of the grid they draw
+struct TerrainSelection
+{
+    glm::mat4                viewProjection;
+    glm::vec3                eye;
+    std::vector<TerrainNode> nodes;
+    u32                      groupFirst[TerrainDrawGroup_Count];
+    u32                      groupCount[TerrainDrawGroup_Count];
+};
+
+// The terrain of one frame, computed by the game thread
+struct TerrainFrame
+{
+    bool             enabled;
+    bool             tessellation;
+    f32              lodDistance;
+    f32              morphStart;
+    f32              tessellationScale; // Segments per world unit at a distance of 1
+    TerrainSelection views[TerrainView_Count];
+
+    // Streaming: the tiles to upload and the ones whose layer was given to another
+    u32              uploadCount;
+    u32              uploadTiles[TERRAIN_TILE_UPLOADS];  // x | y << 16
+    u32              uploadLayers[TERRAIN_TILE_UPLOADS];
+    std::vector<u16> uploadTexels;                       // TERRAIN_TILE_TEXELS^2 per upload
+    std::vector<u32> evictedTiles;
+};
+
+struct Terrain
+{
+    // Settings
+    bool enabled;
+    bool tessellation;
+    bool tessellationSupported;
+    f32  texelSize;      // World size of a heightmap texel
+    f32  heightScale;    // World height of the full 16-bit range
+    f32  heightOffset;   // World height of 0
+    f32  lodDistance;    // Range of the finest level, each coarser one doubles it
+    f32  morphStart;     // Fraction of a level's range, past the previous one, where its vertices start to morph
+    f32  tessellationPixels; // Screen size of a tessellated segment
+
+    // Game thread
+    bool             loaded;
+    std::string      heightmapPath;
+    bool             rawFile;       // Read from disk per tile, else decoded into pixels
+    std::vector<u16> pixels;
+    u32              size;          // Heightmap texels per side
+    u32              overviewStep;  // Heightmap texels per overview texel, a power of two
+    u32              overviewSize;
+    u32              tilesPerSide;
+
+    // Height range of the cells of each level, the cells of level k being (TERRAIN_GRID_SIZE << k) texels wide. Pairs of min and max.
+    std::vector<u16> minMax[TERRAIN_MAX_LEVELS];
+    u32              minMaxSize[TERRAIN_MAX_LEVELS]; // Cells per side
+    u32              minMaxLevels;
+
+    std::vector<i32> tileLayers;    // Per tile, -1 if it is not resident
+    std::vector<u32> tileWantedFrame;
+    u32              layerTiles[TERRAIN_TILE_CACHE];     // UINT32_MAX if free
+    u32              layerLastWanted[TERRAIN_TILE_CACHE];
+    u32              frameIndex;
+    u32              residentTiles;
+    u32              streamedTiles; // Since startup
+    u32              drawnNodes;    // Of the main camera, last frame
+
+    // Render thread
+    GLuint overview;
+    GLuint tiles;
+    GLuint tileLayerTexture;
+    GLuint gridVertices;
+    GLuint gridIndices;
+    GLuint gridPatchIndices;
+    GLuint instanceBuffer;
+    u32    instanceCapacity;
+    GLuint vao;      // Triangles
+    GLuint patchVao; // Quads as tessellation patches
+
+    u32 programIdx[TerrainPass_Count][2]; // Without and with tessellation
+};
+
+/**
+ * Loads the heightmap, builds its overview and height ranges, and creates the grid mesh
+ * and textures. Leaves the terrain disabled if the file cannot be read.
+ */
+void InitTerrain(App* app, const char* heightmapPath);
+
+/**
+ * Game thread: selects the nodes of the main and the water cameras and picks the tiles
+ * to stream this frame. Call it once the packet cameras are set.
+ */
+void UpdateTerrain(App* app, FramePacket& packet);
+
+/**
+ * Render thread: uploads the streamed tiles and the nodes of the frame, and binds the
+ * terrain textures to their units. Call it once per frame before the terrain passes.
+ */
+void PrepareTerrain(App* app, const FramePacket& packet);
+
+// Render thread: draws the terrain into the framebuffer of a pass, with its program and camera
+void RenderTerrain(App* app, const FramePacket& packet, TerrainPass pass);
@@ -0,0 +1,478 @@
+#include "water.h"
+#include "engine.h"
+#include "parallel.h"
+#include "simd_math.h"
+
+#include <chrono>
+#include <random>
+
+#define WATER_GRAVITY 9.81f
+
+// Columns a lane of the vectorized FFT holds
+#define WATER_FFT_LANES 4
+
+// FFT order: 0, 1, ..., N/2 - 1, then -N/2, ..., -1
+static f32 WaterWaveNumber(u32 n)
+{
+    return (f32)(n < WATER_FFT_SIZE / 2 ? (i32)n : (i32)n - WATER_FFT_SIZE);
+}
+
+/**
+ * h0(k) of the Phillips spectrum, a complex gaussian whose variance follows the wind.
+ * The Nyquist waves have no -k in the tile, so they stay 0 to keep the heights real.
+ */
+static void BuildWaterSpectrum(Water& water)
+{
+    const u32 n = WATER_FFT_SIZE;
+    water.spectrum.assign(n * n, glm::vec2(0.0f));
+    water.frequencies.assign(n * n, 0.0f);
+
+    std::mt19937 random(1234);
+    std::normal_distribution<f32> gaussian(0.0f, 1.0f);
+
+    const glm::vec2 wind = glm::vec2(cosf(water.windAngle), sinf(water.windAngle));
+    const f32 largestWave = water.windSpeed * water.windSpeed / WATER_GRAVITY;
+    const f32 smallestWave = largestWave * 0.001f;
+    const f32 loopFrequency = 2.0f * glm::pi<f32>() / water.loopPeriod;
+
+    for (u32 m = 0; m < n; ++m)
+    {
+        for (u32 x = 0; x < n; ++x)
+        {
+            // Drawn for every wave, so the others do not change with the ones left out
+            const glm::vec2 random2 = glm::vec2(gaussian(random), gaussian(random));
+            if (x == n / 2 || m == n / 2 || (x == 0 && m == 0))
+                continue;
+
+            const glm::vec2 k = glm::vec2(WaterWaveNumber(x), WaterWaveNumber(m)) * (2.0f * glm::pi<f32>() / water.patchSize);
+            const f32 k2 = glm::dot(k, k);
+            const f32 kLength = sqrtf(k2);
+
+            f32 alignment = glm::dot(k / kLength, wind);
+            f32 phillips = water.amplitude * expf(-1.0f / (k2 * largestWave * largestWave)) / (k2 * k2) * alignment * alignment;
+            phillips *= expf(-k2 * smallestWave * smallestWave);
+            if (alignment < 0.0f)
+                phillips *= 0.07f; // Waves going against the wind are much smaller
+
+            water.spectrum[m * n + x] = random2 * sqrtf(phillips * 0.5f);
+
+            // Rounded down to the loop frequency, so every wave comes back to its start after loopPeriod
+            water.frequencies[m * n + x] = floorf(sqrtf(WATER_GRAVITY * kLength) / loopFrequency) * loopFrequency;
+        }
+    }
+
+    water.spectrumWindSpeed = water.windSpeed;
+    water.spectrumWindAngle = water.windAngle;
+    water.spectrumAmplitude = water.amplitude;
+}
+
+static void BuildWaterFftTables(Water& water)
+{
+    const u32 n = WATER_FFT_SIZE;
+    u32 bits = 0;
+    while ((1u << bits) < n)
+        bits++;
+
+    water.bitReversal.resize(n);
+    for (u32 i = 0; i < n; ++i)
+    {
+        u32 reversed = 0;
+        for (u32 b = 0; b < bits; ++b)
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        water.bitReversal[i] = reversed;
+    }
+
+    // e^(+2 pi i j / N), the inverse transform turns the other way
+    water.twiddles.resize(n);
+    for (u32 j = 0; j < n / 2; ++j)
+    {
+        const f32 angle = 2.0f * glm::pi<f32>() * (f32)j / (f32)n;
+        water.twiddles[j * 2] = cosf(angle);
+        water.twiddles[j * 2 + 1] = sinf(angle);
+    }
+
+    for (u32 field = 0; field < 3; ++field)
+    {
+        water.fftReal[field].resize(n * n);
+        water.fftImaginary[field].resize(n * n);
+    }
+}
+
+/**
+ * Inverse FFT of WATER_FFT_LANES neighbouring columns of a row-major tile, radix 2 in
+ * place. Each row holds the same element of the lanes side by side, so every butterfly
+ * runs on all of them at once.
+ */
+static void InverseFftColumns(const Water& water, f32* real, f32* imaginary, u32 column)
+{
+    const u32 n = WATER_FFT_SIZE;
+
+    for (u32 i = 0; i < n; ++i)
+    {
+        const u32 j = water.bitReversal[i];
+        if (j <= i)
+            continue;
+        for (u32 lane = 0; lane < WATER_FFT_LANES; ++lane)
+        {
+            std::swap(real[i * n + column + lane], real[j * n + column + lane]);
+            std::swap(imaginary[i * n + column + lane], imaginary[j * n + column + lane]);
+        }
+    }
+
+    for (u32 half = 1; half < n; half *= 2)
+    {
+        const u32 twiddleStride = n / (2 * half);
+        for (u32 start = 0; start < n; start += 2 * half)
+        {
+            for (u32 j = 0; j < half; ++j)
+            {
+                const f32 wr = water.twiddles[j * twiddleStride * 2];
+                const f32 wi = water.twiddles[j * twiddleStride * 2 + 1];
+                f32* ar = real + (start + j) * n + column;
+                f32* ai = imaginary + (start + j) * n + column;
+                f32* br = real + (start + j + half) * n + column;
+                f32* bi = imaginary + (start + j + half) * n + column;
+
+#ifdef ENGINE_USE_SSE
+                const __m128 twiddleReal = _mm_set1_ps(wr);
+                const __m128 twiddleImaginary = _mm_set1_ps(wi);
+                const __m128 bReal = _mm_loadu_ps(br);
+                const __m128 bImaginary = _mm_loadu_ps(bi);
+                const __m128 tReal = _mm_sub_ps(_mm_mul_ps(twiddleReal, bReal), _mm_mul_ps(twiddleImaginary, bImaginary));
+                const __m128 tImaginary = _mm_add_ps(_mm_mul_ps(twiddleReal, bImaginary), _mm_mul_ps(twiddleImaginary, bReal));
+                const __m128 aReal = _mm_loadu_ps(ar);
+                const __m128 aImaginary = _mm_loadu_ps(ai);
+                _mm_storeu_ps(br, _mm_sub_ps(aReal, tReal));
+                _mm_storeu_ps(bi, _mm_sub_ps(aImaginary, tImaginary));
+                _mm_storeu_ps(ar, _mm_add_ps(aReal, tReal));
+                _mm_storeu_ps(ai, _mm_add_ps(aImaginary, tImaginary));
+#else
+                for (u32 lane = 0; lane < WATER_FFT_LANES; ++lane)
+                {
+                    const f32 tr = wr * br[lane] - wi * bi[lane];
+                    const f32 ti = wr * bi[lane] + wi * br[lane];
+                    br[lane] = ar[lane] - tr;
+                    bi[lane] = ai[lane] - ti;
+                    ar[lane] += tr;
+                    ai[lane] += ti;
+                }
+#endif
+            }
+        }
+    }
+}
+
+static void TransposeTile(f32* tile)
+{
+    const u32 n = WATER_FFT_SIZE;
+    for (u32 y = 0; y < n; ++y)
+        for (u32 x = y + 1; x < n; ++x)
+            std::swap(tile[y * n + x], tile[x * n + y]);
+}
+
+// 2D inverse FFT of every field: the columns, then the rows as the columns of the transposed tiles
+static void InverseFftFields(Water& water)
+{
+    const u32 columnGroups = WATER_FFT_SIZE / WATER_FFT_LANES;
+    for (u32 pass = 0; pass < 2; ++pass)
+    {
+        ParallelFor(3 * columnGroups, 4, [&](u32 begin, u32 end)
+        {
+            for (u32 job = begin; job < end; ++job)
+            {
+                const u32 field = job / columnGroups;
+                InverseFftColumns(water, water.fftReal[field].data(), water.fftImaginary[field].data(), (job % columnGroups) * WATER_FFT_LANES);
+            }
+        });
+
+        ParallelFor(6, 1, [&](u32 begin, u32 end)
+        {
+            for (u32 tile = begin; tile < end; ++tile)
+                TransposeTile(tile % 2 ? water.fftImaginary[tile / 2].data() : water.fftReal[tile / 2].data());
+        });
+    }
+}
+
+static void CreateWaterGrid(Water& water)
+{
+    const u32 side = WATER_GRID_SIZE + 1;
+    static_assert((WATER_GRID_SIZE + 1) * (WATER_GRID_SIZE + 1) <= 65536, "The grid is indexed with 16 bits");
+
+    std::vector<glm::vec2> vertices(side * side);
+    for (u32 y = 0; y < side; ++y)
+        for (u32 x = 0; x < side; ++x)
+            vertices[y * side + x] = glm::vec2((f32)x, (f32)y) / (f32)WATER_GRID_SIZE;
+
+    std::vector<u16> indices;
+    indices.reserve(WATER_GRID_SIZE * WATER_GRID_SIZE * 6);
+    for (u32 y = 0; y < WATER_GRID_SIZE; ++y)
+    {
+        for (u32 x = 0; x < WATER_GRID_SIZE; ++x)
+        {
+            const u16 i0 = (u16)(y * side + x);
+            const u16 quad[] = { i0, (u16)(i0 + 1), (u16)(i0 + side + 1), i0, (u16)(i0 + side + 1), (u16)(i0 + side) };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+    water.gridIndexCount = (u32)indices.size();
+
+    glGenVertexArrays(1, &water.gridVao);
+    glBindVertexArray(water.gridVao);
+
+    glGenBuffers(1, &water.gridVertices);
+    glBindBuffer(GL_ARRAY_BUFFER, water.gridVertices);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glGenBuffers(1, &water.gridIndices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, water.gridIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(u16), indices.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static GLuint CreateWaveTexture(GLenum internalFormat)
+{
+    u32 levels = 1;
+    while ((1u << (levels - 1)) < WATER_FFT_SIZE)
+        levels++;
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, WATER_FFT_SIZE, WATER_FFT_SIZE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+void InitWater(App* app)
+{
+    Water& water = app->water;
+
+    water.enabled = true;
+    water.height = 0.0f;
+    water.patchSize = 128.0f;
+    water.windSpeed = 10.0f;
+    water.windAngle = 0.4f;
+    water.amplitude = 2e-6f; // About 0.4 m of RMS height at 10 m/s
+    water.choppiness = 1.2f;
+    water.loopPeriod = 200.0f;
+    water.reflection = WaterReflection_Planar;
+    water.ssrMaxDistance = 300.0f;
+    water.ssrMaxSteps = 64;
+    water.time = 0.0f;
+    water.moveFactor = 0.0f;
+
+    BuildWaterSpectrum(water);
+    BuildWaterFftTables(water);
+
+    water.displacementTexture = CreateWaveTexture(GL_RGBA16F);
+    water.slopesTexture = CreateWaveTexture(GL_RG16F);
+    CreateWaterGrid(water);
+
+    water.ssrProgramIdx = LoadProgram(app, "shaders.glsl", "WATER_MESH_SSR");
+    water.closestDepthProgramIdx = LoadProgram(app, "shaders.glsl", "DEPTH_PYRAMID_CLOSEST", ShaderFeature_Compute);
+}
+
+void UpdateWater(App* app, FramePacket& packet)
+{
+    Water& water = app->water;
+    WaterFrame& frame = packet.water;
+
+    // The dudv map keeps scrolling, with or without the waves
+    const f32 waveLength = 0.03f;
+    water.moveFactor = fmodf(water.moveFactor + waveLength * packet.deltaTime, 1.0f);
+    frame.moveFactor = water.moveFactor;
+    frame.reflection = water.reflection;
+
+    // Only the forward mode draws the water
+    frame.enabled = water.enabled && packet.mode == Mode_Count;
+    frame.displacement.clear();
+    frame.slopes.clear();
+    if (!frame.enabled)
+        return;
+
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    if (water.windSpeed != water.spectrumWindSpeed || water.windAngle != water.spectrumWindAngle || water.amplitude != water.spectrumAmplitude)
+        BuildWaterSpectrum(water);
+
+    water.time = fmodf(water.time + packet.deltaTime, water.loopPeriod);
+
+    // h(k, t) from h0(k) and h0(-k), then the displacements and slopes in the frequency domain
+    const u32 n = WATER_FFT_SIZE;
+    const f32 waveScale = 2.0f * glm::pi<f32>() / water.patchSize;
+    ParallelFor(n, 8, [&](u32 begin, u32 end)
+    {
+        for (u32 m = begin; m < end; ++m)
+        {
+            for (u32 x = 0; x < n; ++x)
+            {
+                const u32 i = m * n + x;
+                const u32 opposite = ((n - m) % n) * n + (n - x) % n;
+                const glm::vec2 h0 = water.spectrum[i];
+                const glm::vec2 h0Opposite = glm::vec2(water.spectrum[opposite].x, -water.spectrum[opposite].y);
+
+                const f32 phase = water.frequencies[i] * water.time;
+                const f32 c = cosf(phase), s = sinf(phase);
+                const glm::vec2 h = glm::vec2(h0.x * c - h0.y * s, h0.x * s + h0.y * c) + glm::vec2(h0Opposite.x * c + h0Opposite.y * s, h0Opposite.y * c - h0Opposite.x * s);
+
+                const glm::vec2 k = glm::vec2(WaterWaveNumber(x), WaterWaveNumber(m)) * waveScale;
+                const f32 kLength = glm::length(k);
+                const glm::vec2 direction = kLength > 0.0f ? k / kLength : glm::vec2(0.0f);
+
+                // -i k / |k| h for the displacement, i k h for the slope
+                const glm::vec2 dx = glm::vec2(h.y, -h.x) * direction.x;
+                const glm::vec2 dz = glm::vec2(h.y, -h.x) * direction.y;
+                const glm::vec2 sx = glm::vec2(-h.y, h.x) * k.x;
+                const glm::vec2 sz = glm::vec2(-h.y, h.x) * k.y;
+
+                // Real fields in pairs, one as the real and one as the imaginary part
+                water.fftReal[0][i] = h.x - dx.y;
+                water.fftImaginary[0][i] = h.y + dx.x;
+                water.fftReal[1][i] = dz.x - sx.y;
+                water.fftImaginary[1][i] = dz.y + sx.x;
+                water.fftReal[2][i] = sz.x;
+                water.fftImaginary[2][i] = sz.y;
+            }
+        }
+    });
+
+    InverseFftFields(water);
+
+    frame.displacement.resize(n * n);
+    frame.slopes.resize(n * n);
+    for (u32 i = 0; i < n * n; ++i)
+    {
+        frame.displacement[i] = glm::vec4(water.fftImaginary[0][i] * water.choppiness, water.fftReal[0][i], water.fftReal[1][i] * water.choppiness, 0.0f);
+        frame.slopes[i] = glm::vec2(water.fftImaginary[1][i], water.fftReal[2][i]);
+    }
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    water.fftMs = (f32)std::chrono::duration<f64, std::milli>(end - start).count();
+}
+
+/**
+ * Copies the color of the forward pass aside, since the water draws into it, and reduces
+ * its depth into the closest-depth pyramid the reflected rays are traced through. The hits
+ * are rebuilt into world positions from that depth, so it has to be the rasterized depth:
+ * a program offsetting gl_FragDepth would put the reflections of its surfaces in front of them.
+ */
+static void PrepareScreenSpaceReflection(App* app, const FramePacket& packet)
+{
+    Water& water = app->water;
+
+    if (!water.sceneColor || water.sceneColorSize != packet.displaySize)
+    {
+        if (water.sceneColor)
+            glDeleteTextures(1, &water.sceneColor);
+
+        glGenTextures(1, &water.sceneColor);
+        glBindTexture(GL_TEXTURE_2D, water.sceneColor);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, packet.displaySize.x, packet.displaySize.y);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        water.sceneColorSize = packet.displaySize;
+    }
+
+    if (packet.debugGroupMode)
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 6, -1, "Water SSR");
+
+    glCopyImageSubData(app->renderAttachmentHandle, GL_TEXTURE_2D, 0, 0, 0, 0,
+                       water.sceneColor, GL_TEXTURE_2D, 0, 0, 0, 0,
+                       packet.displaySize.x, packet.displaySize.y, 1);
+
+    ReduceDepthPyramid(app, packet, water.closestDepthProgramIdx, app->forwardDepthAttachmentHandle, water.closestDepth);
+
+    if (packet.debugGroupMode)
+        glPopDebugGroup();
+}
+
+void RenderWater(App* app, const FramePacket& packet)
+{
+    Water& water = app->water;
+    const WaterFrame& frame = packet.water;
+
+    if (frame.enabled)
+    {
+        glBindTexture(GL_TEXTURE_2D, water.displacementTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WATER_FFT_SIZE, WATER_FFT_SIZE, GL_RGBA, GL_FLOAT, frame.displacement.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, water.slopesTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WATER_FFT_SIZE, WATER_FFT_SIZE, GL_RG, GL_FLOAT, frame.slopes.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    const bool screenSpaceReflection = frame.reflection == WaterReflection_ScreenSpace;
+    if (screenSpaceReflection)
+        PrepareScreenSpaceReflection(app, packet);
+
+    Program& waterMeshProgram = GetProgram(app, screenSpaceReflection ? water.ssrProgramIdx : app->waterMeshProgramIdx);
+    glUseProgram(waterMeshProgram.handle);
+
+    SetUniform(waterMeshProgram, "uProjection", packet.projection);
+    SetUniform(waterMeshProgram, "uView", packet.view);
+    SetUniform(waterMeshProgram, "uInverseViewProjection", glm::inverse(packet.projection * packet.view));
+    SetUniform(waterMeshProgram, "uCameraPosition", packet.camera.position);
+
+    // The grid ends at the far plane, and lies flat when the waves are off
+    SetUniform(waterMeshProgram, "uWaterParams", glm::vec4(water.height, water.patchSize, packet.camera.far_plane, frame.enabled ? 1.0f : 0.0f));
+
+    glActiveTexture(GL_TEXTURE0 + WATER_DISPLACEMENT_UNIT);
+    glBindTexture(GL_TEXTURE_2D, water.displacementTexture);
+    SetUniform(waterMeshProgram, "uWaterDisplacement", WATER_DISPLACEMENT_UNIT);
+
+    glActiveTexture(GL_TEXTURE0 + WATER_SLOPES_UNIT);
+    glBindTexture(GL_TEXTURE_2D, water.slopesTexture);
+    SetUniform(waterMeshProgram, "uWaterSlopes", WATER_SLOPES_UNIT);
+
+    if (screenSpaceReflection)
+    {
+        glActiveTexture(GL_TEXTURE0 + WATER_SCENE_COLOR_UNIT);
+        glBindTexture(GL_TEXTURE_2D, water.sceneColor);
+        SetUniform(waterMeshProgram, "uSceneColor", WATER_SCENE_COLOR_UNIT);
+
+        glActiveTexture(GL_TEXTURE0 + WATER_CLOSEST_DEPTH_UNIT);
+        glBindTexture(GL_TEXTURE_2D, water.closestDepth.texture);
+        SetUniform(waterMeshProgram, "uClosestDepth", WATER_CLOSEST_DEPTH_UNIT);
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap);
+        SetUniform(waterMeshProgram, "uSkybox", 1);
+
+        SetUniform(waterMeshProgram, "uSsrParams", glm::vec4(water.ssrMaxDistance, (f32)water.ssrMaxSteps, (f32)water.closestDepth.levels, 0.0f));
+    }
+    else
+    {
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D, app->waterReflectionColorAttachment);
+        SetUniform(waterMeshProgram, "uReflectionTexture", 10);
+    }
+
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D, app->waterRefractionColorAttachment);
+    SetUniform(waterMeshProgram, "uRefractionTexture", 11);
+
+    glActiveTexture(GL_TEXTURE12);
+    GLuint dudvMapTexHandle = app->textures[app->dudvMapIdx].handle;
+    glBindTexture(GL_TEXTURE_2D, dudvMapTexHandle);
+    SetUniform(waterMeshProgram, "uDudvMap", 12);
+    glActiveTexture(GL_TEXTURE0);
+
+    SetUniform(waterMeshProgram, "uMoveFactor", frame.moveFactor);
+
+    glBindVertexArray(water.gridVao);
+    glDrawElements(GL_TRIANGLES, water.gridIndexCount, GL_UNSIGNED_SHORT, (void*)0);
+    glBindVertexArray(0);
+
+    glUseProgram(0);
+}
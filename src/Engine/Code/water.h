@@ -0,0 +1,119 @@
+//
+// water.h: Ocean surface drawn as a projected grid (Johanson 2004) and displaced by an
+// FFT wave tile (Tessendorf, "Simulating Ocean Water"). The grid is fixed in screen space
+// and every vertex is projected along its view ray onto the water plane, so the vertices
+// are as dense on screen near and far, and the vertex count stays the same however large
+// the water is. Rays that miss the plane end on the horizon at the far distance.
+//
+// The wave spectrum is built once. Each frame the game thread advances its phases and
+// turns it into heights, horizontal (choppy) displacements and slopes with inverse FFTs,
+// vectorized over 4 columns at a time, and the render thread uploads them into two
+// textures that tile the plane. Vertices sample the displacement at the mip level of
+// their grid cell, so the waves do not alias towards the horizon.
+//
+// The reflection is either planar, the scene drawn again from the mirrored camera, or
+// traced in screen space: after the forward pass its color is copied aside and its depth
+// reduced into a pyramid of the closest depth, and every water fragment marches its
+// reflected ray through the pyramid, skipping the empty cells of the coarse levels. Rays
+// that leave the screen or find nothing get the skybox. The planar pass costs as much as
+// the scene, the traced one a fixed amount per pixel, but only shows what the screen does.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include "platform.h"
+#include "gpu_culling.h"
+
+struct App;
+struct FramePacket;
+
+#define WATER_FFT_SIZE           128 // Texels per side of the wave tile, a power of two
+#define WATER_GRID_SIZE          192 // Quads per side of the projected grid
+#define WATER_GRID_MARGIN        0.1f // Extra NDC around the screen, for the waves displaced into view
+#define WATER_DISPLACEMENT_UNIT  8
+#define WATER_SLOPES_UNIT        9
+#define WATER_SCENE_COLOR_UNIT   10 // The one of the planar reflection, which the traced one replaces
+#define WATER_CLOSEST_DEPTH_UNIT 15
+
+enum WaterReflection
+{
+    WaterReflection_Planar,
+    WaterReflection_ScreenSpace,
+    WaterReflection_Count
+};
+
+// The waves of one frame, computed by the game thread
+struct WaterFrame
+{
+    bool                   enabled;
+    WaterReflection        reflection;
+    f32                    moveFactor; // Scroll of the dudv map
+    std::vector<glm::vec4> displacement; // x, height, z per texel of the tile
+    std::vector<glm::vec2> slopes;       // Of the height along x and z
+};
+
+struct Water
+{
+    // Settings
+    bool enabled;     // The ocean, else the flat surface of the dudv map alone
+    f32  height;      // Of the water plane, where the water passes clip the scene
+    f32  patchSize;   // World size of the wave tile
+    f32  windSpeed;
+    f32  windAngle;   // Radians, from +x towards +z
+    f32  amplitude;   // Of the Phillips spectrum
+    f32  choppiness;  // Scale of the horizontal displacement
+    f32  loopPeriod;  // Seconds until the waves repeat
+
+    WaterReflection reflection;
+    f32             ssrMaxDistance; // World length of the traced rays
+    u32             ssrMaxSteps;    // Pyramid cells a ray visits at most
+
+    // Game thread
+    f32                    time;
+    f32                    moveFactor;
+    f32                    spectrumWindSpeed; // What the spectrum was built for
+    f32                    spectrumWindAngle;
+    f32                    spectrumAmplitude;
+    std::vector<glm::vec2> spectrum;      // h0(k) of each wave vector, complex
+    std::vector<f32>       frequencies;   // w(k), multiples of 2 pi / loopPeriod
+    std::vector<f32>       twiddles;      // cos, sin of each butterfly angle
+    std::vector<u32>       bitReversal;
+    std::vector<f32>       fftReal[3];    // Height + i x, z + i slope x, slope z
+    std::vector<f32>       fftImaginary[3];
+    f32                    fftMs;         // Last frame
+
+    // Render thread
+    GLuint displacementTexture;
+    GLuint slopesTexture;
+    GLuint gridVertices;
+    GLuint gridIndices;
+    GLuint gridVao;
+    u32    gridIndexCount;
+
+    u32          ssrProgramIdx;
+    u32          closestDepthProgramIdx;
+    DepthPyramid closestDepth;
+    GLuint       sceneColor;
+    glm::ivec2   sceneColorSize;
+};
+
+/**
+ * Builds the wave spectrum, the FFT tables, the textures and the projected grid, and
+ * loads the programs of the traced reflection.
+ */
+void InitWater(App* app);
+
+/**
+ * Game thread: advances the waves by the frame time and computes the tile of the frame.
+ */
+void UpdateWater(App* app, FramePacket& packet);
+
+/**
+ * Render thread: uploads the tile of the frame and draws the surface into the bound
+ * framebuffer, sampling the refraction pass and either the reflection pass or, when
+ * traced, the color and depth of the forward pass. Call it once the forward pass and the
+ * skybox are drawn.
+ */
+void RenderWater(App* app, const FramePacket& packet);
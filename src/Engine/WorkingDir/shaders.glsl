@@ -1,50 +1,27 @@
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
-#ifdef TEXTURED_GEOMETRY
-
-#if defined(VERTEX) ///////////////////////////////////////////////////
-
-layout(location = 0) in vec3 aPosition;
-layout(location = 2) in vec2 aTexCoord;
-
-out vec2 vTexCoord;
-
-void main()
-{
-	vTexCoord = aTexCoord;
-	gl_Position = vec4(aPosition, 1.0);
-}
-
-#elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-in vec2 vTexCoord;
-
-uniform sampler2D uTexture;
-
-layout(location = 0) out vec4 oColor;
-
-void main()
-{
-	oColor = texture(uTexture, vTexCoord);
-}
+// Shared code -------------------------------------------------------
+// GLSL has no #include, so the declarations several programs need live here, ahead of
+// the program sections, and each program and stage that uses them is listed below.
 
+#if defined(SHOW_TEXTURED_MESH) || defined(DEFERRED_LIGHTING_PASS) || (defined(VERTEX) && (defined(DEFERRED_GEOMETRY_PASS) || defined(SHADOW_CASTER))) || (defined(FRAGMENT) && defined(TERRAIN))
+#define SHARED_GLOBAL_PARAMS // The frame uniforms PackFrameUniforms() writes
 #endif
+#if defined(FRAGMENT) && (defined(SHOW_TEXTURED_MESH) || defined(DEFERRED_LIGHTING_PASS) || defined(TERRAIN))
+#define SHARED_SHADOWS // Cascaded and point light shadow lookups
+#endif
+#if defined(FRAGMENT) && (defined(DEFERRED_LIGHTING_PASS) || defined(TERRAIN))
+#define SHARED_LIGHTING // Every light of the frame on a lit surface
 #endif
 
-#ifdef SHOW_TEXTURED_MESH
-
-#if defined(VERTEX) ///////////////////////////////////////////////////
-
-layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
-layout(location = 2) in vec2 aTexCoord;
-// layout(location = 3) in vec3 aTangent;
-// layout(location = 4) in vec3 aBitangent;
+#ifdef SHARED_GLOBAL_PARAMS
 
 struct Light
 {
 	unsigned int type;
+	int shadowSlot; // Into uPointShadowFaces, -1 if the point light casts no shadows
 	vec3 color;
 	vec3 direction;
 	float intensity;
@@ -54,119 +31,192 @@ struct Light
 
 layout(binding = 0, std140) uniform GlobalParams
 {
+	mat4 uViewProjectionMatrix;
 	vec3 uCameraPosition;
 	unsigned int uLightCount;
 	Light uLight[50];
-};
 
-layout(binding = 1, std140) uniform LocalParams
-{
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	// Cascaded shadows of the directional light uLight[uShadowLightIndex]
+	mat4 uCascadeViewProjection[4];
+	vec4 uCascadeSplits; // View depth where each cascade ends
+	vec4 uCascadeTexelSizes; // World size of a shadow map texel
+	vec3 uCameraForward;
+	unsigned int uCascadeCount;
+	unsigned int uShadowLightIndex;
+
+	// Point light shadow atlas tiles, 6 faces per shadow slot
+	vec4 uPointShadowFaces[16 * 6]; // xy: atlas origin, z: size, w: size in texels, 0 if the face is lit
 };
 
-out vec2 vTexCoord;
-out vec3 vPosition; // In worldspace
-out vec3 vNormal; // In worldspace
-out vec3 vViewDir; // In worldspace
+#endif
 
-void main()
-{
-	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vNormal = vec3(transpose(inverse(uWorldMatrix)) * vec4(aNormal, 1.0));
-	vViewDir = uCameraPosition - vPosition;
+#ifdef SHARED_SHADOWS
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+uniform sampler2DArrayShadow uShadowMap;
+
+// 1.0 where the shadow light reaches the point, 0.0 where a caster blocks it
+float SampleShadow(vec3 worldPosition, vec3 worldNormal)
+{
+	float viewDepth = dot(worldPosition - uCameraPosition, uCameraForward);
+
+	uint cascade = 0u;
+	while (cascade < uCascadeCount && viewDepth > uCascadeSplits[cascade])
+		cascade++;
+	if (cascade >= uCascadeCount)
+		return 1.0;
+
+	// Moving the point out along the normal by a texel or so keeps surfaces from shadowing themselves
+	vec3 offsetPosition = worldPosition + normalize(worldNormal) * uCascadeTexelSizes[cascade] * 1.5;
+	vec4 lightPosition = uCascadeViewProjection[cascade] * vec4(offsetPosition, 1.0);
+	vec3 shadowCoord = lightPosition.xyz / lightPosition.w * 0.5 + 0.5;
+
+	// 3x3 taps, each one already a bilinear 2x2 comparison
+	vec2 texelSize = 1.0 / vec2(textureSize(uShadowMap, 0).xy);
+	float lit = 0.0;
+	for (int y = -1; y <= 1; ++y)
+	{
+		for (int x = -1; x <= 1; ++x)
+		{
+			lit += texture(uShadowMap, vec4(shadowCoord.xy + vec2(x, y) * texelSize, float(cascade), min(shadowCoord.z, 1.0)));
+		}
+	}
+	return lit / 9.0;
 }
 
-#elif defined(FRAGMENT) ///////////////////////////////////////////////
+uniform sampler2DShadow uPointShadowAtlas;
 
-in vec2 vTexCoord;
-in vec3 vPosition;
-in vec3 vNormal;
-in vec3 vViewDir;
+// Cube faces: +X, -X, +Y, -Y, +Z, -Z, as rendered by shadows.cpp
+const vec3 cPointShadowFaceForward[6] = vec3[6](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+const vec3 cPointShadowFaceUp[6] = vec3[6](vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0), vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0));
+const float cPointShadowNear = 0.05; // POINT_SHADOW_NEAR
 
-struct Light
+int PointShadowFace(vec3 direction)
 {
-	unsigned int type;
-	vec3 color;
-	vec3 direction;
-	float intensity;
-	vec3 position;
-	float radius;
-};
+	vec3 a = abs(direction);
+	if (a.x >= a.y && a.x >= a.z)
+		return direction.x > 0.0 ? 0 : 1;
+	if (a.y >= a.z)
+		return direction.y > 0.0 ? 2 : 3;
+	return direction.z > 0.0 ? 4 : 5;
+}
 
-layout(binding = 0, std140) uniform GlobalParams
+// 1.0 where the point light reaches the point, 0.0 where a caster blocks it
+float SamplePointShadow(Light light, vec3 worldPosition, vec3 worldNormal)
 {
-	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[50];
-};
-
-uniform sampler2D uTexture;
-uniform samplerCube uSkybox;
+	if (light.shadowSlot < 0)
+		return 1.0;
+
+	vec3 toPoint = worldPosition - light.position;
+	vec4 rect = uPointShadowFaces[light.shadowSlot * 6 + PointShadowFace(toPoint)];
+	if (rect.w == 0.0)
+		return 1.0;
+
+	// A 90 degree face texel is 2 * distance / size wide
+	float texelWorldSize = 2.0 * length(toPoint) / rect.w;
+	toPoint += normalize(worldNormal) * texelWorldSize * 1.5;
+
+	int face = PointShadowFace(toPoint);
+	rect = uPointShadowFaces[light.shadowSlot * 6 + face];
+	if (rect.w == 0.0)
+		return 1.0;
+
+	vec3 forward = cPointShadowFaceForward[face];
+	vec3 side = normalize(cross(forward, cPointShadowFaceUp[face]));
+	vec3 up = cross(side, forward);
+
+	// Same projection as the face: perspective, 90 degrees, from cPointShadowNear to the light radius
+	float viewDepth = dot(toPoint, forward);
+	vec2 faceUV = vec2(dot(toPoint, side), dot(toPoint, up)) / viewDepth * 0.5 + 0.5;
+	float far = light.radius;
+	float ndcDepth = (far + cPointShadowNear) / (far - cPointShadowNear) - 2.0 * far * cPointShadowNear / ((far - cPointShadowNear) * viewDepth);
+	float depth = min(ndcDepth * 0.5 + 0.5, 1.0);
+
+	// 2x2 taps, kept inside the tile so the neighbour tiles do not bleed in
+	float halfTexel = 0.5 / rect.w;
+	float lit = 0.0;
+	for (int y = 0; y < 2; ++y)
+	{
+		for (int x = 0; x < 2; ++x)
+		{
+			vec2 uv = clamp(faceUV + (vec2(x, y) * 2.0 - 1.0) * halfTexel, vec2(2.0 * halfTexel), vec2(1.0 - 2.0 * halfTexel));
+			lit += texture(uPointShadowAtlas, vec3(rect.xy + uv * rect.z, depth));
+		}
+	}
+	return lit * 0.25;
+}
 
-layout(location = 0) out vec4 oFinalRender;
+#endif
 
-out float gl_FragDepth;
+#ifdef SHARED_LIGHTING
 
-vec3 CalculateDirectionalLight(Light light)
+vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 diffuse, float shadow)
 {
-	return vec3(1.0);
+	float cosAngle = max(dot(normal, -light.direction), 0.0);
+	vec3 ambient = 0.1 * light.color;
+	vec3 lit = 0.9 * light.color * cosAngle;
+	return (ambient + lit * shadow) * diffuse;
 }
 
-vec3 CalculatePointLight(Light light)
+// Diffuse plus a specular term of exponent 1, so twice N.L
+vec3 CalculatePointLight(Light light, vec3 position, vec3 normal)
 {
-	vec3 lightVector = normalize(light.position - vPosition);
-	float brightness = dot(lightVector, vNormal);
-
-	return vec3(brightness) * light.color;
+	vec3 L = normalize(light.position - position);
+	float intensity = max(0.0, dot(normalize(normal), L));
+	return vec3(2.0 * intensity) * light.intensity * light.color;
 }
 
-void main()
+// Every light on a point of the given albedo, with the ambient term and the shadows
+vec3 ShadeLights(vec3 position, vec3 normal, vec3 diffuse)
 {
-	vec4 objectColor = texture(uTexture, vTexCoord);
-	vec4 spec = vec4(0.0);
-
-	vec3 lightFactor = vec3(0.0);
-	for(int i = 0; i < uLightCount; ++i)
+	vec3 lighting = diffuse * 0.1;
+	for (int i = 0; i < uLightCount; ++i)
 	{
-		switch(uLight[i].type)
+		if (uLight[i].type == 0u) // Directional
 		{
-			case 0: // Directional
-			{
-				lightFactor += CalculateDirectionalLight(uLight[i]);
-			}
-			break;
-
-			case 1: // Point
-			{
-				lightFactor += CalculatePointLight(uLight[i]);
-			}
-			break;
-
-			default:
-			{
-				break;
-			}
+			float shadow = (uint(i) == uShadowLightIndex) ? SampleShadow(position, normal) : 1.0;
+			lighting += CalculateDirectionalLight(uLight[i], normal, diffuse, shadow);
+		}
+		else if (uLight[i].type == 1u && distance(uLight[i].position, position) < uLight[i].radius) // Point
+		{
+			lighting += CalculatePointLight(uLight[i], position, normal) * SamplePointShadow(uLight[i], position, normal);
 		}
 	}
+	return lighting;
+}
 
-	vec3 I = normalize(vPosition - uCameraPosition);
-	vec3 R = reflect(I, normalize(vNormal));
+#endif
+#ifdef TEXTURED_GEOMETRY
 
-	vec4 reflections = vec4(texture(uSkybox, R).rgb, 1.0);
-	oFinalRender = mix(vec4(lightFactor, 1.0) * objectColor, reflections, 0.5);
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 2) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
 
-	gl_FragDepth = gl_FragCoord.z - 0.2;
+void main()
+{
+	vTexCoord = aTexCoord;
+	gl_Position = vec4(aPosition, 1.0);
 }
 
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec2 vTexCoord;
+
+uniform sampler2D uTexture;
+
+layout(location = 0) out vec4 oColor;
+
+void main()
+{
+	oColor = texture(uTexture, vTexCoord);
+}
 
 #endif
 #endif
 
-#ifdef SHOW_TEXTURED_MESH_WITH_CLIPPING
+#ifdef SHOW_TEXTURED_MESH
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -176,34 +226,34 @@ layout(location = 2) in vec2 aTexCoord;
 // layout(location = 3) in vec3 aTangent;
 // layout(location = 4) in vec3 aBitangent;
 
-struct Light
+#ifdef GPU_DRIVEN
+// Written by GPU_CULL: world matrix (in vec4s into the cbuffer) and material of every visible instance
+layout(binding = 3, std430) readonly buffer VisibleInstances
 {
-	unsigned int type;
-	vec3 color;
-	vec3 direction;
-	float intensity;
-	vec3 position;
-	float radius;
+	uvec2 uVisibleInstances[];
 };
 
-layout(binding = 0, std140) uniform GlobalParams
+layout(binding = 4, std430) readonly buffer EntityParams
 {
-	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[50];
+	vec4 uEntityParams[]; // The cbuffer
 };
 
+flat out uint vMaterialIndex;
+#else
 layout(binding = 1, std140) uniform LocalParams
 {
 	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
 };
+#endif
 
+#ifdef CLIPPING
+// Used by the water passes, which render from a mirrored camera
 uniform mat4 uProjection;
 uniform mat4 uView;
 uniform mat4 uModel;
 
 uniform vec4 uClippingPlane;
+#endif
 
 out vec2 vTexCoord;
 out vec3 vPosition; // In worldspace
@@ -212,15 +262,30 @@ out vec3 vViewDir; // In worldspace
 
 void main()
 {
+#ifdef GPU_DRIVEN
+	uvec2 instance = uVisibleInstances[gl_BaseInstanceARB + gl_InstanceID];
+	mat4 worldMatrix = mat4(uEntityParams[instance.x], uEntityParams[instance.x + 1u], uEntityParams[instance.x + 2u], uEntityParams[instance.x + 3u]);
+	vMaterialIndex = instance.y;
+#else
+	mat4 worldMatrix = uWorldMatrix;
+#endif
+
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vNormal = vec3(transpose(inverse(uWorldMatrix)) * vec4(aNormal, 1.0));
+	vPosition = vec3(worldMatrix * vec4(aPosition, 1.0));
+	vNormal = vec3(transpose(inverse(worldMatrix)) * vec4(aNormal, 1.0));
 	vViewDir = uCameraPosition - vPosition;
 
-	vec3 positionWorldSpace = vPosition;
-	gl_ClipDistance[0] = dot(vec4(positionWorldSpace, 1.0), uClippingPlane);
+#ifdef CLIPPING
+	gl_ClipDistance[0] = dot(vec4(vPosition, 1.0), uClippingPlane);
 
+#ifdef GPU_DRIVEN
+	gl_Position = uProjection * uView * worldMatrix * vec4(aPosition, 1.0);
+#else
 	gl_Position = uProjection * uView * uModel * vec4(aPosition, 1.0);
+#endif
+#else
+	gl_Position = uViewProjectionMatrix * vec4(vPosition, 1.0);
+#endif
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -230,30 +295,51 @@ in vec3 vPosition;
 in vec3 vNormal;
 in vec3 vViewDir;
 
-struct Light
+struct MaterialData
 {
-	unsigned int type;
-	vec3 color;
-	vec3 direction;
-	float intensity;
-	vec3 position;
-	float radius;
+	vec4 albedo; // rgb: albedo, a: smoothness
+	vec4 emissive;
+	uvec2 albedoTexture; // Bindless handle, or (texture array, layer)
+	uvec2 emissiveTexture;
+	uvec2 specularTexture;
+	uvec2 normalsTexture;
+	uvec2 bumpTexture;
+	uvec2 padding;
 };
 
-layout(binding = 0, std140) uniform GlobalParams
+layout(binding = 0, std430) readonly buffer Materials
 {
-	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[50];
+	MaterialData uMaterials[];
 };
 
-uniform sampler2D uTexture;
+#ifdef GPU_DRIVEN
+flat in uint vMaterialIndex; // Of the instance
+#define uMaterialIndex vMaterialIndex
+#else
+uniform uint uMaterialIndex;
+#endif
+
+#ifdef BINDLESS
+vec4 SampleMaterialTexture(uvec2 handle, vec2 uv)
+{
+	return texture(sampler2D(handle), uv);
+}
+#else
+uniform sampler2DArray uTextureArrays[8];
+uniform sampler2D uTexture; // Textures that were not packed in the arrays
+
+vec4 SampleMaterialTexture(uvec2 arrayLayer, vec2 uv)
+{
+	if (arrayLayer.x == 0xFFFFFFFFu)
+		return texture(uTexture, uv);
+
+	return texture(uTextureArrays[arrayLayer.x], vec3(uv, float(arrayLayer.y)));
+}
+#endif
 uniform samplerCube uSkybox;
 
 layout(location = 0) out vec4 oFinalRender;
 
-out float gl_FragDepth;
-
 vec3 CalculateDirectionalLight(Light light)
 {
 	return vec3(1.0);
@@ -269,7 +355,7 @@ vec3 CalculatePointLight(Light light)
 
 void main()
 {
-	vec4 objectColor = texture(uTexture, vTexCoord);
+	vec4 objectColor = SampleMaterialTexture(uMaterials[uMaterialIndex].albedoTexture, vTexCoord);
 	vec4 spec = vec4(0.0);
 
 	vec3 lightFactor = vec3(0.0);
@@ -279,13 +365,14 @@ void main()
 		{
 			case 0: // Directional
 			{
-				lightFactor += CalculateDirectionalLight(uLight[i]);
+				float shadow = (uint(i) == uShadowLightIndex) ? SampleShadow(vPosition, vNormal) : 1.0;
+				lightFactor += CalculateDirectionalLight(uLight[i]) * mix(0.3, 1.0, shadow);
 			}
 			break;
 
 			case 1: // Point
 			{
-				lightFactor += CalculatePointLight(uLight[i]);
+				lightFactor += CalculatePointLight(uLight[i]) * SamplePointShadow(uLight[i], vPosition, vNormal);
 			}
 			break;
 
@@ -301,40 +388,69 @@ void main()
 
 	vec4 reflections = vec4(texture(uSkybox, R).rgb, 1.0);
 	oFinalRender = mix(vec4(lightFactor, 1.0) * objectColor, reflections, 0.5);
-
-	gl_FragDepth = gl_FragCoord.z - 0.2;
 }
 
 
 #endif
 #endif
 
-#ifdef WATER_MESH
+#if defined(WATER_MESH) || defined(WATER_MESH_SSR)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
-layout (location = 0) in vec3 aPosition;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aTexCoords;
+layout (location = 0) in vec2 aGridPosition; // 0 to 1 across the screen, see water.h
 
 uniform mat4 uProjection;
 uniform mat4 uView;
-uniform mat4 uModel;
+uniform mat4 uInverseViewProjection;
 
 uniform vec3 uCameraPosition;
+uniform vec4 uWaterParams; // x: plane height, y: wave tile size, z: far distance, w: wave scale, 0 when the waves are off
+
+uniform sampler2D uWaterDisplacement;
 
 out vec4 vClipSpace;
 out vec2 vTexCoords;
 out vec3 vToCameraVector;
+out vec2 vWaveCoords;
 
 const float tiling = 1.0;
+const float cGridMargin = 0.1; // WATER_GRID_MARGIN
+const float cGridSize = 192.0; // WATER_GRID_SIZE
+const float cWaveTexels = 128.0; // WATER_FFT_SIZE
+
+// Where the view ray through a point of the screen meets the water plane
+vec3 ProjectOntoWater(vec2 ndc)
+{
+	vec4 nearPoint = uInverseViewProjection * vec4(ndc, -1.0, 1.0);
+	vec4 farPoint = uInverseViewProjection * vec4(ndc, 1.0, 1.0);
+	vec3 origin = nearPoint.xyz / nearPoint.w;
+	vec3 direction = farPoint.xyz / farPoint.w - origin;
+
+	float t = (uWaterParams.x - origin.y) / direction.y;
+	vec3 hit = origin + direction * t;
+
+	// Rays that miss the plane, or meet it past the far distance, end on the horizon
+	if (!(t > 0.0) || distance(hit.xz, uCameraPosition.xz) > uWaterParams.z)
+		hit.xz = uCameraPosition.xz + normalize(direction.xz) * uWaterParams.z;
+	return vec3(hit.x, uWaterParams.x, hit.z);
+}
 
 void main()
 {
-	vec4 worldPosition =  uModel * vec4(aPosition, 1.0);
+	vec2 ndc = (aGridPosition * 2.0 - 1.0) * (1.0 + cGridMargin);
+	vec3 surface = ProjectOntoWater(ndc);
+
+	// The waves are filtered down to the size of a grid cell, which grows towards the horizon
+	vec3 neighbour = ProjectOntoWater(ndc + vec2(0.0, 2.0 * (1.0 + cGridMargin) / cGridSize));
+	float cellTexels = distance(surface, neighbour) / uWaterParams.y * cWaveTexels;
+
+	vWaveCoords = surface.xz / uWaterParams.y;
+	vec3 displacement = textureLod(uWaterDisplacement, vWaveCoords, log2(max(cellTexels, 1.0))).xyz * uWaterParams.w;
+	vec4 worldPosition = vec4(surface + displacement, 1.0);
 
 	vClipSpace = uProjection * uView * worldPosition;
-	vTexCoords = vec2(aPosition.x / 2.0 + 0.5, aPosition.y / 2.0 + 0.5) * tiling;
+	vTexCoords = surface.xz / 200.0 * tiling; // The dudv map spanned the 200 units of the old water quad
 	vToCameraVector = uCameraPosition - worldPosition.xyz;
 
 	gl_Position = vClipSpace;
@@ -351,11 +467,114 @@ uniform sampler2D uDudvMap;
 
 uniform float uMoveFactor;
 
+uniform vec4 uWaterParams;
+uniform sampler2D uWaterSlopes;
+
 in vec4 vClipSpace;
 in vec2 vTexCoords;
 in vec3 vToCameraVector;
+in vec2 vWaveCoords;
 
 const float waveStrength = 0.02;
+const float oceanDistortion = 0.05;
+
+#ifdef WATER_MESH_SSR
+uniform mat4 uProjection;
+uniform mat4 uView;
+uniform mat4 uInverseViewProjection;
+uniform vec3 uCameraPosition;
+
+uniform sampler2D uSceneColor; // The forward pass, without the water
+uniform sampler2D uClosestDepth; // Its depth, reduced to the closest of every texel footprint
+uniform samplerCube uSkybox;
+uniform vec4 uSsrParams; // x: longest reflected ray, y: steps at most, z: pyramid levels
+
+// Screen uv and window depth of a point in view space
+vec3 ProjectToScreen(vec3 viewPosition)
+{
+	vec4 clip = uProjection * vec4(viewPosition, 1.0);
+	return clip.xyz / clip.w * 0.5 + 0.5;
+}
+
+// Marches a screen space ray, along which uv and depth are linear, through the pyramid.
+// A cell whose closest depth stays behind the ray is skipped whole and the next cell is
+// tested one level coarser; a cell the ray goes behind is tested again one level finer.
+// Surfaces have no thickness: the first texel the ray goes behind is the hit. Returns
+// the uv and depth of the hit, with w 1, or w 0 on a miss.
+vec4 TraceScreenSpace(vec3 start, vec3 end)
+{
+	vec3 ray = end - start;
+	vec2 rayXY = vec2(abs(ray.x) < 1e-7 ? 1e-7 : ray.x, abs(ray.y) < 1e-7 ? 1e-7 : ray.y);
+	vec2 pyramidSize = vec2(textureSize(uClosestDepth, 0));
+	int maxLevel = int(uSsrParams.z) - 1;
+
+	// t of one texel of level 0, the ray starts that far off its own texel
+	float texelT = 1.0 / max(length(ray.xy * pyramidSize), 1.0);
+	float t = texelT;
+	int level = 0;
+
+	for (int i = 0; i < int(uSsrParams.y) && t <= 1.0; ++i)
+	{
+		vec3 position = start + ray * t;
+		if (any(lessThan(position.xy, vec2(0.0))) || any(greaterThanEqual(position.xy, vec2(1.0))))
+			break;
+
+		vec2 cellCount = max(floor(pyramidSize / exp2(float(level))), vec2(1.0));
+		vec2 cell = floor(position.xy * cellCount);
+		float closest = texelFetch(uClosestDepth, ivec2(cell), level).r;
+
+		// Where the ray leaves the cell, and where it goes behind the closest depth in it
+		vec2 boundary = (cell + step(0.0, ray.xy)) / cellCount;
+		vec2 tBoundary = (boundary - start.xy) / rayXY;
+		float tExit = min(tBoundary.x, tBoundary.y);
+		float tBehind = position.z >= closest ? t : (ray.z > 0.0 ? (closest - start.z) / ray.z : 2.0);
+
+		if (tBehind < tExit)
+		{
+			t = max(t, tBehind);
+			if (level == 0)
+				return vec4(start + ray * t, 1.0);
+			level--;
+		}
+		else
+		{
+			t = tExit + texelT * 0.01;
+			level = min(level + 1, maxLevel);
+		}
+	}
+
+	return vec4(0.0);
+}
+
+// The scene along the reflected ray, or the skybox where the screen does not hold it
+vec4 ScreenSpaceReflection(vec3 worldPosition, vec3 direction, vec2 distortion)
+{
+	vec4 skyColor = vec4(texture(uSkybox, direction).rgb, 1.0);
+
+	vec3 viewPosition = (uView * vec4(worldPosition, 1.0)).xyz;
+	vec3 viewDirection = mat3(uView) * direction;
+
+	// Rays towards the camera end before the near plane
+	float nearPlane = uProjection[3][2] / (uProjection[2][2] - 1.0);
+	float rayLength = uSsrParams.x;
+	if (viewDirection.z > 0.0)
+		rayLength = min(rayLength, (-nearPlane - viewPosition.z) / viewDirection.z * 0.99);
+
+	vec4 hit = TraceScreenSpace(ProjectToScreen(viewPosition), ProjectToScreen(viewPosition + viewDirection * rayLength));
+	if (hit.w == 0.0)
+		return skyColor;
+
+	// What the screen shows under the water is not in the reflection
+	vec4 hitPosition = uInverseViewProjection * vec4(hit.xyz * 2.0 - 1.0, 1.0);
+	if (hitPosition.y / hitPosition.w < uWaterParams.x - 1.0)
+		return skyColor;
+
+	// Faded into the skybox towards the edges of the screen, where the rays leave it
+	vec2 edges = min(hit.xy, 1.0 - hit.xy);
+	float confidence = smoothstep(0.0, 0.1, min(edges.x, edges.y));
+	return mix(skyColor, texture(uSceneColor, hit.xy + distortion), confidence);
+}
+#endif
 
 void main()
 {
@@ -366,16 +585,24 @@ void main()
 
 	vec2 distortion01 = (texture(uDudvMap, vec2(vTexCoords.x + uMoveFactor, vTexCoords.y)).rg * 2.0 - 1.0) * waveStrength;
 	vec2 distortion02 = (texture(uDudvMap, vec2(-vTexCoords.x + uMoveFactor, vTexCoords.y + uMoveFactor)).rg * 2.0 - 1.0) * waveStrength;
-	vec2 totalDistortion = distortion01 + distortion02;
+	vec2 slopes = texture(uWaterSlopes, vWaveCoords).xy * uWaterParams.w;
+	vec3 normal = normalize(vec3(-slopes.x, 1.0, -slopes.y));
+	vec2 totalDistortion = distortion01 + distortion02 + normal.xz * oceanDistortion;
 
 	reflectTexCoords += totalDistortion;
 	refractTexCoords += totalDistortion;
 
+	vec3 viewVector = normalize(vToCameraVector);
+
+#ifdef WATER_MESH_SSR
+	// The waves already bend the traced ray, only the dudv map distorts the hit
+	vec4 reflectColor = ScreenSpaceReflection(uCameraPosition - vToCameraVector, reflect(-viewVector, normal), distortion01 + distortion02);
+#else
 	vec4 reflectColor = texture(uReflectionTexture, reflectTexCoords);
+#endif
 	vec4 refractColor = texture(uRefractionTexture, refractTexCoords);
 
-	vec3 viewVector = normalize(vToCameraVector);
-	float refractiveFactor = dot(viewVector, vec3(0.0, 1.0, 0.0));
+	float refractiveFactor = max(dot(viewVector, normal), 0.0);
 	refractiveFactor = pow(refractiveFactor, 5.0);
 
 	oFinalRender = mix(reflectColor, refractColor, refractiveFactor);
@@ -396,11 +623,25 @@ layout(location = 2) in vec2 aTexCoord;
 // layout(location = 3) in vec3 aTangent;
 // layout(location = 4) in vec3 aBitangent;
 
+#ifdef GPU_DRIVEN
+// Written by GPU_CULL: world matrix (in vec4s into the cbuffer) and material of every visible instance
+layout(binding = 3, std430) readonly buffer VisibleInstances
+{
+	uvec2 uVisibleInstances[];
+};
+
+layout(binding = 4, std430) readonly buffer EntityParams
+{
+	vec4 uEntityParams[]; // The cbuffer
+};
+
+flat out uint vMaterialIndex;
+#else
 layout(binding = 1, std140) uniform LocalParams
 {
 	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
 };
+#endif
 
 out vec2 vTexCoord;
 out vec3 vPosition; // In worldspace
@@ -408,11 +649,19 @@ out vec3 vNormal; // In worldspace
 
 void main()
 {
+#ifdef GPU_DRIVEN
+	uvec2 instance = uVisibleInstances[gl_BaseInstanceARB + gl_InstanceID];
+	mat4 worldMatrix = mat4(uEntityParams[instance.x], uEntityParams[instance.x + 1u], uEntityParams[instance.x + 2u], uEntityParams[instance.x + 3u]);
+	vMaterialIndex = instance.y;
+#else
+	mat4 worldMatrix = uWorldMatrix;
+#endif
+
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vNormal = vec3(transpose(inverse(uWorldMatrix)) * vec4(aNormal, 1.0));
+	vPosition = vec3(worldMatrix * vec4(aPosition, 1.0));
+	vNormal = vec3(transpose(inverse(worldMatrix)) * vec4(aNormal, 1.0));
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjectionMatrix * vec4(vPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -421,23 +670,59 @@ in vec2 vTexCoord;
 in vec3 vPosition;
 in vec3 vNormal;
 
-uniform sampler2D uTexture;
+struct MaterialData
+{
+	vec4 albedo; // rgb: albedo, a: smoothness
+	vec4 emissive;
+	uvec2 albedoTexture; // Bindless handle, or (texture array, layer)
+	uvec2 emissiveTexture;
+	uvec2 specularTexture;
+	uvec2 normalsTexture;
+	uvec2 bumpTexture;
+	uvec2 padding;
+};
+
+layout(binding = 0, std430) readonly buffer Materials
+{
+	MaterialData uMaterials[];
+};
+
+#ifdef GPU_DRIVEN
+flat in uint vMaterialIndex; // Of the instance
+#define uMaterialIndex vMaterialIndex
+#else
+uniform uint uMaterialIndex;
+#endif
+
+#ifdef BINDLESS
+vec4 SampleMaterialTexture(uvec2 handle, vec2 uv)
+{
+	return texture(sampler2D(handle), uv);
+}
+#else
+uniform sampler2DArray uTextureArrays[8];
+uniform sampler2D uTexture; // Textures that were not packed in the arrays
+
+vec4 SampleMaterialTexture(uvec2 arrayLayer, vec2 uv)
+{
+	if (arrayLayer.x == 0xFFFFFFFFu)
+		return texture(uTexture, uv);
+
+	return texture(uTextureArrays[arrayLayer.x], vec3(uv, float(arrayLayer.y)));
+}
+#endif
 
 layout(location = 0) out vec4 oPosition;
 layout(location = 1) out vec4 oNormals;
 layout(location = 2) out vec4 oDiffuse;
 
-out float gl_FragDepth;
-
 void main()
 {
-	vec3 objectColor = texture(uTexture, vTexCoord).rgb;
+	vec3 objectColor = SampleMaterialTexture(uMaterials[uMaterialIndex].albedoTexture, vTexCoord).rgb;
 
 	oPosition = vec4(vPosition, 1.0);
 	oNormals = vec4(normalize(vNormal), 1.0);
 	oDiffuse = vec4(objectColor, 1.0);
-
-	gl_FragDepth = gl_FragCoord.z - 0.2;
 }
 
 
@@ -451,23 +736,6 @@ void main()
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec2 aTexCoord;
 
-struct Light
-{
-	unsigned int type;
-	vec3 color;
-	vec3 direction;
-	float intensity;
-	vec3 position;
-	float radius;
-};
-
-layout(binding = 0, std140) uniform GlobalParams
-{
-	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[50];
-};
-
 out vec2 vTexCoord;
 
 void main()
@@ -481,121 +749,245 @@ void main()
 
 in vec2 vTexCoord;
 
-struct Light
-{
-	unsigned int type;
-	vec3 color;
-	vec3 direction;
-	float intensity;
-	vec3 position;
-	float radius;
-};
-
-layout(binding = 0, std140) uniform GlobalParams
-{
-	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[50];
-};
-
 uniform sampler2D uGPosition;
 uniform sampler2D uGNormals;
 uniform sampler2D uGDiffuse;
 
 layout(location = 0) out vec4 oFinalRender;
 
-vec3 CalculateDirectionalLight(Light light, vec3 Normal, vec3 Diffuse)
+void main()
 {
-	/*vec3 N = normalize(Normal);
-    vec3 L = normalize(light.direction);
+	vec3 FragPos = texture(uGPosition, vTexCoord).rgb;
+    vec3 Normal = texture(uGNormals, vTexCoord).rgb;
+    vec3 Diffuse = texture(uGDiffuse, vTexCoord).rgb;
+
+	vec3 lighting = ShadeLights(FragPos, Normal, Diffuse);
+
+	oFinalRender = vec4(lighting * Diffuse, 1.0);
+}
+
+
+#endif
+#endif
+
+#if defined(TERRAIN) || defined(TERRAIN_GEOMETRY_PASS)
 
-	// Hardcoded specular parameter
-    vec3 specularMat = vec3(0.5);
+// Shared by the stages: the heights of the terrain, from the world position alone
+// so that neighbouring nodes always agree on them (terrain.h)
 
-	// Diffuse
-    float diffuseIntensity = max(0.0, dot(N,L));
+uniform mat4 uViewProjection; // Of the camera of the pass, the mirrored one in the water passes
+uniform vec3 uTerrainEye;
+uniform vec4 uTerrainParams; // x: texel size, y: height scale, z: height offset, w: heightmap texels per side
+uniform vec4 uTerrainLod; // x: lod distance, y: morph start, z: heightmap texels per overview texel, w: tessellation scale
 
-	// Specular
-    float specularIntensity = pow(max(0.0, dot(N, L)), 1.0);
-    vec3 specular = specularMat * specularIntensity;
+uniform sampler2D uTerrainOverview;
+uniform sampler2DArray uTerrainTiles;
+uniform usampler2D uTerrainTileLayers; // Layer + 1 of each tile, 0 if it is not resident
 
+const float cTerrainGridSize = 32.0; // TERRAIN_GRID_SIZE
+const float cTerrainTileSize = 256.0; // TERRAIN_TILE_SIZE
+const float cTerrainTileTexels = 259.0; // TERRAIN_TILE_TEXELS
+const float cTerrainMaxTessLevel = 4.0; // TERRAIN_MAX_TESS_LEVEL
 
-	return (diffuseIntensity + specular) * light.intensity * light.color;*/
-	float cosAngle = max(dot(Normal, -light.direction), 0.0); 
-    vec3 ambient = 0.1 * light.color;
-    vec3 diffuse = 0.9 * light.color * cosAngle;
+vec2 TerrainWorldToTexel(vec2 world)
+{
+	return world / uTerrainParams.x + (uTerrainParams.w - 1.0) * 0.5;
+}
 
-    return (ambient + diffuse) * Diffuse;
+uint TerrainTileLayer(vec2 texel)
+{
+	ivec2 tile = min(ivec2(texel / cTerrainTileSize), textureSize(uTerrainTileLayers, 0) - 1);
+	return texelFetch(uTerrainTileLayers, tile, 0).r;
 }
 
-vec3 CalculatePointLight(Light light, vec3 FragPos, vec3 Normal)
+float TerrainHeight(vec2 texel)
 {
-	vec3 N = normalize(Normal);
-	vec3 L = normalize(light.position - FragPos);
+	texel = clamp(texel, vec2(0.0), vec2(uTerrainParams.w - 1.0));
+
+	float height;
+	uint layer = TerrainTileLayer(texel);
+	if (layer != 0u)
+	{
+		// Tiles start one texel before their first heightmap texel
+		vec2 local = texel - floor(texel / cTerrainTileSize) * cTerrainTileSize + 1.0;
+		height = textureLod(uTerrainTiles, vec3((local + 0.5) / cTerrainTileTexels, float(layer - 1u)), 0.0).r;
+	}
+	else
+	{
+		vec2 overviewTexel = texel / uTerrainLod.z;
+		height = textureLod(uTerrainOverview, (overviewTexel + 0.5) / vec2(textureSize(uTerrainOverview, 0)), 0.0).r;
+	}
+	return uTerrainParams.z + height * uTerrainParams.y;
+}
 
-	float threshold = 1.0;
+#if defined(VERTEX) ///////////////////////////////////////////////////
 
-	float shadowIntensity = 1.0;
+layout(location = 0) in vec2 aGridPosition; // 0 to 1 across the node
+layout(location = 1) in vec4 aNode; // xy: world origin, z: world size, w: level
 
-	float dist = distance(light.position, FragPos);
+#ifdef TESSELLATION
+out vec3 vControlPosition;
+#else
+#ifdef CLIPPING
+uniform vec4 uClippingPlane;
+#endif
 
-	if(dist > light.radius)
-		shadowIntensity = 1.0 - ((dist - light.radius) / threshold);
+out vec3 vPosition; // In worldspace
+#endif
 
-	// Hardcoded specular parameter
-    vec3 specularMat = vec3(1.0);
+void main()
+{
+	vec2 world = aNode.xy + aGridPosition * aNode.z;
+	vec3 position = vec3(world.x, TerrainHeight(TerrainWorldToTexel(world)), world.y);
+
+	// Towards the end of its range, the odd vertices of a node slide onto the grid of its parent
+	float level = aNode.w;
+	float rangeEnd = uTerrainLod.x * exp2(level);
+	float rangeStart = level > 0.0 ? uTerrainLod.x * exp2(level - 1.0) : 0.0;
+	float morphStart = mix(rangeStart, rangeEnd, uTerrainLod.y);
+	float morph = clamp((distance(position, uTerrainEye) - morphStart) / (rangeEnd - morphStart), 0.0, 1.0);
+
+	vec2 oddOffset = fract(aGridPosition * cTerrainGridSize * 0.5) * 2.0 / cTerrainGridSize;
+	float halfExtent = (uTerrainParams.w - 1.0) * 0.5 * uTerrainParams.x;
+	world = clamp(world - oddOffset * aNode.z * morph, vec2(-halfExtent), vec2(halfExtent));
+	position = vec3(world.x, TerrainHeight(TerrainWorldToTexel(world)), world.y);
+
+#ifdef TESSELLATION
+	vControlPosition = position;
+#else
+	vPosition = position;
+
+#ifdef CLIPPING
+	gl_ClipDistance[0] = dot(vec4(vPosition, 1.0), uClippingPlane);
+#endif
 
+	gl_Position = uViewProjection * vec4(vPosition, 1.0);
+#endif
+}
 
-	// Specular
-    float specularIntensity = pow(max(0.0, dot(N, L)), 1.0);
-    vec3 specular = specularMat * specularIntensity;
+#elif defined(TESS_CONTROL) ///////////////////////////////////////////
 
-	// Diffuse
-    float diffuseIntensity = max(0.0, dot(N, L));
+layout(vertices = 4) out;
 
-	return vec3(specular + diffuseIntensity) * shadowIntensity * light.intensity * light.color;
+in vec3 vControlPosition[];
+out vec3 tcPosition[];
+
+// Segments for an edge to be about the same size on screen, the same from both patches that share it
+float TerrainEdgeLevel(vec3 a, vec3 b)
+{
+	float dist = max(distance((a + b) * 0.5, uTerrainEye), 0.001);
+	return clamp(ceil(distance(a, b) * uTerrainLod.w / dist), 1.0, cTerrainMaxTessLevel);
 }
 
 void main()
 {
-	vec3 FragPos = texture(uGPosition, vTexCoord).rgb;
-    vec3 Normal = texture(uGNormals, vTexCoord).rgb;
-    vec3 Diffuse = texture(uGDiffuse, vTexCoord).rgb;
+	tcPosition[gl_InvocationID] = vControlPosition[gl_InvocationID];
 
-	vec3 viewDir = normalize(uCameraPosition - FragPos);
+	if (gl_InvocationID == 0)
+	{
+		// Corners at (0, 0), (1, 0), (1, 1), (0, 1) of the domain
+		vec3 p0 = vControlPosition[0];
+		vec3 p1 = vControlPosition[1];
+		vec3 p2 = vControlPosition[2];
+		vec3 p3 = vControlPosition[3];
+
+		gl_TessLevelOuter[0] = TerrainEdgeLevel(p0, p3);
+		gl_TessLevelOuter[1] = TerrainEdgeLevel(p0, p1);
+		gl_TessLevelOuter[2] = TerrainEdgeLevel(p1, p2);
+		gl_TessLevelOuter[3] = TerrainEdgeLevel(p3, p2);
+		gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+		gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
+	}
+}
 
-	vec3 lighting = Diffuse * 0.1;
-    for(int i = 0; i < uLightCount; ++i)
-    {
-		switch(uLight[i].type)
-		{
-			case 0: // Directional
-			{
-                lighting += CalculateDirectionalLight(uLight[i], Normal, Diffuse);
-			}
-			break;
+#elif defined(TESS_EVALUATION) ////////////////////////////////////////
 
-			case 1: // Point
-			{
-				float distance = length(uLight[i].position - FragPos);
-				if(distance < uLight[i].radius)
-				{
-					lighting += CalculatePointLight(uLight[i], FragPos, Normal);
-				}
-			}
-			break;
+layout(quads, equal_spacing) in;
 
-			default:
-			{
-				
-			}
-			break;
-		}
-    }
+in vec3 tcPosition[];
 
-	oFinalRender = vec4(lighting * Diffuse, 1.0);
+#ifdef CLIPPING
+uniform vec4 uClippingPlane;
+#endif
+
+out vec3 vPosition; // In worldspace
+
+void main()
+{
+	vec2 uv = gl_TessCoord.xy;
+	vec3 bottom = mix(tcPosition[0], tcPosition[1], uv.x);
+	vec3 top = mix(tcPosition[3], tcPosition[2], uv.x);
+	vec2 world = mix(bottom, top, uv.y).xz;
+
+	vPosition = vec3(world.x, TerrainHeight(TerrainWorldToTexel(world)), world.y);
+
+#ifdef CLIPPING
+	gl_ClipDistance[0] = dot(vec4(vPosition, 1.0), uClippingPlane);
+#endif
+
+	gl_Position = uViewProjection * vec4(vPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec3 vPosition;
+
+vec3 TerrainNormal(vec3 worldPosition)
+{
+	// Central differences a texel apart, or an overview texel apart where the tile is not resident
+	vec2 texel = TerrainWorldToTexel(worldPosition.xz);
+	float d = TerrainTileLayer(clamp(texel, vec2(0.0), vec2(uTerrainParams.w - 1.0))) != 0u ? 1.0 : uTerrainLod.z;
+
+	float hL = TerrainHeight(texel - vec2(d, 0.0));
+	float hR = TerrainHeight(texel + vec2(d, 0.0));
+	float hD = TerrainHeight(texel - vec2(0.0, d));
+	float hU = TerrainHeight(texel + vec2(0.0, d));
+	return normalize(vec3(hL - hR, 2.0 * d * uTerrainParams.x, hD - hU));
+}
+
+vec3 TerrainAlbedo(float height, vec3 normal)
+{
+	const vec3 sand = vec3(0.76, 0.70, 0.50);
+	const vec3 grass = vec3(0.25, 0.42, 0.16);
+	const vec3 rock = vec3(0.42, 0.39, 0.36);
+	const vec3 snow = vec3(0.92, 0.93, 0.95);
+
+	vec3 albedo = mix(sand, grass, smoothstep(1.0, 4.0, height));
+	albedo = mix(albedo, snow, smoothstep(70.0, 85.0, height));
+	return mix(albedo, rock, smoothstep(0.25, 0.45, 1.0 - normal.y));
+}
+
+#ifdef TERRAIN_GEOMETRY_PASS
+
+layout(location = 0) out vec4 oPosition;
+layout(location = 1) out vec4 oNormals;
+layout(location = 2) out vec4 oDiffuse;
+
+void main()
+{
+	vec3 normal = TerrainNormal(vPosition);
+
+	oPosition = vec4(vPosition, 1.0);
+	oNormals = vec4(normal, 1.0);
+	oDiffuse = vec4(TerrainAlbedo(vPosition.y, normal), 1.0);
+}
+
+#else
+
+layout(location = 0) out vec4 oFinalRender;
+
+void main()
+{
+	vec3 normal = TerrainNormal(vPosition);
+	vec3 diffuse = TerrainAlbedo(vPosition.y, normal);
+
+	// Lit like the deferred lighting pass, so the terrain looks the same in both modes
+	vec3 lighting = ShadeLights(vPosition, normal, diffuse);
+
+	oFinalRender = vec4(lighting * diffuse, 1.0);
 }
 
+#endif
 
 #endif
 #endif
@@ -668,7 +1060,549 @@ void main()
 #endif
 
 
+#ifdef SHADOW_CASTER
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+#ifdef GPU_DRIVEN
+// Written by GPU_CULL: world matrix (in vec4s into the cbuffer) and material of every visible instance
+layout(binding = 3, std430) readonly buffer VisibleInstances
+{
+	uvec2 uVisibleInstances[];
+};
+
+layout(binding = 4, std430) readonly buffer EntityParams
+{
+	vec4 uEntityParams[]; // The cbuffer
+};
+#else
+layout(binding = 1, std140) uniform LocalParams
+{
+	mat4 uWorldMatrix;
+};
+#endif
+
+uniform uint uCascadeMask; // Cascades drawn, one instance each
+
+void main()
+{
+#ifdef GPU_DRIVEN
+	uvec2 instance = uVisibleInstances[gl_BaseInstanceARB + gl_InstanceID];
+	mat4 worldMatrix = mat4(uEntityParams[instance.x], uEntityParams[instance.x + 1u], uEntityParams[instance.x + 2u], uEntityParams[instance.x + 3u]);
+
+	// Every cascade has its own culled instances, so the draws go one cascade at a time
+	int cascade = findLSB(uCascadeMask);
+#else
+	mat4 worldMatrix = uWorldMatrix;
+
+	// The instance draws the cascade of the gl_InstanceID-th bit set in the mask
+	uint mask = uCascadeMask;
+	for (int i = 0; i < gl_InstanceID; ++i)
+		mask &= mask - 1u;
+	int cascade = findLSB(mask);
+#endif
+
+#ifdef VERTEX_LAYER
+	gl_Layer = cascade;
+#endif
+	gl_Position = uCascadeViewProjection[cascade] * worldMatrix * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main()
+{
+	// Depth only
+}
+
+#endif
+#endif
+
+#ifdef POINT_SHADOW_CASTER
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+layout(binding = 1, std140) uniform LocalParams
+{
+	mat4 uWorldMatrix;
+};
+
+uniform mat4 uFaceViewProjection;
+
+void main()
+{
+	gl_Position = uFaceViewProjection * uWorldMatrix * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main()
+{
+	// Depth only
+}
+
+#endif
+#endif
+
+
+#if defined(DEPTH_PYRAMID) || defined(DEPTH_PYRAMID_CLOSEST)
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Every texel keeps the farthest depth of the source texels it covers, for the occlusion
+// test, or the closest one, for the screen-space reflections of the water
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D uSourceDepth; // The depth buffer for level 0, the pyramid itself after that
+uniform uint uSourceLevel;
+uniform vec2 uSourceSize;
+
+layout(binding = 0, r32f) writeonly uniform image2D uDestination;
+
+void main()
+{
+	ivec2 destinationSize = imageSize(uDestination);
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(texel, destinationSize)))
+		return;
+
+	// Rounded outwards: level 0 texels cover between 1 and 2 depth buffer texels, and may straddle 3
+	ivec2 sourceSize = ivec2(uSourceSize);
+	ivec2 begin = (texel * sourceSize) / destinationSize;
+	ivec2 end = min(((texel + 1) * sourceSize + destinationSize - 1) / destinationSize, sourceSize);
+
+#ifdef DEPTH_PYRAMID_CLOSEST
+	float depth = 1.0;
+	for (int y = begin.y; y < end.y; ++y)
+	{
+		for (int x = begin.x; x < end.x; ++x)
+		{
+			depth = min(depth, texelFetch(uSourceDepth, ivec2(x, y), int(uSourceLevel)).r);
+		}
+	}
+#else
+	float depth = 0.0;
+	for (int y = begin.y; y < end.y; ++y)
+	{
+		for (int x = begin.x; x < end.x; ++x)
+		{
+			depth = max(depth, texelFetch(uSourceDepth, ivec2(x, y), int(uSourceLevel)).r);
+		}
+	}
+#endif
+
+	imageStore(uDestination, texel, vec4(depth));
+}
+
+#endif
+#endif
+
+#ifdef GPU_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One invocation per instance (x) and pass (y)
+layout(local_size_x = 64) in; // GPU_CULL_GROUP_SIZE
+
+struct Instance
+{
+	vec4 bounds; // World bounding sphere of the entity
+	uint batch;
+	uint matrixOffset; // World matrix in the cbuffer, in vec4s
+	uint material;
+	uint flags;
+	vec4 boxCenter; // Model space bounding box of the mesh
+	vec4 boxExtent; // Half size
+};
+
+struct Batch
+{
+	uint indexCount;
+	uint firstIndex;
+	int baseVertex;
+	uint firstInstance; // Of its slice of the visible instances of a pass
+	uint group;
+	uint groupFirstBatch;
+	uint firstMeshlet;
+	uint meshletCount; // The instances are drawn by meshlet when not 0
+	uint groupFirstCluster; // Of the cluster commands of its group
+	uint padding[3];
+};
+
+struct CullPass
+{
+	mat4 viewProjection;
+	vec4 eye; // For the cone test
+	uint flags;
+	uint padding[3];
+};
+
+struct Meshlet
+{
+	vec4 bounds; // Bounding sphere in model space
+	vec4 cone; // Axis and cutoff
+	uint firstIndex; // From the first index of its submesh
+	uint triangleCount;
+	uvec2 padding;
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+#define INSTANCE_STATIC 1u
+
+#define CULL_PASS_ACTIVE       1u
+#define CULL_PASS_OCCLUSION    2u
+#define CULL_PASS_DEPTH_CLAMP  4u
+#define CULL_PASS_STATIC_ONLY  8u
+#define CULL_PASS_MOVABLE_ONLY 16u
+#define CULL_PASS_CONE         32u
+
+layout(binding = 1, std430) readonly buffer Instances
+{
+	Instance uInstances[];
+};
+
+layout(binding = 2, std430) readonly buffer Batches
+{
+	Batch uBatches[];
+};
+
+layout(binding = 3, std430) writeonly buffer VisibleInstances
+{
+	uvec2 uVisibleInstances[]; // Per pass and instance
+};
+
+layout(binding = 4, std430) readonly buffer EntityParams
+{
+	vec4 uEntityParams[]; // The cbuffer
+};
+
+layout(binding = 5, std430) readonly buffer CullPasses
+{
+	CullPass uPasses[];
+};
+
+layout(binding = 6, std430) buffer InstanceCounts
+{
+	uint uInstanceCounts[]; // Per pass and batch
+};
+
+layout(binding = 7, std430) buffer CullStats
+{
+	// Of the main pass
+	uint uCulledCount;
+	uint uTestedMeshlets;
+	uint uCulledMeshlets;
+};
+
+layout(binding = 8, std430) readonly buffer Meshlets
+{
+	Meshlet uMeshlets[];
+};
+
+layout(binding = 9, std430) writeonly buffer DrawCommands
+{
+	DrawCommand uCommands[]; // Per pass: per batch, then the cluster commands of every group
+};
+
+layout(binding = 10, std430) buffer DrawCounts
+{
+	uint uDrawCounts[]; // Per pass: per group for the batches, then per group for the clusters
+};
+
+uniform uint uInstanceCount;
+uniform uint uBatchCount;
+uniform uint uGroupCount;
+uniform uint uCommandsPerPass;
+uniform mat4 uPyramidViewProjection; // Camera the depth pyramid was built with
+uniform uint uPyramidLevels; // 0 while there is no pyramid
+uniform sampler2D uDepthPyramid;
+
+// The corners of the box around the sphere, in clip space
+void ProjectBox(vec4 sphere, mat4 viewProjection, out vec4 corners[8])
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner = sphere.xyz + sphere.w * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		corners[i] = viewProjection * vec4(corner, 1.0);
+	}
+}
+
+bool IsOutsideFrustum(vec4 sphere, mat4 viewProjection, bool depthClamp)
+{
+	vec4 corners[8];
+	ProjectBox(sphere, viewProjection, corners);
+
+	// Outside when every corner is beyond the same clip plane
+	int planeAxes = depthClamp ? 2 : 3;
+	for (int axis = 0; axis < planeAxes; ++axis)
+	{
+		bool allBelow = true;
+		bool allAbove = true;
+		for (int i = 0; i < 8; ++i)
+		{
+			allBelow = allBelow && corners[i][axis] < -corners[i].w;
+			allAbove = allAbove && corners[i][axis] > corners[i].w;
+		}
+		if (allBelow || allAbove)
+			return true;
+	}
+	return false;
+}
+
+// Corners of a model space box, projected with viewProjection * worldMatrix
+void ProjectOrientedBox(vec3 center, vec3 extent, mat4 worldViewProjection, out vec4 corners[8])
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner = center + extent * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		corners[i] = worldViewProjection * vec4(corner, 1.0);
+	}
+}
+
+// Whether the screen rectangle of the corners, projected with uPyramidViewProjection, is behind the pyramid
+bool IsOccluded(vec4 corners[8])
+{
+	if (uPyramidLevels == 0u)
+		return false;
+
+	vec2 minUV = vec2(1.0);
+	vec2 maxUV = vec2(0.0);
+	float nearestDepth = 1.0;
+	for (int i = 0; i < 8; ++i)
+	{
+		// Crossing the near plane: too close to tell
+		if (corners[i].w <= 0.0)
+			return false;
+
+		vec3 ndc = corners[i].xyz / corners[i].w;
+		minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+		maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+		nearestDepth = min(nearestDepth, ndc.z * 0.5 + 0.5);
+	}
+	minUV = clamp(minUV, 0.0, 1.0);
+	maxUV = clamp(maxUV, 0.0, 1.0);
+
+	// The level where the box spans at most 2x2 texels
+	vec2 pyramidSize = vec2(textureSize(uDepthPyramid, 0));
+	vec2 boxTexels = (maxUV - minUV) * pyramidSize;
+	int level = clamp(int(ceil(log2(max(max(boxTexels.x, boxTexels.y), 1.0)))), 0, int(uPyramidLevels) - 1);
+
+	ivec2 levelSize = textureSize(uDepthPyramid, level);
+	ivec2 minTexel = clamp(ivec2(minUV * vec2(levelSize)), ivec2(0), levelSize - 1);
+	ivec2 maxTexel = clamp(ivec2(maxUV * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+	float farthestDepth = max(max(texelFetch(uDepthPyramid, minTexel, level).r, texelFetch(uDepthPyramid, ivec2(maxTexel.x, minTexel.y), level).r),
+	                          max(texelFetch(uDepthPyramid, ivec2(minTexel.x, maxTexel.y), level).r, texelFetch(uDepthPyramid, maxTexel, level).r));
+
+	return nearestDepth > farthestDepth;
+}
+
+void main()
+{
+	uint instanceIdx = gl_GlobalInvocationID.x;
+	uint passIdx = gl_GlobalInvocationID.y;
+	if (instanceIdx >= uInstanceCount)
+		return;
+
+	CullPass pass = uPasses[passIdx];
+	if ((pass.flags & CULL_PASS_ACTIVE) == 0u)
+		return;
+
+	// Shadow passes draw either the static or the movable casters
+	Instance instance = uInstances[instanceIdx];
+	bool isStatic = (instance.flags & INSTANCE_STATIC) != 0u;
+	if (((pass.flags & CULL_PASS_STATIC_ONLY) != 0u && !isStatic) || ((pass.flags & CULL_PASS_MOVABLE_ONLY) != 0u && isStatic))
+		return;
+
+	mat4 worldMatrix = mat4(uEntityParams[instance.matrixOffset], uEntityParams[instance.matrixOffset + 1u], uEntityParams[instance.matrixOffset + 2u], uEntityParams[instance.matrixOffset + 3u]);
+
+	// The occlusion test takes the mesh box, which fits tighter than the sphere
+	vec4 boxCorners[8];
+	bool occlusion = (pass.flags & CULL_PASS_OCCLUSION) != 0u;
+	if (occlusion)
+		ProjectOrientedBox(instance.boxCenter.xyz, instance.boxExtent.xyz, uPyramidViewProjection * worldMatrix, boxCorners);
+
+	if (IsOutsideFrustum(instance.bounds, pass.viewProjection, (pass.flags & CULL_PASS_DEPTH_CLAMP) != 0u) ||
+	    (occlusion && IsOccluded(boxCorners)))
+	{
+		if (passIdx == 0u)
+			atomicAdd(uCulledCount, 1u);
+		return;
+	}
+
+	// Appended to the visible instances of its batch, in no particular order
+	Batch batch = uBatches[instance.batch];
+	uint slot = atomicAdd(uInstanceCounts[passIdx * uBatchCount + instance.batch], 1u);
+	uint visibleIdx = passIdx * uInstanceCount + batch.firstInstance + slot;
+	uVisibleInstances[visibleIdx] = uvec2(instance.matrixOffset, instance.material);
+
+	if (batch.meshletCount == 0u)
+		return;
+
+	// A command per meshlet left, drawing this instance alone
+	float scale = sqrt(max(max(dot(worldMatrix[0].xyz, worldMatrix[0].xyz), dot(worldMatrix[1].xyz, worldMatrix[1].xyz)), dot(worldMatrix[2].xyz, worldMatrix[2].xyz)));
+
+	// Non-uniform scale or shear bends the normals and widens their cones, so only rotations
+	// and uniform scales keep the cone test: the axes must be orthogonal and of one length
+	mat3 axes = transpose(mat3(worldMatrix)) * mat3(worldMatrix);
+	float tolerance = 1e-3 * scale * scale;
+	bool conformal = abs(axes[0][0] - axes[1][1]) < tolerance && abs(axes[0][0] - axes[2][2]) < tolerance &&
+	                 abs(axes[0][1]) < tolerance && abs(axes[0][2]) < tolerance && abs(axes[1][2]) < tolerance;
+	bool coneTest = (pass.flags & CULL_PASS_CONE) != 0u && conformal;
+	bool depthClamp = (pass.flags & CULL_PASS_DEPTH_CLAMP) != 0u;
+	uint countIdx = passIdx * 2u * uGroupCount + uGroupCount + batch.group;
+	uint firstCommand = passIdx * uCommandsPerPass + uBatchCount + batch.groupFirstCluster;
+
+	uint culledMeshlets = 0u;
+	for (uint i = 0u; i < batch.meshletCount; ++i)
+	{
+		Meshlet meshlet = uMeshlets[batch.firstMeshlet + i];
+		vec4 sphere = vec4((worldMatrix * vec4(meshlet.bounds.xyz, 1.0)).xyz, meshlet.bounds.w * scale);
+
+		// Facing away: the eye is on the back side of the cone around the normals
+		bool backFacing = false;
+		if (coneTest)
+		{
+			vec3 axis = normalize(mat3(worldMatrix) * meshlet.cone.xyz);
+			vec3 toCenter = sphere.xyz - pass.eye.xyz;
+			backFacing = dot(toCenter, axis) >= meshlet.cone.w * length(toCenter) + sphere.w;
+		}
+
+		// Meshlets only have a sphere, tested as the box around it
+		vec4 sphereCorners[8];
+		if (occlusion)
+			ProjectBox(sphere, uPyramidViewProjection, sphereCorners);
+
+		if (backFacing || IsOutsideFrustum(sphere, pass.viewProjection, depthClamp) ||
+		    (occlusion && IsOccluded(sphereCorners)))
+		{
+			culledMeshlets++;
+			continue;
+		}
+
+		DrawCommand command;
+		command.count = meshlet.triangleCount * 3u;
+		command.instanceCount = 1u;
+		command.firstIndex = batch.firstIndex + meshlet.firstIndex;
+		command.baseVertex = batch.baseVertex;
+		command.baseInstance = visibleIdx;
+		uCommands[firstCommand + atomicAdd(uDrawCounts[countIdx], 1u)] = command;
+	}
+
+	if (passIdx == 0u)
+	{
+		atomicAdd(uTestedMeshlets, batch.meshletCount);
+		atomicAdd(uCulledMeshlets, culledMeshlets);
+	}
+}
+
+#endif
+#endif
+
+#ifdef GPU_CULL_COMPACT
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One invocation per batch (x) and pass (y)
+layout(local_size_x = 64) in; // GPU_CULL_GROUP_SIZE
+
+struct Batch
+{
+	uint indexCount;
+	uint firstIndex;
+	int baseVertex;
+	uint firstInstance; // Of its slice of the visible instances of a pass
+	uint group;
+	uint groupFirstBatch;
+	uint firstMeshlet;
+	uint meshletCount; // The instances are drawn by meshlet when not 0
+	uint groupFirstCluster; // Of the cluster commands of its group
+	uint padding[3];
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout(binding = 9, std430) writeonly buffer DrawCommands
+{
+	DrawCommand uCommands[]; // Per pass and batch, the ones of a group packed at its first batch
+};
+
+layout(binding = 2, std430) readonly buffer Batches
+{
+	Batch uBatches[];
+};
+
+layout(binding = 10, std430) buffer DrawCounts
+{
+	uint uDrawCounts[]; // Per pass and group, the cluster counts after the batch ones
+};
+
+layout(binding = 6, std430) readonly buffer InstanceCounts
+{
+	uint uInstanceCounts[]; // Per pass and batch
+};
+
+uniform uint uInstanceCount;
+uniform uint uBatchCount;
+uniform uint uGroupCount;
+uniform uint uCommandsPerPass;
+
+void main()
+{
+	uint batchIdx = gl_GlobalInvocationID.x;
+	uint passIdx = gl_GlobalInvocationID.y;
+	if (batchIdx >= uBatchCount)
+		return;
+
+	uint instanceCount = uInstanceCounts[passIdx * uBatchCount + batchIdx];
+	if (instanceCount == 0u)
+		return;
+
+	// Only the batches with visible instances get a command, so the group draw skips the others.
+	// The meshlets of a meshlet batch already have theirs.
+	Batch batch = uBatches[batchIdx];
+	if (batch.meshletCount != 0u)
+		return;
+
+	uint slot = atomicAdd(uDrawCounts[passIdx * 2u * uGroupCount + batch.group], 1u);
+
+	DrawCommand command;
+	command.count = batch.indexCount;
+	command.instanceCount = instanceCount;
+	command.firstIndex = batch.firstIndex;
+	command.baseVertex = batch.baseVertex;
+	command.baseInstance = passIdx * uInstanceCount + batch.firstInstance;
+	uCommands[passIdx * uCommandsPerPass + batch.groupFirstBatch + slot] = command;
+}
+
+#endif
+#endif
+
+
 // NOTE: You can write several shaders in the same file if you want as
 // long as you embrace them within an #ifdef block (as you can see above).
 // The third parameter of the LoadProgram function in engine.cpp allows
-// chosing the shader you want to load by name.
\ No newline at end of file
+// chosing the shader you want to load by name. The optional fourth one
+// selects a variant: each ShaderFeature bit is defined as a keyword
+// (CLIPPING, INSTANCED, NORMAL_MAP, SKINNED, BINDLESS, VERTEX_LAYER, COMPUTE,
+// GPU_DRIVEN) that the shaders can test with #ifdef. COMPUTE variants build a compute
+// shader instead of the VERTEX and FRAGMENT stages.
\ No newline at end of file